@@ -0,0 +1,102 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "BNRAES.h"
+
+#if BNR_USE_COMMONCRYPTO
+
+int BNRAESCryptorInit(BNRAESCryptor *c, int encrypt, BNRAESMode mode, const void *key)
+{
+    CCOperation operation = encrypt ? kCCEncrypt : kCCDecrypt;
+    CCOptions options = (mode == BNRAESModeECB) ? kCCOptionECBMode : 0;
+    size_t used = 0;
+    CCCryptorStatus status = CCCryptorCreateFromData(operation, kCCAlgorithmAES128, options,
+                                                     key, kBNRAESKeySize, NULL,
+                                                     c->memory, sizeof(c->memory),
+                                                     &c->cryptor, &used);
+    if (status == kCCBufferTooSmall) {
+        // This CommonCrypto wants more room than we set aside
+        status = CCCryptorCreate(operation, kCCAlgorithmAES128, options,
+                                 key, kBNRAESKeySize, NULL, &c->cryptor);
+    }
+    if (status != kCCSuccess) {
+        c->cryptor = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+int BNRAESCryptorUpdate(BNRAESCryptor *c, const void *in, void *out, size_t length)
+{
+    size_t moved = 0;
+    CCCryptorStatus status = CCCryptorUpdate(c->cryptor, in, length, out, length, &moved);
+    return status == kCCSuccess && moved == length;
+}
+
+void BNRAESCryptorRelease(BNRAESCryptor *c)
+{
+    if (c->cryptor) {
+        CCCryptorRelease(c->cryptor);
+        c->cryptor = NULL;
+    }
+}
+
+#else
+
+#include <openssl/evp.h>
+
+int BNRAESCryptorInit(BNRAESCryptor *c, int encrypt, BNRAESMode mode, const void *key)
+{
+    static const unsigned char zeroIV[kBNRAESBlockSize];
+    EVP_CIPHER_CTX *context = EVP_CIPHER_CTX_new();
+    c->context = context;
+    if (context == NULL) {
+        return 0;
+    }
+    const EVP_CIPHER *cipher = (mode == BNRAESModeECB) ? EVP_aes_128_ecb() : EVP_aes_128_cbc();
+    if (!EVP_CipherInit_ex(context, cipher, NULL, (const unsigned char *)key, zeroIV, encrypt ? 1 : 0)) {
+        return 0;
+    }
+    EVP_CIPHER_CTX_set_padding(context, 0);
+    return 1;
+}
+
+int BNRAESCryptorUpdate(BNRAESCryptor *c, const void *in, void *out, size_t length)
+{
+    int moved = 0;
+    if (!EVP_CipherUpdate((EVP_CIPHER_CTX *)c->context, (unsigned char *)out, &moved,
+                          (const unsigned char *)in, (int)length)) {
+        return 0;
+    }
+    return (size_t)moved == length;
+}
+
+void BNRAESCryptorRelease(BNRAESCryptor *c)
+{
+    if (c->context) {
+        EVP_CIPHER_CTX_free((EVP_CIPHER_CTX *)c->context);
+        c->context = NULL;
+    }
+}
+
+#endif
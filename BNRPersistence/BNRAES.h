@@ -0,0 +1,71 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef BNRPersistence_BNRAES_h
+#define BNRPersistence_BNRAES_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CommonCrypto on Apple platforms; elsewhere OpenSSL, which uses AES-NI when the CPU has it
+#if defined(__APPLE__)
+#define BNR_USE_COMMONCRYPTO 1
+#include <CommonCrypto/CommonCryptor.h>
+#else
+#define BNR_USE_COMMONCRYPTO 0
+#endif
+
+#define kBNRAESBlockSize (16)
+#define kBNRAESKeySize (16)
+
+// Room for CommonCrypto's AES state, so making a cryptor doesn't malloc
+#define kBNRAESCryptorMemorySize (2048)
+
+typedef enum {
+    BNRAESModeECB,
+    BNRAESModeCBC   // zero IV, as in the v1 record format
+} BNRAESMode;
+
+/*! An AES128 cryptor without padding.  With CommonCrypto its state lives inside
+ *  the struct, so it can sit on the stack, but it must not be copied. */
+typedef struct BNRAESCryptor {
+#if BNR_USE_COMMONCRYPTO
+    CCCryptorRef cryptor;
+    uint64_t memory[kBNRAESCryptorMemorySize / sizeof(uint64_t)];
+#else
+    void *context; // EVP_CIPHER_CTX
+#endif
+} BNRAESCryptor;
+
+/*! Sets up |c| to encrypt (or decrypt) with the kBNRAESKeySize bytes at |key|.
+ *  Returns 0 on failure. */
+int BNRAESCryptorInit(BNRAESCryptor *c, int encrypt, BNRAESMode mode, const void *key);
+
+/*! Runs |length| bytes, a whole number of blocks, through the cryptor.  |in| may
+ *  be the same as |out|.  CBC chains on from the previous call.  Returns 0 on failure. */
+int BNRAESCryptorUpdate(BNRAESCryptor *c, const void *in, void *out, size_t length);
+
+/*! Frees what BNRAESCryptorInit made; safe on a cryptor whose init failed. */
+void BNRAESCryptorRelease(BNRAESCryptor *c);
+
+#endif
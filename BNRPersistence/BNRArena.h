@@ -0,0 +1,71 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#import <Foundation/Foundation.h>
+
+/*!
+ @class BNRArena
+ @abstract A bump allocator that hands out memory from large chunks
+ @discussion Nothing allocated from an arena is freed individually: all of it goes
+ at once, when the arena is reset or deallocated.  That makes it a good home for
+ lots of small, short-lived blobs that die together (undo snapshots from one
+ undo group, strings read during one scan).  Not threadsafe.
+ */
+@interface BNRArena : NSObject {
+    size_t chunkSize;
+    unsigned char **chunks;         // chunkSize each; the last one is being filled
+    unsigned chunkCount;
+    unsigned chunkCapacity;
+    unsigned char **largeBlocks;    // allocations bigger than chunkSize
+    unsigned largeBlockCount;
+    unsigned largeBlockCapacity;
+    
+    unsigned char *nextByte;    // in the last chunk
+    size_t bytesRemaining;      // in the last chunk
+}
+
+/*!
+ @method initWithChunkSize:
+ @abstract Allocations larger than |size| get a chunk of their own
+ */
+- (id)initWithChunkSize:(size_t)size;
+
+/*!
+ @method allocate:
+ @abstract Returns |size| bytes, aligned to 8 bytes, that live as long as the arena
+ */
+- (void *)allocate:(size_t)size;
+
+/*!
+ @method copyBytes:length:
+ @abstract Copies |length| bytes into the arena and returns the copy
+ */
+- (void *)copyBytes:(const void *)bytes length:(size_t)length;
+
+/*!
+ @method reset
+ @abstract Frees everything allocated so far, keeping the first chunk for reuse
+ */
+- (void)reset;
+
+@end
@@ -0,0 +1,111 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#import "BNRArena.h"
+
+#define kBNRArenaAlignment (8)
+
+@implementation BNRArena
+
+- (id)initWithChunkSize:(size_t)size
+{
+    self = [super init];
+    if (self) {
+        chunkSize = size;
+    }
+    return self;
+}
+
+- (id)init
+{
+    return [self initWithChunkSize:65536];
+}
+
+- (void)dealloc
+{
+    for (unsigned i = 0; i < chunkCount; i++) {
+        free(chunks[i]);
+    }
+    free(chunks);
+    for (unsigned i = 0; i < largeBlockCount; i++) {
+        free(largeBlocks[i]);
+    }
+    free(largeBlocks);
+    [super dealloc];
+}
+
+static unsigned char *BNRArenaAddBlock(unsigned char ***blocks, unsigned *count, unsigned *blockCapacity, size_t size)
+{
+    if (*count == *blockCapacity) {
+        *blockCapacity = (*blockCapacity == 0) ? 8 : *blockCapacity * 2;
+        *blocks = (unsigned char **)realloc(*blocks, *blockCapacity * sizeof(unsigned char *));
+    }
+    unsigned char *block = (unsigned char *)malloc(size);
+    (*blocks)[(*count)++] = block;
+    return block;
+}
+
+- (void *)allocate:(size_t)size
+{
+    size_t alignedSize = (size + kBNRArenaAlignment - 1) & ~(size_t)(kBNRArenaAlignment - 1);
+    
+    if (alignedSize > bytesRemaining) {
+        if (alignedSize > chunkSize) {
+            return BNRArenaAddBlock(&largeBlocks, &largeBlockCount, &largeBlockCapacity, alignedSize);
+        }
+        nextByte = BNRArenaAddBlock(&chunks, &chunkCount, &chunkCapacity, chunkSize);
+        bytesRemaining = chunkSize;
+    }
+    
+    void *result = nextByte;
+    nextByte += alignedSize;
+    bytesRemaining -= alignedSize;
+    return result;
+}
+
+- (void *)copyBytes:(const void *)bytes length:(size_t)length
+{
+    void *copy = [self allocate:length];
+    memcpy(copy, bytes, length);
+    return copy;
+}
+
+- (void)reset
+{
+    for (unsigned i = 0; i < largeBlockCount; i++) {
+        free(largeBlocks[i]);
+    }
+    largeBlockCount = 0;
+    
+    if (chunkCount == 0) {
+        return;
+    }
+    for (unsigned i = 1; i < chunkCount; i++) {
+        free(chunks[i]);
+    }
+    chunkCount = 1;
+    nextByte = chunks[0];
+    bytesRemaining = chunkSize;
+}
+
+@end
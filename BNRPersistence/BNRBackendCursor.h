@@ -23,6 +23,7 @@
 #import <Foundation/Foundation.h>
 
 @class BNRDataBuffer;
+@class BNRArena;
 
 /*! 
  @class BNRBackendCursor
@@ -42,4 +43,17 @@
  @param c An empty databuffer to be filled with data
  */
 - (UInt32)nextBuffer:(BNRDataBuffer *)c;
+
+/*!
+ @method nextBytes:length:arena:
+ @abstract returns the key and points |bytesPtr| at the associated data without
+ copying it when the backend can avoid that.
+ @discussion The bytes are read-only.  They stay valid as long as |arena| does,
+ provided the store is not changed in the meantime: they are either in the
+ backend's memory-mapped file or copied into |arena|.  The default implementation
+ always copies.  Returns 0 when there are no more records.
+ */
+- (UInt32)nextBytes:(const void **)bytesPtr
+             length:(unsigned *)lengthPtr
+              arena:(BNRArena *)arena;
 @end
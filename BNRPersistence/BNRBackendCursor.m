@@ -21,6 +21,8 @@
 // THE SOFTWARE.
 
 #import "BNRBackendCursor.h"
+#import "BNRDataBuffer.h"
+#import "BNRArena.h"
 
 @implementation BNRBackendCursor
 - (UInt32)nextBuffer:(BNRDataBuffer *)c
@@ -28,4 +30,18 @@
     return 0;
 }
 
+- (UInt32)nextBytes:(const void **)bytesPtr
+             length:(unsigned *)lengthPtr
+              arena:(BNRArena *)arena
+{
+    BNRDataBuffer *b = [BNRDataBuffer borrowBufferWithCapacity:4096];
+    UInt32 result = [self nextBuffer:b];
+    if (result) {
+        *bytesPtr = [arena copyBytes:[b buffer] length:[b length]];
+        *lengthPtr = [b length];
+    }
+    [BNRDataBuffer returnBuffer:b];
+    return result;
+}
+
 @end
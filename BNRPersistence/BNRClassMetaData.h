@@ -31,6 +31,26 @@
  */
 #define kBNRMetadataRowID (1)
 
+/*!
+ @enum BNRRecordFormat
+ @abstract Flags in the class meta data saying how the class's records are encoded
+ @constant BNRRecordFormatCompactLengths String and data lengths, object
+ references and array counts are varints instead of 4 bytes (see
+ -[BNRDataBuffer setUsesCompactLengths:])
+ @constant BNRRecordFormatNativeObjects Archiveable objects are written with
+ BNRDataBuffer+Objects instead of NSKeyedArchiver
+ */
+enum {
+    BNRRecordFormatCompactLengths = 1 << 0,
+    BNRRecordFormatNativeObjects = 1 << 1
+};
+
+/*!
+ @const kBNRCompactRecordFormat
+ @abstract The flags new classes get when the store uses compact encoding
+ */
+#define kBNRCompactRecordFormat (BNRRecordFormatCompactLengths | BNRRecordFormatNativeObjects)
+
 /*! 
  @class BNRClassMetaData
  @abstract Holds onto the classID, the last primary key given out, and
@@ -57,6 +77,11 @@
     volatile UInt32 lastPrimaryKey;
     unsigned char versionNumber;
     BNRSalt salt;
+    UInt8 formatFlags;  // Absent (so 0) in stores written before there were flags
+    
+    // Not persisted: the block handed out by nextPrimaryKeyFromBlockOfSize:
+    UInt32 nextReservedKey;
+    UInt32 lastReservedKey;
 } 
 
 /*!
@@ -81,6 +106,22 @@
 */
 - (UInt32)nextPrimaryKey;
 
+/*!
+ @method nextPrimaryKeyFromBlockOfSize:
+ @abstract Returns a unique row ID, reserving |blockSize| of them at a time
+ @discussion Only one atomic increment per block.  Handing out keys from the
+ reserved block is not threadsafe; it is meant for a single bulk importer.
+ */
+- (UInt32)nextPrimaryKeyFromBlockOfSize:(UInt32)blockSize;
+
+/*!
+ @method releaseReservedPrimaryKeys
+ @abstract Gives back the unused part of the reserved block
+ @discussion Only possible if no keys have been given out since the block was
+ reserved; otherwise the unused keys are simply skipped.
+ */
+- (void)releaseReservedPrimaryKeys;
+
 /*!
  @method versionNumber
  @abstract returns the version of the class that is in the backend
@@ -93,6 +134,18 @@
 */
 - (void)setVersionNumber:(unsigned char)x;
 
+/*!
+ @method formatFlags
+ @abstract Returns the BNRRecordFormat flags the class's records were written with
+ */
+- (UInt8)formatFlags;
+
+/*!
+ @method setFormatFlags:
+ @abstract Only for classes that have no records yet
+ */
+- (void)setFormatFlags:(UInt8)x;
+
 /*!
  @method readContentFromBuffer:
  @abstract Called automatically when the meta data is first read in from the backend
@@ -51,6 +51,10 @@
         for (int i = 0; i < BNR_SALT_WORD_COUNT; i++)
             salt.word[i] = [d readUInt32];
     }
+    if ([d length] > 6 + sizeof(salt.word))
+    {
+        formatFlags = [d readUInt8];
+    }
         
 }
 - (void)writeContentToBuffer:(BNRDataBuffer *)d
@@ -61,6 +65,8 @@
 
     for (int i = 0; i < BNR_SALT_WORD_COUNT; i++)
         [d writeUInt32:salt.word[i]];
+    
+    [d writeUInt8:formatFlags];
 }
 - (unsigned char )classID
 {
@@ -78,6 +84,26 @@
     return nextPrimaryKey;
 }
 
+- (UInt32)nextPrimaryKeyFromBlockOfSize:(UInt32)blockSize
+{
+    if (nextReservedKey == 0 || nextReservedKey > lastReservedKey) {
+        lastReservedKey = (UInt32)OSAtomicAdd32Barrier((int32_t)blockSize,
+                                (volatile int32_t *)&lastPrimaryKey);
+        nextReservedKey = lastReservedKey - blockSize + 1;
+    }
+    return nextReservedKey++;
+}
+
+- (void)releaseReservedPrimaryKeys
+{
+    if (nextReservedKey != 0 && nextReservedKey <= lastReservedKey) {
+        (void)OSAtomicCompareAndSwap32Barrier((int32_t)lastReservedKey, (int32_t)(nextReservedKey - 1),
+                                              (volatile int32_t *)&lastPrimaryKey);
+    }
+    nextReservedKey = 0;
+    lastReservedKey = 0;
+}
+
 - (unsigned char)versionNumber
 {
     return versionNumber;
@@ -88,6 +114,16 @@
     versionNumber = x;
 }
 
+- (UInt8)formatFlags
+{
+    return formatFlags;
+}
+
+- (void)setFormatFlags:(UInt8)x
+{
+    formatFlags = x;
+}
+
 - (const BNRSalt *)encryptionKeySalt
 {
     return &salt;
@@ -8,4 +8,10 @@
 #import <sys/types.h>
 
 /*! Fills |buffer| with |length| random bytes. */
-void BNRRandomBytes(void *buffer, size_t length);
\ No newline at end of file
+void BNRRandomBytes(void *buffer, size_t length);
+
+/*! Derives |keyLength| bytes of key from a passphrase with PBKDF2 (HMAC-SHA1).
+ *  Slow on purpose: do it once and keep the key.  Returns 0 on failure. */
+int BNRDeriveKey(const void *passphrase, size_t passphraseLength,
+                 const void *salt, size_t saltLength,
+                 unsigned rounds, void *key, size_t keyLength);
@@ -5,8 +5,10 @@
 //  Created by Adam Preble on 4/8/10.
 //  Copyright 2010 Big Nerd Ranch. All rights reserved.
 //
+#if defined(__APPLE__)
 #import <ConditionalMacros.h>
 #import <AvailabilityMacros.h>
+#endif
 
 #import "BNRCrypto.h"
 
@@ -14,15 +16,27 @@
 // Note that macros such as MAC_OS_X_VERSION_10_7 don't exist in earlier SDKs; Apple recommends using the numeric value
 
 #import <Security/SecRandom.h>
+#import <CommonCrypto/CommonKeyDerivation.h>
 
 void BNRRandomBytes(void *buffer, size_t length)
 {
     SecRandomCopyBytes(kSecRandomDefault, length, (uint8_t*)buffer);
 }
 
-#else // Older OS X
+int BNRDeriveKey(const void *passphrase, size_t passphraseLength,
+                 const void *salt, size_t saltLength,
+                 unsigned rounds, void *key, size_t keyLength)
+{
+    int status = CCKeyDerivationPBKDF(kCCPBKDF2, (const char *)passphrase, passphraseLength,
+                                      (const uint8_t *)salt, saltLength, kCCPRFHmacAlgSHA1,
+                                      rounds, (uint8_t *)key, keyLength);
+    return status == kCCSuccess;
+}
+
+#elif defined(__APPLE__) // Older OS X
 
 #import <openssl/rand.h>
+#import <openssl/evp.h>
 #import <libkern/OSTypes.h>
 
 void BNRRandomBytes(void *buffer, size_t length)
@@ -30,4 +44,51 @@ void BNRRandomBytes(void *buffer, size_t length)
     /* This function was deprecated with OS X 10.7. */
     RAND_pseudo_bytes((UInt8*)buffer, (int)length);
 }
+
+int BNRDeriveKey(const void *passphrase, size_t passphraseLength,
+                 const void *salt, size_t saltLength,
+                 unsigned rounds, void *key, size_t keyLength)
+{
+    return PKCS5_PBKDF2_HMAC_SHA1((const char *)passphrase, (int)passphraseLength,
+                                  (const unsigned char *)salt, (int)saltLength,
+                                  (int)rounds, (int)keyLength, (unsigned char *)key);
+}
+
+#else // Linux and the like: the kernel's random numbers, OpenSSL for the rest
+
+#import <openssl/evp.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import <errno.h>
+#import <stdlib.h>
+
+void BNRRandomBytes(void *buffer, size_t length)
+{
+    static int fd = -1;
+    if (fd < 0) {
+        fd = open("/dev/urandom", O_RDONLY);
+        if (fd < 0) {
+            abort(); // No salts or nonces we can trust
+        }
+    }
+    unsigned char *p = (unsigned char *)buffer;
+    while (length > 0) {
+        ssize_t n = read(fd, p, length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            abort();
+        p += n;
+        length -= (size_t)n;
+    }
+}
+
+int BNRDeriveKey(const void *passphrase, size_t passphraseLength,
+                 const void *salt, size_t saltLength,
+                 unsigned rounds, void *key, size_t keyLength)
+{
+    return PKCS5_PBKDF2_HMAC_SHA1((const char *)passphrase, (int)passphraseLength,
+                                  (const unsigned char *)salt, (int)saltLength,
+                                  (int)rounds, (int)keyLength, (unsigned char *)key);
+}
 #endif
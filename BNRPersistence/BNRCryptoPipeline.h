@@ -0,0 +1,86 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#import <Foundation/Foundation.h>
+#import "BNRSalt.h"
+@class BNRDataBuffer;
+@class BNRRecordCipher;
+
+/*!
+ @const kBNRCryptoBatchSize
+ @abstract How many records the store hands the pipeline at a time
+ */
+#define kBNRCryptoBatchSize (256)
+
+/*!
+ @struct BNRCryptoJob
+ @abstract One record for a BNRCryptoPipeline
+ @field buffer    Encrypted or decrypted in place
+ @field cipher    The class's cipher (v2); nil to use the v1 format
+ @field salt      The record's salt (the class's, stirred with the words), for v1
+ @field word0     The words the cipher builds the record's counter blocks from
+ @field word1
+ @field succeeded Set by the pipeline: NO if the buffer couldn't be decrypted
+ */
+typedef struct BNRCryptoJob {
+    BNRDataBuffer *buffer;
+    BNRRecordCipher *cipher;
+    BNRSalt salt;
+    UInt32 word0;
+    UInt32 word1;
+    BOOL succeeded;
+} BNRCryptoJob;
+
+/*!
+ @class BNRCryptoPipeline
+ @abstract Encrypts or decrypts a batch of records on several threads
+ @discussion The batch is cut into one run of records per thread and each run
+ is done on an NSOperationQueue; the call returns when all are done, with every
+ buffer still at its index, so the caller reads or writes them in order.  Each
+ run works with its own copies of the ciphers.
+
+ Buffers being encrypted must start with the room made by
+ -[BNRRecordCipher reserveHeaderInBuffer:] when they have a cipher.  Records
+ come out exactly as BNRStore writes them on one thread.
+ */
+@interface BNRCryptoPipeline : NSObject {
+    NSOperationQueue *queue;
+    NSUInteger threadCount;
+}
+
+- (id)initWithThreadCount:(NSUInteger)n;
+- (NSUInteger)threadCount;
+
+/*!
+ @method encryptJobs:count:key:
+ @abstract Encrypts every job's buffer; |key| is the passphrase, for jobs without a cipher
+ */
+- (void)encryptJobs:(BNRCryptoJob *)jobs count:(NSUInteger)count key:(NSString *)key;
+
+/*!
+ @method decryptJobs:count:key:
+ @abstract Decrypts every job's buffer, trying v2 and then v1 like the store does
+ */
+- (void)decryptJobs:(BNRCryptoJob *)jobs count:(NSUInteger)count key:(NSString *)key;
+
+@end
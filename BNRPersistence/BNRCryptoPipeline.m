@@ -0,0 +1,152 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#import "BNRCryptoPipeline.h"
+#import "BNRRecordCipher.h"
+#import "BNRDataBuffer.h"
+#import "BNRDataBuffer+Encryption.h"
+
+// One thread's run of jobs
+@interface BNRCryptoOperation : NSOperation {
+    BNRCryptoJob *jobs;
+    NSUInteger count;
+    NSString *key;
+    BOOL encrypting;
+}
+- (id)initWithJobs:(BNRCryptoJob *)j count:(NSUInteger)n key:(NSString *)k encrypting:(BOOL)yn;
+@end
+
+@implementation BNRCryptoOperation
+
+- (id)initWithJobs:(BNRCryptoJob *)j count:(NSUInteger)n key:(NSString *)k encrypting:(BOOL)yn
+{
+    self = [super init];
+    if (self) {
+        jobs = j;
+        count = n;
+        key = [k copy];
+        encrypting = yn;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [key release];
+    [super dealloc];
+}
+
+- (void)main
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    
+    // Ciphers aren't threadsafe, so this run uses copies (one at a time: batches
+    // are mostly one class)
+    BNRRecordCipher *original = nil;
+    BNRRecordCipher *cipher = nil;
+    
+    for (NSUInteger i = 0; i < count; i++) {
+        BNRCryptoJob *job = jobs + i;
+        if (job->cipher != original) {
+            [cipher release];
+            original = job->cipher;
+            cipher = [original copy];
+        }
+        if (encrypting) {
+            if (cipher) {
+                [cipher encryptReservedBuffer:job->buffer word0:job->word0 word1:job->word1];
+            } else {
+                [job->buffer encryptWithKey:key salt:&job->salt];
+            }
+            job->succeeded = YES;
+        } else {
+            job->succeeded = [cipher decryptBuffer:job->buffer word0:job->word0 word1:job->word1] ||
+                             [job->buffer decryptWithKey:key salt:&job->salt];
+        }
+    }
+    [cipher release];
+    
+    [pool drain];
+}
+
+@end
+
+
+@implementation BNRCryptoPipeline
+
+- (id)initWithThreadCount:(NSUInteger)n
+{
+    self = [super init];
+    if (self) {
+        threadCount = (n > 0) ? n : 1;
+        queue = [[NSOperationQueue alloc] init];
+        [queue setMaxConcurrentOperationCount:threadCount];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [queue release];
+    [super dealloc];
+}
+
+- (NSUInteger)threadCount
+{
+    return threadCount;
+}
+
+- (void)runJobs:(BNRCryptoJob *)jobs count:(NSUInteger)count key:(NSString *)key encrypting:(BOOL)yn
+{
+    if (count == 0) {
+        return;
+    }
+    NSUInteger runCount = (count < threadCount) ? count : threadCount;
+    NSMutableArray *operations = [[NSMutableArray alloc] initWithCapacity:runCount];
+    NSUInteger start = 0;
+    for (NSUInteger i = 0; i < runCount; i++) {
+        // Spread the remainder over the first runs
+        NSUInteger length = count / runCount + ((i < count % runCount) ? 1 : 0);
+        BNRCryptoOperation *op = [[BNRCryptoOperation alloc] initWithJobs:jobs + start
+                                                                    count:length
+                                                                      key:key
+                                                               encrypting:yn];
+        [operations addObject:op];
+        [op release];
+        start += length;
+    }
+    [queue addOperations:operations waitUntilFinished:YES];
+    [operations release];
+}
+
+- (void)encryptJobs:(BNRCryptoJob *)jobs count:(NSUInteger)count key:(NSString *)key
+{
+    [self runJobs:jobs count:count key:key encrypting:YES];
+}
+
+- (void)decryptJobs:(BNRCryptoJob *)jobs count:(NSUInteger)count key:(NSString *)key
+{
+    [self runJobs:jobs count:count key:key encrypting:NO];
+}
+
+@end
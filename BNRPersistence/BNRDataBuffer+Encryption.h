@@ -10,8 +10,11 @@
 #import "BNRDataBuffer.h"
 #import "BNRSalt.h"
 
+// The v1 record format (see BNRRecordCipher for v2).  Both work in the buffer's
+// own memory, growing it if needed, rather than allocating a copy.
 @interface BNRDataBuffer (Encryption)
 
+// Returns NO, leaving the buffer alone, if it wasn't encrypted with |key| and |salt|
 - (BOOL)decryptWithKey:(NSString *)key salt:(const BNRSalt *)salt;
 - (void)encryptWithKey:(NSString *)key salt:(const BNRSalt *)salt;
 
@@ -7,29 +7,30 @@
 //
 
 #import "BNRDataBuffer+Encryption.h"
+#import "BNRAES.h"
+#if BNR_USE_COMMONCRYPTO
 #import <CommonCrypto/CommonDigest.h>
-#import <CommonCrypto/CommonCryptor.h>
+#else
+#import <openssl/md5.h>
+#define CC_MD5_CTX MD5_CTX
+#define CC_MD5_Init MD5_Init
+#define CC_MD5_Update MD5_Update
+#define CC_MD5_Final MD5_Final
+#endif
+
+// Salt bytes put in front of the data; decrypting checks for them to know the key was right
+#define kBNRSaltCheckSize (sizeof(((BNRSalt *)0)->word))
 
 /*!
- @function CryptHelper
- @abstract Performs salted AES128 encryption on the given data buffer and returns a new buffer with the result.
+ @function InitCryptor
+ @abstract Sets up an AES128 CBC cryptor with the v1 key: an MD5 of the salt and the passphrase.
+ @param c             The cryptor; release it with BNRAESCryptorRelease().
  @param key           The "passphrase" to use as part of the encryption key.
- @param salt          The salt to use as part of the encryption key.
- @param operation     kCCEncrypt or kCCDecrypt.
- @param data          Bytes to encrypt or decrypt.
- @param length        Number of bytes in data.
- @param outData       (output) Pointer to the data region containing the decrypted or encrypted data.
-                      It is the caller's responsiblity to free() this memory.
- @param outDataLength (output) Number of bytes of data in outData.
+ @param salt          The salt to use as part of the encryption key (little endian).
+ @param encrypt       YES to encrypt, NO to decrypt.
  */
-BOOL CryptHelper(NSString *key, const BNRSalt *salt, CCOperation operation, const void *data, size_t length, void **outData, size_t *outDataLength)
+static BOOL InitCryptor(BNRAESCryptor *c, NSString *key, const BNRSalt *salt, BOOL encrypt)
 {
-    if (key == nil || [key length] == 0)
-        return NO;
-    
-    *outData = NULL;
-    *outDataLength = 0;
-
     NSData *keyData = [key dataUsingEncoding:NSUTF8StringEncoding];
 
     // Create a hash of the key.
@@ -40,53 +41,11 @@ BOOL CryptHelper(NSString *key, const BNRSalt *salt, CCOperation operation, cons
     UInt32 md[4];
     CC_MD5_Final((unsigned char*)md, &ctx);
     
-    CCCryptorRef cryptor = nil;
-    CCOptions options = operation == kCCEncrypt ? kCCOptionPKCS7Padding : 0;
-    CCCryptorStatus status = CCCryptorCreate(operation, kCCAlgorithmAES128, options, md, sizeof(md), NULL/*IV*/, &cryptor);
-
-    if (status != kCCSuccess) {
-        NSLog(@"CCCryptorCreate(): error:%d", status);
-        return NO;
-    }
-    
-    int outputLength = CCCryptorGetOutputLength(cryptor, length, true);
-    void *outputBuffer = malloc(outputLength);
-    if (outputBuffer == NULL)
-    {
-        NSLog(@"BFEncrypt(): Memory allocation error:%d, %s", errno, strerror(errno));
-        CCCryptorRelease(cryptor);
-        return NO;
-    }
-    
-    size_t bytesOutput = 0;
-    size_t totalBytesOutput = 0;
-    UInt8 *writePtr = (UInt8 *)outputBuffer;
-    status = CCCryptorUpdate(cryptor, data, length, writePtr, outputLength, &bytesOutput);
-    if (status != kCCSuccess)
-    {
-        NSLog(@"CCCryptorUpdate(): error:%d", status);
-        CCCryptorRelease(cryptor);
-        free(outputBuffer);
-        return NO;
-    }
-    writePtr += bytesOutput;
-    outputLength -= bytesOutput;
-    totalBytesOutput += bytesOutput;
-    
-    status = CCCryptorFinal(cryptor, writePtr, outputLength, &bytesOutput);
-    if (status != kCCSuccess)
-    {
-        NSLog(@"CCCryptorFinal(): error:%d", status);
-        CCCryptorRelease(cryptor);
-        free(outputBuffer);
+    if (!BNRAESCryptorInit(c, encrypt, BNRAESModeCBC, md)) {
+        NSLog(@"BNRAESCryptorInit() failed");
+        BNRAESCryptorRelease(c);
         return NO;
     }
-    totalBytesOutput += bytesOutput;
-    
-    *outData = outputBuffer;
-    *outDataLength = totalBytesOutput;
-    
-    CCCryptorRelease(cryptor);
     return YES;
 }
 
@@ -97,31 +56,36 @@ BOOL CryptHelper(NSString *key, const BNRSalt *salt, CCOperation operation, cons
     if (key == nil || [key length] == 0)
         return YES;
     
-    BOOL ret = YES;
-
+    // Not something we encrypted (whole blocks, salt first): leave it be
+    if (length < kBNRAESBlockSize || length % kBNRAESBlockSize != 0)
+        return NO;
+    
     BNRSalt littleSalt = *salt;
     BNRSaltToLittle(&littleSalt);
     
-    void *decryptedBuffer = NULL;
-    size_t decryptedBufferLength;
-    BOOL success = CryptHelper(key, &littleSalt, kCCDecrypt, buffer, length, &decryptedBuffer, &decryptedBufferLength);
-
-    size_t saltSize = sizeof(littleSalt.word);
-    if (success && decryptedBufferLength >= saltSize && memcmp(decryptedBuffer, &littleSalt.word, saltSize) == 0)
+    BNRAESCryptor cryptor;
+    if (!InitCryptor(&cryptor, key, &littleSalt, NO))
+        return NO;
+    
+    // Decrypt the first block on the side, and only touch the buffer if its salt matches
+    UInt8 firstBlock[kBNRAESBlockSize];
+    BOOL ret = BNRAESCryptorUpdate(&cryptor, buffer, firstBlock, kBNRAESBlockSize) &&
+               memcmp(firstBlock, &littleSalt.word, kBNRSaltCheckSize) == 0;
+    if (ret)
     {
         // Salt matches, so we believe the given key is good.
-        // Let's move the data into our own buffer.
-        memcpy(buffer, decryptedBuffer+8, length-8);
-        length -= 8;
-        ret = YES;
-    }
-    else
-    {
-        // We weren't able to decrypt the buffer successfully.
-        // This might just be okay if the object wasn't encrypted in the first place.
-        ret = NO;
+        // Decrypt the rest where it is (CBC carries on from the first block).
+        [self ensureCapacity:length];
+        ret = BNRAESCryptorUpdate(&cryptor, buffer + kBNRAESBlockSize, buffer + kBNRAESBlockSize,
+                                  length - kBNRAESBlockSize);
+        memcpy(buffer, firstBlock, kBNRAESBlockSize);
+        memmove(buffer, buffer + kBNRSaltCheckSize, length - kBNRSaltCheckSize);
+        length -= kBNRSaltCheckSize;
+        cursor = buffer;
     }
-    free(decryptedBuffer);
+    // Otherwise we weren't able to decrypt the buffer successfully.
+    // This might just be okay if the object wasn't encrypted in the first place.
+    BNRAESCryptorRelease(&cryptor);
     return ret;
 }
 
@@ -133,25 +97,25 @@ BOOL CryptHelper(NSString *key, const BNRSalt *salt, CCOperation operation, cons
     BNRSalt littleSalt = *salt;
     BNRSaltToLittle(&littleSalt);
 
-    /* (jws/2013-08-14)FIXME: We should be using in-place cryption where
-     * possible, and taking advantage of being able to feed buffers one by one
-     * into the Update() function, rather than having to manually paste things
-     * together all the time. */
-    // Create a scratch buffer so we can prepend the 8 bytes of salt.
-    // We will look for these salt bytes when decrypting to confirm that we were successful.
-    int scratchBufferLength = 8 + length;
-    UInt8 *scratchBuffer = (UInt8*)malloc(scratchBufferLength);
-    memcpy(scratchBuffer, littleSalt.word, 8);
-    memcpy(scratchBuffer + 8, buffer, length);
+    BNRAESCryptor cryptor;
+    if (!InitCryptor(&cryptor, key, &littleSalt, YES))
+        return;
     
-    void *encryptedBuffer = NULL;
-    size_t encryptedBufferLength = 0;
-
-    CryptHelper(key, &littleSalt, kCCEncrypt, scratchBuffer, scratchBufferLength, &encryptedBuffer, &encryptedBufferLength);
-
-    free(scratchBuffer);
+    // Prepend the salt bytes (we look for them when decrypting to confirm that we
+    // were successful) and PKCS7 pad to whole blocks, then encrypt where it sits.
+    unsigned clearLength = kBNRSaltCheckSize + length;
+    unsigned padding = kBNRAESBlockSize - (clearLength % kBNRAESBlockSize);
+    [self ensureCapacity:clearLength + padding];
+    memmove(buffer + kBNRSaltCheckSize, buffer, length);
+    memcpy(buffer, littleSalt.word, kBNRSaltCheckSize);
+    memset(buffer + clearLength, (int)padding, padding);
+    length = clearLength + padding;
+    cursor = buffer;
     
-    [self setData:encryptedBuffer length:encryptedBufferLength];
+    if (!BNRAESCryptorUpdate(&cryptor, buffer, buffer, length)) {
+        NSLog(@"BNRAESCryptorUpdate() failed");
+    }
+    BNRAESCryptorRelease(&cryptor);
 }
 
 @end
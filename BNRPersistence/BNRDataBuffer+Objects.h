@@ -0,0 +1,44 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#import <Foundation/Foundation.h>
+#import "BNRDataBuffer.h"
+
+/*!
+ @category BNRDataBuffer (Objects)
+ @abstract A compact binary encoding for property-list-like object graphs
+ @discussion NSDictionary, NSArray, NSNumber, NSString, NSData, NSDate and NSNull
+ are written as a one-byte tag followed by their contents (varint counts and
+ lengths, little-endian floats).  No class names are written and reading needs
+ no unarchiver.  Any other object is written with NSKeyedArchiver under its
+ own tag, so everything that could go through writeArchiveableObject: still can.
+
+ Arrays and dictionaries are read back mutable, as the keyed archiver would have
+ returned them if they were written mutable; strings, data and numbers are not.
+ */
+@interface BNRDataBuffer (Objects)
+
+- (void)writeObject:(id)obj;
+- (id)readObject;
+
+@end
@@ -0,0 +1,213 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#import "BNRDataBuffer+Objects.h"
+
+// One byte before each object
+enum {
+    BNRObjectTagNil = 0,
+    BNRObjectTagNull,
+    BNRObjectTagFalse,
+    BNRObjectTagTrue,
+    BNRObjectTagInteger,        // zigzag varint
+    BNRObjectTagUnsignedInteger,// varint, for values above INT64_MAX
+    BNRObjectTagFloat32,
+    BNRObjectTagFloat64,
+    BNRObjectTagString,         // varint length + UTF-8
+    BNRObjectTagData,           // varint length + bytes
+    BNRObjectTagDate,           // Float64 seconds since the reference date
+    BNRObjectTagArray,          // varint count + objects
+    BNRObjectTagDictionary,     // varint count + key, value pairs
+    BNRObjectTagArchived        // varint length + NSKeyedArchiver data
+};
+
+@implementation BNRDataBuffer (Objects)
+
+- (void)writeTaggedBytes:(const void *)bytes length:(NSUInteger)byteCount tag:(UInt8)tag
+{
+    [self writeUInt8:tag];
+    [self writeVarUInt:byteCount];
+    if (byteCount) {
+        [self copyFrom:bytes length:byteCount];
+    }
+}
+
+- (void)writeNumber:(NSNumber *)n
+{
+    if (CFGetTypeID((CFTypeRef)n) == CFBooleanGetTypeID()) {
+        [self writeUInt8:[n boolValue] ? BNRObjectTagTrue : BNRObjectTagFalse];
+        return;
+    }
+    
+    switch (*[n objCType]) {
+        case 'f': {
+            Float32 f = [n floatValue];
+            [self writeUInt8:BNRObjectTagFloat32];
+            [self writeFloat32Array:&f count:1];
+            break;
+        }
+        case 'd': {
+            Float64 d = [n doubleValue];
+            [self writeUInt8:BNRObjectTagFloat64];
+            [self writeFloat64Array:&d count:1];
+            break;
+        }
+        case 'Q':
+        case 'L':
+        case 'I': {
+            unsigned long long u = [n unsignedLongLongValue];
+            if (u > INT64_MAX) {
+                [self writeUInt8:BNRObjectTagUnsignedInteger];
+                [self writeVarUInt:u];
+                break;
+            }
+            // Fits in a signed integer: fall through
+        }
+        default:
+            [self writeUInt8:BNRObjectTagInteger];
+            [self writeVarInt:[n longLongValue]];
+            break;
+    }
+}
+
+- (void)writeObject:(id)obj
+{
+    if (obj == nil) {
+        [self writeUInt8:BNRObjectTagNil];
+    } else if ([obj isKindOfClass:[NSString class]]) {
+        NSString *s = obj;
+        [self writeTaggedBytes:[s UTF8String]
+                        length:[s lengthOfBytesUsingEncoding:NSUTF8StringEncoding]
+                           tag:BNRObjectTagString];
+    } else if ([obj isKindOfClass:[NSNumber class]] && ![obj isKindOfClass:[NSDecimalNumber class]]) {
+        [self writeNumber:obj];
+    } else if ([obj isKindOfClass:[NSDictionary class]]) {
+        NSDictionary *d = obj;
+        [self writeUInt8:BNRObjectTagDictionary];
+        [self writeVarUInt:[d count]];
+        for (id key in d) {
+            [self writeObject:key];
+            [self writeObject:[d objectForKey:key]];
+        }
+    } else if ([obj isKindOfClass:[NSArray class]]) {
+        NSArray *a = obj;
+        [self writeUInt8:BNRObjectTagArray];
+        [self writeVarUInt:[a count]];
+        for (id element in a) {
+            [self writeObject:element];
+        }
+    } else if ([obj isKindOfClass:[NSData class]]) {
+        NSData *d = obj;
+        [self writeTaggedBytes:[d bytes] length:[d length] tag:BNRObjectTagData];
+    } else if ([obj isKindOfClass:[NSDate class]]) {
+        Float64 t = [obj timeIntervalSinceReferenceDate];
+        [self writeUInt8:BNRObjectTagDate];
+        [self writeFloat64Array:&t count:1];
+    } else if (obj == [NSNull null]) {
+        [self writeUInt8:BNRObjectTagNull];
+    } else {
+        NSData *d = [NSKeyedArchiver archivedDataWithRootObject:obj];
+        [self writeTaggedBytes:[d bytes] length:[d length] tag:BNRObjectTagArchived];
+    }
+}
+
+- (id)readObject
+{
+    UInt8 tag = [self readUInt8];
+    switch (tag) {
+        case BNRObjectTagNil:
+            return nil;
+        case BNRObjectTagNull:
+            return [NSNull null];
+        case BNRObjectTagFalse:
+            return (id)kCFBooleanFalse;
+        case BNRObjectTagTrue:
+            return (id)kCFBooleanTrue;
+        case BNRObjectTagInteger:
+            return [NSNumber numberWithLongLong:[self readVarInt]];
+        case BNRObjectTagUnsignedInteger:
+            return [NSNumber numberWithUnsignedLongLong:[self readVarUInt]];
+        case BNRObjectTagFloat32: {
+            Float32 f;
+            [self readFloat32Array:&f count:1];
+            return [NSNumber numberWithFloat:f];
+        }
+        case BNRObjectTagFloat64: {
+            Float64 d;
+            [self readFloat64Array:&d count:1];
+            return [NSNumber numberWithDouble:d];
+        }
+        case BNRObjectTagDate: {
+            Float64 t;
+            [self readFloat64Array:&t count:1];
+            return [NSDate dateWithTimeIntervalSinceReferenceDate:t];
+        }
+        case BNRObjectTagString: {
+            NSUInteger byteCount = (NSUInteger)[self readVarUInt];
+            NSString *s = [[NSString alloc] initWithBytes:cursor
+                                                   length:byteCount
+                                                 encoding:NSUTF8StringEncoding];
+            cursor += byteCount;
+            return [s autorelease];
+        }
+        case BNRObjectTagData: {
+            NSUInteger byteCount = (NSUInteger)[self readVarUInt];
+            NSData *d = [NSData dataWithBytes:cursor length:byteCount];
+            cursor += byteCount;
+            return d;
+        }
+        case BNRObjectTagArray: {
+            NSUInteger count = (NSUInteger)[self readVarUInt];
+            NSMutableArray *a = [NSMutableArray arrayWithCapacity:count];
+            for (NSUInteger i = 0; i < count; i++) {
+                id element = [self readObject];
+                [a addObject:(element ? element : [NSNull null])];
+            }
+            return a;
+        }
+        case BNRObjectTagDictionary: {
+            NSUInteger count = (NSUInteger)[self readVarUInt];
+            NSMutableDictionary *d = [NSMutableDictionary dictionaryWithCapacity:count];
+            for (NSUInteger i = 0; i < count; i++) {
+                id key = [self readObject];
+                id value = [self readObject];
+                if (key && value) {
+                    [d setObject:value forKey:key];
+                }
+            }
+            return d;
+        }
+        case BNRObjectTagArchived: {
+            NSUInteger byteCount = (NSUInteger)[self readVarUInt];
+            NSData *d = [NSData dataWithBytesNoCopy:cursor length:byteCount freeWhenDone:NO];
+            id result = [NSKeyedUnarchiver unarchiveObjectWithData:d];
+            cursor += byteCount;
+            return result;
+        }
+        default:
+            NSLog(@"Unknown object tag %u in %@", (unsigned)tag, self);
+            return nil;
+    }
+}
+
+@end
@@ -23,6 +23,7 @@
 #import <Foundation/Foundation.h>
 @class BNRStoredObject;
 @class BNRStore;
+@class BNRStringDictionary;
 
 /*!
  @class BNRDataBuffer
@@ -37,6 +38,11 @@
     unsigned length;    
     unsigned char *cursor;
     UInt8 versionOfData; // Set by consumeVersion, see -[BNRStore usesPerInstanceVersioning];
+    id owner;            // If non-nil, owns the bytes (which this buffer must not free)
+    BOOL readsWithoutCopying; // readString/readData return views of the bytes
+    BOOL usesCompactLengths;  // string and data lengths are varints
+    BOOL usesNativeObjectEncoding; // archiveable objects use BNRDataBuffer+Objects
+    BNRStringDictionary *stringDictionary; // not retained; for writeDictionaryString:
 }
 /*!
  @method initWithCapacity:
@@ -50,6 +56,52 @@
 */
 - (id)initWithData:(void *)v
             length:(unsigned)size;
+/*!
+ @method initWithBytesNoCopy:length:owner:
+ @abstract Used to create full buffers over memory that something else owns
+ @discussion The buffer retains |o| for as long as it uses the bytes.  Writing
+ past the end copies the bytes into memory of the buffer's own.
+ */
+- (id)initWithBytesNoCopy:(void *)v
+                   length:(unsigned)size
+                    owner:(id)o;
+
+/*!
+ @method setBytesNoCopy:length:owner:
+ @abstract Like initWithBytesNoCopy:length:owner:, for reusing one buffer
+ over many records
+ @discussion The bytes are never written to: the first write copies them.
+ |o| must not be nil.
+ */
+- (void)setBytesNoCopy:(const void *)v
+                length:(unsigned)size
+                 owner:(id)o;
+
+/*!
+ @method setReadsWithoutCopying:
+ @abstract If YES, readString and readData return objects that point into the
+ buffer's bytes instead of copying them
+ @discussion Only safe when the bytes outlive everything that is read: use it with
+ setBytesNoCopy:length:owner:, and copy any string or data you keep past the
+ owner's lifetime.
+ */
+- (void)setReadsWithoutCopying:(BOOL)yn;
+- (BOOL)readsWithoutCopying;
+
+/*!
+ @method borrowBufferWithCapacity:
+ @abstract Returns an empty buffer from the calling thread's pool
+ @discussion Hand it back with returnBuffer: instead of releasing it.
+ The buffer must not be kept (or passed to another thread) after that.
+ */
++ (BNRDataBuffer *)borrowBufferWithCapacity:(NSUInteger)c;
+
+/*!
+ @method returnBuffer:
+ @abstract Gives a buffer from borrowBufferWithCapacity: back to the calling thread's pool
+ */
++ (void)returnBuffer:(BNRDataBuffer *)b;
+
 /*!
  @method setData:length:
  @abstract Used to create full buffers (typically then read from)
@@ -105,6 +157,66 @@
 - (Float64)readFloat64;
 - (void)writeFloat64:(Float64)f;
 
+/*!
+ @method writeVarUInt:
+ @abstract Writes an unsigned integer in as few bytes as it needs (7 bits per byte)
+ @discussion Values under 128 take one byte, under 16384 two, and so on.
+ */
+- (void)writeVarUInt:(UInt64)x;
+- (UInt64)readVarUInt;
+
+/*!
+ @method writeVarInt:
+ @abstract Like writeVarUInt:, for signed integers: small negative numbers are short too
+ */
+- (void)writeVarInt:(SInt64)x;
+- (SInt64)readVarInt;
+
+/*!
+ @method setUsesCompactLengths:
+ @abstract If YES, strings and data are prefixed with varint lengths instead of 4-byte ones,
+ and object references, array counts and the rowIDs in arrays are varints too
+ @discussion The store sets this from the class's format flags before reading or
+ writing a record, so stores written before compact lengths stay readable.
+ */
+- (void)setUsesCompactLengths:(BOOL)yn;
+- (BOOL)usesCompactLengths;
+
+- (UInt16)readUInt16;
+- (void)writeUInt16:(UInt16)x;
+
+- (UInt64)readUInt64;
+- (void)writeUInt64:(UInt64)x;
+
+/*!
+ @method writeUInt32Array:count:
+ @abstract Writes |count| unsigned 32-bit integers and moves the cursor past them.
+ @discussion Much faster than writing them one at a time: the space is checked once,
+ and on little-endian machines the values are simply copied.  No count is written;
+ store it yourself if the reader won't know it.  The same goes for the other
+ array methods.  Note that the float arrays are little-endian like the integers,
+ unlike writeFloat32: and writeFloat64:, so they can't be read back one at a time.
+ */
+- (void)writeUInt32Array:(const UInt32 *)values count:(NSUInteger)count;
+
+/*!
+ @method readUInt32Array:count:
+ @abstract Reads |count| unsigned 32-bit integers into |values| and moves the cursor past them.
+ */
+- (void)readUInt32Array:(UInt32 *)values count:(NSUInteger)count;
+
+- (void)writeUInt16Array:(const UInt16 *)values count:(NSUInteger)count;
+- (void)readUInt16Array:(UInt16 *)values count:(NSUInteger)count;
+
+- (void)writeUInt64Array:(const UInt64 *)values count:(NSUInteger)count;
+- (void)readUInt64Array:(UInt64 *)values count:(NSUInteger)count;
+
+- (void)writeFloat32Array:(const Float32 *)values count:(NSUInteger)count;
+- (void)readFloat32Array:(Float32 *)values count:(NSUInteger)count;
+
+- (void)writeFloat64Array:(const Float64 *)values count:(NSUInteger)count;
+- (void)readFloat64Array:(Float64 *)values count:(NSUInteger)count;
+
 - (BNRStoredObject *)readObjectReferenceOfClass:(Class)c
                                      usingStore:(BNRStore *)s;
 
@@ -124,12 +236,43 @@
 
 - (void)writeHeteroArray:(NSArray *)a usingStore:(BNRStore *)s;
 
-- (id)readArchiveableObject;
+/*!
+ @method writeArchiveableObject:
+ @abstract Writes |obj| with NSKeyedArchiver, or with writeObject: (see
+ BNRDataBuffer+Objects) if the buffer uses native object encoding
+ */
 - (void)writeArchiveableObject:(id)obj;
+- (id)readArchiveableObject;
+
+/*!
+ @method setUsesNativeObjectEncoding:
+ @abstract Set by the store from the class's format flags, like setUsesCompactLengths:
+ */
+- (void)setUsesNativeObjectEncoding:(BOOL)yn;
+- (BOOL)usesNativeObjectEncoding;
 
 
 - (NSString *)readString;
 - (void)writeString:(NSString *)s;
+/*!
+ @method writeDictionaryString:
+ @abstract Writes |s| as its code in the buffer's string dictionary
+ @discussion For strings that many records repeat (artists, genres...).  The
+ store hands each record buffer its class's dictionary; raises if there is none.
+ */
+- (void)writeDictionaryString:(NSString *)s;
+
+/*!
+ @method readDictionaryString
+ @abstract Reads a string written by writeDictionaryString:
+ @discussion Returns the dictionary's own instance, shared by every record that
+ has the same string.
+ */
+- (NSString *)readDictionaryString;
+
+- (void)setStringDictionary:(BNRStringDictionary *)d;
+- (BNRStringDictionary *)stringDictionary;
+
 - (NSData *)readData;
 - (void)writeData:(NSData *)d;
 - (NSDate *)readDate;
@@ -146,5 +289,12 @@
 - (unsigned)length;
 - (void)setLength:(unsigned)r;
 - (unsigned)capacity;
+
+/*!
+ @method ensureCapacity:
+ @abstract Makes sure the buffer owns at least |c| bytes of writable memory
+ @discussion Keeps the contents and the cursor position.
+ */
+- (void)ensureCapacity:(unsigned)c;
 - (NSString *)description;
 @end
@@ -27,7 +27,129 @@
 #import "BNRDataBuffer.h"
 #import "BNRStore.h"
 #import "BNRStoredObject.h"
+#import "BNRStringDictionary.h"
+#import "BNRDataBuffer+Objects.h"
 #import <CoreFoundation/CFByteOrder.h>
+#import <TargetConditionals.h>
+#import <pthread.h>
+
+#pragma mark Buffer pool
+
+// Each thread keeps a few buffers of each size class for borrowBufferWithCapacity:
+#define kBNRDataBufferPoolClassCount (3)
+#define kBNRDataBufferPoolDepth (4)
+static const unsigned BNRDataBufferPoolClassSizes[kBNRDataBufferPoolClassCount] = { 4096, 65536, 1048576 };
+
+typedef struct {
+    BNRDataBuffer *buffers[kBNRDataBufferPoolClassCount][kBNRDataBufferPoolDepth];
+    unsigned count[kBNRDataBufferPoolClassCount];
+} BNRDataBufferPool;
+
+static pthread_key_t BNRDataBufferPoolKey;
+static pthread_once_t BNRDataBufferPoolKeyOnce = PTHREAD_ONCE_INIT;
+
+static void BNRDataBufferPoolDestroy(void *p)
+{
+    BNRDataBufferPool *pool = (BNRDataBufferPool *)p;
+    for (int i = 0; i < kBNRDataBufferPoolClassCount; i++) {
+        for (unsigned j = 0; j < pool->count[i]; j++) {
+            [pool->buffers[i][j] release];
+        }
+    }
+    free(pool);
+}
+
+static void BNRDataBufferPoolMakeKey(void)
+{
+    pthread_key_create(&BNRDataBufferPoolKey, BNRDataBufferPoolDestroy);
+}
+
+static BNRDataBufferPool *BNRCurrentDataBufferPool(void)
+{
+    pthread_once(&BNRDataBufferPoolKeyOnce, BNRDataBufferPoolMakeKey);
+    BNRDataBufferPool *pool = (BNRDataBufferPool *)pthread_getspecific(BNRDataBufferPoolKey);
+    if (!pool) {
+        pool = (BNRDataBufferPool *)calloc(1, sizeof(BNRDataBufferPool));
+        pthread_setspecific(BNRDataBufferPoolKey, pool);
+    }
+    return pool;
+}
+
+static BOOL BNRBytesAreASCII(const unsigned char *bytes, unsigned count)
+{
+    const unsigned char *end = bytes + count;
+    
+    // A word at a time, then the leftovers
+    while (bytes + sizeof(UInt64) <= end) {
+        UInt64 word;
+        memcpy(&word, bytes, sizeof(UInt64));
+        if (word & 0x8080808080808080ULL) {
+            return NO;
+        }
+        bytes += sizeof(UInt64);
+    }
+    while (bytes < end) {
+        if (*bytes++ & 0x80) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+#pragma mark Bulk byte swapping
+
+// Array values are stored little-endian.  On little-endian machines that's a
+// straight copy; otherwise these simple loops are left for the compiler to vectorize.
+static void BNRCopyLittleUInt16s(void *dst, const void *src, NSUInteger count)
+{
+#if TARGET_RT_LITTLE_ENDIAN
+    memcpy(dst, src, count * sizeof(UInt16));
+#else
+    const unsigned char *s = (const unsigned char *)src;
+    unsigned char *d = (unsigned char *)dst;
+    for (NSUInteger i = 0; i < count; i++) {
+        UInt16 x;
+        memcpy(&x, s + i * sizeof(UInt16), sizeof(UInt16));
+        x = CFSwapInt16(x);
+        memcpy(d + i * sizeof(UInt16), &x, sizeof(UInt16));
+    }
+#endif
+}
+
+static void BNRCopyLittleUInt32s(void *dst, const void *src, NSUInteger count)
+{
+#if TARGET_RT_LITTLE_ENDIAN
+    memcpy(dst, src, count * sizeof(UInt32));
+#else
+    const unsigned char *s = (const unsigned char *)src;
+    unsigned char *d = (unsigned char *)dst;
+    for (NSUInteger i = 0; i < count; i++) {
+        UInt32 x;
+        memcpy(&x, s + i * sizeof(UInt32), sizeof(UInt32));
+        x = CFSwapInt32(x);
+        memcpy(d + i * sizeof(UInt32), &x, sizeof(UInt32));
+    }
+#endif
+}
+
+static void BNRCopyLittleUInt64s(void *dst, const void *src, NSUInteger count)
+{
+#if TARGET_RT_LITTLE_ENDIAN
+    memcpy(dst, src, count * sizeof(UInt64));
+#else
+    const unsigned char *s = (const unsigned char *)src;
+    unsigned char *d = (unsigned char *)dst;
+    for (NSUInteger i = 0; i < count; i++) {
+        UInt64 x;
+        memcpy(&x, s + i * sizeof(UInt64), sizeof(UInt64));
+        x = CFSwapInt64(x);
+        memcpy(d + i * sizeof(UInt64), &x, sizeof(UInt64));
+    }
+#endif
+}
+
+// Object arrays are converted through a stack buffer this many rowIDs at a time
+#define kBNRRowIDChunkSize (256)
 
 @implementation BNRDataBuffer
 - (id)initWithCapacity:(NSUInteger)c
@@ -41,6 +163,54 @@
     return self;
 }
 
++ (BNRDataBuffer *)borrowBufferWithCapacity:(NSUInteger)c
+{
+    int sizeClass = 0;
+    while (sizeClass < kBNRDataBufferPoolClassCount && BNRDataBufferPoolClassSizes[sizeClass] < c) {
+        sizeClass++;
+    }
+    if (sizeClass == kBNRDataBufferPoolClassCount) {
+        return [[self alloc] initWithCapacity:c];
+    }
+    
+    BNRDataBufferPool *pool = BNRCurrentDataBufferPool();
+    if (pool->count[sizeClass] > 0) {
+        return pool->buffers[sizeClass][--pool->count[sizeClass]];
+    }
+    return [[self alloc] initWithCapacity:BNRDataBufferPoolClassSizes[sizeClass]];
+}
+
++ (void)returnBuffer:(BNRDataBuffer *)b
+{
+    if (!b) {
+        return;
+    }
+    
+    // File it under the largest size class it can serve
+    int sizeClass = kBNRDataBufferPoolClassCount - 1;
+    while (sizeClass >= 0 && BNRDataBufferPoolClassSizes[sizeClass] > b->capacity) {
+        sizeClass--;
+    }
+    
+    // Don't hang on to borrowed bytes or buffers that grew huge
+    BOOL keep = (sizeClass >= 0 && b->owner == nil &&
+                 b->capacity <= 4 * BNRDataBufferPoolClassSizes[kBNRDataBufferPoolClassCount - 1]);
+    if (keep) {
+        BNRDataBufferPool *pool = BNRCurrentDataBufferPool();
+        if (pool->count[sizeClass] < kBNRDataBufferPoolDepth) {
+            [b clearBuffer];
+            b->versionOfData = 0;
+            b->readsWithoutCopying = NO;
+            b->usesCompactLengths = NO;
+            b->usesNativeObjectEncoding = NO;
+            b->stringDictionary = nil;
+            pool->buffers[sizeClass][pool->count[sizeClass]++] = b;
+            return;
+        }
+    }
+    [b release];
+}
+
 - (id)initWithData:(void *)v
             length:(unsigned)size
 {
@@ -51,12 +221,58 @@
     return self;
 }
 
-- (void)setData:(void *)v
-         length:(unsigned)size
+- (id)initWithBytesNoCopy:(void *)v
+                   length:(unsigned)size
+                    owner:(id)o
+{
+    self = [super init];
+    if (self) {
+        buffer = v;
+        cursor = buffer;
+        length = size;
+        capacity = size;
+        owner = [o retain];
+    }
+    return self;
+}
+
+- (void)setBytesNoCopy:(const void *)v
+                length:(unsigned)size
+                 owner:(id)o
+{
+    [o retain];
+    [self releaseBytes];
+    buffer = (unsigned char *)v;
+    cursor = buffer;
+    length = size;
+    capacity = size;
+    owner = o;
+}
+
+- (void)setReadsWithoutCopying:(BOOL)yn
 {
-    if (buffer) {
+    readsWithoutCopying = yn;
+}
+
+- (BOOL)readsWithoutCopying
+{
+    return readsWithoutCopying;
+}
+
+- (void)releaseBytes
+{
+    if (owner) {
+        [owner release];
+        owner = nil;
+    } else if (buffer) {
         free(buffer);
     }
+}
+
+- (void)setData:(void *)v
+         length:(unsigned)size
+{
+    [self releaseBytes];
     buffer = v;
     cursor = buffer;
     length = size;
@@ -65,34 +281,48 @@
 
 - (void)dealloc
 {
-    free(buffer);
+    [self releaseBytes];
     [super dealloc];
 }
 
 
-- (void)grow
+- (void)growToFit:(unsigned)required
 {
-    NSLog(@"growing");
-    unsigned newCapacity;
-
-    if (capacity < 256) {
-        newCapacity = 512;
-    } else {
-        newCapacity = capacity * 2;
+    unsigned newCapacity = capacity;
+    if (newCapacity < required) {
+        newCapacity = (capacity < 256) ? 512 : capacity * 2;
+        while (newCapacity < required) {
+            newCapacity *= 2;
+        }
     }
     ptrdiff_t offset = cursor - buffer;
-    unsigned char *newBuffer = (unsigned char *)malloc(newCapacity);
-    memcpy(newBuffer,buffer,length);
-    cursor = newBuffer + offset;
+    
+    if (owner) {
+        // Someone else's bytes: copy them into memory of our own
+        unsigned char *newBuffer = (unsigned char *)malloc(newCapacity);
+        memcpy(newBuffer, buffer, length);
+        [self releaseBytes];
+        buffer = newBuffer;
+    } else {
+        buffer = (unsigned char *)realloc(buffer, newCapacity);
+    }
+    cursor = buffer + offset;
     capacity = newCapacity;
-    free(buffer);
-    buffer = newBuffer;
 }
 
 - (void)checkForSpaceFor:(unsigned int)bytesComing
 {
-    while (capacity < cursor - buffer + bytesComing) {
-        [self grow];
+    unsigned required = (unsigned)(cursor - buffer) + bytesComing;
+    // Never write into someone else's bytes (they may be a read-only mapping)
+    if (owner || capacity < required) {
+        [self growToFit:required];
+    }
+}
+
+- (void)ensureCapacity:(unsigned)c
+{
+    if (owner || capacity < c) {
+        [self growToFit:c];
     }
 }
 
@@ -143,6 +373,217 @@
 }
 
 
+#pragma mark Variable-length integers
+
+- (void)writeVarUInt:(UInt64)x
+{
+    UInt8 bytes[10];
+    unsigned count = 0;
+    while (x >= 0x80) {
+        bytes[count++] = (UInt8)(x | 0x80);
+        x >>= 7;
+    }
+    bytes[count++] = (UInt8)x;
+    
+    [self checkForSpaceFor:count];
+    memcpy(cursor, bytes, count);
+    cursor += count;
+    length += count;
+}
+
+- (UInt64)readVarUInt
+{
+    // Most values are small: one byte and no loop
+    const unsigned char *p = cursor;
+    UInt64 result = p[0];
+    if (result < 0x80) {
+        cursor += 1;
+        return result;
+    }
+    result = (result & 0x7f) | ((UInt64)(p[1] & 0x7f) << 7);
+    if (p[1] < 0x80) {
+        cursor += 2;
+        return result;
+    }
+    
+    unsigned shift = 14;
+    p += 2;
+    UInt64 byte;
+    do {
+        byte = *p++;
+        result |= (byte & 0x7f) << shift;
+        shift += 7;
+    } while ((byte & 0x80) && shift < 64);
+    cursor = (unsigned char *)p;
+    return result;
+}
+
+// Zigzag: 0, -1, 1, -2, 2... become 0, 1, 2, 3, 4...
+- (void)writeVarInt:(SInt64)x
+{
+    [self writeVarUInt:((UInt64)x << 1) ^ (UInt64)(x >> 63)];
+}
+
+- (SInt64)readVarInt
+{
+    UInt64 z = [self readVarUInt];
+    return (SInt64)(z >> 1) ^ -(SInt64)(z & 1);
+}
+
+- (void)setUsesCompactLengths:(BOOL)yn
+{
+    usesCompactLengths = yn;
+}
+
+- (BOOL)usesCompactLengths
+{
+    return usesCompactLengths;
+}
+
+- (UInt32)readLength
+{
+    if (usesCompactLengths) {
+        return (UInt32)[self readVarUInt];
+    }
+    return [self readUInt32];
+}
+
+- (void)writeLength:(UInt32)x
+{
+    if (usesCompactLengths) {
+        [self writeVarUInt:x];
+    } else {
+        [self writeUInt32:x];
+    }
+}
+
+// RowIDs are handed out in order from 2, so they are small numbers too
+- (UInt32)readRowID
+{
+    return [self readLength];
+}
+
+- (void)writeRowID:(UInt32)rowID
+{
+    [self writeLength:rowID];
+}
+
+#pragma mark -
+
+- (UInt16)readUInt16
+{
+    UInt16 result;
+    memcpy(&result, cursor, sizeof(UInt16));
+    cursor += sizeof(UInt16);
+    return CFSwapInt16LittleToHost(result);
+}
+
+- (void)writeUInt16:(UInt16)x
+{
+    [self checkForSpaceFor:sizeof(UInt16)];
+    UInt16 swapped = CFSwapInt16HostToLittle(x);
+    memcpy(cursor, &swapped, sizeof(UInt16));
+    cursor += sizeof(UInt16);
+    length += sizeof(UInt16);
+}
+
+- (UInt64)readUInt64
+{
+    UInt64 result;
+    memcpy(&result, cursor, sizeof(UInt64));
+    cursor += sizeof(UInt64);
+    return CFSwapInt64LittleToHost(result);
+}
+
+- (void)writeUInt64:(UInt64)x
+{
+    [self checkForSpaceFor:sizeof(UInt64)];
+    UInt64 swapped = CFSwapInt64HostToLittle(x);
+    memcpy(cursor, &swapped, sizeof(UInt64));
+    cursor += sizeof(UInt64);
+    length += sizeof(UInt64);
+}
+
+#pragma mark Arrays of scalars
+
+- (void)writeUInt16Array:(const UInt16 *)values count:(NSUInteger)count
+{
+    unsigned byteCount = count * sizeof(UInt16);
+    [self checkForSpaceFor:byteCount];
+    BNRCopyLittleUInt16s(cursor, values, count);
+    cursor += byteCount;
+    length += byteCount;
+}
+
+- (void)readUInt16Array:(UInt16 *)values count:(NSUInteger)count
+{
+    BNRCopyLittleUInt16s(values, cursor, count);
+    cursor += count * sizeof(UInt16);
+}
+
+- (void)writeUInt32Array:(const UInt32 *)values count:(NSUInteger)count
+{
+    unsigned byteCount = count * sizeof(UInt32);
+    [self checkForSpaceFor:byteCount];
+    BNRCopyLittleUInt32s(cursor, values, count);
+    cursor += byteCount;
+    length += byteCount;
+}
+
+- (void)readUInt32Array:(UInt32 *)values count:(NSUInteger)count
+{
+    BNRCopyLittleUInt32s(values, cursor, count);
+    cursor += count * sizeof(UInt32);
+}
+
+- (void)writeUInt64Array:(const UInt64 *)values count:(NSUInteger)count
+{
+    unsigned byteCount = count * sizeof(UInt64);
+    [self checkForSpaceFor:byteCount];
+    BNRCopyLittleUInt64s(cursor, values, count);
+    cursor += byteCount;
+    length += byteCount;
+}
+
+- (void)readUInt64Array:(UInt64 *)values count:(NSUInteger)count
+{
+    BNRCopyLittleUInt64s(values, cursor, count);
+    cursor += count * sizeof(UInt64);
+}
+
+// IEEE floats are swapped as the integers of the same width
+- (void)writeFloat32Array:(const Float32 *)values count:(NSUInteger)count
+{
+    unsigned byteCount = count * sizeof(Float32);
+    [self checkForSpaceFor:byteCount];
+    BNRCopyLittleUInt32s(cursor, values, count);
+    cursor += byteCount;
+    length += byteCount;
+}
+
+- (void)readFloat32Array:(Float32 *)values count:(NSUInteger)count
+{
+    BNRCopyLittleUInt32s(values, cursor, count);
+    cursor += count * sizeof(Float32);
+}
+
+- (void)writeFloat64Array:(const Float64 *)values count:(NSUInteger)count
+{
+    unsigned byteCount = count * sizeof(Float64);
+    [self checkForSpaceFor:byteCount];
+    BNRCopyLittleUInt64s(cursor, values, count);
+    cursor += byteCount;
+    length += byteCount;
+}
+
+- (void)readFloat64Array:(Float64 *)values count:(NSUInteger)count
+{
+    BNRCopyLittleUInt64s(values, cursor, count);
+    cursor += count * sizeof(Float64);
+}
+
+#pragma mark -
+
 - (UInt32)readUInt32
 {
     UInt32 result;
@@ -170,7 +611,7 @@
 
 - (void)writeUInt8:(UInt8)x
 {
-    [self checkForSpaceFor:sizeof(UInt32)];
+    [self checkForSpaceFor:sizeof(UInt8)];
     memcpy(cursor, &x, sizeof(UInt8));
     cursor += sizeof(UInt8);   
     length += sizeof(UInt8);
@@ -204,7 +645,7 @@
 - (BNRStoredObject *)readObjectReferenceOfClass:(Class)c
                                      usingStore:(BNRStore *)s
 {
-    UInt32 rowID = [self readUInt32];
+    UInt32 rowID = [self readRowID];
     if (rowID == 0) {
         NSLog(@"reading nil object reference");
         return nil;
@@ -218,7 +659,7 @@
 - (void)writeObjectReference:(BNRStoredObject *)obj
 {
     UInt32 rowID = [obj rowID];
-    [self writeUInt32:rowID];
+    [self writeRowID:rowID];
 }
 
 - (BNRStoredObject *)readObjectReferenceOfUnknownClassUsingStore:(BNRStore *)s
@@ -240,19 +681,35 @@
 - (NSMutableArray *)readArrayOfClass:(Class)c
                           usingStore:(BNRStore *)s
 {
-    // FIXME: I suspect that this could also be made faster with 
-    // clever multithreading
-    UInt32 len = [self readUInt32];
+    UInt32 len = [self readLength];
     NSMutableArray *result = [NSMutableArray arrayWithCapacity:len];
-    int i;
-    for (i = 0; i < len; i++) {
-        BNRStoredObject *obj = [self readObjectReferenceOfClass:c
-                                                     usingStore:s];
-        if (obj) {
-            [result addObject:obj];
+    UInt32 rowIDs[kBNRRowIDChunkSize];
+    UInt32 i = 0;
+    while (i < len) {
+        UInt32 chunk = MIN(len - i, (UInt32)kBNRRowIDChunkSize);
+        if (usesCompactLengths) {
+            for (UInt32 j = 0; j < chunk; j++) {
+                rowIDs[j] = (UInt32)[self readVarUInt];
+            }
         } else {
-            NSLog(@"Fetched nil for object %d in array.  Skipping.", i);
+            [self readUInt32Array:rowIDs count:chunk];
+        }
+        for (UInt32 j = 0; j < chunk; j++) {
+            BNRStoredObject *obj = nil;
+            if (rowIDs[j] == 0) {
+                NSLog(@"reading nil object reference");
+            } else {
+                obj = [s objectForClass:c
+                                  rowID:rowIDs[j]
+                           fetchContent:NO];
+            }
+            if (obj) {
+                [result addObject:obj];
+            } else {
+                NSLog(@"Fetched nil for object %u in array.  Skipping.", (unsigned)(i + j));
+            }
         }
+        i += chunk;
     }
     return result;
 }
@@ -260,17 +717,32 @@
            ofClass:(Class)c
 {
     UInt32 len = [a count];
-    [self writeUInt32:len];
-    int i;
-    for (i = 0; i < len; i++) {
-        BNRStoredObject *obj = [a objectAtIndex:i];
-        [self writeObjectReference:obj];
+    [self writeLength:len];
+    // At most 5 bytes each as varints
+    [self checkForSpaceFor:len * (usesCompactLengths ? 5 : sizeof(UInt32))];
+    BNRStoredObject *objs[kBNRRowIDChunkSize];
+    UInt32 rowIDs[kBNRRowIDChunkSize];
+    UInt32 i = 0;
+    while (i < len) {
+        UInt32 chunk = MIN(len - i, (UInt32)kBNRRowIDChunkSize);
+        [a getObjects:objs range:NSMakeRange(i, chunk)];
+        for (UInt32 j = 0; j < chunk; j++) {
+            rowIDs[j] = [objs[j] rowID];
+        }
+        if (usesCompactLengths) {
+            for (UInt32 j = 0; j < chunk; j++) {
+                [self writeVarUInt:rowIDs[j]];
+            }
+        } else {
+            [self writeUInt32Array:rowIDs count:chunk];
+        }
+        i += chunk;
     }
 }
 
 - (NSMutableArray *)readHeteroArrayUsingStore:(BNRStore *)s
 {
-    UInt32 len = [self readUInt32];
+    UInt32 len = [self readLength];
     NSMutableArray *result = [NSMutableArray arrayWithCapacity:len];
     int i;
     for (i = 0; i < len; i++) {
@@ -283,7 +755,7 @@
 - (void)writeHeteroArray:(NSArray *)a usingStore:(BNRStore *)s
 {
     UInt32 len = [a count];
-    [self writeUInt32:len];
+    [self writeLength:len];
     int i;
     for (i = 0; i < len; i++) {
         BNRStoredObject *obj = [a objectAtIndex:i];
@@ -293,12 +765,19 @@
 }
 - (NSData *)readData
 {
-    unsigned dLen = [self readUInt32];
+    unsigned dLen = [self readLength];
     if (dLen == 0) {
         return nil;
     }
-    NSData *d = [NSData dataWithBytes:cursor
-                               length:dLen];
+    NSData *d;
+    if (readsWithoutCopying) {
+        d = [NSData dataWithBytesNoCopy:cursor
+                                 length:dLen
+                           freeWhenDone:NO];
+    } else {
+        d = [NSData dataWithBytes:cursor
+                           length:dLen];
+    }
     cursor += dLen;
     return d;
 }
@@ -306,7 +785,7 @@
 - (void)writeData:(NSData *)d
 {
     unsigned dLen = [d length];
-    [self writeUInt32:dLen];
+    [self writeLength:dLen];
     if (dLen != 0) {
         [self copyFrom:[d bytes]
                 length:dLen];
@@ -333,6 +812,9 @@
 
 - (id)readArchiveableObject
 {
+    if (usesNativeObjectEncoding) {
+        return [self readObject];
+    }
     NSData *d = [self readData];
     id result = [NSKeyedUnarchiver unarchiveObjectWithData:d];
     return result;
@@ -340,18 +822,39 @@
 
 - (void)writeArchiveableObject:(id)obj
 {
+    if (usesNativeObjectEncoding) {
+        [self writeObject:obj];
+        return;
+    }
     NSData *d = [NSKeyedArchiver archivedDataWithRootObject:obj];
     [self writeData:d];
 }
 
+- (void)setUsesNativeObjectEncoding:(BOOL)yn
+{
+    usesNativeObjectEncoding = yn;
+}
+
+- (BOOL)usesNativeObjectEncoding
+{
+    return usesNativeObjectEncoding;
+}
+
 
 - (NSString *)readString
 {
-    unsigned dLen = [self readUInt32];
+    unsigned dLen = [self readLength];
     if (dLen == 0) {
         return nil;
     }
-    NSString *d = [[NSString alloc] initWithBytes:cursor length:dLen encoding:NSUTF8StringEncoding];
+    // Plain ASCII needs no UTF-8 decoding
+    NSStringEncoding encoding = BNRBytesAreASCII(cursor, dLen) ? NSASCIIStringEncoding : NSUTF8StringEncoding;
+    NSString *d;
+    if (readsWithoutCopying) {
+        d = [[NSString alloc] initWithBytesNoCopy:cursor length:dLen encoding:encoding freeWhenDone:NO];
+    } else {
+        d = [[NSString alloc] initWithBytes:cursor length:dLen encoding:encoding];
+    }
     cursor += dLen;
     return [d autorelease];
 }
@@ -359,7 +862,7 @@
 - (void)writeString:(NSString *)s
 {
     UInt32 dLen = [s lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
-    [self writeUInt32:dLen];
+    [self writeLength:dLen];
 
     if (dLen != 0) {
         [self checkForSpaceFor:dLen];
@@ -379,6 +882,34 @@
     }
 }
 
+- (void)setStringDictionary:(BNRStringDictionary *)d
+{
+    stringDictionary = d;
+}
+
+- (BNRStringDictionary *)stringDictionary
+{
+    return stringDictionary;
+}
+
+- (void)writeDictionaryString:(NSString *)s
+{
+    if (!stringDictionary) {
+        [NSException raise:NSInternalInconsistencyException
+                    format:@"writeDictionaryString: on a buffer with no string dictionary"];
+    }
+    [self writeVarUInt:[stringDictionary codeForString:s]];
+}
+
+- (NSString *)readDictionaryString
+{
+    if (!stringDictionary) {
+        [NSException raise:NSInternalInconsistencyException
+                    format:@"readDictionaryString on a buffer with no string dictionary"];
+    }
+    return [stringDictionary stringForCode:(UInt32)[self readVarUInt]];
+}
+
 - (void)consumeVersion
 {
     versionOfData = [self readUInt8];
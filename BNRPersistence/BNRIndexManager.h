@@ -22,6 +22,18 @@
 #import <Foundation/Foundation.h>
 @class BNRModel;
 @class BNRStoredObject;
+@class BNRTextQuery;
+
+// How a search treats index changes that have been saved but not applied yet
+// (see -[BNRTCIndexManager usesBackgroundIndexing])
+typedef enum {
+    BNRIndexSearchIncludePending = 0,	// search the index, then check the queued changes one by one
+    BNRIndexSearchWaitForIndexing		// wait until every queued change is in the index
+} BNRIndexSearchConsistency;
+
+// Puts |count| rowIDs in ascending order.  Index results usually are already,
+// so this only sorts when it finds a pair out of order.
+void BNRSortRowIDs(UInt32 *rowIDs, UInt32 count);
 
 /*! BNRIndexManager is an abstract class. */
 
@@ -31,9 +43,60 @@
                 matchingText:(NSString *)toMatch
                       forKey:(NSString *)key
                         list:(UInt32 **)listptr;
+- (UInt32)countOfRowsInClass:(Class)c 
+                matchingText:(NSString *)toMatch
+                      forKey:(NSString *)key
+                 consistency:(BNRIndexSearchConsistency)consistency
+                        list:(UInt32 **)listptr;
+
+// The (at most) |limit| best matches, most relevant first.  The expression's
+// words are ORed together and ranked with BM25.
+- (UInt32)rankedRowsInClass:(Class)c
+               matchingText:(NSString *)toMatch
+                     forKey:(NSString *)key
+                      limit:(UInt32)limit
+                       list:(UInt32 **)listptr;
+
+// Evaluates a query across several keys on rowID lists; see BNRTextQuery
+- (UInt32)countOfRowsInClass:(Class)c
+               matchingQuery:(BNRTextQuery *)query
+                        list:(UInt32 **)listptr;
+
+// Rows whose tableIndexedAttributes satisfy |predicate|, in the order of
+// |sortDescriptor| (nil for rowID order), at most |limit| of them (0 for all)
+- (UInt32)countOfRowsInClass:(Class)c
+           matchingPredicate:(NSPredicate *)predicate
+              sortDescriptor:(NSSortDescriptor *)sortDescriptor
+                       limit:(NSUInteger)limit
+                        list:(UInt32 **)listptr;
+
+// Words starting with |prefix| (ignoring case and accents) in the values of a
+// prefix-indexed key, most frequent first, at most |limit| of them
+- (NSArray *)completionsInClass:(Class)c
+                      forPrefix:(NSString *)prefix
+                         forKey:(NSString *)key
+                          limit:(NSUInteger)limit;
+
 - (void)insertObjectInIndexes:(BNRStoredObject *)obj;
 - (void)deleteObjectFromIndexes:(BNRStoredObject *)obj;
 - (void)updateObjectInIndexes:(BNRStoredObject *)obj;
+
+// The store brackets each save with these.  In between, an index manager may
+// hold on to the changes and apply them together when the save commits; if
+// the save fails they are discarded.  Batches may nest.
+- (void)beginIndexBatch;
+- (void)commitIndexBatch;
+- (void)discardIndexBatch;
+
+// Rebuilding the indexes of class |c| from scratch (see
+// -[BNRStore rebuildTextIndexesForClass:threadCount:]).  In between, the store
+// hands over every stored object of the class; committing puts the new indexes
+// in place of the old ones, and discarding leaves the old ones alone.
+- (void)beginRebuildOfIndexesForClass:(Class)c threadCount:(NSUInteger)n;
+- (void)addObjectToRebuild:(BNRStoredObject *)obj;
+- (BOOL)commitRebuild;
+- (void)discardRebuild;
+
 - (void)close;
 
 @end
@@ -20,6 +20,24 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 #import "BNRIndexManager.h"
+#import "BNRTextQuery.h"
+
+static int BNRCompareRowIDs(const void *a, const void *b)
+{
+    UInt32 x = *(const UInt32 *)a;
+    UInt32 y = *(const UInt32 *)b;
+    return (x < y) ? -1 : (x > y);
+}
+
+void BNRSortRowIDs(UInt32 *rowIDs, UInt32 count)
+{
+    for (UInt32 i = 1; i < count; i++) {
+        if (rowIDs[i - 1] > rowIDs[i]) {
+            qsort(rowIDs, count, sizeof(UInt32), BNRCompareRowIDs);
+            return;
+        }
+    }
+}
 
 @implementation BNRIndexManager
 
@@ -30,6 +48,62 @@
 {
     return 0; 
 }
+- (UInt32)countOfRowsInClass:(Class)c 
+                matchingText:(NSString *)toMatch
+                      forKey:(NSString *)key
+                 consistency:(BNRIndexSearchConsistency)consistency
+                        list:(UInt32 **)listptr
+{
+    return [self countOfRowsInClass:c
+                       matchingText:toMatch
+                             forKey:key
+                               list:listptr];
+}
+- (UInt32)rankedRowsInClass:(Class)c
+               matchingText:(NSString *)toMatch
+                     forKey:(NSString *)key
+                      limit:(UInt32)limit
+                       list:(UInt32 **)listptr
+{
+    // Unranked: just the first |limit| matches
+    UInt32 *list = NULL;
+    UInt32 count = [self countOfRowsInClass:c
+                               matchingText:toMatch
+                                     forKey:key
+                                       list:&list];
+    if (count > limit) {
+        count = limit;
+    }
+    if (count > 0 && listptr) {
+        *listptr = list;
+    } else if (list) {
+        free(list);
+    }
+    return count;
+}
+- (UInt32)countOfRowsInClass:(Class)c
+               matchingQuery:(BNRTextQuery *)query
+                        list:(UInt32 **)listptr
+{
+    return [query countOfRowsInClass:c
+                        indexManager:self
+                                list:listptr];
+}
+- (UInt32)countOfRowsInClass:(Class)c
+           matchingPredicate:(NSPredicate *)predicate
+              sortDescriptor:(NSSortDescriptor *)sortDescriptor
+                       limit:(NSUInteger)limit
+                        list:(UInt32 **)listptr
+{
+    return 0;
+}
+- (NSArray *)completionsInClass:(Class)c
+                      forPrefix:(NSString *)prefix
+                         forKey:(NSString *)key
+                          limit:(NSUInteger)limit
+{
+    return [NSArray array];
+}
 - (void)insertObjectInIndexes:(BNRStoredObject *)obj
 {
 }
@@ -40,6 +114,29 @@
 - (void)updateObjectInIndexes:(BNRStoredObject *)obj
 {
     
+}
+- (void)beginIndexBatch
+{
+}
+- (void)commitIndexBatch
+{
+}
+- (void)discardIndexBatch
+{
+}
+- (void)beginRebuildOfIndexesForClass:(Class)c threadCount:(NSUInteger)n
+{
+}
+- (void)addObjectToRebuild:(BNRStoredObject *)obj
+{
+    [self updateObjectInIndexes:obj];
+}
+- (BOOL)commitRebuild
+{
+    return YES;
+}
+- (void)discardRebuild
+{
 }
 - (void)close
 {
@@ -0,0 +1,103 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#import <Foundation/Foundation.h>
+#import "BNRSalt.h"
+#import "BNRAES.h"
+@class BNRDataBuffer;
+
+/*!
+ @const kBNRRecordCipherRounds
+ @abstract PBKDF2 rounds used to turn the passphrase into a class's key
+ */
+#define kBNRRecordCipherRounds (10000)
+
+/*!
+ @const kBNRRecordCipherOverhead
+ @abstract Bytes an encrypted record is longer than the clear one
+ */
+#define kBNRRecordCipherOverhead (17)
+
+/*!
+ @class BNRRecordCipher
+ @abstract Encrypts and decrypts the records of one class (format v2)
+ @discussion The passphrase and the class's salt go through PBKDF2 once, when the
+ cipher is made, and the AES key schedule is kept in a cryptor for the life of the
+ cipher.  Records are then encrypted with AES128 in counter mode: the counter block
+ is made from the record's words (the rowID), a 64-bit nonce and the block number,
+ so there is no hashing or cryptor setup per record and the work is done in place.
+
+ An encrypted record is a version byte (2), the nonce, and then the encrypted
+ key check (the row's salt, as in v1) followed by the encrypted bytes.  The
+ nonce comes from a counter that starts at a random value, so rewriting a row
+ never reuses a key stream.
+
+ v2 records are not authenticated.  The key check only tells the right key from
+ a wrong one; it is not a MAC.  Someone who can write the database file can
+ flip bits of a record's data and the record will still decrypt.
+
+ -decryptBuffer:word0:word1: leaves a buffer it can't decrypt alone and returns NO,
+ so the caller can try the v1 format (BNRDataBuffer+Encryption) next.
+
+ Not threadsafe: use one cipher per thread.  -copy is cheap (no key derivation)
+ and gives a cipher with its own cryptor and nonces for another thread.
+ */
+@interface BNRRecordCipher : NSObject <NSCopying> {
+    BNRAESCryptor cryptor;  // AES128 ECB with the derived key; makes key stream blocks
+    UInt8 derivedKey[kBNRAESKeySize]; // kept for -copy
+    BNRSalt salt;           // the class's salt
+    UInt64 nextNonce;
+}
+
+/*!
+ @method initWithKey:salt:
+ @abstract Derives the key for records salted with |s|; returns nil if |key| is empty
+ */
+- (id)initWithKey:(NSString *)key salt:(const BNRSalt *)s;
+
+/*!
+ @method reserveHeaderInBuffer:
+ @abstract Writes kBNRRecordCipherOverhead bytes of room for -encryptReservedBuffer:word0:word1:
+ */
+- (void)reserveHeaderInBuffer:(BNRDataBuffer *)buffer;
+
+/*!
+ @method encryptReservedBuffer:word0:word1:
+ @abstract Encrypts in place a buffer that starts with the room made by -reserveHeaderInBuffer:
+ */
+- (void)encryptReservedBuffer:(BNRDataBuffer *)buffer word0:(UInt32)w0 word1:(UInt32)w1;
+
+/*!
+ @method encryptBuffer:word0:word1:
+ @abstract Encrypts the whole buffer in place; the words are what would be stirred into the salt
+ */
+- (void)encryptBuffer:(BNRDataBuffer *)buffer word0:(UInt32)w0 word1:(UInt32)w1;
+
+/*!
+ @method decryptBuffer:word0:word1:
+ @abstract Decrypts in place, or returns NO without touching the buffer if it
+ isn't a v2 record encrypted with this key
+ */
+- (BOOL)decryptBuffer:(BNRDataBuffer *)buffer word0:(UInt32)w0 word1:(UInt32)w1;
+
+@end
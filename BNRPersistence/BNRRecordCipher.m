@@ -0,0 +1,228 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#import "BNRRecordCipher.h"
+#import "BNRDataBuffer.h"
+#import "BNRCrypto.h"
+
+#define kBNRRecordCipherVersion (2)
+#define kBNRCipherBlockSize (kBNRAESBlockSize)
+#define kBNRCipherBlocksPerPass (64)
+
+// Record layout: version byte, little-endian nonce, then key check and data (encrypted)
+#define kBNRNonceOffset (1)
+#define kBNRKeyCheckOffset (9)
+
+@implementation BNRRecordCipher
+
+// Designated initializer
+- (id)initWithDerivedKey:(const UInt8 *)k salt:(const BNRSalt *)s
+{
+    self = [super init];
+    if (self) {
+        salt = *s;
+        memcpy(derivedKey, k, sizeof(derivedKey));
+        
+        // ECB on counter blocks is all counter mode needs, and the cryptor keeps no
+        // state between calls when fed whole blocks, so one cryptor does every record
+        if (!BNRAESCryptorInit(&cryptor, 1, BNRAESModeECB, derivedKey)) {
+            NSLog(@"BNRAESCryptorInit() failed");
+            [self release];
+            return nil;
+        }
+        BNRRandomBytes(&nextNonce, sizeof(nextNonce));
+    }
+    return self;
+}
+
+- (id)initWithKey:(NSString *)key salt:(const BNRSalt *)s
+{
+    if ([key length] == 0) {
+        [self release];
+        return nil;
+    }
+    BNRSalt littleSalt = *s;
+    BNRSaltToLittle(&littleSalt);
+    
+    NSData *keyData = [key dataUsingEncoding:NSUTF8StringEncoding];
+    UInt8 k[kBNRAESKeySize];
+    if (!BNRDeriveKey([keyData bytes], [keyData length],
+                      littleSalt.word, sizeof(littleSalt.word),
+                      kBNRRecordCipherRounds, k, sizeof(k))) {
+        NSLog(@"BNRDeriveKey() failed");
+        [self release];
+        return nil;
+    }
+    self = [self initWithDerivedKey:k salt:s];
+    memset(k, 0, sizeof(k));
+    return self;
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    return [[[self class] allocWithZone:zone] initWithDerivedKey:derivedKey salt:&salt];
+}
+
+- (void)dealloc
+{
+    BNRAESCryptorRelease(&cryptor);
+    memset(derivedKey, 0, sizeof(derivedKey));
+    [super dealloc];
+}
+
+#pragma mark Key stream
+
+// The first 12 bytes of every counter block of a record; the last 4 are the block number
+- (void)getCounterPrefix:(UInt8 *)prefix word0:(UInt32)w0 word1:(UInt32)w1 nonce:(UInt64)nonce
+{
+    UInt32 littleWord = CFSwapInt32HostToLittle(w1);
+    UInt64 littleNonce = CFSwapInt64HostToLittle(nonce ^ ((UInt64)w0 << 32));
+    memcpy(prefix, &littleWord, sizeof(UInt32));
+    memcpy(prefix + sizeof(UInt32), &littleNonce, sizeof(UInt64));
+}
+
+// Tells a wrong key (or a v1 record) from the right one.  It is no MAC: the
+// counter mode key stream makes any bit of the data flippable unnoticed.
+- (void)getKeyCheck:(BNRSalt *)check word0:(UInt32)w0 word1:(UInt32)w1
+{
+    *check = salt;
+    StirBNRSaltWithWords(check, w0, w1);
+    BNRSaltToLittle(check);
+}
+
+// XORs |length| bytes with the key stream, starting at block 0
+- (void)applyKeyStreamTo:(UInt8 *)bytes
+                  length:(size_t)length
+           counterPrefix:(const UInt8 *)prefix
+{
+    UInt8 counters[kBNRCipherBlocksPerPass * kBNRCipherBlockSize];
+    UInt8 keyStream[kBNRCipherBlocksPerPass * kBNRCipherBlockSize];
+    UInt32 block = 0;
+    
+    while (length > 0) {
+        size_t blockCount = (length + kBNRCipherBlockSize - 1) / kBNRCipherBlockSize;
+        if (blockCount > kBNRCipherBlocksPerPass) {
+            blockCount = kBNRCipherBlocksPerPass;
+        }
+        for (size_t i = 0; i < blockCount; i++) {
+            UInt8 *counter = counters + i * kBNRCipherBlockSize;
+            UInt32 bigBlock = CFSwapInt32HostToBig(block + (UInt32)i);
+            memcpy(counter, prefix, 12);
+            memcpy(counter + 12, &bigBlock, sizeof(UInt32));
+        }
+        
+        size_t streamLength = blockCount * kBNRCipherBlockSize;
+        if (!BNRAESCryptorUpdate(&cryptor, counters, keyStream, streamLength)) {
+            [NSException raise:NSInternalInconsistencyException
+                        format:@"BNRAESCryptorUpdate() failed"];
+        }
+        
+        size_t n = (length < streamLength) ? length : streamLength;
+        for (size_t i = 0; i < n; i++) {
+            bytes[i] ^= keyStream[i];
+        }
+        bytes += n;
+        length -= n;
+        block += (UInt32)blockCount;
+    }
+}
+
+#pragma mark Records
+
+- (void)reserveHeaderInBuffer:(BNRDataBuffer *)buffer
+{
+    [buffer writeUInt8:kBNRRecordCipherVersion];
+    [buffer writeUInt64:0]; // nonce
+    [buffer writeUInt64:0]; // key check
+}
+
+- (void)encryptReservedBuffer:(BNRDataBuffer *)buffer word0:(UInt32)w0 word1:(UInt32)w1
+{
+    unsigned fullLength = [buffer length];
+    NSAssert(fullLength >= kBNRRecordCipherOverhead, @"no room reserved for the header");
+    UInt8 *bytes = [buffer buffer];
+    
+    UInt64 nonce = nextNonce++;
+    UInt64 littleNonce = CFSwapInt64HostToLittle(nonce);
+    bytes[0] = kBNRRecordCipherVersion;
+    memcpy(bytes + kBNRNonceOffset, &littleNonce, sizeof(UInt64));
+    
+    BNRSalt check;
+    [self getKeyCheck:&check word0:w0 word1:w1];
+    memcpy(bytes + kBNRKeyCheckOffset, check.word, sizeof(check.word));
+    
+    UInt8 prefix[12];
+    [self getCounterPrefix:prefix word0:w0 word1:w1 nonce:nonce];
+    [self applyKeyStreamTo:bytes + kBNRKeyCheckOffset
+                    length:fullLength - kBNRKeyCheckOffset
+             counterPrefix:prefix];
+    [buffer resetCursor];
+}
+
+- (void)encryptBuffer:(BNRDataBuffer *)buffer word0:(UInt32)w0 word1:(UInt32)w1
+{
+    // Make the room the writer didn't reserve
+    unsigned clearLength = [buffer length];
+    [buffer ensureCapacity:clearLength + kBNRRecordCipherOverhead];
+    UInt8 *bytes = [buffer buffer];
+    memmove(bytes + kBNRRecordCipherOverhead, bytes, clearLength);
+    [buffer setLength:clearLength + kBNRRecordCipherOverhead];
+    
+    [self encryptReservedBuffer:buffer word0:w0 word1:w1];
+}
+
+- (BOOL)decryptBuffer:(BNRDataBuffer *)buffer word0:(UInt32)w0 word1:(UInt32)w1
+{
+    unsigned fullLength = [buffer length];
+    const UInt8 *bytes = [buffer buffer];
+    if (fullLength < kBNRRecordCipherOverhead || bytes[0] != kBNRRecordCipherVersion) {
+        return NO;
+    }
+    
+    UInt64 littleNonce;
+    memcpy(&littleNonce, bytes + kBNRNonceOffset, sizeof(UInt64));
+    UInt8 prefix[12];
+    [self getCounterPrefix:prefix word0:w0 word1:w1 nonce:CFSwapInt64LittleToHost(littleNonce)];
+    
+    // Check the key on a copy first so a failed attempt leaves the buffer for v1
+    BNRSalt check, expected;
+    memcpy(check.word, bytes + kBNRKeyCheckOffset, sizeof(check.word));
+    [self applyKeyStreamTo:(UInt8 *)check.word length:sizeof(check.word) counterPrefix:prefix];
+    [self getKeyCheck:&expected word0:w0 word1:w1];
+    if (memcmp(check.word, expected.word, sizeof(check.word)) != 0) {
+        return NO;
+    }
+    
+    // Bytes in someone else's memory get copied before we write on them
+    [buffer ensureCapacity:fullLength];
+    UInt8 *writable = [buffer buffer];
+    [self applyKeyStreamTo:writable + kBNRKeyCheckOffset
+                    length:fullLength - kBNRKeyCheckOffset
+             counterPrefix:prefix];
+    memmove(writable, writable + kBNRRecordCipherOverhead, fullLength - kBNRRecordCipherOverhead);
+    [buffer setLength:fullLength - kBNRRecordCipherOverhead];
+    [buffer resetCursor];
+    return YES;
+}
+
+@end
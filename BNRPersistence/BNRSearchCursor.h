@@ -0,0 +1,101 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#import <Foundation/Foundation.h>
+@class BNRStore;
+
+/*!
+ @const kBNRSearchCursorBatchSize
+ @abstract How many objects a BNRSearchCursor reads from the store at a time
+ */
+#define kBNRSearchCursorBatchSize (256)
+
+/*!
+ @class BNRSearchCursor
+ @abstract Walks the rows that match a full-text search in ascending rowID order
+ @discussion The cursor holds only the matching rowIDs, 4 bytes each.  It makes
+ objects only for the rows you take, reading them from the store a batch at a
+ time.  Memory stays flat even for searches that match hundreds of thousands of
+ rows.
+
+ The resume token is the rowID of the last row taken or skipped.  A later
+ cursor for the same search can pick up right after it, even if rows were
+ inserted or deleted in between, so a paging UI can keep just the token.
+ */
+@interface BNRSearchCursor : NSObject {
+    BNRStore *store;
+    Class searchClass;
+    UInt32 *rowIDs;
+    UInt32 rowCount;
+    UInt32 position;
+}
+
+/*!
+ @method initWithStore:class:rowIDs:count:
+ @abstract Takes over |ids|, which must come from malloc (or be NULL if |n| is 0)
+ */
+- (id)initWithStore:(BNRStore *)s
+              class:(Class)c
+             rowIDs:(UInt32 *)ids
+              count:(UInt32)n;
+
+/*!
+ @method count
+ @abstract How many rows matched, taken or not
+ */
+- (NSUInteger)count;
+- (NSUInteger)position;
+- (BOOL)isAtEnd;
+
+/*!
+ @method skip:
+ @abstract Moves past up to |n| rows without making objects; returns how many
+ */
+- (NSUInteger)skip:(NSUInteger)n;
+
+/*!
+ @method take:
+ @abstract Returns the objects, with content, for up to the next |n| rows
+ @discussion Rows whose records are gone are left out.
+ */
+- (NSMutableArray *)take:(NSUInteger)n;
+
+/*!
+ @method takeRowIDs:maxCount:
+ @abstract Copies up to the next |n| rowIDs into |buffer|; returns how many
+ */
+- (NSUInteger)takeRowIDs:(UInt32 *)buffer maxCount:(NSUInteger)n;
+
+/*!
+ @method resumeToken
+ @abstract The rowID of the last row taken or skipped; 0 before the first
+ */
+- (UInt32)resumeToken;
+
+/*!
+ @method resumeAfterToken:
+ @abstract Moves to the first row after the one |token| names
+ */
+- (void)resumeAfterToken:(UInt32)token;
+
+@end
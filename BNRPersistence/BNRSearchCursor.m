@@ -0,0 +1,119 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "BNRSearchCursor.h"
+#import "BNRStore.h"
+#import "BNRIndexManager.h"
+
+@implementation BNRSearchCursor
+
+- (id)initWithStore:(BNRStore *)s
+              class:(Class)c
+             rowIDs:(UInt32 *)ids
+              count:(UInt32)n
+{
+    self = [super init];
+    if (self) {
+        store = [s retain];
+        searchClass = c;
+        rowIDs = ids;
+        rowCount = ids ? n : 0;
+        BNRSortRowIDs(rowIDs, rowCount);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    free(rowIDs);
+    [store release];
+    [super dealloc];
+}
+
+- (NSUInteger)count
+{
+    return rowCount;
+}
+
+- (NSUInteger)position
+{
+    return position;
+}
+
+- (BOOL)isAtEnd
+{
+    return position >= rowCount;
+}
+
+- (NSUInteger)skip:(NSUInteger)n
+{
+    NSUInteger skipped = MIN(n, (NSUInteger)(rowCount - position));
+    position += (UInt32)skipped;
+    return skipped;
+}
+
+- (NSUInteger)takeRowIDs:(UInt32 *)buffer maxCount:(NSUInteger)n
+{
+    NSUInteger taken = MIN(n, (NSUInteger)(rowCount - position));
+    memcpy(buffer, rowIDs + position, taken * sizeof(UInt32));
+    position += (UInt32)taken;
+    return taken;
+}
+
+- (NSMutableArray *)take:(NSUInteger)n
+{
+    NSUInteger remaining = MIN(n, (NSUInteger)(rowCount - position));
+    NSMutableArray *result = [NSMutableArray arrayWithCapacity:remaining];
+    while (remaining > 0) {
+        NSUInteger batchCount = MIN(remaining, (NSUInteger)kBNRSearchCursorBatchSize);
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        [result addObjectsFromArray:[store objectsForClass:searchClass
+                                                    rowIDs:rowIDs + position
+                                                     count:batchCount]];
+        [pool drain];
+        position += (UInt32)batchCount;
+        remaining -= batchCount;
+    }
+    return result;
+}
+
+- (UInt32)resumeToken
+{
+    return (position > 0) ? rowIDs[position - 1] : 0;
+}
+
+- (void)resumeAfterToken:(UInt32)token
+{
+    UInt32 low = 0;
+    UInt32 high = rowCount;
+    while (low < high) {
+        UInt32 mid = low + (high - low) / 2;
+        if (rowIDs[mid] <= token) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    position = low;
+}
+
+@end
@@ -23,6 +23,7 @@
 #define kUseBNRResizableUniquingTable 0 // see size/speed tradeoffs in BNRResizableUniquingTable. kUseBNRResizableUniquingTable will be required for ARC.
 
 #import <Foundation/Foundation.h>
+#import "BNRIndexManager.h"
 @class BNRClassDictionary;
 @class BNRUniquingTable;
 @class BNRResizableUniquingTable;
@@ -30,8 +31,12 @@
 @class BNRStoredObject;
 @class BNRDataBuffer;
 @class BNRStore;
-@class BNRIndexManager;
 @class BNRClassMetaData;
+@class BNRUndoJournal;
+@class BNRStringDictionary;
+@class BNRCryptoPipeline;
+@class BNRSearchCursor;
+@class BNRTextQuery;
 
 @protocol BNRStoreDelegate
 
@@ -44,6 +49,7 @@
 
 #if NS_BLOCKS_AVAILABLE
 typedef void(^BNRStoredObjectIterBlock)(UInt32 rowID, BNRStoredObject *object, BOOL *stop);
+typedef void(^BNRRawRecordIterBlock)(UInt32 rowID, BNRDataBuffer *record, BOOL *stop);
 #endif
 
 //! BNRStore
@@ -71,6 +77,7 @@ typedef void(^BNRStoredObjectIterBlock)(UInt32 rowID, BNRStoredObject *object, B
     BNRStoreBackend *backend; /**< Actually saves the data */
     
     NSUndoManager *undoManager; /**< If non-nil, undo actions are automatically registered */
+    BNRUndoJournal *undoJournal; /**< Holds the snapshots registered with undoManager */
     
     BNRIndexManager *indexManager; 
     
@@ -83,11 +90,20 @@ typedef void(^BNRStoredObjectIterBlock)(UInt32 rowID, BNRStoredObject *object, B
     
     // Class meta data
     BNRClassDictionary *classMetaData; /*< Maps Class->BNRClassMetaData */
+    BNRClassDictionary *stringDictionaries; /*< Maps Class->BNRStringDictionary, loaded when first needed */
+    BNRClassDictionary *recordCiphers; /*< Maps Class->BNRRecordCipher, made when first needed */
     Class classes[256];  /*< Maps int (the class ID) -> Class */
     
     BOOL usesPerInstanceVersioning; /*< Prepends version number on data buffer; Default = YES */
+    BOOL usesCompactEncoding; /*< New classes get kBNRCompactRecordFormat; Default = NO */
     
     NSString *encryptionKey; /**< Password to be used in reading and writing objects to/from the store. */
+    BNRCryptoPipeline *cryptoPipeline; /**< nil unless cryptoThreadCount > 1 */
+    
+    // Bulk import (see -beginBulkImport)
+    BOOL inBulkImport;
+    NSMutableSet *bulkImportedClasses;
+    NSMutableDictionary *deferredIndexRowIDs; /*< Maps class name -> NSMutableIndexSet of rowIDs still to be text-indexed */
 
 #if iCloudBNRStoreSupportEnabled
 	NSFileCoordinator *coordinator;
@@ -98,7 +114,18 @@ typedef void(^BNRStoredObjectIterBlock)(UInt32 rowID, BNRStoredObject *object, B
 @property (nonatomic, retain) NSUndoManager *undoManager;
 @property (nonatomic, assign) id <BNRStoreDelegate> delegate;
 @property (nonatomic, assign) BOOL usesPerInstanceVersioning;
+// Classes that have no records in the backend yet are created with compact
+// (varint) string and data lengths, and archiveable objects written without
+// NSKeyedArchiver.  Existing classes keep the format they were written with,
+// so set this before touching any class.
+@property (nonatomic, assign) BOOL usesCompactEncoding;
+// Records are written with BNRRecordCipher, which derives a key per class the
+// first time the class is read or written after the key is set.  Records written
+// in the older per-record format are still read.
 @property (nonatomic, retain) NSString *encryptionKey;
+// With more than one thread, saveChanges: and allObjectsForClass: encrypt and
+// decrypt records in batches spread over that many threads.  Default = 1.
+@property (nonatomic, assign) NSUInteger cryptoThreadCount;
 
 - (id)init;
 
@@ -115,13 +142,75 @@ typedef void(^BNRStoredObjectIterBlock)(UInt32 rowID, BNRStoredObject *object, B
 // All returned objects have content.
 - (NSMutableArray *)allObjectsForClass:(Class)c;
 
-// Full-text search
+// Fetches the objects of class |c| at the |n| rows in |rowIDs|, in that order,
+// reading their records a batch at a time (-[BNRStoreBackend dataForClass:rowIDs:count:])
+// and decrypting them together.  Rows with no record are left out.  All returned
+// objects have content.
+- (NSMutableArray *)objectsForClass:(Class)c
+                             rowIDs:(const UInt32 *)rowIDs
+                              count:(NSUInteger)n;
+
+// Full-text search.  Changes the index manager has queued but not applied yet
+// are checked one by one (BNRIndexSearchIncludePending).
 - (NSMutableArray *)objectsForClass:(Class)c
                        matchingText:(NSString *)toMatch
                              forKey:(NSString *)key;
+- (NSMutableArray *)objectsForClass:(Class)c
+                       matchingText:(NSString *)toMatch
+                             forKey:(NSString *)key
+                        consistency:(BNRIndexSearchConsistency)consistency;
+
+// The (at most) |limit| objects that match best, most relevant first
+- (NSMutableArray *)objectsForClass:(Class)c
+                       matchingText:(NSString *)toMatch
+                             forKey:(NSString *)key
+                              limit:(NSUInteger)limit;
+
+// Streams the matches in rowID order instead of making every object up front
+- (BNRSearchCursor *)searchCursorForClass:(Class)c
+                             matchingText:(NSString *)toMatch
+                                   forKey:(NSString *)key;
+
+// A boolean query across several text-indexed keys, evaluated on rowIDs
+// before any object is made
+- (NSMutableArray *)objectsForClass:(Class)c
+                      matchingQuery:(BNRTextQuery *)query;
+- (BNRSearchCursor *)searchCursorForClass:(Class)c
+                            matchingQuery:(BNRTextQuery *)query;
+
+// Conditions on the class's tableIndexedAttributes, evaluated by the index
+// manager (see BNRTCTableIndexManager) before any object is made.  |limit| 0
+// means no limit.
+- (NSMutableArray *)objectsForClass:(Class)c
+                  matchingPredicate:(NSPredicate *)predicate
+                     sortDescriptor:(NSSortDescriptor *)sortDescriptor
+                              limit:(NSUInteger)limit;
+
+// Type-ahead: the (at most) |limit| most frequent words in a prefix-indexed
+// key that start with |prefix|, lowercased and without accents
+- (NSArray *)completionsForClass:(Class)c
+                          prefix:(NSString *)prefix
+                          forKey:(NSString *)key
+                           limit:(NSUInteger)limit;
 
 #if NS_BLOCKS_AVAILABLE
 - (void)enumerateAllObjectsForClass:(Class)c usingBlock:(BNRStoredObjectIterBlock)block;
+
+// Hands the block each stored record of class |c| without making objects, with the
+// buffer positioned after the version byte.  Strings and data read from |record|
+// point into the store's memory-mapped file (or a scratch arena) instead of being
+// copied: they are only good until the block returns, so -copy anything you keep,
+// and don't save changes from inside the block.
+- (void)enumerateRawRecordsForClass:(Class)c usingBlock:(BNRRawRecordIterBlock)block;
+
+// The same, with the class file split into (up to) |n| parts that are scanned at
+// once, each on a thread of its own.  The block is called concurrently and in no
+// particular order, so it must be threadsafe and must not use the store.  What
+// it reads from |record| is only good until it returns.  Setting *stop ends
+// every part.
+- (void)enumerateRawRecordsForClass:(Class)c
+                        threadCount:(NSUInteger)n
+                         usingBlock:(BNRRawRecordIterBlock)block;
 #endif
 
 #pragma mark Saving
@@ -140,6 +229,27 @@ typedef void(^BNRStoredObjectIterBlock)(UInt32 rowID, BNRStoredObject *object, B
 
 - (BOOL)saveChanges:(NSError **)errorPtr;
 
+#pragma mark Bulk import
+
+// For initial loads.  Between these calls inserted objects are not put in the
+// uniquing table (fetching one returns a different instance), no undo is
+// registered, the backend may defer writing to disk, and full-text indexing
+// of the inserted objects is put off until endBulkImport, which saves, indexes
+// and syncs everything.
+- (void)beginBulkImport;
+- (BOOL)endBulkImport;
+- (BOOL)isInBulkImport;
+
+#pragma mark Text indexes
+
+// Throws away the full-text indexes of class |c| and builds them again from
+// its stored records, tokenizing on |n| threads, then swaps the new indexes in.
+// For after textIndexedAttributes changes, restoring a backup, or a damaged
+// index.  Save first: the records are read straight from the backend.  Saves
+// made while it runs go into the new indexes too.  The prefix indexes used
+// for completions (prefixIndexedAttributes) are left as they are.
+- (BOOL)rebuildTextIndexesForClass:(Class)c threadCount:(NSUInteger)n;
+
 #pragma mark Backend
 
 - (BNRStoreBackend *)backend;
@@ -154,6 +264,9 @@ typedef void(^BNRStoredObjectIterBlock)(UInt32 rowID, BNRStoredObject *object, B
 - (unsigned char)classIDForClass:(Class)c;
 - (BNRClassMetaData *)metaDataForClass:(Class)c;
 
+// The shared strings for -[BNRDataBuffer writeDictionaryString:]; saved along with the class
+- (BNRStringDictionary *)stringDictionaryForClass:(Class)c;
+
 #pragma mark Retain-cycle breaking
 
 - (void)dissolveAllRelationships;
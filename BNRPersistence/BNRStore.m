@@ -29,6 +29,12 @@
 #import "BNRClassMetaData.h"
 #import "BNRIndexManager.h"
 #import "BNRDataBuffer+Encryption.h"
+#import "BNRUndoJournal.h"
+#import "BNRArena.h"
+#import "BNRStringDictionary.h"
+#import "BNRRecordCipher.h"
+#import "BNRCryptoPipeline.h"
+#import "BNRSearchCursor.h"
 
 #if kUseBNRResizableUniquingTable
 	#import "BNRResizableUniquingTable.h"
@@ -36,9 +42,11 @@
 	#import "BNRUniquingTable.h"
 #endif
 
-#ifndef PAGE_SIZE
-#define PAGE_SIZE (4096)
-#endif
+// Borrowed buffers for reading one record start this big (they grow if needed)
+#define kBNRRecordBufferCapacity (4096)
+
+// Row IDs are reserved this many at a time during a bulk import
+#define kBNRBulkImportRowIDBlockSize (4096)
 
 @interface BNRStoredObject (BNRStoreFriend)
 
@@ -48,6 +56,118 @@
 @end
 
 
+#if NS_BLOCKS_AVAILABLE
+// One part of -enumerateRawRecordsForClass:threadCount:usingBlock:
+@interface BNRRawScanOperation : NSOperation {
+    BNRBackendCursor *cursor;
+    BNRDataBuffer *record;          // formatted for the class by the store
+    BNRRawRecordIterBlock block;
+    BNRRecordCipher *cipher;        // a copy: ciphers aren't threadsafe
+    NSString *key;                  // nil if the store isn't encrypted
+    BNRSalt salt;                   // the class's, before stirring in the rowID
+    BOOL consumesVersion;
+    volatile BOOL *stop;            // shared by every part
+}
+- (id)initWithCursor:(BNRBackendCursor *)cu
+              record:(BNRDataBuffer *)r
+               block:(BNRRawRecordIterBlock)b
+              cipher:(BNRRecordCipher *)ci
+                 key:(NSString *)k
+                salt:(const BNRSalt *)s
+     consumesVersion:(BOOL)yn
+                stop:(volatile BOOL *)st;
+@end
+
+@implementation BNRRawScanOperation
+
+- (id)initWithCursor:(BNRBackendCursor *)cu
+              record:(BNRDataBuffer *)r
+               block:(BNRRawRecordIterBlock)b
+              cipher:(BNRRecordCipher *)ci
+                 key:(NSString *)k
+                salt:(const BNRSalt *)s
+     consumesVersion:(BOOL)yn
+                stop:(volatile BOOL *)st
+{
+    self = [super init];
+    if (self) {
+        cursor = [cu retain];
+        record = [r retain];
+        block = [b copy];
+        cipher = [ci copy];
+        key = [k copy];
+        salt = *s;
+        consumesVersion = yn;
+        stop = st;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [cursor release];
+    [record release];
+    [block release];
+    [cipher release];
+    [key release];
+    [super dealloc];
+}
+
+- (void)main
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    
+    // Only this record's copies live in the arena, so it is emptied after each one
+    BNRArena *arena = [[BNRArena alloc] init];
+    BNRDataBuffer *scratch = key ? [BNRDataBuffer borrowBufferWithCapacity:kBNRRecordBufferCapacity] : nil;
+    
+    const void *bytes;
+    unsigned length;
+    UInt32 rowID;
+    while (!*stop && (rowID = [cursor nextBytes:&bytes length:&length arena:arena]) != 0)
+    {
+        if (kBNRMetadataRowID == rowID) continue;  // skip metadata
+        
+        // Same as -[BNRStore decryptBuffer:ofClass:rowID:], with this thread's cipher
+        if (key) {
+            [scratch clearBuffer];
+            [scratch copyFrom:bytes length:length];
+            [scratch resetCursor];
+            if (![cipher decryptBuffer:scratch word0:0 word1:rowID]) {
+                BNRSalt rowSalt = salt;
+                StirBNRSaltWithWords(&rowSalt, 0, rowID);
+                [scratch decryptWithKey:key salt:&rowSalt];
+            }
+            length = [scratch length];
+            bytes = [arena copyBytes:[scratch buffer] length:length];
+        }
+        
+        NSAutoreleasePool *recordPool = [[NSAutoreleasePool alloc] init];
+        
+        [record setBytesNoCopy:bytes length:length owner:arena];
+        if (consumesVersion) {
+            [record consumeVersion];
+        }
+        
+        BOOL stopHere = NO;
+        block(rowID, record, &stopHere);
+        
+        [recordPool drain];
+        [arena reset];
+        
+        if (stopHere)
+            *stop = YES;
+    }
+    [BNRDataBuffer returnBuffer:scratch];
+    [arena release];
+    
+    [pool drain];
+}
+
+@end
+#endif
+
+
 @interface BNRStore (FilePresenter)
 // iCloud - currently disabled; full support requires iCloudBNRStoreSupportEnabled and more testing
 - (void)registerAsFilePresenter;
@@ -57,7 +177,7 @@
 
 
 @implementation BNRStore
-@synthesize undoManager, indexManager, delegate, usesPerInstanceVersioning, encryptionKey;
+@synthesize undoManager, indexManager, delegate, usesPerInstanceVersioning, usesCompactEncoding;
 
 - (id)init
 {
@@ -75,7 +195,11 @@
 		toBeDeleted = [[NSMutableSet alloc] init];
 		toBeUpdated = [[NSMutableSet alloc] init];
 		classMetaData = [[BNRClassDictionary alloc] init];
+		stringDictionaries = [[BNRClassDictionary alloc] init];
+		recordCiphers = [[BNRClassDictionary alloc] init];
 		usesPerInstanceVersioning = YES; // Adds an 8-bit number to every record, but enables versioning...
+		bulkImportedClasses = [[NSMutableSet alloc] init];
+		deferredIndexRowIDs = [[NSMutableDictionary alloc] init];
     }
     return self;
 }
@@ -90,6 +214,36 @@
     [ud retain];
     [undoManager release];
     undoManager = ud;
+    
+    [undoJournal release];
+    undoJournal = ud ? [[BNRUndoJournal alloc] initWithUndoManager:ud] : nil;
+}
+
+- (NSString *)encryptionKey
+{
+    return encryptionKey;
+}
+
+- (void)setEncryptionKey:(NSString *)key
+{
+    [key retain];
+    [encryptionKey release];
+    encryptionKey = key;
+    
+    // The ciphers hold keys derived from the old passphrase
+    [recordCiphers release];
+    recordCiphers = [[BNRClassDictionary alloc] init];
+}
+
+- (NSUInteger)cryptoThreadCount
+{
+    return cryptoPipeline ? [cryptoPipeline threadCount] : 1;
+}
+
+- (void)setCryptoThreadCount:(NSUInteger)n
+{
+    [cryptoPipeline release];
+    cryptoPipeline = (n > 1) ? [[BNRCryptoPipeline alloc] initWithThreadCount:n] : nil;
 }
 
 - (void)makeEveryStoredObjectPerformSelector:(SEL)s
@@ -116,6 +270,11 @@
     
     [backend release];
     [classMetaData release];
+    [stringDictionaries release];
+    [recordCiphers release];
+    [cryptoPipeline release];
+    [bulkImportedClasses release];
+    [deferredIndexRowIDs release];
 	
 	[undoManager release];		// added BMonk 4/2/11
 	[encryptionKey release];	// added BMonk 4/2/11
@@ -138,32 +297,113 @@
     classes[classCount] = c;
 }
 
-- (void)getSalt:(BNRSalt *)salt forClass:(Class)c rowID:(UInt32)rowID
+// Derives the class's key the first time it is needed; nil if there is no encryptionKey
+- (BNRRecordCipher *)cipherForClass:(Class)c
 {
-    NSParameterAssert(salt != nil);
-    BNRClassMetaData *metaData = [self metaDataForClass:c];
-    *salt = *[metaData encryptionKeySalt];
-    StirBNRSaltWithWords(salt, 0, rowID);
+    if ([encryptionKey length] == 0)
+        return nil;
+    
+    BNRRecordCipher *cipher = [recordCiphers objectForClass:c];
+    if (!cipher) {
+        BNRClassMetaData *metaData = [self metaDataForClass:c];
+        cipher = [[BNRRecordCipher alloc] initWithKey:encryptionKey salt:[metaData encryptionKeySalt]];
+        if (cipher) {
+            [recordCiphers setObject:cipher forClass:c];
+            [cipher release];
+        }
+    }
+    return cipher;
 }
 
-- (BOOL)decryptBuffer:(BNRDataBuffer *)buffer ofClass:(Class)c rowID:(UInt32)rowID
+// Records are read and written with the format their class was created with
+- (void)setFormatOfBuffer:(BNRDataBuffer *)buffer forClass:(Class)c
+{
+    UInt8 flags = [[self metaDataForClass:c] formatFlags];
+    [buffer setUsesCompactLengths:(flags & BNRRecordFormatCompactLengths) != 0];
+    [buffer setUsesNativeObjectEncoding:(flags & BNRRecordFormatNativeObjects) != 0];
+    [buffer setStringDictionary:[self stringDictionaryForClass:c]];
+}
+
+// |w0| and |w1| are stirred into the class's salt: (0, rowID) for records.
+// Tries the v2 format, then v1 (salted per record, see BNRDataBuffer+Encryption).
+- (BOOL)decryptBuffer:(BNRDataBuffer *)buffer ofClass:(Class)c word0:(UInt32)w0 word1:(UInt32)w1
 {
     if (buffer == nil)
         return YES;
 
-    BNRSalt salt;
-    [self getSalt:&salt forClass:c rowID:rowID];
+    BNRRecordCipher *cipher = [self cipherForClass:c];
+    if ([cipher decryptBuffer:buffer word0:w0 word1:w1])
+        return YES;
+    
+    BNRSalt salt = *[[self metaDataForClass:c] encryptionKeySalt];
+    StirBNRSaltWithWords(&salt, w0, w1);
     return [buffer decryptWithKey:encryptionKey salt:&salt];
 }
+// Writers call this before writing anything, so encrypting doesn't have to move the record
+- (void)reserveEncryptionHeaderInBuffer:(BNRDataBuffer *)buffer forClass:(Class)c
+{
+    [[self cipherForClass:c] reserveHeaderInBuffer:buffer];
+}
+// Expects the buffer to start with the room made by reserveEncryptionHeaderInBuffer:forClass:
+- (void)encryptBuffer:(BNRDataBuffer *)buffer ofClass:(Class)c word0:(UInt32)w0 word1:(UInt32)w1
+{
+    BNRRecordCipher *cipher = [self cipherForClass:c];
+    if (cipher) {
+        [cipher encryptReservedBuffer:buffer word0:w0 word1:w1];
+    } else {
+        BNRSalt salt = *[[self metaDataForClass:c] encryptionKeySalt];
+        StirBNRSaltWithWords(&salt, w0, w1);
+        [buffer encryptWithKey:encryptionKey salt:&salt]; // does not encrypt if encryptionKey is empty.
+    }
+}
+
+- (BOOL)decryptBuffer:(BNRDataBuffer *)buffer ofClass:(Class)c rowID:(UInt32)rowID
+{
+    return [self decryptBuffer:buffer ofClass:c word0:0 word1:rowID];
+}
 - (void)encryptBuffer:(BNRDataBuffer *)buffer ofClass:(Class)c rowID:(UInt32)rowID
 {
-    BNRSalt salt;
-    [self getSalt:&salt forClass:c rowID:rowID];
-    [buffer encryptWithKey:encryptionKey salt:&salt]; // does not encrypt if encryptionKey is empty.
+    [self encryptBuffer:buffer ofClass:c word0:0 word1:rowID];
+}
+
+// Batches only go to the pipeline when there is one and something to encrypt
+- (BOOL)usesCryptoPipeline
+{
+    return cryptoPipeline != nil && [encryptionKey length] > 0;
+}
+
+- (void)getCryptoJob:(BNRCryptoJob *)job forBuffer:(BNRDataBuffer *)buffer ofClass:(Class)c rowID:(UInt32)rowID
+{
+    job->buffer = buffer;
+    job->cipher = [self cipherForClass:c];
+    job->salt = *[[self metaDataForClass:c] encryptionKeySalt];
+    StirBNRSaltWithWords(&job->salt, 0, rowID);
+    job->word0 = 0;
+    job->word1 = rowID;
+    job->succeeded = NO;
 }
 
 #pragma mark Fetching
 
+- (BOOL)readContentOfObject:(BNRStoredObject *)obj
+{
+    Class c = [obj class];
+    UInt32 n = [obj rowID];
+    BNRDataBuffer *d = [BNRDataBuffer borrowBufferWithCapacity:kBNRRecordBufferCapacity];
+    BOOL found = [backend readDataForClass:c rowID:n intoBuffer:d];
+    if (found) {
+        [self decryptBuffer:d ofClass:c rowID:n];
+        [self setFormatOfBuffer:d forClass:c];
+        if (usesPerInstanceVersioning) {
+            [d consumeVersion];
+        }
+        [obj readContentFromBuffer:d];
+        [obj setHasContent:YES];
+    }
+    [BNRDataBuffer returnBuffer:d];
+    return found;
+}
+
 - (BNRStoredObject *)objectForClass:(Class)c 
                               rowID:(UInt32)n 
                        fetchContent:(BOOL)mustFetch
@@ -172,25 +412,13 @@
     // Try to find it in the uniquing table
     BNRStoredObject *obj = [uniquingTable objectForClass:c rowID:n];
 
-    if (obj) {
-        if (mustFetch && ![obj hasContent]) {
-            BNRDataBuffer *const d = [backend dataForClass:c rowID:n];
-            [self decryptBuffer:d ofClass:c rowID:n];
-            if (usesPerInstanceVersioning) {
-                [d consumeVersion];
-            }
-            [obj readContentFromBuffer:d];
-            [obj setHasContent:YES];
-        }
-    } else {
-        BNRDataBuffer *const d = mustFetch? [backend dataForClass:c rowID:n] : nil;
-        [self decryptBuffer:d ofClass:c rowID:n];
-        if (usesPerInstanceVersioning) {
-            [d consumeVersion];
-        }
-        obj = [[[c alloc] initWithStore:self rowID:n buffer:d] autorelease];
+    if (!obj) {
+        obj = [[[c alloc] initWithStore:self rowID:n buffer:nil] autorelease];
         [uniquingTable setObject:obj forClass:c rowID:n];
     }
+    if (mustFetch && ![obj hasContent]) {
+        [self readContentOfObject:obj];
+    }
     return obj;
 }
 
@@ -203,32 +431,143 @@
         return nil;
     }
     NSMutableArray *const allObjects = [NSMutableArray array];
-    BNRDataBuffer *const buffer = [[[BNRDataBuffer alloc]
-                                    initWithCapacity:(UINT16_MAX + 1)]
-                                   autorelease];
-
+    
+    // With a crypto pipeline, records are read a batch at a time and decrypted together
+    const NSUInteger batchSize = [self usesCryptoPipeline] ? kBNRCryptoBatchSize : 1;
+    BNRDataBuffer *buffers[kBNRCryptoBatchSize] = { nil };
+    BNRStoredObject *batch[kBNRCryptoBatchSize];
+    BNRCryptoJob jobs[kBNRCryptoBatchSize];
+    NSUInteger count = 0;
+    
     UInt32 rowID;
-    while ((rowID = [cursor nextBuffer:buffer]) != 0)
-    {
-        if (kBNRMetadataRowID == rowID) continue;  // skip metadata
+    do {
+        if (!buffers[count]) {
+            buffers[count] = [BNRDataBuffer borrowBufferWithCapacity:(count == 0 ? UINT16_MAX + 1 : kBNRRecordBufferCapacity)];
+            [self setFormatOfBuffer:buffers[count] forClass:c];
+        }
+        rowID = [cursor nextBuffer:buffers[count]];
+        if (rowID != 0 && rowID != kBNRMetadataRowID)  // skip metadata
+        {
+            // Get the next object.
+            BNRStoredObject *storedObject = [self objectForClass:c
+                                                           rowID:rowID
+                                                    fetchContent:NO];
+            [allObjects addObject:storedObject];
+            // Possibly read in its stored data.
+            const BOOL hasUnsavedData = [toBeUpdated containsObject:storedObject];
+            if (!hasUnsavedData) {
+                batch[count] = storedObject;
+                [self getCryptoJob:&jobs[count] forBuffer:buffers[count] ofClass:c rowID:rowID];
+                count++;
+            }
+        }
+        if (count == batchSize || (rowID == 0 && count > 0)) {
+            if (batchSize > 1) {
+                [cryptoPipeline decryptJobs:jobs count:count key:encryptionKey];
+            }
+            for (NSUInteger i = 0; i < count; i++) {
+                if (batchSize == 1) {
+                    [self decryptBuffer:buffers[i] ofClass:c rowID:jobs[i].word1];
+                }
+                if (usesPerInstanceVersioning) {
+                    [buffers[i] consumeVersion];
+                }
+                [batch[i] readContentFromBuffer:buffers[i]];
+                [batch[i] setHasContent:YES];
+            }
+            count = 0;
+        }
+    } while (rowID != 0);
+    
+    for (NSUInteger i = 0; i < batchSize && buffers[i]; i++) {
+        [BNRDataBuffer returnBuffer:buffers[i]];
+    }
+    return allObjects;
+}
 
-        // Get the next object.
-        BNRStoredObject *storedObject = [self objectForClass:c
-                                                       rowID:rowID
-                                                fetchContent:NO];
-        [allObjects addObject:storedObject];
-        // Possibly read in its stored data.
-        const BOOL hasUnsavedData = [toBeUpdated containsObject:storedObject];
-        if (!hasUnsavedData) {
-            [self decryptBuffer:buffer ofClass:c rowID:rowID];
+- (NSMutableArray *)objectsForClass:(Class)c
+                             rowIDs:(const UInt32 *)rowIDs
+                              count:(NSUInteger)n
+{
+    NSMutableArray *const result = [NSMutableArray arrayWithCapacity:n];
+    
+    // The records still needed are read kBNRCryptoBatchSize at a time with one
+    // backend call, and decrypted together when there is a crypto pipeline.
+    // Decryption happens in place, so encrypted records are copied out first.
+    const BOOL encrypted = ([encryptionKey length] > 0);
+    const BOOL pipelined = [self usesCryptoPipeline];
+    BNRDataBuffer *scratch[kBNRCryptoBatchSize] = { nil };
+    BNRDataBuffer *buffers[kBNRCryptoBatchSize];
+    BNRStoredObject *batch[kBNRCryptoBatchSize];
+    BNRCryptoJob jobs[kBNRCryptoBatchSize];
+    UInt32 toFetch[kBNRCryptoBatchSize];
+    BOOL needsFetch[kBNRCryptoBatchSize];
+    
+    for (NSUInteger start = 0; start < n; start += kBNRCryptoBatchSize) {
+        const NSUInteger end = MIN(n, start + kBNRCryptoBatchSize);
+        NSUInteger fetchCount = 0;
+        for (NSUInteger r = start; r < end; r++) {
+            BNRStoredObject *storedObject = [uniquingTable objectForClass:c rowID:rowIDs[r]];
+            needsFetch[r - start] = !(storedObject && ([storedObject hasContent] || [toBeUpdated containsObject:storedObject]));
+            if (needsFetch[r - start]) {
+                toFetch[fetchCount++] = rowIDs[r];
+            }
+        }
+        NSArray *records = (fetchCount > 0) ? [backend dataForClass:c rowIDs:toFetch count:fetchCount] : nil;
+        
+        NSUInteger fetched = 0;
+        NSUInteger count = 0;
+        for (NSUInteger r = start; r < end; r++) {
+            const UInt32 rowID = rowIDs[r];
+            if (!needsFetch[r - start]) {
+                [result addObject:[uniquingTable objectForClass:c rowID:rowID]];
+                continue;
+            }
+            id record = [records objectAtIndex:fetched++];
+            if (record == nil || record == [NSNull null]) {
+                continue;
+            }
+            BNRDataBuffer *buffer = record;
+            if (encrypted) {
+                if (!scratch[count]) {
+                    scratch[count] = [BNRDataBuffer borrowBufferWithCapacity:kBNRRecordBufferCapacity];
+                }
+                buffer = scratch[count];
+                [buffer clearBuffer];
+                [buffer copyFrom:[record buffer] length:[record length]];
+                [buffer resetCursor];
+            }
+            [self setFormatOfBuffer:buffer forClass:c];
+            
+            BNRStoredObject *storedObject = [self objectForClass:c
+                                                          rowID:rowID
+                                                   fetchContent:NO];
+            [result addObject:storedObject];
+            buffers[count] = buffer;
+            batch[count] = storedObject;
+            [self getCryptoJob:&jobs[count] forBuffer:buffer ofClass:c rowID:rowID];
+            count++;
+        }
+        
+        if (pipelined && count > 0) {
+            [cryptoPipeline decryptJobs:jobs count:count key:encryptionKey];
+        }
+        for (NSUInteger i = 0; i < count; i++) {
+            if (encrypted && !pipelined) {
+                [self decryptBuffer:buffers[i] ofClass:c rowID:jobs[i].word1];
+            }
             if (usesPerInstanceVersioning) {
-                [buffer consumeVersion];
+                [buffers[i] consumeVersion];
             }
-            [storedObject readContentFromBuffer:buffer];
-            [storedObject setHasContent:YES];
+            [batch[i] readContentFromBuffer:buffers[i]];
+            [batch[i] setHasContent:YES];
         }
-     }
-    return allObjects;
+    }
+    
+    for (NSUInteger i = 0; i < kBNRCryptoBatchSize && scratch[i]; i++) {
+        [BNRDataBuffer returnBuffer:scratch[i]];
+    }
+    return result;
 }
 
 #if NS_BLOCKS_AVAILABLE
@@ -241,9 +580,8 @@
         return;
     }
 
-    BNRDataBuffer *const buffer = [[[BNRDataBuffer alloc]
-                                    initWithCapacity:(UINT16_MAX + 1)]
-                                   autorelease];
+    BNRDataBuffer *const buffer = [BNRDataBuffer borrowBufferWithCapacity:(UINT16_MAX + 1)];
+    [self setFormatOfBuffer:buffer forClass:c];
     
     UInt32 rowID;
     while ((rowID = [cursor nextBuffer:buffer]) != 0)
@@ -276,12 +614,116 @@
         if (stop)
             break;
     }
+    [BNRDataBuffer returnBuffer:buffer];
+}
+
+- (void)enumerateRawRecordsForClass:(Class)c usingBlock:(BNRRawRecordIterBlock)iterBlock
+{
+    BNRBackendCursor *const cursor = [backend cursorForClass:c];
+    if (!cursor) {
+        NSLog(@"No database for %@", NSStringFromClass(c));
+        return;
+    }
+    
+    // Everything the block reads points into the mapped file or into this arena,
+    // which only holds the current record's copies and is emptied after each one
+    BNRArena *arena = [[BNRArena alloc] init];
+    BNRDataBuffer *record = [[BNRDataBuffer alloc] initWithCapacity:0];
+    [record setReadsWithoutCopying:YES];
+    [self setFormatOfBuffer:record forClass:c];
+    BOOL encrypted = ([encryptionKey length] > 0);
+    BNRDataBuffer *scratch = encrypted ? [BNRDataBuffer borrowBufferWithCapacity:kBNRRecordBufferCapacity] : nil;
+    
+    const void *bytes;
+    unsigned length;
+    UInt32 rowID;
+    while ((rowID = [cursor nextBytes:&bytes length:&length arena:arena]) != 0)
+    {
+        if (kBNRMetadataRowID == rowID) continue;  // skip metadata
+        
+        // Decryption happens in place, so it needs a copy of its own
+        if (encrypted) {
+            [scratch clearBuffer];
+            [scratch copyFrom:bytes length:length];
+            [self decryptBuffer:scratch ofClass:c rowID:rowID];
+            length = [scratch length];
+            bytes = [arena copyBytes:[scratch buffer] length:length];
+        }
+        
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        
+        [record setBytesNoCopy:bytes length:length owner:arena];
+        if (usesPerInstanceVersioning) {
+            [record consumeVersion];
+        }
+        
+        BOOL stop = NO;
+        iterBlock(rowID, record, &stop);
+        
+        [pool drain];
+        [arena reset];
+        
+        if (stop)
+            break;
+    }
+    [BNRDataBuffer returnBuffer:scratch];
+    [record release];
+    [arena release];
+}
+
+- (void)enumerateRawRecordsForClass:(Class)c
+                        threadCount:(NSUInteger)n
+                         usingBlock:(BNRRawRecordIterBlock)iterBlock
+{
+    NSArray *cursors = [backend cursorsForClass:c count:n];
+    if ([cursors count] == 0) {
+        NSLog(@"No database for %@", NSStringFromClass(c));
+        return;
+    }
+    
+    // Everything the parts share is looked up here, before they start
+    NSString *key = ([encryptionKey length] > 0) ? encryptionKey : nil;
+    BNRRecordCipher *cipher = key ? [self cipherForClass:c] : nil;
+    BNRSalt salt = *[[self metaDataForClass:c] encryptionKeySalt];
+    volatile BOOL stop = NO;
+    
+    NSOperationQueue *queue = [[NSOperationQueue alloc] init];
+    [queue setMaxConcurrentOperationCount:[cursors count]];
+    for (BNRBackendCursor *cursor in cursors) {
+        BNRDataBuffer *record = [[BNRDataBuffer alloc] initWithCapacity:0];
+        [record setReadsWithoutCopying:YES];
+        [self setFormatOfBuffer:record forClass:c];
+        BNRRawScanOperation *op = [[BNRRawScanOperation alloc] initWithCursor:cursor
+                                                                       record:record
+                                                                        block:iterBlock
+                                                                       cipher:cipher
+                                                                          key:key
+                                                                         salt:&salt
+                                                              consumesVersion:usesPerInstanceVersioning
+                                                                         stop:&stop];
+        [queue addOperation:op];
+        [op release];
+        [record release];
+    }
+    [queue waitUntilAllOperationsAreFinished];
+    [queue release];
 }
 #endif
 
 - (NSMutableArray *)objectsForClass:(Class)c
                        matchingText:(NSString *)toMatch
                              forKey:(NSString *)key
+{
+    return [self objectsForClass:c
+                    matchingText:toMatch
+                          forKey:key
+                     consistency:BNRIndexSearchIncludePending];
+}
+
+- (NSMutableArray *)objectsForClass:(Class)c
+                       matchingText:(NSString *)toMatch
+                             forKey:(NSString *)key
+                        consistency:(BNRIndexSearchConsistency)consistency
 {
     if (!indexManager) {
         NSLog(@"No fulltext search without an index manager");
@@ -293,6 +735,7 @@
     UInt32 rowCount = [indexManager countOfRowsInClass:c 
                                           matchingText:toMatch
                                                 forKey:key
+                                           consistency:consistency
                                                   list:&indexResult];
     
     NSMutableArray *result = [NSMutableArray array];
@@ -309,8 +752,165 @@
     return result;
 }
 
+- (NSMutableArray *)objectsForClass:(Class)c
+                       matchingText:(NSString *)toMatch
+                             forKey:(NSString *)key
+                              limit:(NSUInteger)limit
+{
+    if (!indexManager) {
+        NSLog(@"No fulltext search without an index manager");
+        return nil;
+    }
+    
+    UInt32 *indexResult;
+    UInt32 rowCount = [indexManager rankedRowsInClass:c
+                                         matchingText:toMatch
+                                               forKey:key
+                                                limit:(UInt32)MIN(limit, UINT32_MAX)
+                                                 list:&indexResult];
+    
+    NSMutableArray *result = [NSMutableArray arrayWithCapacity:rowCount];
+    for (UInt32 i = 0; i < rowCount; i++) {
+        BNRStoredObject *obj = [self objectForClass:c 
+                                              rowID:indexResult[i]
+                                       fetchContent:NO];
+        [result addObject:obj];
+    }
+    if (rowCount > 0) {
+        free(indexResult);
+    }
+    return result;
+}
+
+- (BNRSearchCursor *)searchCursorForClass:(Class)c
+                             matchingText:(NSString *)toMatch
+                                   forKey:(NSString *)key
+{
+    if (!indexManager) {
+        NSLog(@"No fulltext search without an index manager");
+        return nil;
+    }
+    
+    UInt32 *indexResult = NULL;
+    UInt32 rowCount = [indexManager countOfRowsInClass:c 
+                                          matchingText:toMatch
+                                                forKey:key
+                                                  list:&indexResult];
+    BNRSearchCursor *cursor = [[BNRSearchCursor alloc] initWithStore:self
+                                                               class:c
+                                                              rowIDs:(rowCount > 0 ? indexResult : NULL)
+                                                               count:rowCount];
+    return [cursor autorelease];
+}
+
+- (NSMutableArray *)objectsForClass:(Class)c
+                      matchingQuery:(BNRTextQuery *)query
+{
+    if (!indexManager) {
+        NSLog(@"No fulltext search without an index manager");
+        return nil;
+    }
+    
+    UInt32 *indexResult;
+    UInt32 rowCount = [indexManager countOfRowsInClass:c
+                                         matchingQuery:query
+                                                  list:&indexResult];
+    
+    NSMutableArray *result = [NSMutableArray arrayWithCapacity:rowCount];
+    for (UInt32 i = 0; i < rowCount; i++) {
+        BNRStoredObject *obj = [self objectForClass:c 
+                                              rowID:indexResult[i]
+                                       fetchContent:NO];
+        [result addObject:obj];
+    }
+    if (rowCount > 0) {
+        free(indexResult);
+    }
+    return result;
+}
+
+- (BNRSearchCursor *)searchCursorForClass:(Class)c
+                            matchingQuery:(BNRTextQuery *)query
+{
+    if (!indexManager) {
+        NSLog(@"No fulltext search without an index manager");
+        return nil;
+    }
+    
+    UInt32 *indexResult = NULL;
+    UInt32 rowCount = [indexManager countOfRowsInClass:c
+                                         matchingQuery:query
+                                                  list:&indexResult];
+    BNRSearchCursor *cursor = [[BNRSearchCursor alloc] initWithStore:self
+                                                               class:c
+                                                              rowIDs:(rowCount > 0 ? indexResult : NULL)
+                                                               count:rowCount];
+    return [cursor autorelease];
+}
+
+- (NSMutableArray *)objectsForClass:(Class)c
+                  matchingPredicate:(NSPredicate *)predicate
+                     sortDescriptor:(NSSortDescriptor *)sortDescriptor
+                              limit:(NSUInteger)limit
+{
+    if (!indexManager) {
+        NSLog(@"No predicate search without an index manager");
+        return nil;
+    }
+    
+    UInt32 *indexResult = NULL;
+    UInt32 rowCount = [indexManager countOfRowsInClass:c
+                                     matchingPredicate:predicate
+                                        sortDescriptor:sortDescriptor
+                                                 limit:limit
+                                                  list:&indexResult];
+    NSMutableArray *result = [self objectsForClass:c
+                                            rowIDs:indexResult
+                                             count:rowCount];
+    if (rowCount > 0) {
+        free(indexResult);
+    }
+    return result;
+}
+
+- (NSArray *)completionsForClass:(Class)c
+                          prefix:(NSString *)prefix
+                          forKey:(NSString *)key
+                           limit:(NSUInteger)limit
+{
+    if (!indexManager) {
+        NSLog(@"No completions without an index manager");
+        return nil;
+    }
+    return [indexManager completionsInClass:c
+                                  forPrefix:prefix
+                                     forKey:key
+                                      limit:limit];
+}
+
 #pragma mark Insert, update, delete
 
+// Returns the bytes needed to put |obj| back the way it is now.
+- (BNRDataBuffer *)undoSnapshotOfObject:(BNRStoredObject *)obj
+{
+    // A clean object's bytes are already in the backend; no need to encode it again
+    BOOL isClean = ![toBeUpdated containsObject:obj] && ![toBeInserted containsObject:obj];
+    if (isClean && [encryptionKey length] == 0) {
+        BNRDataBuffer *d = [backend dataForClass:[obj class] rowID:[obj rowID]];
+        if (d) {
+            return d;
+        }
+    }
+    
+    BNRDataBuffer *scratch = [undoJournal scratchBuffer];
+    [self setFormatOfBuffer:scratch forClass:[obj class]];
+    if (usesPerInstanceVersioning) {
+        [scratch writeVersionForObject:obj];
+    }
+    [obj writeContentToBuffer:scratch];
+    return [undoJournal snapshotOfBuffer:scratch];
+}
+
 - (BOOL)hasUnsavedChanges
 {
     return [toBeDeleted count] || [toBeInserted count] || [toBeUpdated count];
@@ -330,11 +930,15 @@
         [obj setRowID:rowID];
     }
     
-    // Put it in the uniquing table
-    [uniquingTable setObject:obj forClass:c rowID:rowID];
+    if (inBulkImport) {
+        [bulkImportedClasses addObject:c];
+    } else {
+        // Put it in the uniquing table
+        [uniquingTable setObject:obj forClass:c rowID:rowID];
 
-    if (undoManager) {
-        [(BNRStore *)[undoManager prepareWithInvocationTarget:self] deleteObject:obj];
+        if (undoManager) {
+            [(BNRStore *)[undoManager prepareWithInvocationTarget:self] deleteObject:obj];
+        }
     }
     
     [self willChangeValueForKey:@"hasUnsavedChanges"];
@@ -356,6 +960,7 @@
     BNRStoredObject *obj = [self objectForClass:c
                                           rowID:rowID
                                    fetchContent:NO];
+    [self setFormatOfBuffer:snap forClass:c];
     if (usesPerInstanceVersioning) {
         [snap consumeVersion];
     }
@@ -372,6 +977,12 @@
         return;
     }
     
+    // Store away current values (before the object leaves toBeUpdated/toBeInserted)
+    BNRDataBuffer *snapshot = nil;
+    if (undoManager && !inBulkImport) {
+        snapshot = [self undoSnapshotOfObject:obj];
+    }
+    
     [self willChangeValueForKey:@"hasUnsavedChanges"];
     
     if ([toBeInserted containsObject:obj]){
@@ -385,24 +996,12 @@
 
     [self didChangeValueForKey:@"hasUnsavedChanges"];
     
-    // Store away current values
-    if (undoManager) {
-        BNRDataBuffer *snapshot = [[BNRDataBuffer alloc]
-                                   initWithCapacity:PAGE_SIZE];
-        if (usesPerInstanceVersioning) {
-            [snapshot writeVersionForObject:obj];
-        }
-        
-        [obj writeContentToBuffer:snapshot];
-        [snapshot resetCursor];
-        //NSLog(@"snapshot for undo = %@", snapshot);
-
+    if (snapshot) {
         unsigned rowID = [obj rowID];
         Class c = [obj class];
         [[undoManager prepareWithInvocationTarget:self] insertWithRowID:rowID
                                                                   class:c
                                                                snapshot:snapshot];
-        [snapshot release];
     }
     
     // objects implement their own delete rules - cascade, whatever
@@ -416,20 +1015,13 @@
 - (void)updateObject:(BNRStoredObject *)obj withSnapshot:(BNRDataBuffer *)b
 {
     // Store away current values
-    if (undoManager) {
-        BNRDataBuffer *snapshot = [[BNRDataBuffer alloc]
-                                   initWithCapacity:PAGE_SIZE];
-        if (usesPerInstanceVersioning) {
-            [snapshot writeVersionForObject:obj];
-        }
-        
-        [obj writeContentToBuffer:snapshot];
-        [snapshot resetCursor];
+    if (undoManager && [undoJournal needsUpdateSnapshotOfObject:obj]) {
+        BNRDataBuffer *snapshot = [self undoSnapshotOfObject:obj];
         [[undoManager prepareWithInvocationTarget:self] updateObject:obj 
                                                         withSnapshot:snapshot];
-        [snapshot release];
     }
     
+    [self setFormatOfBuffer:b forClass:[obj class]];
     if (usesPerInstanceVersioning) {
         [b consumeVersion];
     }
@@ -448,19 +1040,10 @@
 
 - (void)willUpdateObject:(BNRStoredObject *)obj
 {
-    if (undoManager) {
-        BNRDataBuffer *snapshot = [[BNRDataBuffer alloc]
-                                   initWithCapacity:PAGE_SIZE];
-        if (usesPerInstanceVersioning) {
-            [snapshot writeVersionForObject:obj];
-        }
-        
-        [obj writeContentToBuffer:snapshot];
-        [snapshot resetCursor];
-
+    if (undoManager && !inBulkImport && [undoJournal needsUpdateSnapshotOfObject:obj]) {
+        BNRDataBuffer *snapshot = [self undoSnapshotOfObject:obj];
         [[undoManager prepareWithInvocationTarget:self] updateObject:obj 
                                                         withSnapshot:snapshot];
-        [snapshot release];
     }
     
     if (delegate) {
@@ -548,114 +1131,367 @@
 
 // MARK: Saving
 
-- (BOOL)saveChanges:(NSError **)errorPtr
+// Puts a batch of written records in the backend, encrypting them first
+- (void)flushObjects:(BNRStoredObject **)objects
+             buffers:(BNRDataBuffer **)buffers
+                jobs:(BNRCryptoJob *)jobs
+               count:(NSUInteger)count
+           inserting:(BOOL)inserting
 {
-    [self willChangeValueForKey:@"hasUnsavedChanges"];
-
-    BNRDataBuffer *buffer = [[BNRDataBuffer alloc] initWithCapacity:65536];
-    NSSet *affectedClasses = [self beginTransaction];
-    
-	// Inserts
-    //NSLog(@"inserting %d objects", [toBeInserted count]);
-    for (BNRStoredObject *obj in toBeInserted) {
+    if (count > 1) {
+        [cryptoPipeline encryptJobs:jobs count:count key:encryptionKey];
+    }
+    for (NSUInteger i = 0; i < count; i++) {
+        BNRStoredObject *obj = objects[i];
+        BNRDataBuffer *buffer = buffers[i];
         Class c = [obj class];
         UInt32 rowID = [obj rowID];
         
-        if (usesPerInstanceVersioning) {
-            [buffer writeVersionForObject:obj];
-        }        
-        
-        [obj writeContentToBuffer:buffer];
-        
-        [self encryptBuffer:buffer ofClass:c rowID:rowID]; // does not encrypt if encryptionKey is empty.
+        if (count == 1) {
+            [self encryptBuffer:buffer ofClass:c rowID:rowID]; // does not encrypt if encryptionKey is empty.
+        }
         
-        [backend insertData:buffer
-                   forClass:c
-                      rowID:rowID];
+        if (inserting) {
+            [backend insertData:buffer
+                       forClass:c
+                          rowID:rowID];
+        } else {
+            [backend updateData:buffer
+                       forClass:c
+                          rowID:rowID];
+        }
         [buffer clearBuffer];
         
+        // FIXME: updating all indexes is inefficient
         if (indexManager) {
-            [indexManager insertObjectInIndexes:obj];
+            // Only rows inserted during a bulk import wait for its end; rows that
+            // were already indexed are updated in the index as usual
+            if (inBulkImport && (inserting || [self isIndexingDeferredForClass:c rowID:rowID])) {
+                [self deferIndexingOfClass:c rowID:rowID];
+            } else if (inserting) {
+                [indexManager insertObjectInIndexes:obj];
+            } else {
+                [indexManager updateObjectInIndexes:obj];
+            }
         }
-        
     }
+}
+
+// Writes |objects| to the backend, a batch at a time if there is a crypto pipeline
+- (void)writeObjects:(NSSet *)objects inserting:(BOOL)inserting
+{
+    const NSUInteger batchSize = [self usesCryptoPipeline] ? kBNRCryptoBatchSize : 1;
+    BNRDataBuffer *buffers[kBNRCryptoBatchSize] = { nil };
+    BNRStoredObject *batch[kBNRCryptoBatchSize];
+    BNRCryptoJob jobs[kBNRCryptoBatchSize];
+    NSUInteger count = 0;
     
-    // Updates
-    //NSLog(@"updating %d objects", [toBeUpdated count]);
-    for (BNRStoredObject *obj in toBeUpdated) {
+    for (BNRStoredObject *obj in objects) {
         Class c = [obj class];
-        UInt32 rowID = [obj rowID];
+        if (!buffers[count]) {
+            buffers[count] = [BNRDataBuffer borrowBufferWithCapacity:(count == 0 ? 65536 : kBNRRecordBufferCapacity)];
+        }
+        BNRDataBuffer *buffer = buffers[count];
+        
+        [self setFormatOfBuffer:buffer forClass:c];
+        [self reserveEncryptionHeaderInBuffer:buffer forClass:c];
         if (usesPerInstanceVersioning) {
             [buffer writeVersionForObject:obj];
         }
         
         [obj writeContentToBuffer:buffer];
         
-        [self encryptBuffer:buffer ofClass:c rowID:rowID]; // does not encrypt if encryptionKey is empty.
-        
-        [backend updateData:buffer
-                   forClass:c
-                      rowID:rowID];
-        [buffer clearBuffer];
-        
-        // FIXME: updating all indexes is inefficient
-        if (indexManager) {
-            [indexManager updateObjectInIndexes:obj];
+        batch[count] = obj;
+        [self getCryptoJob:&jobs[count] forBuffer:buffer ofClass:c rowID:[obj rowID]];
+        if (++count == batchSize) {
+            [self flushObjects:batch buffers:buffers jobs:jobs count:count inserting:inserting];
+            count = 0;
         }
-        
     }
+    [self flushObjects:batch buffers:buffers jobs:jobs count:count inserting:inserting];
     
-    // Deletes
-    //NSLog(@"deleting %d objects", [toBeDeleted count]);
-    for (BNRStoredObject *obj in toBeDeleted) {
-        Class c = [obj class];
-        UInt32 rowID = [obj rowID];
+    for (NSUInteger i = 0; i < batchSize && buffers[i]; i++) {
+        [BNRDataBuffer returnBuffer:buffers[i]];
+    }
+}
+
+- (BOOL)saveChanges:(NSError **)errorPtr
+{
+    [self willChangeValueForKey:@"hasUnsavedChanges"];
+
+    BNRDataBuffer *buffer = [BNRDataBuffer borrowBufferWithCapacity:65536];
+    NSSet *affectedClasses = [self beginTransaction];
+    // Text index changes are collected and applied in one pass once the save commits
+    [indexManager beginIndexBatch];
+    BOOL successful = NO;
+    
+    @try {
+        [self writeObjects:toBeInserted inserting:YES];
+        [self writeObjects:toBeUpdated inserting:NO];
+    
+        // Deletes
+        //NSLog(@"deleting %d objects", [toBeDeleted count]);
+        for (BNRStoredObject *obj in toBeDeleted) {
+            Class c = [obj class];
+            UInt32 rowID = [obj rowID];
         
-        // Take it out of the uniquing table:
-        // Should I remove it from the uniquingTable in deleteObject?
-        [uniquingTable removeObjectForClass:c rowID:rowID];
-        [obj setStore:nil];
+            // Take it out of the uniquing table:
+            // Should I remove it from the uniquingTable in deleteObject?
+            if ([uniquingTable objectForClass:c rowID:rowID] == obj) {
+                [uniquingTable removeObjectForClass:c rowID:rowID];
+            }
+            [obj setStore:nil];
 
-        [backend deleteDataForClass:c
-                              rowID:rowID];
+            [backend deleteDataForClass:c
+                                  rowID:rowID];
+        
+            if (indexManager && ![self cancelDeferredIndexingOfClass:c rowID:rowID]) {
+                [indexManager deleteObjectFromIndexes:obj];
+            }
         
-        if (indexManager) {
-            [indexManager deleteObjectFromIndexes:obj];
         }
         
-    }
+        // Update metadata
+        for (Class c in affectedClasses) {
+            BNRClassMetaData *d = [classMetaData objectForClass:c];
+            if (d) {
+                [d writeContentToBuffer:buffer];
+                //NSLog(@"Inserting %d bytes of meta data for %@", [buffer length], NSStringFromClass(c));
+
+                [backend updateData:buffer
+                           forClass:c
+                              rowID:1];
+                [buffer clearBuffer];
+            }
+        }
     
-	
-	// Update metadata
-	for (Class c in affectedClasses) {
-        BNRClassMetaData *d = [classMetaData objectForClass:c];
-        if (d) {
-            [d writeContentToBuffer:buffer];
-            //NSLog(@"Inserting %d bytes of meta data for %@", [buffer length], NSStringFromClass(c));
-
-            [backend updateData:buffer
-                       forClass:c
-                          rowID:1];
-            [buffer clearBuffer];
+        // Before the commit, so no saved record has a code the backend doesn't know
+        for (Class c in affectedClasses) {
+            [self saveStringDictionaryForClass:c usingBuffer:buffer];
         }
+        
+        successful = [self commitTransaction];
+    }
+    @catch (NSException *e) {
+        // Leave no transaction open and no index batch that never ends
+        [self abortTransaction];
+        [indexManager discardIndexBatch];
+        [self didChangeValueForKey:@"hasUnsavedChanges"];
+        @throw;
+    }
+    @finally {
+        [BNRDataBuffer returnBuffer:buffer];
     }
-	
-    [buffer release];
     
-    BOOL successful = [self commitTransaction];
     if (successful) {
+        [indexManager commitIndexBatch];
         [toBeInserted removeAllObjects];
         [toBeUpdated removeAllObjects];
         [toBeDeleted removeAllObjects];
     } else {
         NSLog(@"Error: save was not successful");
         [self abortTransaction];
+        [indexManager discardIndexBatch];
     }
     
     [self didChangeValueForKey:@"hasUnsavedChanges"];        
     return successful;
 }
 
+#pragma mark Bulk import
+
+- (void)beginBulkImport
+{
+    if (inBulkImport) {
+        return;
+    }
+    [backend beginBulkImport];
+    inBulkImport = YES;
+}
+
+- (BOOL)isInBulkImport
+{
+    return inBulkImport;
+}
+
+- (void)deferIndexingOfClass:(Class)c rowID:(UInt32)rowID
+{
+    NSString *className = NSStringFromClass(c);
+    NSMutableIndexSet *rowIDs = [deferredIndexRowIDs objectForKey:className];
+    if (!rowIDs) {
+        rowIDs = [[NSMutableIndexSet alloc] init];
+        [deferredIndexRowIDs setObject:rowIDs forKey:className];
+        [rowIDs release];
+    }
+    // Bulk-assigned rowIDs are consecutive, so this stays a handful of ranges
+    [rowIDs addIndex:rowID];
+}
+
+- (BOOL)isIndexingDeferredForClass:(Class)c rowID:(UInt32)rowID
+{
+    return [[deferredIndexRowIDs objectForKey:NSStringFromClass(c)] containsIndex:rowID];
+}
+
+// Returns YES if the row was waiting to be indexed (so is not in the index yet)
+- (BOOL)cancelDeferredIndexingOfClass:(Class)c rowID:(UInt32)rowID
+{
+    if (![self isIndexingDeferredForClass:c rowID:rowID]) {
+        return NO;
+    }
+    [[deferredIndexRowIDs objectForKey:NSStringFromClass(c)] removeIndex:rowID];
+    return YES;
+}
+
+// One pass per class over everything saved during the bulk import.
+// The objects are read straight from the backend and are not uniqued.
+- (void)indexDeferredRows
+{
+    [indexManager beginIndexBatch];
+    for (NSString *className in deferredIndexRowIDs) {
+        Class c = NSClassFromString(className);
+        NSIndexSet *rowIDs = [deferredIndexRowIDs objectForKey:className];
+        
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        BNRDataBuffer *d = [BNRDataBuffer borrowBufferWithCapacity:kBNRRecordBufferCapacity];
+        [self setFormatOfBuffer:d forClass:c];
+        NSUInteger indexedCount = 0;
+        NSUInteger rowID = [rowIDs firstIndex];
+        while (rowID != NSNotFound) {
+            if ([backend readDataForClass:c rowID:(UInt32)rowID intoBuffer:d]) {
+                [self decryptBuffer:d ofClass:c rowID:(UInt32)rowID];
+                BNRStoredObject *obj = [[c alloc] initWithStore:self
+                                                          rowID:(UInt32)rowID
+                                                         buffer:d];
+                [indexManager insertObjectInIndexes:obj];
+                // Keep its dealloc from touching a uniqued instance with the same rowID
+                [obj setStore:nil];
+                [obj release];
+            }
+            
+            if (++indexedCount % 1000 == 0) {
+                [pool drain];
+                pool = [[NSAutoreleasePool alloc] init];
+            }
+            rowID = [rowIDs indexGreaterThanIndex:rowID];
+        }
+        [BNRDataBuffer returnBuffer:d];
+        [pool drain];
+    }
+    [indexManager commitIndexBatch];
+    [deferredIndexRowIDs removeAllObjects];
+}
+
+- (BOOL)endBulkImport
+{
+    if (!inBulkImport) {
+        return YES;
+    }
+    
+    BOOL successful = YES;
+    if ([self hasUnsavedChanges]) {
+        successful = [self saveChanges:NULL];
+    }
+    
+    // Give back the unused part of each class's block of rowIDs
+    BNRDataBuffer *buffer = [BNRDataBuffer borrowBufferWithCapacity:256];
+    for (Class c in bulkImportedClasses) {
+        BNRClassMetaData *d = [classMetaData objectForClass:c];
+        [d releaseReservedPrimaryKeys];
+        [d writeContentToBuffer:buffer];
+        [backend updateData:buffer
+                   forClass:c
+                      rowID:kBNRMetadataRowID];
+        [buffer clearBuffer];
+    }
+    [BNRDataBuffer returnBuffer:buffer];
+    [bulkImportedClasses removeAllObjects];
+    
+    inBulkImport = NO;
+    if (![backend endBulkImport]) {
+        successful = NO;
+    }
+    
+    if (indexManager) {
+        [self indexDeferredRows];
+    }
+    return successful;
+}
+
+#pragma mark Text indexes
+
+- (BOOL)rebuildTextIndexesForClass:(Class)c threadCount:(NSUInteger)n
+{
+    if (!indexManager || [[c textIndexedAttributes] count] == 0) {
+        return YES;
+    }
+    BNRBackendCursor *const cursor = [backend cursorForClass:c];
+    if (!cursor) {
+        NSLog(@"No database for %@", NSStringFromClass(c));
+        return NO;
+    }
+    
+    // The raw scan from -enumerateRawRecordsForClass:usingBlock:, making a
+    // throwaway object of each record for the index manager to read
+    [indexManager beginRebuildOfIndexesForClass:c threadCount:n];
+    BNRArena *arena = [[BNRArena alloc] init];
+    BNRDataBuffer *record = [[BNRDataBuffer alloc] initWithCapacity:0];
+    [record setReadsWithoutCopying:YES];
+    [self setFormatOfBuffer:record forClass:c];
+    BOOL encrypted = ([encryptionKey length] > 0);
+    BNRDataBuffer *scratch = encrypted ? [BNRDataBuffer borrowBufferWithCapacity:kBNRRecordBufferCapacity] : nil;
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    
+    @try {
+        const void *bytes;
+        unsigned length;
+        UInt32 rowID;
+        NSUInteger rowCount = 0;
+        while ((rowID = [cursor nextBytes:&bytes length:&length arena:arena]) != 0)
+        {
+            if (kBNRMetadataRowID == rowID) continue;  // skip metadata
+            
+            if (encrypted) {
+                [scratch clearBuffer];
+                [scratch copyFrom:bytes length:length];
+                [self decryptBuffer:scratch ofClass:c rowID:rowID];
+                length = [scratch length];
+                bytes = [arena copyBytes:[scratch buffer] length:length];
+            }
+            [record setBytesNoCopy:bytes length:length owner:arena];
+            
+            BNRStoredObject *obj = [[c alloc] initWithStore:self
+                                                      rowID:rowID
+                                                     buffer:record];
+            [indexManager addObjectToRebuild:obj];
+            // Keep its dealloc from touching a uniqued instance with the same rowID
+            [obj setStore:nil];
+            [obj release];
+            
+            // The index manager has copied the text, so the bytes can go
+            if (++rowCount % 1000 == 0) {
+                [pool drain];
+                pool = [[NSAutoreleasePool alloc] init];
+                [arena reset];
+            }
+        }
+    }
+    @catch (NSException *e) {
+        [indexManager discardRebuild];
+        // Outlive the pool
+        [e retain];
+        [pool drain];
+        pool = nil;
+        @throw [e autorelease];
+    }
+    @finally {
+        [pool drain];
+        [BNRDataBuffer returnBuffer:scratch];
+        [record release];
+        [arena release];
+    }
+    return [indexManager commitRebuild];
+}
+
 #pragma mark Backend
 
 - (BNRStoreBackend *)backend
@@ -671,6 +1507,54 @@
 	[self registerAsFilePresenter];
 }
 
+#pragma mark String dictionaries
+
+// Salt words for dictionary chunks; records stir in (0, rowID)
+#define kBNRStringDictionarySaltWord (0x53444943)
+
+- (NSString *)nameOfStringDictionaryChunk:(NSUInteger)chunk forClass:(Class)c
+{
+    return [NSString stringWithFormat:@"BNRStringDictionary.%@.%lu",
+            NSStringFromClass(c), (unsigned long)chunk];
+}
+
+- (BNRStringDictionary *)stringDictionaryForClass:(Class)c
+{
+    BNRStringDictionary *sd = [stringDictionaries objectForClass:c];
+    if (!sd) {
+        sd = [[BNRStringDictionary alloc] init];
+        NSUInteger chunk = 0;
+        BNRDataBuffer *b;
+        while ((b = [backend dataBufferForName:[self nameOfStringDictionaryChunk:chunk forClass:c]])) {
+            [self decryptBuffer:b ofClass:c word0:kBNRStringDictionarySaltWord word1:(UInt32)chunk];
+            [sd readChunkFromBuffer:b];
+            chunk++;
+        }
+        [stringDictionaries setObject:sd forClass:c];
+        [sd release];
+    }
+    return sd;
+}
+
+- (void)saveStringDictionaryForClass:(Class)c usingBuffer:(BNRDataBuffer *)buffer
+{
+    BNRStringDictionary *sd = [stringDictionaries objectForClass:c];
+    NSRange chunks = [sd unsavedChunks];
+    if (!sd || chunks.length == 0) {
+        return;
+    }
+    for (NSUInteger chunk = chunks.location; chunk < NSMaxRange(chunks); chunk++) {
+        [buffer clearBuffer];
+        [self reserveEncryptionHeaderInBuffer:buffer forClass:c];
+        [sd writeChunk:chunk toBuffer:buffer];
+        [self encryptBuffer:buffer ofClass:c word0:kBNRStringDictionarySaltWord word1:(UInt32)chunk];
+        [backend updateDataBuffer:buffer
+                          forName:[self nameOfStringDictionaryChunk:chunk forClass:c]];
+    }
+    [buffer clearBuffer];
+    [sd markSaved];
+}
+
 #pragma mark Class meta data
 
 - (BNRClassMetaData *)metaDataForClass:(Class)c
@@ -700,6 +1584,7 @@
                 }
             }
             [md setClassID:classID];
+            [md setFormatFlags:usesCompactEncoding ? kBNRCompactRecordFormat : 0];
         }
         [classMetaData setObject:md forClass:c];
         [md release];
@@ -710,6 +1595,9 @@
 - (unsigned)nextRowIDForClass:(Class)c
 {
     BNRClassMetaData *md = [self metaDataForClass:c];
+    if (inBulkImport) {
+        return [md nextPrimaryKeyFromBlockOfSize:kBNRBulkImportRowIDBlockSize];
+    }
     return [md nextPrimaryKey];
 }
 - (unsigned char)versionForClass:(Class)c
@@ -41,6 +41,13 @@
 - (BOOL)abortTransaction;
 - (BOOL)hasOpenTransaction;
 
+#pragma mark Bulk import
+
+// Between these calls the backend may trade durability for speed: writes
+// need not reach the disk until endBulkImport, and transactions may be ignored.
+- (void)beginBulkImport;
+- (BOOL)endBulkImport;
+
 #pragma mark Writing changes
 
 - (void)insertData:(BNRDataBuffer *)attNames 
@@ -74,8 +81,27 @@
 - (BNRDataBuffer *)dataForClass:(Class)c 
                    rowID:(UInt32)n;
 
+// Like dataForClass:rowID:, but reads into |b| (replacing its contents and
+// resetting its cursor) so a caller can reuse one buffer for many records.
+// Returns NO if there is no such record.
+- (BOOL)readDataForClass:(Class)c
+                   rowID:(UInt32)n
+              intoBuffer:(BNRDataBuffer *)b;
+
+// The records of class |c| at the |n| rows in |rowIDs|, read as one batch: an
+// entry per row, in order, holding a full buffer or NSNull if the row has no
+// record.  The buffers may share read-only memory that lives as long as they do.
+- (NSArray *)dataForClass:(Class)c
+                   rowIDs:(const UInt32 *)rowIDs
+                    count:(NSUInteger)n;
+
 - (BNRBackendCursor *)cursorForClass:(Class)c;
 
+// Up to |n| cursors over disjoint parts of class |c| that together return every
+// record once.  Each can be run on a thread of its own.  The default is the
+// one cursor from cursorForClass:.
+- (NSArray *)cursorsForClass:(Class)c count:(NSUInteger)n;
+
 - (void)close;
 
 @end
@@ -22,6 +22,7 @@
 
 
 #import "BNRStoreBackend.h"
+#import "BNRDataBuffer.h"
 
 
 @implementation BNRStoreBackend
@@ -50,6 +51,18 @@
     return NO;
 }
 
+#pragma mark Bulk import
+
+- (void)beginBulkImport
+{
+    
+}
+
+- (BOOL)endBulkImport
+{
+    return YES;
+}
+
 
 #pragma mark Writing changes
 
@@ -111,11 +124,43 @@
     return nil;
 }
 
+- (BOOL)readDataForClass:(Class)c
+                   rowID:(UInt32)n
+              intoBuffer:(BNRDataBuffer *)b
+{
+    BNRDataBuffer *d = [self dataForClass:c rowID:n];
+    if (!d) {
+        return NO;
+    }
+    [b clearBuffer];
+    [b copyFrom:[d buffer] length:[d length]];
+    [b resetCursor];
+    return YES;
+}
+
+- (NSArray *)dataForClass:(Class)c
+                   rowIDs:(const UInt32 *)rowIDs
+                    count:(NSUInteger)n
+{
+    NSMutableArray *result = [NSMutableArray arrayWithCapacity:n];
+    for (NSUInteger i = 0; i < n; i++) {
+        BNRDataBuffer *d = [self dataForClass:c rowID:rowIDs[i]];
+        [result addObject:(d ? (id)d : [NSNull null])];
+    }
+    return result;
+}
+
 - (BNRBackendCursor *)cursorForClass:(Class)c
 {
     return nil;
 }
 
+- (NSArray *)cursorsForClass:(Class)c count:(NSUInteger)n
+{
+    BNRBackendCursor *cursor = [self cursorForClass:c];
+    return cursor ? [NSArray arrayWithObject:cursor] : [NSArray array];
+}
+
 - (void)close
 {
     
@@ -70,6 +70,27 @@
 // a property of a string type
 + (NSSet *)textIndexedAttributes;
 
+// Like textIndexedAttributes, for properties whose words should be offered
+// as type-ahead completions (see -[BNRStore completionsForClass:prefix:forKey:limit:])
++ (NSSet *)prefixIndexedAttributes;
+
+// How BNRTCTableIndexManager compares the values of an attribute
+typedef enum {
+    BNRTableAttributeString = 0,
+    BNRTableAttributeNumber		// NSNumber or NSDate properties
+} BNRTableAttributeType;
+
+// For BNRTCTableIndexManager: maps the name of each property to mirror into
+// the class's table to an NSNumber holding its BNRTableAttributeType
++ (NSDictionary *)tableIndexedAttributes;
+
+#pragma mark Storage hints
+
+// May return the number of instances the class expects to hold
+// (e.g. a million Songs).  BNRTCBackend sizes the class's file
+// from it.  Defaults to 0 (no hint).
++ (UInt32)expectedInstanceCount;
+
 #pragma mark Dealing with store
 
 // Every StoredObject knows the store that is holding it
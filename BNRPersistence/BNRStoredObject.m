@@ -22,11 +22,9 @@
 
 #import "BNRStoredObject.h"
 #import "BNRStore.h"
-#import "BNRStoreBackend.h"
 #import "BNRUniquingTable.h"
 #import "BNRResizableUniquingTable.h"
 #import "BNRDataBuffer.h"
-#import "BNRDataBuffer+Encryption.h"
 #import "BNRClassMetaData.h"
 
 @interface BNRStore (StoredObjectIsFriend)
@@ -37,6 +35,9 @@
 - (BNRUniquingTable *)uniquingTable;
 #endif
 
+// Implemented in BNRStore.m
+- (BOOL)readContentOfObject:(BNRStoredObject *)obj;
+
 @end
 
 
@@ -194,6 +195,21 @@
     return nil;
 }
 
++ (NSSet *)prefixIndexedAttributes
+{
+    return nil;
+}
+
++ (NSDictionary *)tableIndexedAttributes
+{
+    return nil;
+}
+
++ (UInt32)expectedInstanceCount
+{
+    return 0;
+}
+
 - (UInt32)rowID
 {
     return rowID;
@@ -218,20 +234,8 @@
 {
     if (0U == rowID) return;
 
-    BNRStore *s = [self store];
-    BNRStoreBackend *backend = [s backend];
-    BNRDataBuffer *d = [backend dataForClass:[self class]
-                                       rowID:[self rowID]];
-    if (!d) return;
-    
-    BNRClassMetaData *metaData = [s metaDataForClass:[self class]];
-    [d decryptWithKey:[s encryptionKey] salt:[metaData encryptionKeySalt]];
-
-    if ([s usesPerInstanceVersioning]) {
-        [d consumeVersion];
-    }
-    [self readContentFromBuffer:d];
-    [self setHasContent:YES];
+    // The store decrypts with the per-row salt and reads through a pooled buffer
+    [[self store] readContentOfObject:self];
 }
 
 - (void)checkForContent
@@ -263,7 +267,11 @@
 #else
     BNRUniquingTable *uniquingTable = [store uniquingTable];
 #endif
-    [uniquingTable removeObjectForClass:[self class] rowID:[self rowID]];
+    // Objects inserted during a bulk import aren't in the table, and mustn't
+    // take out the instance that is
+    if ([uniquingTable objectForClass:[self class] rowID:[self rowID]] == self) {
+        [uniquingTable removeObjectForClass:[self class] rowID:[self rowID]];
+    }
     [super dealloc];
 }
 
@@ -0,0 +1,84 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#import <Foundation/Foundation.h>
+@class BNRDataBuffer;
+
+/*!
+ @const kBNRStringDictionaryChunkSize
+ @abstract How many strings a BNRStringDictionary writes per chunk
+ */
+#define kBNRStringDictionaryChunkSize (1024)
+
+/*!
+ @class BNRStringDictionary
+ @abstract Gives the strings a class stores over and over a small integer code
+ @discussion Records written with -[BNRDataBuffer writeDictionaryString:] hold
+ just the code (a varint), and reading them back hands out the dictionary's own
+ string, so every record with the same artist shares one NSString.
+
+ Codes start at 1 (0 means nil) and are never reused or taken back: the dictionary
+ only grows.  The store saves it in chunks of kBNRStringDictionaryChunkSize strings,
+ as named buffers, rewriting only chunks with new strings.
+ */
+@interface BNRStringDictionary : NSObject {
+    NSMutableArray *strings;        // code - 1 -> NSString
+    NSMutableDictionary *codes;     // NSString -> NSNumber
+    NSUInteger savedCount;          // this many strings are in the backend
+}
+
+/*!
+ @method codeForString:
+ @abstract Returns the code for |s|, giving it one if it is new.  0 for nil.
+ */
+- (UInt32)codeForString:(NSString *)s;
+
+/*!
+ @method stringForCode:
+ @abstract Returns the shared string for |code|, or nil for 0 or an unknown code
+ */
+- (NSString *)stringForCode:(UInt32)code;
+
+- (NSUInteger)count;
+
+/*!
+ @method readChunkFromBuffer:
+ @abstract Appends the strings of the next chunk, as written by writeChunk:toBuffer:
+ */
+- (void)readChunkFromBuffer:(BNRDataBuffer *)d;
+
+/*!
+ @method unsavedChunks
+ @abstract The chunks that have strings the backend doesn't have yet
+ */
+- (NSRange)unsavedChunks;
+
+- (void)writeChunk:(NSUInteger)chunk toBuffer:(BNRDataBuffer *)d;
+
+/*!
+ @method markSaved
+ @abstract Call once all of unsavedChunks have been written
+ */
+- (void)markSaved;
+
+@end
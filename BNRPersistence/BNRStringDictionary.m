@@ -0,0 +1,125 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#import "BNRStringDictionary.h"
+#import "BNRDataBuffer.h"
+
+@implementation BNRStringDictionary
+
+- (id)init
+{
+    self = [super init];
+    if (self) {
+        strings = [[NSMutableArray alloc] init];
+        codes = [[NSMutableDictionary alloc] init];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [strings release];
+    [codes release];
+    [super dealloc];
+}
+
+- (void)addString:(NSString *)s
+{
+    [strings addObject:s];
+    [codes setObject:[NSNumber numberWithUnsignedInt:(UInt32)[strings count]]
+              forKey:s];
+}
+
+- (UInt32)codeForString:(NSString *)s
+{
+    if (!s) {
+        return 0;
+    }
+    NSNumber *code = [codes objectForKey:s];
+    if (code) {
+        return [code unsignedIntValue];
+    }
+    NSString *copy = [s copy];
+    [self addString:copy];
+    [copy release];
+    return (UInt32)[strings count];
+}
+
+- (NSString *)stringForCode:(UInt32)code
+{
+    if (code == 0 || code > [strings count]) {
+        if (code != 0) {
+            NSLog(@"No string for dictionary code %u", (unsigned)code);
+        }
+        return nil;
+    }
+    return [strings objectAtIndex:code - 1];
+}
+
+- (NSUInteger)count
+{
+    return [strings count];
+}
+
+#pragma mark Saving and loading
+
+// A chunk is its string count followed by the strings
+- (void)readChunkFromBuffer:(BNRDataBuffer *)d
+{
+    [d setUsesCompactLengths:YES];
+    UInt32 chunkCount = (UInt32)[d readVarUInt];
+    for (UInt32 i = 0; i < chunkCount; i++) {
+        NSString *s = [d readString];
+        [self addString:(s ? s : @"")];
+    }
+    savedCount = [strings count];
+}
+
+- (NSRange)unsavedChunks
+{
+    NSUInteger count = [strings count];
+    if (savedCount == count) {
+        return NSMakeRange(savedCount / kBNRStringDictionaryChunkSize, 0);
+    }
+    NSUInteger first = savedCount / kBNRStringDictionaryChunkSize;
+    NSUInteger last = (count - 1) / kBNRStringDictionaryChunkSize;
+    return NSMakeRange(first, last - first + 1);
+}
+
+- (void)writeChunk:(NSUInteger)chunk toBuffer:(BNRDataBuffer *)d
+{
+    NSUInteger start = chunk * kBNRStringDictionaryChunkSize;
+    NSUInteger end = MIN(start + kBNRStringDictionaryChunkSize, [strings count]);
+    [d setUsesCompactLengths:YES];
+    [d writeVarUInt:end - start];
+    for (NSUInteger i = start; i < end; i++) {
+        [d writeString:[strings objectAtIndex:i]];
+    }
+}
+
+- (void)markSaved
+{
+    savedCount = [strings count];
+}
+
+@end
@@ -62,6 +62,14 @@ typedef pair<Class, TCHDB *> TCFileHashedPair;
 	// TC Transaction support
 	BOOL usesTransactions;
 	NSMutableSet *openTransactions;
+
+	// Per-class file tuning (see -tuneFile:forClass:atPath:)
+	BOOL usesAutomaticTuning;
+	NSMutableSet *classesNeedingOptimization;
+
+	// Bulk import (see -beginBulkImport)
+	BOOL inBulkImport;
+	NSMutableSet *bulkImportedClasses;
 }
 - (id)initWithPath:(NSString *)p useTransactions:(BOOL)useTransactionsFlag useWriteSyncronization:(BOOL)useWriteSyncronizationFlag error:(NSError **)err; // designated intializer
 - (id)initWithPath:(NSString *)p error:(NSError **)err;
@@ -69,6 +77,33 @@ typedef pair<Class, TCHDB *> TCFileHashedPair;
 - (TCHDB *)fileForClass:(Class)c;
 - (NSString *)path;
 
+/*!
+ @method optimizeFilesIfNeeded
+ @abstract Rebuckets any open class file whose load factor (records per bucket)
+ has passed kBNRTCMaxLoadFactor.
+ @discussion Called automatically after each committed save when usesAutomaticTuning
+ is YES. Does nothing while a transaction or bulk import is open.
+ */
+- (void)optimizeFilesIfNeeded;
+
+/*!
+ @method beginBulkImport
+ @abstract Puts the backend into a mode meant for initial loads.
+ @discussion Class files are reopened without HDBOTSYNC, records are written with
+ tchdbputasync (buffered in Tokyo Cabinet's delayed record pool) and transactions
+ are skipped.  Nothing written is guaranteed to be on disk until endBulkImport.
+ */
+- (void)beginBulkImport;
+
+/*!
+ @method endBulkImport
+ @abstract Flushes everything written since beginBulkImport.
+ @discussion Each class file that was written to is rebucketed if it has outgrown its
+ buckets and then synced once.  Files are reopened with the normal options on next use.
+ */
+- (BOOL)endBulkImport;
+
 @property (readonly)	BOOL usesWriteSync;
 @property (assign)		BOOL usesTransactions;
+@property (assign)		BOOL usesAutomaticTuning;	// Default = YES; must be set before class files are opened to affect tuning at open time
 @end
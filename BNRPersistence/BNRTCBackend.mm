@@ -23,6 +23,16 @@
 #import "BNRTCBackend.h"
 #import "BNRDataBuffer.h"
 #import "BNRTCBackendCursor.h"
+#import "BNRStoredObject.h"
+
+// Tokyo Cabinet's own defaults are 131,071 buckets, 16-byte alignment and 64MB of mapped memory,
+// regardless of how many records a file holds. These bound the automatic tuning done in fileForClass:.
+#define kBNRTCMaxLoadFactor (2.0)               // rebucket when records per bucket passes this
+#define kBNRTCTargetLoadFactor (0.5)            // ...to get this many records per bucket
+#define kBNRTCMinBucketCount (131071LL)
+#define kBNRTCMinMappedSize (64LL << 20)
+#define kBNRTCMaxMappedSize ((sizeof(void *) > 4) ? (4LL << 30) : (256LL << 20))
+#define kBNRTCMaxCachedRecords (65536)
 
 const char *BNRToCString(NSString *str, int *lenPtr)
 {
@@ -35,7 +45,7 @@ const char *BNRToCString(NSString *str, int *lenPtr)
 
 @implementation BNRTCBackend
 
-@synthesize usesTransactions, usesWriteSync;
+@synthesize usesTransactions, usesWriteSync, usesAutomaticTuning;
 
 // designated initializer
 - (id)initWithPath:(NSString *)p useTransactions:(BOOL)useTransactionsFlag useWriteSyncronization:(BOOL)useWriteSyncronizationFlag error:(NSError **)err;
@@ -78,6 +88,10 @@ const char *BNRToCString(NSString *str, int *lenPtr)
         openTransactions = [[NSMutableSet alloc] init];
         usesTransactions = useTransactionsFlag;
         usesWriteSync = useWriteSyncronizationFlag;
+
+        usesAutomaticTuning = YES;
+        classesNeedingOptimization = [[NSMutableSet alloc] init];
+        bulkImportedClasses = [[NSMutableSet alloc] init];
 	}
     return self;
 }
@@ -90,6 +104,8 @@ const char *BNRToCString(NSString *str, int *lenPtr)
 - (void)dealloc
 {
 	[openTransactions release];
+	[classesNeedingOptimization release];
+	[bulkImportedClasses release];
     [self close];
     [path release];
     delete dbTable;
@@ -100,7 +116,8 @@ const char *BNRToCString(NSString *str, int *lenPtr)
 
 - (BOOL)beginTransactionForClasses:(NSSet *)classesForTransaction
 {
-	if (usesTransactions) {		
+	// tchdbtranbegin would flush the delayed record pool on every save
+	if (usesTransactions && !inBulkImport) {		
 		
 		for (Class c in classesForTransaction) {
 			
@@ -145,11 +162,16 @@ const char *BNRToCString(NSString *str, int *lenPtr)
 
 		if ([openTransactions count]) {
 			NSLog(@"Will roll back transactions which failed to commit:%@", [openTransactions description]);
+		} else if (usesAutomaticTuning) {
+			[self optimizeFilesIfNeeded];
 		}
 		
 		return cumulativeResult;
 	}
 	
+	if (usesAutomaticTuning) {
+		[self optimizeFilesIfNeeded];
+	}
     return YES;
 }
 
@@ -195,6 +217,168 @@ const char *BNRToCString(NSString *str, int *lenPtr)
     return NO;
 }
 
+#pragma mark Tuning
+
+static UInt32 BNRExpectedInstanceCount(Class c)
+{
+    if ([c respondsToSelector:@selector(expectedInstanceCount)]) {
+        return [c expectedInstanceCount];
+    }
+    return 0;
+}
+
+static int64_t BNRBucketCountForRecords(uint64_t recordCount)
+{
+    int64_t bnum = (int64_t)(recordCount / kBNRTCTargetLoadFactor);
+    return (bnum < kBNRTCMinBucketCount) ? kBNRTCMinBucketCount : bnum;
+}
+
+// Records are padded out to 2^apow bytes; aim for a quarter of the average record
+// so padding wastes little space but in-place updates still usually fit.
+static int8_t BNRAlignmentPowerForRecordSize(uint64_t averageSize)
+{
+    int8_t apow = 0;
+    while (apow < 10 && (4ULL << (apow + 1)) <= averageSize) {
+        apow++;
+    }
+    return (apow < 4) ? 4 : apow;
+}
+
+static int64_t BNRMappedSizeForFileSize(uint64_t fileSize)
+{
+    // Leave room for the file to grow by a quarter before records fall outside the map.
+    int64_t xmsiz = (int64_t)(fileSize + fileSize / 4);
+    if (xmsiz < kBNRTCMinMappedSize) {
+        xmsiz = kBNRTCMinMappedSize;
+    }
+    if (xmsiz > kBNRTCMaxMappedSize) {
+        xmsiz = kBNRTCMaxMappedSize;
+    }
+    return xmsiz;
+}
+
+// Called before the file is opened: bucket count and alignment only take effect when the
+// file is created (existing files are rebucketed by optimizeFilesIfNeeded), but the
+// mapped size and record cache apply to every open.
+- (void)tuneFile:(TCHDB *)dbFile forClass:(Class)c atPath:(NSString *)classPath
+{
+    UInt32 expectedCount = BNRExpectedInstanceCount(c);
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:classPath
+                                                                                error:NULL];
+    if (!attributes) {
+        if (expectedCount > 0) {
+            (void)tchdbtune(dbFile, BNRBucketCountForRecords(expectedCount), -1, -1, 0);
+        }
+    } else {
+        (void)tchdbsetxmsiz(dbFile, BNRMappedSizeForFileSize([attributes fileSize]));
+    }
+    
+    if (expectedCount > 0) {
+        int32_t rcnum = expectedCount / 8;
+        if (rcnum > kBNRTCMaxCachedRecords) {
+            rcnum = kBNRTCMaxCachedRecords;
+        }
+        (void)tchdbsetcache(dbFile, rcnum);
+    }
+}
+
+- (BOOL)fileNeedsOptimization:(TCHDB *)dbFile forClass:(Class)c
+{
+    uint64_t bnum = tchdbbnum(dbFile);
+    uint64_t rnum = tchdbrnum(dbFile);
+    return (bnum > 0 && rnum > bnum * kBNRTCMaxLoadFactor);
+}
+
+- (void)optimizeFilesIfNeeded
+{
+    // A bulk import optimizes once, in endBulkImport
+    if ([self hasOpenTransaction] || inBulkImport) {
+        return;
+    }
+    
+    hash_map<Class, TCHDB *, hash<Class>, equal_to<Class> >::iterator iter = dbTable->begin();
+    while (iter != dbTable->end()) {
+        TCFileHashedPair currentPair = *iter;
+        if ([self fileNeedsOptimization:currentPair.second forClass:currentPair.first]) {
+            [classesNeedingOptimization addObject:currentPair.first];
+        }
+        iter++;
+    }
+    
+    for (Class c in classesNeedingOptimization) {
+        TCHDB *db = (*dbTable)[c];
+        if (db) {
+            [self optimizeFile:db forClass:c];
+        }
+    }
+    [classesNeedingOptimization removeAllObjects];
+}
+
+- (BOOL)optimizeFile:(TCHDB *)db forClass:(Class)c
+{
+    uint64_t rnum = tchdbrnum(db);
+    uint64_t expectedCount = BNRExpectedInstanceCount(c);
+    if (expectedCount < rnum) {
+        expectedCount = rnum;
+    }
+    uint64_t averageSize = (rnum > 0) ? (tchdbfsiz(db) / rnum) : 0;
+    
+    if (!tchdboptimize(db, BNRBucketCountForRecords(expectedCount),
+                       BNRAlignmentPowerForRecordSize(averageSize), -1, UINT8_MAX)) {
+        int ecode = tchdbecode(db);
+        NSLog(@"tchdboptimize() failed for Class:%@, error:%s", NSStringFromClass(c), tchdberrmsg(ecode));
+        return NO;
+    }
+    return YES;
+}
+
+#pragma mark Bulk import
+
+- (void)beginBulkImport
+{
+    if (inBulkImport) {
+        return;
+    }
+    if (usesWriteSync) {
+        // Reopen without HDBOTSYNC
+        [self closeClassFiles];
+    }
+    inBulkImport = YES;
+}
+
+- (BOOL)endBulkImport
+{
+    if (!inBulkImport) {
+        return YES;
+    }
+    inBulkImport = NO;
+    
+    BOOL successful = YES;
+    for (Class c in bulkImportedClasses) {
+        TCHDB *db = (*dbTable)[c];
+        if (!db) {
+            continue;
+        }
+        // tchdboptimize and tchdbsync both flush the delayed record pool first
+        if ([self fileNeedsOptimization:db forClass:c]) {
+            [self optimizeFile:db forClass:c];
+            [classesNeedingOptimization removeObject:c];
+        }
+        if (!tchdbsync(db)) {
+            int ecode = tchdbecode(db);
+            NSLog(@"tchdbsync() failed for Class:%@, error:%s", NSStringFromClass(c), tchdberrmsg(ecode));
+            successful = NO;
+        }
+    }
+    [bulkImportedClasses removeAllObjects];
+    
+    if (usesWriteSync) {
+        // Reopen with HDBOTSYNC
+        [self closeClassFiles];
+    }
+    return successful;
+}
+
 #pragma mark Reading and writing
 
 - (void)setFile:(TCHDB *)f forClass:(Class)c
@@ -210,7 +394,7 @@ const char *BNRToCString(NSString *str, int *lenPtr)
         
         int mode = HDBOREADER | HDBOWRITER | HDBONOLCK| HDBOCREAT;	// FIXME: need to watch out for read-only media
         
-		if (usesWriteSync) {
+		if (usesWriteSync && !inBulkImport) {
 			// BMonk 5/22/11 HDBOTSYNC ensures TC will immediately sync all inserts and updates to the storage device's physical media,
 			// writing through any caching in the OS or on the device itself. This is much slower, but safer in case fo crash or power outage.
 			// The performance hit is not noticable for typical-case small writes, but the slowdown is extreme for bulk operations
@@ -228,6 +412,10 @@ const char *BNRToCString(NSString *str, int *lenPtr)
 		
         dbFile = tchdbnew();
         
+        if (usesAutomaticTuning) {
+            [self tuneFile:dbFile forClass:c atPath:classPath];
+        }
+        
         if (!tchdbopen(dbFile, [classPath cStringUsingEncoding:NSUTF8StringEncoding], mode)) {
         
 			// FIXME: I think we'll need to do this before throwing
@@ -242,6 +430,10 @@ const char *BNRToCString(NSString *str, int *lenPtr)
             return NULL;
         }
         [self setFile:dbFile forClass:c];
+        
+        if (usesAutomaticTuning && [self fileNeedsOptimization:dbFile forClass:c]) {
+            [classesNeedingOptimization addObject:c];
+        }
     }
     return dbFile;
 }
@@ -292,13 +484,22 @@ const char *BNRToCString(NSString *str, int *lenPtr)
     
 }
 
+- (bool)putData:(BNRDataBuffer *)d inFile:(TCHDB *)db forClass:(Class)c key:(UInt32)key
+{
+    if (inBulkImport) {
+        [bulkImportedClasses addObject:c];
+        return tchdbputasync(db, &key, sizeof(UInt32), [d buffer], [d length]);
+    }
+    return tchdbput(db, &key, sizeof(UInt32), [d buffer], [d length]);
+}
+
 - (void)insertData:(BNRDataBuffer *)d 
           forClass:(Class)c
              rowID:(UInt32)n
 {    
     TCHDB *db = [self fileForClass:c];
     UInt32 key = CFSwapInt32HostToLittle(n);
-    bool successful = tchdbput(db, &key, sizeof(UInt32), [d buffer], [d length]);
+    bool successful = [self putData:d inFile:db forClass:c key:key];
     if (!successful) {
 		
 		// FIXME: I think we'll need to do this before throwing
@@ -333,7 +534,7 @@ const char *BNRToCString(NSString *str, int *lenPtr)
     TCHDB *db = [self fileForClass:c];
     UInt32 key = CFSwapInt32HostToLittle(n);    
     
-    bool successful = tchdbput(db, &key, sizeof(UInt32), [d buffer], [d length]);
+    bool successful = [self putData:d inFile:db forClass:c key:key];
     if (!successful) {
 		
 		// FIXME: I think we'll need to do this before throwing
@@ -369,6 +570,91 @@ const char *BNRToCString(NSString *str, int *lenPtr)
     return b;
 }
 
+- (BOOL)readDataForClass:(Class)c
+                   rowID:(UInt32)n
+              intoBuffer:(BNRDataBuffer *)b
+{
+    TCHDB * db = [self fileForClass:c];
+    UInt32 key = CFSwapInt32HostToLittle(n);
+    
+    [b ensureCapacity:1];
+    int bufferSize = tchdbget3(db, &key, sizeof(UInt32), [b buffer], [b capacity]);
+    if (bufferSize < 0) {
+        return NO;
+    }
+    
+    // tchdbget3 truncates to the space it was given
+    if ((unsigned)bufferSize == [b capacity]) {
+        int recordSize = tchdbvsiz(db, &key, sizeof(UInt32));
+        if (recordSize > bufferSize) {
+            [b ensureCapacity:recordSize];
+            bufferSize = tchdbget3(db, &key, sizeof(UInt32), [b buffer], [b capacity]);
+            if (bufferSize < 0) {
+                return NO;
+            }
+        }
+    }
+    [b setLength:bufferSize];
+    [b resetCursor];
+    return YES;
+}
+
+// One tchdbgetmany: the records share its allocation, which the NSData frees
+// once the last buffer lets go of it
+- (NSArray *)dataForClass:(Class)c
+                   rowIDs:(const UInt32 *)rowIDs
+                    count:(NSUInteger)n
+{
+    TCHDB *db = [self fileForClass:c];
+    UInt32 *keys = (UInt32 *)malloc(n * sizeof(UInt32) + 1);
+    const void **keyPtrs = (const void **)malloc(n * sizeof(void *) + 1);
+    int *keySizes = (int *)malloc(n * sizeof(int) + 1);
+    const void **values = (const void **)malloc(n * sizeof(void *) + 1);
+    int *valueSizes = (int *)malloc(n * sizeof(int) + 1);
+    for (NSUInteger i = 0; i < n; i++) {
+        keys[i] = CFSwapInt32HostToLittle(rowIDs[i]);
+        keyPtrs[i] = &keys[i];
+        keySizes[i] = sizeof(UInt32);
+    }
+    
+    void *arena = tchdbgetmany(db, keyPtrs, keySizes, (int)n, values, valueSizes);
+    NSMutableArray *result = nil;
+    if (arena) {
+        // Every value is followed by a zero byte, so the extent is never empty
+        NSUInteger extent = 1;
+        for (NSUInteger i = 0; i < n; i++) {
+            if (values[i]) {
+                extent = MAX(extent, (const char *)values[i] - (const char *)arena + valueSizes[i] + 1);
+            }
+        }
+        NSData *owner = [[NSData alloc] initWithBytesNoCopy:arena
+                                                     length:extent
+                                               freeWhenDone:YES];
+        result = [NSMutableArray arrayWithCapacity:n];
+        for (NSUInteger i = 0; i < n; i++) {
+            if (!values[i]) {
+                [result addObject:[NSNull null]];
+                continue;
+            }
+            BNRDataBuffer *b = [[BNRDataBuffer alloc] initWithBytesNoCopy:(void *)values[i]
+                                                                   length:valueSizes[i]
+                                                                    owner:owner];
+            [result addObject:b];
+            [b release];
+        }
+        [owner release];
+    } else {
+        NSLog(@"tchdbgetmany in dataForClass:rowIDs:count:: %s", tchdberrmsg(tchdbecode(db)));
+    }
+    
+    free(valueSizes);
+    free(values);
+    free(keySizes);
+    free(keyPtrs);
+    free(keys);
+    return result;
+}
+
 - (BNRBackendCursor *)cursorForClass:(Class)c
 {
     TCHDB *db = [self fileForClass:c];
@@ -380,7 +666,32 @@ const char *BNRToCString(NSString *str, int *lenPtr)
     return cu;
 }
 
-- (void)close
+// The parts come from tchdbsplitscan, which starts them at records heading a
+// bucket so that they are about the same size
+- (NSArray *)cursorsForClass:(Class)c count:(NSUInteger)n
+{
+    TCHDB *db = [self fileForClass:c];
+    if (!db) {
+        return [NSArray array];
+    }
+    int scanCount = 0;
+    HDBSCAN **scans = tchdbsplitscan(db, (int)MAX(n, (NSUInteger)1), &scanCount);
+    if (!scans) {
+        int ecode = tchdbecode(db);
+        NSLog(@"tchdbsplitscan in cursorsForClass:count:: %s", tchdberrmsg(ecode));
+        return [NSArray array];
+    }
+    NSMutableArray *cursors = [NSMutableArray arrayWithCapacity:scanCount];
+    for (int i = 0; i < scanCount; i++) {
+        BNRTCBackendCursor *cu = [[BNRTCBackendCursor alloc] initWithFile:db scan:scans[i]];
+        [cursors addObject:cu];
+        [cu release];
+    }
+    free(scans);
+    return cursors;
+}
+
+- (void)closeClassFiles
 {
     hash_map<Class, TCHDB *, hash<Class>, equal_to<Class> >::iterator iter = dbTable->begin();
     while (iter != dbTable->end()) {
@@ -391,6 +702,11 @@ const char *BNRToCString(NSString *str, int *lenPtr)
         iter++;
     }
     dbTable->clear();
+}
+
+- (void)close
+{
+    [self closeClassFiles];
     
     if (namedBufferDB) {
         tchdbclose(namedBufferDB); // namedBufferDB may not be open if tchdbopen() failed in -namedBufferDB
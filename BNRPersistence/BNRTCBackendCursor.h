@@ -24,8 +24,13 @@
 #include <tcutil.h>
 #include <tchdb.h>
 
+// Walks the records in file order with a tchdbscannew scan, which reads ahead
+// a large block at a time and hands back key and value without copying them
 @interface BNRTCBackendCursor : BNRBackendCursor {
     TCHDB *file;
+    HDBSCAN *scan;
 }
 - (id)initWithFile:(TCHDB *)f;
+// Takes over |s| (from tchdbsplitscan) and deletes it when done
+- (id)initWithFile:(TCHDB *)f scan:(HDBSCAN *)s; // designated initializer
 @end
@@ -22,48 +22,86 @@
 
 #import "BNRTCBackendCursor.h"
 #import "BNRDataBuffer.h"
+#import "BNRArena.h"
 
 @implementation BNRTCBackendCursor
 
-- (id)initWithFile:(TCHDB *)f
+- (id)initWithFile:(TCHDB *)f scan:(HDBSCAN *)s
 {
     self = [super init];
     if (self) {
 		file = f;
-		bool successful = tchdbiterinit(file);
-		if (!successful) {
-			int ecode = tchdbecode(file);
-			NSLog(@"Bad tchdbiterinit in initWithFile: %s", tchdberrmsg(ecode));
-		}
+		scan = s;
     }
     
     return self;
 }
 
-- (UInt32)nextBuffer:(BNRDataBuffer *)buff
+- (id)initWithFile:(TCHDB *)f
 {
-    UInt32 result;
-    UInt32 *buffer;
-    int size;
-    buffer = (UInt32 *)tchdbiternext(file, &size);
+    HDBSCAN *s = tchdbscannew(f);
+    if (!s) {
+        int ecode = tchdbecode(f);
+        NSLog(@"Bad tchdbscannew in initWithFile: %s", tchdberrmsg(ecode));
+    }
+    return [self initWithFile:f scan:s];
+}
 
-    if (!buffer) {
+- (void)dealloc
+{
+    if (scan) {
+        tchdbscandel(scan);
+    }
+    [super dealloc];
+}
+
+- (UInt32)nextKey:(const void **)bytesPtr length:(int *)lengthPtr mapped:(bool *)mappedPtr
+{
+    const void *keyBytes;
+    int keySize;
+    if (!scan || !tchdbscannext(scan, &keyBytes, &keySize, bytesPtr, lengthPtr, mappedPtr)) {
         return 0;
     }
-    
-    result = CFSwapInt32LittleToHost(*buffer);
+    UInt32 key;
+    memcpy(&key, keyBytes, sizeof(UInt32));
+    return CFSwapInt32LittleToHost(key);
+}
 
-    // Avoid fetching data if possible.
-    if (nil != buff) {
-        int bufferSize;
-        void *data = tchdbget(file, buffer, sizeof(UInt32), &bufferSize);
-        
-        [buff setData:data
-               length:bufferSize];
+- (UInt32)nextBuffer:(BNRDataBuffer *)buff
+{
+    const void *bytes;
+    int size;
+    UInt32 result = [self nextKey:&bytes length:&size mapped:NULL];
+    if (result == 0 || nil == buff) {
+        return result;
     }
     
-    free(buffer);
+    [buff clearBuffer];
+    [buff copyFrom:bytes length:size];
+    [buff resetCursor];
+    
+    return result;
+}
+
+- (UInt32)nextBytes:(const void **)bytesPtr
+             length:(unsigned *)lengthPtr
+              arena:(BNRArena *)arena
+{
+    const void *bytes;
+    int size;
+    bool mapped;
+    UInt32 result = [self nextKey:&bytes length:&size mapped:&mapped];
+    if (result == 0) {
+        return 0;
+    }
     
+    // Records beyond the mapped region are in the scan's readahead buffer,
+    // which later calls will overwrite
+    if (!mapped) {
+        bytes = [arena copyBytes:bytes length:size];
+    }
+    *bytesPtr = bytes;
+    *lengthPtr = size;
     return result;
 }
 
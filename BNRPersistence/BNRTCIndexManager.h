@@ -22,16 +22,57 @@
 #import <Foundation/Foundation.h>
 #import "BNRIndexManager.h"
 #include <dystopia.h>
+@class BNRIndexQueue;
+@class BNRIndexRebuild;
+@class BNRSearchCache;
 
 @interface BNRTCIndexManager : BNRIndexManager {
     NSString *path;
     NSMutableDictionary *textIndexes;
+    NSMutableDictionary *pendingChanges;	// BNRClassKey -> (rowID -> text to index, or NSNull to remove)
+    NSMutableDictionary *prefixIndexes;		// BNRClassKey -> BNRPrefixIndex, loaded when first needed
+    NSMutableDictionary *pendingPrefixChanges;	// like pendingChanges, for prefixIndexedAttributes
+    NSUInteger batchDepth;
+    BNRIndexQueue *indexQueue;			// saved changes waiting to be applied; nil until needed
+    NSCondition *indexLock;				// guards the TCIDBs and indexQueue against the background thread
+    BOOL usesBackgroundIndexing;
+    BOOL backgroundThreadRunning;
+    BOOL backgroundThreadShouldStop;
+    BOOL backgroundThreadApplying;		// the thread is writing to the indexes without indexLock
+    UInt64 queueAppliedSequence;		// queued changes through this one are in the indexes, maybe not yet synced
+    BNRIndexRebuild *rebuild;			// between -beginRebuildOfIndexesForClass:threadCount: and its commit
+    NSMutableDictionary *rebuildChanges;	// like pendingChanges: what was saved to the class being rebuilt meanwhile
+    BNRSearchCache *searchCache;		// nil unless searchCacheByteLimit > 0
+    NSUInteger searchCacheByteLimit;
 	BOOL usesIndexFileWriteSync;		// will cause every write to sync to the physical storage media; slower, but much less fragile in cases of crash or power outage
 	BOOL usesIndexFileCompression;		// will compress offline TC index files; index files can go from a default of ~8.5MB to as little as 12KB!
 }
 @property (readonly) BOOL usesIndexFileWriteSync;
 @property (readonly) BOOL usesIndexFileCompression;
 
+// With background indexing, committing a save only appends its index changes to a
+// queue file in the index directory, and a background thread applies them to the
+// indexes.  The queue survives crashes: whatever is left in it is applied the next
+// time an index manager is opened on the directory.  Changes leave the queue once
+// the indexes they went into have been synced.  The thread doesn't retain the index
+// manager: -close, or the last release, stops it.  Default = NO; turning it off
+// applies everything still queued.
+@property (nonatomic, assign) BOOL usesBackgroundIndexing;
+
+- (NSUInteger)countOfQueuedChanges;
+- (void)waitUntilIndexesAreCurrent;
+
+// With a limit above 0, the rowIDs found by recent searches are kept and handed
+// back when the same search (same class, key and expression, give or take case
+// and spacing) comes again.  The least recently used go first once the lists
+// take more than the limit.  Changing an index drops only the results cached
+// for it.  Default = 0 (off).
+@property (nonatomic, assign) NSUInteger searchCacheByteLimit;
+
+- (NSUInteger)searchCacheHitCount;
+- (NSUInteger)searchCacheMissCount;
+- (double)searchCacheHitRate;
+
 - (id)initWithPath:(NSString *)p useWriteSyncronization:(BOOL)useWriteSyncFlag compressIndexFiles:(BOOL)compressIndexFilesFlag error:(NSError **)err; // designated initializer
 - (id)initWithPath:(NSString *)p error:(NSError **)err;
 
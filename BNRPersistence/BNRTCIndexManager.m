@@ -21,17 +21,43 @@
 // THE SOFTWARE.
 #import "BNRTCIndexManager.h"
 #import "BNRStoredObject.h"
+#import "BNRDataBuffer.h"
+#include <math.h>
+#include <errno.h>
+#include <limits.h>
+
+// Changes the background thread reads from the queue at a time
+#define kBNRIndexQueueBatchSize (256)
+
+// Applied changes after which the background thread syncs the indexes and
+// trims the queue even though more are waiting
+#define kBNRIndexQueueSyncInterval (16 * kBNRIndexQueueBatchSize)
+
+// Rows a rebuild hands a tokenizing thread at a time
+#define kBNRRebuildBatchSize (1024)
+
+// Token cache a rebuild shares out among the shards of each new index
+#define kBNRRebuildCacheSize (256LL * 1024 * 1024)
+
+// What a search cache entry costs besides its rows and key, roughly
+#define kBNRSearchCacheEntryOverhead (96)
+
+// Completions kept in memory for each one- or two-character prefix
+#define kBNRShortPrefixCompletionCount (32)
 
 // MARK: -
 // MARK: Private Classes
 // MARK: -
 // =============================//
 
-@interface BNRTextIndex : NSObject {
+@interface BNRTextIndex : NSObject <NSLocking> {
 	NSString	*indexDirectoryPath;				// path of the form /.../<BNRStoreName>.bnrtc/<BNRStoredObjectName>-<propertyName>.tindex 
     TCIDB		*TCIDBFile;
+	NSLock		*fileLock;							// held while TCIDBFile is read or written; see -lock
 	BOOL		usesIndexFileWriteSync;
 	BOOL		usesIndexFileCompression;
+	double		averageTextLength;					// estimated from a sample; see -averageTextLength
+	uint64_t	sampledRecordCount;
 }
 @property (nonatomic, readonly)	NSString	*indexDirectoryPath;
 @property (nonatomic, readonly) TCIDB		*TCIDBFile;
@@ -59,6 +85,15 @@
 
 - (TCIDB *)loadTCIndexFile:(NSError **)errorPtr;
 
+// Mean length in characters of the indexed texts, for ranking
+- (double)averageTextLength;
+
+// The background indexing thread writes to TCIDBFile without holding the
+// index manager's indexLock, so everything else that uses TCIDBFile takes
+// this lock too (after indexLock, never before it).
+- (void)lock;
+- (void)unlock;
+
 @end;
 
 @implementation BNRTextIndex
@@ -78,6 +113,7 @@
 	if (self) {
 		usesIndexFileWriteSync = writeSyncFlag;
 		usesIndexFileCompression = indexCompressionFlag;
+		fileLock = [[NSLock alloc] init];
 		
 		NSString *indexName = [BNRTextIndex standardIndexFilenameForClass:c key:k];
 		indexDirectoryPath = [[storePath stringByAppendingPathComponent:indexName] retain];
@@ -196,6 +232,14 @@
 		(void)tcidbtune(newDB, 0, 0, 0, IDBTBZIP);
 	}
 	
+	// A rebuild that stopped between moving the old index aside and moving the
+	// new one in leaves only the old one
+	NSFileManager *fm = [NSFileManager defaultManager];
+	NSString *oldPath = [indexDirectoryPath stringByAppendingPathExtension:@"old"];
+	if (![fm fileExistsAtPath:indexDirectoryPath] && [fm fileExistsAtPath:oldPath]) {
+		(void)rename([oldPath fileSystemRepresentation], [indexDirectoryPath fileSystemRepresentation]);
+	}
+	
 	if (!tcidbopen(newDB, [indexDirectoryPath cStringUsingEncoding:NSUTF8StringEncoding], mode)) {
 		int ecode = tcidbecode(newDB);
 		NSLog(@"Error opening TC index file %@: %s\n", indexDirectoryPath, tcidberrmsg(ecode));
@@ -217,6 +261,38 @@
 	return newDB;
 }
 
+// Reading every text would cost as much as the search, so this looks at the
+// first few hundred records and looks again once the index has doubled.
+- (double)averageTextLength
+{
+	uint64_t recordCount = tcidbrnum(TCIDBFile);
+	if (sampledRecordCount > 0 && recordCount <= sampledRecordCount * 2) {
+		return averageTextLength;
+	}
+	
+	double totalLength = 0.0;
+	int sampleCount = 0;
+	if (tcidbiterinit(TCIDBFile)) {
+		uint64_t rowID;
+		while (sampleCount < 512 && (rowID = tcidbiternext(TCIDBFile)) > 0) {
+			char *text = tcidbget(TCIDBFile, rowID);
+			if (text) {
+				NSString *s = [[NSString alloc] initWithUTF8String:text];
+				totalLength += [s length];
+				[s release];
+				free(text);
+				sampleCount++;
+			}
+		}
+	}
+	averageTextLength = (sampleCount > 0) ? totalLength / sampleCount : 1.0;
+	if (averageTextLength < 1.0) {
+		averageTextLength = 1.0;
+	}
+	sampledRecordCount = recordCount;
+	return averageTextLength;
+}
+
 #if kImplementCacheUnloading
 - (void)unloadIndexFile
 {
@@ -253,10 +329,21 @@
 								// be slow to init? TODO: Benchmark this.
     
 	[indexDirectoryPath release];
+	[fileLock release];
 	
     [super dealloc];
 }
 
+- (void)lock
+{
+	[fileLock lock];
+}
+
+- (void)unlock
+{
+	[fileLock unlock];
+}
+
 @end
 
 // MARK: -
@@ -290,7 +377,7 @@
 - (BOOL)isEqual:(id)object
 {
     BNRClassKey *other = (BNRClassKey *)object;
-    return ([other class] == [self class]) && [[other key] isEqual:[self key]];
+    return ([other class] == [self class]) && ([other keyClass] == keyClass) && [[other key] isEqual:[self key]];
 }
 
 - (id)copyWithZone:(NSZone *)zone
@@ -301,239 +388,2078 @@
 
 @end
 
-// MARK: -
-// MARK: Public Classes
+// Returns the changes for (c, k) in |changes|, which maps BNRClassKey -> (rowID -> text or NSNull)
+static NSMutableDictionary *BNRChangesForClassKey(NSMutableDictionary *changes, Class c, NSString *k)
+{
+    BNRClassKey *ck = [[BNRClassKey alloc] init];
+    [ck setKeyClass:c];
+    [ck setKey:k];
+    
+    NSMutableDictionary *rowChanges = [changes objectForKey:ck];
+    if (!rowChanges) {
+        rowChanges = [[NSMutableDictionary alloc] init];
+        [changes setObject:rowChanges forKey:ck];
+        [rowChanges release];
+    }
+    [ck release];
+    return rowChanges;
+}
+
 // MARK: -
 // =============================//
 
-@implementation BNRTCIndexManager
+// A B+ tree file of index changes that have been saved but not applied, in the
+// order they were saved.  Keys are big-endian sequence numbers; each value holds
+// the class name, key, rowID and the text to index (or a flag saying to remove it).
+@interface BNRIndexQueue : NSObject {
+    TCBDB *queueFile;
+    UInt64 nextSequence;
+}
 
-@synthesize usesIndexFileWriteSync, usesIndexFileCompression; // read-only properties; must be set at init time
++ (NSString *)queuePathInDirectory:(NSString *)dir;
 
-// designated initializer
-- (id)initWithPath:(NSString *)p useWriteSyncronization:(BOOL)writeSyncFlag compressIndexFiles:(BOOL)compressIndexFilesFlag error:(NSError **)err
+- (id)initWithPath:(NSString *)p usesWriteSync:(BOOL)writeSyncFlag error:(NSError **)errorPtr;
+
+- (NSUInteger)count;
+
+// Appends everything in |changes| in one transaction
+- (BOOL)appendChanges:(NSDictionary *)changes;
+
+// Reads up to |limit| changes (0 for all) that come after sequence number
+// |first| (0 for the front of the queue) into |changes|, leaving them in the
+// queue.  With |ck|, changes for other indexes are skipped.  Returns how many
+// were read.
+- (NSUInteger)readChanges:(NSMutableDictionary *)changes
+              forClassKey:(BNRClassKey *)ck
+            afterSequence:(UInt64)first
+                    limit:(NSUInteger)limit
+             lastSequence:(UInt64 *)lastPtr;
+
+- (BOOL)removeChangesThroughSequence:(UInt64)last;
+
+@end
+
+@implementation BNRIndexQueue
+
++ (NSString *)queuePathInDirectory:(NSString *)dir
+{
+    return [dir stringByAppendingPathComponent:@"IndexQueue.tcb"];
+}
+
+- (id)initWithPath:(NSString *)p usesWriteSync:(BOOL)writeSyncFlag error:(NSError **)errorPtr
 {
     self = [super init];
-	if (self) {
-		path = [p copy];
-		
-		BOOL isDir, exists;
-		exists = [[NSFileManager defaultManager] fileExistsAtPath:path
-													  isDirectory:&isDir];
-		
-		if (exists) {
-			if (!isDir)
-			{
-				if (err) {
-					NSMutableDictionary *ui = [NSMutableDictionary dictionary];
-					[ui setObject:[NSString stringWithFormat:@"%@ is a file", path]
-						   forKey:NSLocalizedDescriptionKey];
-					*err = [NSError errorWithDomain:@"BNRPersistence (BNRTCIndexManager)"
-											   code:4
-										   userInfo:ui];
-				}
-				[self dealloc];
-				return nil;
-			}
-		} else {
-			BOOL success = [[NSFileManager defaultManager] createDirectoryAtPath:path
-													 withIntermediateDirectories:YES
-																	  attributes:nil
-																		   error:err];
-			if (!success) {
-				[self dealloc];
-				return nil;
-			}
-		}
-		
-		// Note that textIndexes is essentially a lazy-loading cache of BNRTextIndex,
-		// which each hold onto a TCIDBFile for each BNRStoredObject subclass
-		// which is text-indexed. The TCIDBFile can be quite large
-		// resulting in a jump in memory consumption the first time
-		// a particular text-indexed BNRStoredObject is accessed,
-		// and this can give the false appearance of leaks. 
-		// The increase in memory consumption stops when all text-indexed
-		// BNRStoredObject subclasses have been written once. This cache
-		// can be invalidated by calling the -close method to remove all the text indexes,
-		// but perhaps there should be a finer-grained way, using BNRTextIndex's 
-		// -unloadIndexFile, to remove only TCIDBFiles that are known not to be needed
-		// again soon. This would leave the BNRTextIndex objects in the cache, but
-		// greatly reducing their memory usage. (BNRTextIndex already has the ability to
-		// lazy-load and reload its TCIDBFile when necessary).
-		// Some support is available; toggle kImplementCacheUnloading to 1
-		textIndexes = [[NSMutableDictionary alloc] init];
-		
-		usesIndexFileWriteSync = writeSyncFlag;
-		usesIndexFileCompression = compressIndexFilesFlag;
-	}
-    
+    if (self) {
+        int mode = BDBOREADER | BDBOWRITER | BDBONOLCK | BDBOCREAT;
+        if (writeSyncFlag) {
+            mode |= BDBOTSYNC;
+        }
+        queueFile = tcbdbnew();
+        if (!tcbdbopen(queueFile, [p fileSystemRepresentation], mode)) {
+            int ecode = tcbdbecode(queueFile);
+            NSLog(@"Error opening index queue %@: %s\n", p, tcbdberrmsg(ecode));
+            if (errorPtr) {
+                NSString *msg = [NSString stringWithFormat:@"Unable to open index queue at path:%@, error %s", p, tcbdberrmsg(ecode)];
+                NSDictionary *userInfo = [NSDictionary dictionaryWithObjectsAndKeys:msg, NSLocalizedDescriptionKey, nil];
+                *errorPtr = [NSError errorWithDomain:@"BNRTextIndex domain" code:ecode userInfo:userInfo];
+            }
+            [self release];
+            return nil;
+        }
+        
+        nextSequence = 1;
+        BDBCUR *cur = tcbdbcurnew(queueFile);
+        if (tcbdbcurlast(cur)) {
+            int ksiz;
+            const UInt64 *k = (const UInt64 *)tcbdbcurkey3(cur, &ksiz);
+            if (k && ksiz == sizeof(UInt64)) {
+                nextSequence = CFSwapInt64BigToHost(*k) + 1;
+            }
+        }
+        tcbdbcurdel(cur);
+    }
     return self;
 }
 
-- (id)initWithPath:(NSString *)p error:(NSError **)err
+- (void)dealloc
 {
-	return [self initWithPath:p useWriteSyncronization:NO compressIndexFiles:NO error:err];
+    if (queueFile) {
+        tcbdbdel(queueFile);
+    }
+    [super dealloc];
 }
 
-#if kImplementCacheUnloading 
-- (void)unloadTCIDBFile:(TCIDB *)ti
+- (NSUInteger)count
 {
-	// See comments at initWithPath. 
-	// Could be used to selectively reduce memory
-	// footprint after accessing a text-indeed BNRStored object. 
-	// This could be useful if the index is large but it is known won't be
-	// needed again soon. The TCIDBFile (can be large with very large indexes)
-	// will be unloaded by the BNTCIndex object remains in the textIndexes cache
-	// and will reload its TCIDBFile the next time it is needed.
-	NSArray *allIndexes = [textIndexes allValues];
-	for (BNRTextIndex *textIndex in allIndexes) {
-		if ([textIndex TCIDBFile] == ti)  {
-			[textIndex unloadIndexFile];
-		}
-	}
+    return (NSUInteger)tcbdbrnum(queueFile);
 }
 
-- (void)unloadTCIDBFiles
+- (BOOL)appendChanges:(NSDictionary *)changes
 {
-	NSArray *allIndexes = [textIndexes allValues];
-	for (BNRTextIndex *textIndex in allIndexes) {
-		[textIndex unloadIndexFile];
-	}
+    if (!tcbdbtranbegin(queueFile)) {
+        NSLog(@"tcbdbtranbegin() failed for index queue: %s", tcbdberrmsg(tcbdbecode(queueFile)));
+        return NO;
+    }
+    BNRDataBuffer *d = [BNRDataBuffer borrowBufferWithCapacity:256];
+    UInt64 sequence = nextSequence;
+    BOOL successful = YES;
+    for (BNRClassKey *ck in changes) {
+        NSDictionary *rowChanges = [changes objectForKey:ck];
+        NSString *className = NSStringFromClass([ck keyClass]);
+        for (NSNumber *rowID in rowChanges) {
+            id value = [rowChanges objectForKey:rowID];
+            [d clearBuffer];
+            [d writeString:className];
+            [d writeString:[ck key]];
+            [d writeUInt32:[rowID unsignedIntValue]];
+            if (value == [NSNull null]) {
+                [d writeUInt8:0];
+            } else {
+                [d writeUInt8:1];
+                [d writeString:value];
+            }
+            UInt64 k = CFSwapInt64HostToBig(sequence++);
+            if (!tcbdbput(queueFile, &k, sizeof(UInt64), [d buffer], [d length])) {
+                successful = NO;
+                break;
+            }
+        }
+        if (!successful) {
+            break;
+        }
+    }
+    [BNRDataBuffer returnBuffer:d];
+    
+    if (successful && tcbdbtrancommit(queueFile)) {
+        nextSequence = sequence;
+        return YES;
+    }
+    NSLog(@"Appending to index queue failed: %s", tcbdberrmsg(tcbdbecode(queueFile)));
+    tcbdbtranabort(queueFile);
+    return NO;
 }
-#endif // kImplementCacheUnloading
 
-- (void)close
+- (NSUInteger)readChanges:(NSMutableDictionary *)changes
+              forClassKey:(BNRClassKey *)ck
+            afterSequence:(UInt64)first
+                    limit:(NSUInteger)limit
+             lastSequence:(UInt64 *)lastPtr
 {
-    [textIndexes removeAllObjects];
+    NSUInteger readCount = 0;
+    BNRDataBuffer *d = [[BNRDataBuffer alloc] initWithCapacity:0];
+    BDBCUR *cur = tcbdbcurnew(queueFile);
+    BOOL more;
+    if (first > 0) {
+        UInt64 start = CFSwapInt64HostToBig(first + 1);
+        more = tcbdbcurjump(cur, &start, sizeof(UInt64));
+    } else {
+        more = tcbdbcurfirst(cur);
+    }
+    while (more && (limit == 0 || readCount < limit)) {
+        int ksiz, vsiz;
+        const UInt64 *k = (const UInt64 *)tcbdbcurkey3(cur, &ksiz);
+        const void *v = tcbdbcurval3(cur, &vsiz);
+        if (!k || !v || ksiz != sizeof(UInt64)) {
+            break;
+        }
+        if (lastPtr) {
+            *lastPtr = CFSwapInt64BigToHost(*k);
+        }
+        readCount++;
+        
+        // Later changes to a row replace earlier ones
+        [d setBytesNoCopy:v length:vsiz owner:self];
+        Class c = NSClassFromString([d readString]);
+        NSString *key = [d readString];
+        UInt32 rowID = [d readUInt32];
+        if (c && key && (!ck || ([ck keyClass] == c && [[ck key] isEqual:key]))) {
+            BOOL hasText = [d readUInt8];
+            NSString *text = hasText ? [d readString] : nil;
+            [BNRChangesForClassKey(changes, c, key) setObject:(hasText ? (text ? (id)text : (id)@"") : (id)[NSNull null])
+                                                       forKey:[NSNumber numberWithUnsignedInt:rowID]];
+        }
+        more = tcbdbcurnext(cur);
+    }
+    tcbdbcurdel(cur);
+    [d release];
+    return readCount;
 }
 
-- (void)dealloc 
+- (BOOL)removeChangesThroughSequence:(UInt64)last
 {
-    [self close];
-    [textIndexes release];
-    [path release];
-    [super dealloc];
+    if (!tcbdbtranbegin(queueFile)) {
+        return NO;
+    }
+    BDBCUR *cur = tcbdbcurnew(queueFile);
+    BOOL more = tcbdbcurfirst(cur);
+    while (more) {
+        int ksiz;
+        const UInt64 *k = (const UInt64 *)tcbdbcurkey3(cur, &ksiz);
+        if (!k || CFSwapInt64BigToHost(*k) > last) {
+            break;
+        }
+        // Moves the cursor to the next record
+        more = tcbdbcurout(cur);
+    }
+    tcbdbcurdel(cur);
+    if (!tcbdbtrancommit(queueFile)) {
+        NSLog(@"Removing applied changes from index queue failed: %s", tcbdberrmsg(tcbdbecode(queueFile)));
+        tcbdbtranabort(queueFile);
+        return NO;
+    }
+    return YES;
 }
 
-- (NSString *)path
+@end
+
+// MARK: -
+// =============================//
+
+// Puts a batch of rows into one shard of each index being rebuilt
+@interface BNRRebuildOperation : NSOperation {
+    TCIDB **indexes;            // one per key; belong to the BNRIndexRebuild
+    NSUInteger keyCount;
+    int shard;
+    UInt32 *rowIDs;
+    char **texts;               // keyCount per row; NULL where there is no text
+    NSUInteger rowCount;
+    volatile BOOL *failedPtr;
+}
+
+- (id)initWithIndexes:(TCIDB **)idxs keyCount:(NSUInteger)n shard:(int)sh failureFlag:(volatile BOOL *)flag;
+
+- (BOOL)isFull;
+
+// The row's slots in texts, one per key, for the caller to fill with malloc()ed strings
+- (char **)textsForNewRow:(UInt32)rowID;
+
+@end
+
+@implementation BNRRebuildOperation
+
+- (id)initWithIndexes:(TCIDB **)idxs keyCount:(NSUInteger)n shard:(int)sh failureFlag:(volatile BOOL *)flag
 {
-    return path;
+    self = [super init];
+    if (self) {
+        indexes = idxs;
+        keyCount = n;
+        shard = sh;
+        failedPtr = flag;
+        rowIDs = malloc(kBNRRebuildBatchSize * sizeof(UInt32));
+        texts = calloc(kBNRRebuildBatchSize * keyCount, sizeof(char *));
+    }
+    return self;
 }
 
-- (TCIDB *)textIndexForClass:(Class)c 
-                         key:(NSString *)k
+- (void)dealloc
 {
-    
-    BNRClassKey *ck = [[[BNRClassKey alloc] init] autorelease];  // autorelease this to avoid annoyance of having to special-case release it if a TC creation error occurs
-    [ck setKeyClass:c];
-    [ck setKey:k];
-    
-    BNRTextIndex *ti = [textIndexes objectForKey:ck];
-    
-    if (!ti) {
-		ti = [BNRTextIndex createIndexForClass:c
-										   key:k
-										atPath:path
-						usesIndexFileWriteSync:usesIndexFileWriteSync
-						  usesIndexCompression:usesIndexFileCompression];	// throws on failure, so no nil should escape
-        [textIndexes setObject:ti forKey:ck];
+    for (NSUInteger i = 0; i < rowCount * keyCount; i++) {
+        free(texts[i]);
+    }
+    free(texts);
+    free(rowIDs);
+    [super dealloc];
 }
 
-    return [ti TCIDBFile];	
+- (BOOL)isFull
+{
+    return rowCount == kBNRRebuildBatchSize;
 }
 
-- (UInt32)countOfRowsInClass:(Class)c 
-                matchingText:(NSString *)toMatch
-                      forKey:(NSString *)key
-                        list:(UInt32 **)listPtr
+- (char **)textsForNewRow:(UInt32)rowID
 {
-    TCIDB *ti = [self textIndexForClass:c 
-                                    key:key];
-	if (!ti) {
-		NSLog(@"textIndexForClass failed for class:%@ key:%@key in %s", NSStringFromClass(c), key, __PRETTY_FUNCTION__);
-		return 0UL;
-	}
-    const char * cMatch = [toMatch cStringUsingEncoding:NSUTF8StringEncoding];
-    int recordCount;
-    uint64_t *searchResults = tcidbsearch2(ti, cMatch, &recordCount);
-    
-    if (listPtr && recordCount > 0) {
-        UInt32 *outputBuffer = (UInt32 *)malloc(recordCount * sizeof(UInt32));
-        
-        for (int i = 0; i < recordCount; i++) {
-            outputBuffer[i] = (UInt32)searchResults[i];
+    rowIDs[rowCount] = rowID;
+    return texts + (rowCount++ * keyCount);
+}
+
+- (void)main
+{
+    for (NSUInteger r = 0; r < rowCount && !*failedPtr; r++) {
+        for (NSUInteger k = 0; k < keyCount; k++) {
+            const char *text = texts[r * keyCount + k];
+            if (text && !tcidbputshard(indexes[k], shard, rowIDs[r], text)) {
+                NSLog(@"Rebuilding text index failed at row %u: %s", (unsigned)rowIDs[r], tcidberrmsg(tcidbecode(indexes[k])));
+                *failedPtr = YES;
+                return;
+            }
         }
-        *listPtr = outputBuffer;
     }
-    free(searchResults);
-
-    return (UInt32)recordCount;
 }
 
-- (void)insertValueOfObject:(BNRStoredObject *)obj forKey:(NSString *)key withRowID:(UInt32)rowID intoTextIndex:(TCIDB *)ti
-{
-	NSString *value = [obj valueForKey:key];
-	const char * cValue = [value cStringUsingEncoding:NSUTF8StringEncoding];
-	// If a BNRStoredObject's text-indexed property value is nil or empty (@""), 
-	// there's no text to index and cValue == NULL.
-	// But passing NULL to tcidbput() will crash, so in that case do nothing.
-	//
-	// (Fixes crashes in -insertObjectInIndexes and -updateObjectInIndexes for 
-	// BNRStoredObjects with nil or empty indexed strings. Remove this comment when merging with
-	// main branch.)
-	//
-	if ( cValue ) {
-		BOOL success = tcidbput(ti, rowID, cValue);
-		if (!success) {
-			NSLog(@"Insert of value %@ into text index for (class:%@, key:%@) failed", value, NSStringFromClass([obj class]), key);
-		} 
-	}
+@end
+
+// MARK: -
+// =============================//
+
+// New indexes for every text-indexed key of a class, built beside the old ones
+// in "<index>.rebuild" directories.  Each index gets one q-gram shard per
+// thread; batches of rows go to the shards in turn, so the threads tokenize
+// without waiting on one another.
+@interface BNRIndexRebuild : NSObject {
+    Class rebuildClass;
+    NSArray *keys;
+    NSArray *indexPaths;        // where each finished index goes
+    TCIDB **indexes;
+    int shardCount;
+    NSOperationQueue *queue;
+    NSMutableArray *operations; // handed to the queue, oldest first
+    BNRRebuildOperation *batch; // being filled
+    NSUInteger batchCount;
+    volatile BOOL failed;
 }
 
-- (void)insertObjectInIndexes:(BNRStoredObject *)obj
+- (id)initWithClass:(Class)c
+          directory:(NSString *)dir
+        threadCount:(NSUInteger)n
+usesIndexCompression:(BOOL)compressionFlag;
+
+- (Class)rebuildClass;
+- (NSArray *)keys;
+
+- (void)addObject:(BNRStoredObject *)obj;
+
+// Waits for the threads and closes the new indexes; NO if anything went wrong
+- (BOOL)finish;
+
+// Moves the old indexes aside, the new ones in, and deletes the old ones.  The
+// old indexes must be closed.
+- (BOOL)installIndexes;
+
+- (void)removeFiles;
+
+@end
+
+@implementation BNRIndexRebuild
+
++ (NSString *)rebuildPathForIndexPath:(NSString *)p
 {
-    Class c = [obj class];
-    UInt32 rowID = [obj rowID];
-    NSSet *indexKeys = [c textIndexedAttributes];
-    for (NSString *key in indexKeys) {
-        TCIDB *ti = [self textIndexForClass:c key:key];
-		
-		[self insertValueOfObject:obj forKey:key withRowID:rowID intoTextIndex:ti];
-    }
+    return [p stringByAppendingPathExtension:@"rebuild"];
 }
 
-- (void)deleteObjectFromIndexes:(BNRStoredObject *)obj
+- (id)initWithClass:(Class)c
+          directory:(NSString *)dir
+        threadCount:(NSUInteger)n
+usesIndexCompression:(BOOL)compressionFlag
 {
-    Class c = [obj class];
-    UInt32 rowID = [obj rowID];
-    NSSet *indexKeys = [c textIndexedAttributes];
-    for (NSString *key in indexKeys) {
-        TCIDB *ti = [self textIndexForClass:c key:key];
-        BOOL success = tcidbout(ti, rowID);
-        if (!success) {
-            NSLog(@"Delete from index (%@, %@) failed", NSStringFromClass(c), key);
+    self = [super init];
+    if (self) {
+        rebuildClass = c;
+        keys = [[[c textIndexedAttributes] allObjects] retain];
+        shardCount = (int)MAX(1, MIN(n, IDBQDBMAX));
+        
+        NSMutableArray *paths = [NSMutableArray array];
+        for (NSString *k in keys) {
+            [paths addObject:[dir stringByAppendingPathComponent:[BNRTextIndex standardIndexFilenameForClass:c key:k]]];
         }
+        indexPaths = [paths copy];
+        
+        indexes = calloc([keys count] + 1, sizeof(TCIDB *));
+        for (NSUInteger k = 0; k < [keys count]; k++) {
+            NSString *rebuildPath = [BNRIndexRebuild rebuildPathForIndexPath:[indexPaths objectAtIndex:k]];
+            TCIDB *idb = tcidbnew();
+            if (compressionFlag) {
+                (void)tcidbtune(idb, 0, 0, 0, IDBTBZIP);
+            }
+            (void)tcidbsetcache(idb, kBNRRebuildCacheSize / shardCount, 0);
+            if (!tcidbopen(idb, [rebuildPath fileSystemRepresentation], IDBOWRITER | IDBOCREAT | IDBOTRUNC | IDBONOLCK)
+                || !tcidbsetshards(idb, shardCount)) {
+                NSLog(@"Error creating text index %@: %s", rebuildPath, tcidberrmsg(tcidbecode(idb)));
+                tcidbdel(idb);
+                failed = YES;
+                break;
+            }
+            indexes[k] = idb;
+        }
+        
+        queue = [[NSOperationQueue alloc] init];
+        [queue setMaxConcurrentOperationCount:shardCount];
+        operations = [[NSMutableArray alloc] init];
     }
-    
+    return self;
 }
-- (void)updateObjectInIndexes:(BNRStoredObject *)obj
+
+- (void)dealloc
 {
-    Class c = [obj class];
-    UInt32 rowID = [obj rowID];
+    [self finish];
+    [operations release];
+    [queue release];
+    free(indexes);
+    [indexPaths release];
+    [keys release];
+    [super dealloc];
+}
+
+- (Class)rebuildClass
+{
+    return rebuildClass;
+}
+
+- (NSArray *)keys
+{
+    return keys;
+}
+
+- (void)sendBatch
+{
+    if (!batch) {
+        return;
+    }
+    [queue addOperation:batch];
+    [operations addObject:batch];
+    [batch release];
+    batch = nil;
+    
+    // Don't let the scan run too far ahead of the threads
+    while ([operations count] > (NSUInteger)shardCount * 2) {
+        [[operations objectAtIndex:0] waitUntilFinished];
+        [operations removeObjectAtIndex:0];
+    }
+}
+
+- (void)addObject:(BNRStoredObject *)obj
+{
+    if (failed) {
+        return;
+    }
+    if (!batch) {
+        batch = [[BNRRebuildOperation alloc] initWithIndexes:indexes
+                                                    keyCount:[keys count]
+                                                       shard:(int)(batchCount++ % shardCount)
+                                                 failureFlag:&failed];
+    }
+    char **texts = [batch textsForNewRow:[obj rowID]];
+    NSUInteger k = 0;
+    for (NSString *key in keys) {
+        const char *cValue = [[obj valueForKey:key] cStringUsingEncoding:NSUTF8StringEncoding];
+        texts[k++] = cValue ? strdup(cValue) : NULL;
+    }
+    if ([batch isFull]) {
+        [self sendBatch];
+    }
+}
+
+- (BOOL)finish
+{
+    [self sendBatch];
+    [queue waitUntilAllOperationsAreFinished];
+    [operations removeAllObjects];
+    
+    for (NSUInteger k = 0; k < [keys count]; k++) {
+        if (indexes[k]) {
+            if (!tcidbclose(indexes[k])) {
+                NSLog(@"Error closing text index %@: %s", [indexPaths objectAtIndex:k], tcidberrmsg(tcidbecode(indexes[k])));
+                failed = YES;
+            }
+            tcidbdel(indexes[k]);
+            indexes[k] = NULL;
+        }
+    }
+    return !failed;
+}
+
+- (BOOL)installIndexes
+{
+    NSFileManager *fm = [NSFileManager defaultManager];
+    for (NSString *indexPath in indexPaths) {
+        NSString *oldPath = [indexPath stringByAppendingPathExtension:@"old"];
+        NSString *rebuildPath = [BNRIndexRebuild rebuildPathForIndexPath:indexPath];
+        [fm removeItemAtPath:oldPath error:NULL];
+        
+        // Each rename is atomic; if we stop in between, -loadTCIndexFile: finds the old index
+        if (rename([indexPath fileSystemRepresentation], [oldPath fileSystemRepresentation]) != 0 && errno != ENOENT) {
+            NSLog(@"Can't move text index %@ aside: %s", indexPath, strerror(errno));
+            return NO;
+        }
+        if (rename([rebuildPath fileSystemRepresentation], [indexPath fileSystemRepresentation]) != 0) {
+            NSLog(@"Can't move rebuilt text index into %@: %s", indexPath, strerror(errno));
+            (void)rename([oldPath fileSystemRepresentation], [indexPath fileSystemRepresentation]);
+            return NO;
+        }
+        [fm removeItemAtPath:oldPath error:NULL];
+    }
+    return YES;
+}
+
+- (void)removeFiles
+{
+    for (NSString *indexPath in indexPaths) {
+        [[NSFileManager defaultManager] removeItemAtPath:[BNRIndexRebuild rebuildPathForIndexPath:indexPath] error:NULL];
+    }
+}
+
+@end
+
+// MARK: -
+// =============================//
+
+@interface BNRSearchCacheEntry : NSObject {
+@public
+    NSString *cacheKey;
+    BNRClassKey *classKey;
+    NSUInteger epoch;           // of classKey when the search ran
+    UInt32 *rows;
+    UInt32 count;
+    NSUInteger byteCount;
+    BNRSearchCacheEntry *newer; // LRU list; not retained
+    BNRSearchCacheEntry *older;
+}
+@end
+
+@implementation BNRSearchCacheEntry
+- (void)dealloc
+{
+    free(rows);
+    [classKey release];
+    [cacheKey release];
+    [super dealloc];
+}
+@end
+
+// Recent search results, dropped least recently used first once they take more
+// than the byte limit.  Each (class, key) has an epoch that goes up whenever its
+// index changes; an entry from an earlier epoch is stale and goes when found.
+// Not threadsafe: the index manager only uses it with indexLock held.
+@interface BNRSearchCache : NSObject {
+    NSMutableDictionary *entries;   // cache key -> BNRSearchCacheEntry
+    NSMutableDictionary *epochs;    // BNRClassKey -> NSNumber
+    BNRSearchCacheEntry *newest;
+    BNRSearchCacheEntry *oldest;
+    NSUInteger byteLimit;
+    NSUInteger byteCount;
+@public
+    NSUInteger hitCount;
+    NSUInteger missCount;
+}
+
+- (id)initWithByteLimit:(NSUInteger)limit;
+
+// On a hit, sets *countPtr and (if listPtr isn't NULL) a malloc()ed copy of the rows
+- (BOOL)getCount:(UInt32 *)countPtr
+            list:(UInt32 **)listPtr
+     forClassKey:(BNRClassKey *)ck
+           query:(NSString *)q;
+
+- (void)setRows:(const UInt32 *)rows
+          count:(UInt32)n
+    forClassKey:(BNRClassKey *)ck
+          query:(NSString *)q;
+
+- (void)invalidateClassKey:(BNRClassKey *)ck;
+
+@end
+
+@implementation BNRSearchCache
+
+- (id)initWithByteLimit:(NSUInteger)limit
+{
+    self = [super init];
+    if (self) {
+        byteLimit = limit;
+        entries = [[NSMutableDictionary alloc] init];
+        epochs = [[NSMutableDictionary alloc] init];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [epochs release];
+    [entries release];
+    [super dealloc];
+}
+
+- (NSUInteger)epochOfClassKey:(BNRClassKey *)ck
+{
+    return [[epochs objectForKey:ck] unsignedIntegerValue];
+}
+
+- (void)unlinkEntry:(BNRSearchCacheEntry *)e
+{
+    if (e->newer) e->newer->older = e->older; else newest = e->older;
+    if (e->older) e->older->newer = e->newer; else oldest = e->newer;
+    e->newer = e->older = nil;
+}
+
+- (void)linkEntryAsNewest:(BNRSearchCacheEntry *)e
+{
+    e->older = newest;
+    if (newest) newest->newer = e; else oldest = e;
+    newest = e;
+}
+
+- (void)removeEntry:(BNRSearchCacheEntry *)e
+{
+    [self unlinkEntry:e];
+    byteCount -= e->byteCount;
+    [entries removeObjectForKey:e->cacheKey];
+}
+
+- (NSString *)cacheKeyForClassKey:(BNRClassKey *)ck query:(NSString *)q
+{
+    return [NSString stringWithFormat:@"%@-%@ %@", NSStringFromClass([ck keyClass]), [ck key], q];
+}
+
+- (BOOL)getCount:(UInt32 *)countPtr
+            list:(UInt32 **)listPtr
+     forClassKey:(BNRClassKey *)ck
+           query:(NSString *)q
+{
+    BNRSearchCacheEntry *e = [entries objectForKey:[self cacheKeyForClassKey:ck query:q]];
+    if (e && e->epoch != [self epochOfClassKey:ck]) {
+        [self removeEntry:e];
+        e = nil;
+    }
+    if (!e) {
+        missCount++;
+        return NO;
+    }
+    hitCount++;
+    [self unlinkEntry:e];
+    [self linkEntryAsNewest:e];
+    
+    *countPtr = e->count;
+    if (listPtr && e->count > 0) {
+        *listPtr = (UInt32 *)malloc(e->count * sizeof(UInt32));
+        memcpy(*listPtr, e->rows, e->count * sizeof(UInt32));
+    }
+    return YES;
+}
+
+- (void)setRows:(const UInt32 *)rows
+          count:(UInt32)n
+    forClassKey:(BNRClassKey *)ck
+          query:(NSString *)q
+{
+    NSString *cacheKey = [self cacheKeyForClassKey:ck query:q];
+    NSUInteger cost = n * sizeof(UInt32) + [cacheKey length] * sizeof(unichar) + kBNRSearchCacheEntryOverhead;
+    if (cost > byteLimit) {
+        return;
+    }
+    BNRSearchCacheEntry *old = [entries objectForKey:cacheKey];
+    if (old) {
+        [self removeEntry:old];
+    }
+    
+    BNRSearchCacheEntry *e = [[BNRSearchCacheEntry alloc] init];
+    e->cacheKey = [cacheKey copy];
+    e->classKey = [ck retain];
+    e->epoch = [self epochOfClassKey:ck];
+    e->count = n;
+    if (n > 0) {
+        e->rows = (UInt32 *)malloc(n * sizeof(UInt32));
+        memcpy(e->rows, rows, n * sizeof(UInt32));
+    }
+    e->byteCount = cost;
+    [entries setObject:e forKey:cacheKey];
+    [self linkEntryAsNewest:e];
+    byteCount += cost;
+    [e release];
+    
+    while (byteCount > byteLimit) {
+        [self removeEntry:oldest];
+    }
+}
+
+- (void)invalidateClassKey:(BNRClassKey *)ck
+{
+    [epochs setObject:[NSNumber numberWithUnsignedInteger:[self epochOfClassKey:ck] + 1] forKey:ck];
+}
+
+@end
+
+// MARK: -
+// =============================//
+
+// Lowercase without accents, the way completions are matched and returned
+static NSString *BNRFoldedString(NSString *s)
+{
+    return [s stringByFoldingWithOptions:(NSCaseInsensitiveSearch | NSDiacriticInsensitiveSearch) locale:nil];
+}
+
+// The distinct words of |text|, folded
+static NSSet *BNRWordsOfText(NSString *text)
+{
+    NSMutableSet *words = [NSMutableSet set];
+    NSCharacterSet *separators = [[NSCharacterSet alphanumericCharacterSet] invertedSet];
+    for (NSString *word in [BNRFoldedString(text) componentsSeparatedByCharactersInSet:separators]) {
+        if ([word length] > 0) {
+            [words addObject:word];
+        }
+    }
+    return words;
+}
+
+typedef struct {
+    int rowCount;
+    char *word;
+} BNRCompletion;
+
+// Type-ahead completions for one key of one class: a B+ tree file mapping each
+// folded word to the number of rows it appears in.  Each row's words are kept
+// too, under a 0 byte and the big-endian rowID, so they can be counted out again
+// when the row changes or goes.
+@interface BNRPrefixIndex : NSObject {
+    TCBDB *wordFile;
+    NSMutableDictionary *shortPrefixCompletions;	// prefix -> most frequent words, until the words change
+}
+
++ (NSString *)standardIndexFilenameForClass:(Class)c key:(NSString *)k;
+
+- (id)initWithPath:(NSString *)p usesWriteSync:(BOOL)writeSyncFlag error:(NSError **)errorPtr;
+
+// |rowChanges| maps rowID -> new text, or NSNull for a deleted row; applied in one transaction
+- (BOOL)applyChanges:(NSDictionary *)rowChanges;
+
+- (NSArray *)completionsForPrefix:(NSString *)prefix limit:(NSUInteger)limit;
+
+@end
+
+@implementation BNRPrefixIndex
+
++ (NSString *)standardIndexFilenameForClass:(Class)c key:(NSString *)k
+{
+    return [NSString stringWithFormat:@"%@-%@.pindx", NSStringFromClass(c), k];
+}
+
+- (id)initWithPath:(NSString *)p usesWriteSync:(BOOL)writeSyncFlag error:(NSError **)errorPtr
+{
+    self = [super init];
+    if (self) {
+        int mode = BDBOREADER | BDBOWRITER | BDBONOLCK | BDBOCREAT;
+        if (writeSyncFlag) {
+            mode |= BDBOTSYNC;
+        }
+        wordFile = tcbdbnew();
+        if (!tcbdbopen(wordFile, [p fileSystemRepresentation], mode)) {
+            int ecode = tcbdbecode(wordFile);
+            NSLog(@"Error opening prefix index %@: %s\n", p, tcbdberrmsg(ecode));
+            if (errorPtr) {
+                NSString *msg = [NSString stringWithFormat:@"Unable to open prefix index at path:%@, error %s", p, tcbdberrmsg(ecode)];
+                NSDictionary *userInfo = [NSDictionary dictionaryWithObjectsAndKeys:msg, NSLocalizedDescriptionKey, nil];
+                *errorPtr = [NSError errorWithDomain:@"BNRTextIndex domain" code:ecode userInfo:userInfo];
+            }
+            [self release];
+            return nil;
+        }
+        shortPrefixCompletions = [[NSMutableDictionary alloc] init];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    if (wordFile) {
+        tcbdbdel(wordFile);
+    }
+    [shortPrefixCompletions release];
+    [super dealloc];
+}
+
+- (BOOL)addRows:(int)n toWord:(NSString *)word
+{
+    const char *w = [word UTF8String];
+    int wsiz = (int)strlen(w);
+    int rowCount = tcbdbaddint(wordFile, w, wsiz, n);
+    if (rowCount == INT_MIN) {
+        return NO;
+    }
+    if (rowCount <= 0) {
+        return tcbdbout(wordFile, w, wsiz);
+    }
+    return YES;
+}
+
+- (BOOL)applyChanges:(NSDictionary *)rowChanges
+{
+    if (!tcbdbtranbegin(wordFile)) {
+        NSLog(@"tcbdbtranbegin() failed for prefix index: %s", tcbdberrmsg(tcbdbecode(wordFile)));
+        return NO;
+    }
+    BOOL successful = YES;
+    NSArray *rowIDs = [[rowChanges allKeys] sortedArrayUsingSelector:@selector(compare:)];
+    for (NSNumber *rowID in rowIDs) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        unsigned char rowKey[1 + sizeof(UInt32)];
+        UInt32 bigRowID = CFSwapInt32HostToBig([rowID unsignedIntValue]);
+        rowKey[0] = 0;
+        memcpy(rowKey + 1, &bigRowID, sizeof(UInt32));
+        
+        NSSet *oldWords = [NSSet set];
+        int osiz;
+        const char *old = tcbdbget3(wordFile, rowKey, sizeof(rowKey), &osiz);
+        if (old) {
+            NSString *oldList = [[[NSString alloc] initWithBytes:old length:osiz encoding:NSUTF8StringEncoding] autorelease];
+            oldWords = [NSSet setWithArray:[oldList componentsSeparatedByString:@" "]];
+        }
+        id value = [rowChanges objectForKey:rowID];
+        NSSet *newWords = (value == [NSNull null]) ? [NSSet set] : BNRWordsOfText(value);
+        
+        for (NSString *word in oldWords) {
+            if (![newWords containsObject:word] && ![self addRows:-1 toWord:word]) {
+                successful = NO;
+            }
+        }
+        for (NSString *word in newWords) {
+            if (![oldWords containsObject:word] && ![self addRows:1 toWord:word]) {
+                successful = NO;
+            }
+        }
+        if ([newWords count] > 0) {
+            const char *list = [[[newWords allObjects] componentsJoinedByString:@" "] UTF8String];
+            if (!tcbdbput(wordFile, rowKey, sizeof(rowKey), list, (int)strlen(list))) {
+                successful = NO;
+            }
+        } else if (old) {
+            (void)tcbdbout(wordFile, rowKey, sizeof(rowKey));
+        }
+        [pool drain];
+        if (!successful) {
+            break;
+        }
+    }
+    [shortPrefixCompletions removeAllObjects];
+    
+    if (successful && tcbdbtrancommit(wordFile)) {
+        return YES;
+    }
+    NSLog(@"Updating prefix index failed: %s", tcbdberrmsg(tcbdbecode(wordFile)));
+    tcbdbtranabort(wordFile);
+    return NO;
+}
+
+// Walks every word with the prefix, keeping the |limit| in the most rows.
+// Ties go to the word that sorts first.
+- (NSArray *)scanCompletionsForPrefix:(NSString *)prefix limit:(NSUInteger)limit
+{
+    const char *p = [prefix UTF8String];
+    int psiz = (int)strlen(p);
+    BNRCompletion *top = (BNRCompletion *)malloc(limit * sizeof(BNRCompletion));
+    NSUInteger topCount = 0;
+    
+    BDBCUR *cur = tcbdbcurnew(wordFile);
+    if (tcbdbcurjump(cur, p, psiz)) {
+        do {
+            int ksiz, vsiz;
+            const char *k = tcbdbcurkey3(cur, &ksiz);
+            if (!k || ksiz < psiz || memcmp(k, p, psiz) != 0) {
+                break;
+            }
+            const int *v = (const int *)tcbdbcurval3(cur, &vsiz);
+            if (!v || vsiz != sizeof(int)) {
+                continue;
+            }
+            int rowCount = *v;
+            if (topCount == limit) {
+                if (rowCount <= top[limit - 1].rowCount) {
+                    continue;
+                }
+                free(top[--topCount].word);
+            }
+            NSUInteger i = topCount++;
+            while (i > 0 && top[i - 1].rowCount < rowCount) {
+                top[i] = top[i - 1];
+                i--;
+            }
+            top[i].rowCount = rowCount;
+            top[i].word = strndup(k, ksiz);
+        } while (tcbdbcurnext(cur));
+    }
+    tcbdbcurdel(cur);
+    
+    NSMutableArray *completions = [NSMutableArray arrayWithCapacity:topCount];
+    for (NSUInteger i = 0; i < topCount; i++) {
+        [completions addObject:[NSString stringWithUTF8String:top[i].word]];
+        free(top[i].word);
+    }
+    free(top);
+    return completions;
+}
+
+- (NSArray *)completionsForPrefix:(NSString *)prefix limit:(NSUInteger)limit
+{
+    NSString *folded = BNRFoldedString([prefix stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]]);
+    if ([folded length] == 0 || limit == 0) {
+        return [NSArray array];
+    }
+    
+    // Short prefixes match the most words, and are typed the most
+    if ([folded length] > 2 || limit > kBNRShortPrefixCompletionCount) {
+        return [self scanCompletionsForPrefix:folded limit:limit];
+    }
+    NSArray *completions = [shortPrefixCompletions objectForKey:folded];
+    if (!completions) {
+        completions = [self scanCompletionsForPrefix:folded limit:kBNRShortPrefixCompletionCount];
+        [shortPrefixCompletions setObject:completions forKey:folded];
+    }
+    if ([completions count] > limit) {
+        completions = [completions subarrayWithRange:NSMakeRange(0, limit)];
+    }
+    return completions;
+}
+
+@end
+
+// Spellings of one expression that Dystopia treats the same share a cache entry
+static NSString *BNRNormalizedExpression(NSString *expr)
+{
+    NSArray *words = [[expr lowercaseString] componentsSeparatedByCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]];
+    NSMutableArray *kept = [NSMutableArray arrayWithCapacity:[words count]];
+    for (NSString *word in words) {
+        if ([word length] > 0) {
+            [kept addObject:word];
+        }
+    }
+    return [kept componentsJoinedByString:@" "];
+}
+
+// A rough stand-in for tcidbsearch2() over text that isn't in the index yet:
+// "||" separates alternatives, and every other word of an alternative must
+// appear somewhere in |text|, ignoring case and accents.  Quotes, "[[*...*]]"
+// and other operators are ignored.
+static BOOL BNRTextMatchesExpression(NSString *text, NSString *expr)
+{
+    NSStringCompareOptions options = NSCaseInsensitiveSearch | NSDiacriticInsensitiveSearch;
+    NSArray *words = [expr componentsSeparatedByCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]];
+    NSCharacterSet *quotes = [NSCharacterSet characterSetWithCharactersInString:@"\"[]*"];
+    BOOL matches = YES;
+    BOOL sawWord = NO;
+    for (NSString *word in words) {
+        if ([word isEqual:@"||"]) {
+            if (matches && sawWord) {
+                return YES;
+            }
+            matches = YES;
+            sawWord = NO;
+            continue;
+        }
+        word = [word stringByTrimmingCharactersInSet:quotes];
+        if ([word length] == 0 || [word isEqual:@"&&"]) {
+            continue;
+        }
+        sawWord = YES;
+        if (matches && [text rangeOfString:word options:options].location == NSNotFound) {
+            matches = NO;
+        }
+    }
+    return matches && sawWord;
+}
+
+// MARK: -
+// MARK: Public Classes
+// MARK: -
+// =============================//
+
+@implementation BNRTCIndexManager
+
+@synthesize usesIndexFileWriteSync, usesIndexFileCompression; // read-only properties; must be set at init time
+
+// designated initializer
+- (id)initWithPath:(NSString *)p useWriteSyncronization:(BOOL)writeSyncFlag compressIndexFiles:(BOOL)compressIndexFilesFlag error:(NSError **)err
+{
+    self = [super init];
+	if (self) {
+		path = [p copy];
+		
+		BOOL isDir, exists;
+		exists = [[NSFileManager defaultManager] fileExistsAtPath:path
+													  isDirectory:&isDir];
+		
+		if (exists) {
+			if (!isDir)
+			{
+				if (err) {
+					NSMutableDictionary *ui = [NSMutableDictionary dictionary];
+					[ui setObject:[NSString stringWithFormat:@"%@ is a file", path]
+						   forKey:NSLocalizedDescriptionKey];
+					*err = [NSError errorWithDomain:@"BNRPersistence (BNRTCIndexManager)"
+											   code:4
+										   userInfo:ui];
+				}
+				[self dealloc];
+				return nil;
+			}
+		} else {
+			BOOL success = [[NSFileManager defaultManager] createDirectoryAtPath:path
+													 withIntermediateDirectories:YES
+																	  attributes:nil
+																		   error:err];
+			if (!success) {
+				[self dealloc];
+				return nil;
+			}
+		}
+		
+		// Note that textIndexes is essentially a lazy-loading cache of BNRTextIndex,
+		// which each hold onto a TCIDBFile for each BNRStoredObject subclass
+		// which is text-indexed. The TCIDBFile can be quite large
+		// resulting in a jump in memory consumption the first time
+		// a particular text-indexed BNRStoredObject is accessed,
+		// and this can give the false appearance of leaks. 
+		// The increase in memory consumption stops when all text-indexed
+		// BNRStoredObject subclasses have been written once. This cache
+		// can be invalidated by calling the -close method to remove all the text indexes,
+		// but perhaps there should be a finer-grained way, using BNRTextIndex's 
+		// -unloadIndexFile, to remove only TCIDBFiles that are known not to be needed
+		// again soon. This would leave the BNRTextIndex objects in the cache, but
+		// greatly reducing their memory usage. (BNRTextIndex already has the ability to
+		// lazy-load and reload its TCIDBFile when necessary).
+		// Some support is available; toggle kImplementCacheUnloading to 1
+		textIndexes = [[NSMutableDictionary alloc] init];
+		pendingChanges = [[NSMutableDictionary alloc] init];
+		prefixIndexes = [[NSMutableDictionary alloc] init];
+		pendingPrefixChanges = [[NSMutableDictionary alloc] init];
+		indexLock = [[NSCondition alloc] init];
+		
+		usesIndexFileWriteSync = writeSyncFlag;
+		usesIndexFileCompression = compressIndexFilesFlag;
+		
+		// Changes saved with background indexing that never made it into the indexes
+		if ([[NSFileManager defaultManager] fileExistsAtPath:[BNRIndexQueue queuePathInDirectory:path]]) {
+			if (![self openIndexQueue:err]) {
+				[self dealloc];
+				return nil;
+			}
+			[self applyQueuedChangesLimit:0];
+		}
+	}
+    
+    return self;
+}
+
+- (id)initWithPath:(NSString *)p error:(NSError **)err
+{
+	return [self initWithPath:p useWriteSyncronization:NO compressIndexFiles:NO error:err];
+}
+
+#if kImplementCacheUnloading 
+- (void)unloadTCIDBFile:(TCIDB *)ti
+{
+	// See comments at initWithPath. 
+	// Could be used to selectively reduce memory
+	// footprint after accessing a text-indeed BNRStored object. 
+	// This could be useful if the index is large but it is known won't be
+	// needed again soon. The TCIDBFile (can be large with very large indexes)
+	// will be unloaded by the BNTCIndex object remains in the textIndexes cache
+	// and will reload its TCIDBFile the next time it is needed.
+	NSArray *allIndexes = [textIndexes allValues];
+	for (BNRTextIndex *textIndex in allIndexes) {
+		if ([textIndex TCIDBFile] == ti)  {
+			[textIndex unloadIndexFile];
+		}
+	}
+}
+
+- (void)unloadTCIDBFiles
+{
+	NSArray *allIndexes = [textIndexes allValues];
+	for (BNRTextIndex *textIndex in allIndexes) {
+		[textIndex unloadIndexFile];
+	}
+}
+#endif // kImplementCacheUnloading
+
+- (void)close
+{
+    [self discardRebuild];
+    // Whatever is still queued is applied when the directory is next opened
+    [self stopBackgroundThread];
+    usesBackgroundIndexing = NO;
+    [indexQueue release];
+    indexQueue = nil;
+    
+    [pendingChanges removeAllObjects];
+    [pendingPrefixChanges removeAllObjects];
+    [textIndexes removeAllObjects];
+    [prefixIndexes removeAllObjects];
+    [searchCache release];
+    searchCache = nil;
+}
+
+- (void)dealloc 
+{
+    [self close];
+    [indexLock release];
+    [pendingChanges release];
+    [pendingPrefixChanges release];
+    [textIndexes release];
+    [prefixIndexes release];
+    [path release];
+    [super dealloc];
+}
+
+- (NSString *)path
+{
+    return path;
+}
+
+// The caller must hold indexLock
+- (BNRTextIndex *)loadedIndexObjectForClass:(Class)c 
+                                        key:(NSString *)k
+{
+    BNRClassKey *ck = [[[BNRClassKey alloc] init] autorelease];  // autorelease this to avoid annoyance of having to special-case release it if a TC creation error occurs
+    [ck setKeyClass:c];
+    [ck setKey:k];
+    
+    BNRTextIndex *ti = [textIndexes objectForKey:ck];
+    
+    if (!ti) {
+		ti = [BNRTextIndex createIndexForClass:c
+										   key:k
+										atPath:path
+						usesIndexFileWriteSync:usesIndexFileWriteSync
+						  usesIndexCompression:usesIndexFileCompression];	// throws on failure, so no nil should escape
+        [textIndexes setObject:ti forKey:ck];
+	}
+
+    return ti;	
+}
+
+// The caller must hold indexLock
+- (TCIDB *)loadedTextIndexForClass:(Class)c 
+                               key:(NSString *)k
+{
+    return [[self loadedIndexObjectForClass:c key:k] TCIDBFile];
+}
+
+- (TCIDB *)textIndexForClass:(Class)c 
+                         key:(NSString *)k
+{
+    [indexLock lock];
+    @try {
+        return [self loadedTextIndexForClass:c key:k];
+    }
+    @finally {
+        [indexLock unlock];
+    }
+    return NULL;
+}
+
+- (UInt32)countOfRowsInClass:(Class)c 
+                matchingText:(NSString *)toMatch
+                      forKey:(NSString *)key
+                        list:(UInt32 **)listPtr
+{
+    return [self countOfRowsInClass:c
+                       matchingText:toMatch
+                             forKey:key
+                        consistency:BNRIndexSearchIncludePending
+                               list:listPtr];
+}
+
+- (UInt32)countOfRowsInClass:(Class)c 
+                matchingText:(NSString *)toMatch
+                      forKey:(NSString *)key
+                 consistency:(BNRIndexSearchConsistency)consistency
+                        list:(UInt32 **)listPtr
+{
+    if (consistency == BNRIndexSearchWaitForIndexing) {
+        [self waitUntilIndexesAreCurrent];
+    }
+    
+    const char * cMatch = [toMatch cStringUsingEncoding:NSUTF8StringEncoding];
+    int recordCount;
+    uint64_t *searchResults;
+    NSDictionary *queued = nil;
     
-    NSSet *keys = [[obj class] textIndexedAttributes];
+    BNRClassKey *ck = [[[BNRClassKey alloc] init] autorelease];
+    [ck setKeyClass:c];
+    [ck setKey:key];
+    NSString *normalized = searchCache ? BNRNormalizedExpression(toMatch) : nil;
     
-    for (NSString *key in keys) {
-        TCIDB *ti = [self textIndexForClass:c key:key];
-        BOOL success = tcidbout(ti, rowID);
-        if (!success) {
-			// For any BNRStoredObject with text-indexed properties that are currently 
-			// nil or empty (@""), failure is expected, but is of no consequence. 
+    // Search and read the queue under one lock, so a change can't be applied
+    // (and leave the queue) in between and be missed by both
+    [indexLock lock];
+    @try {
+        UInt32 cachedCount;
+        if ([searchCache getCount:&cachedCount list:listPtr forClassKey:ck query:normalized]) {
+            return cachedCount;
+        }
+        
+        BNRTextIndex *textIndex = [self loadedIndexObjectForClass:c key:key];
+        [textIndex lock];
+        searchResults = tcidbsearch2([textIndex TCIDBFile], cMatch, &recordCount);
+        [textIndex unlock];
+        if (!searchResults) {
+            recordCount = 0;
+        }
+        
+        if (indexQueue && [indexQueue count] > 0) {
+            NSMutableDictionary *changes = [NSMutableDictionary dictionary];
+            [indexQueue readChanges:changes forClassKey:ck afterSequence:0 limit:0 lastSequence:NULL];
+            queued = [changes objectForKey:ck];
+        }
+        
+        // Only what came from the index alone: queuing or applying a change
+        // for this index moves its epoch on, so this stays right until then
+        if (searchCache && [queued count] == 0) {
+            UInt32 *rows = (UInt32 *)malloc(MAX(recordCount, 1) * sizeof(UInt32));
+            for (int i = 0; i < recordCount; i++) {
+                rows[i] = (UInt32)searchResults[i];
+            }
+            [searchCache setRows:rows count:(UInt32)recordCount forClassKey:ck query:normalized];
+            free(rows);
+        }
+    }
+    @finally {
+        [indexLock unlock];
+    }
+    
+    if ([queued count] > 0) {
+        // Rows with queued changes match on their new text only
+        NSMutableIndexSet *rows = [NSMutableIndexSet indexSet];
+        for (int i = 0; i < recordCount; i++) {
+            if (![queued objectForKey:[NSNumber numberWithUnsignedInt:(UInt32)searchResults[i]]]) {
+                [rows addIndex:(NSUInteger)searchResults[i]];
+            }
+        }
+        for (NSNumber *rowID in queued) {
+            id value = [queued objectForKey:rowID];
+            if (value != [NSNull null] && BNRTextMatchesExpression(value, toMatch)) {
+                [rows addIndex:[rowID unsignedIntValue]];
+            }
+        }
+        free(searchResults);
+        
+        recordCount = (int)[rows count];
+        if (listPtr && recordCount > 0) {
+            NSUInteger *indexes = (NSUInteger *)malloc(recordCount * sizeof(NSUInteger));
+            [rows getIndexes:indexes maxCount:recordCount inIndexRange:NULL];
+            UInt32 *outputBuffer = (UInt32 *)malloc(recordCount * sizeof(UInt32));
+            for (int i = 0; i < recordCount; i++) {
+                outputBuffer[i] = (UInt32)indexes[i];
+            }
+            free(indexes);
+            *listPtr = outputBuffer;
+        }
+        return (UInt32)recordCount;
+    }
+    
+    if (listPtr && recordCount > 0) {
+        UInt32 *outputBuffer = (UInt32 *)malloc(recordCount * sizeof(UInt32));
+        
+        for (int i = 0; i < recordCount; i++) {
+            outputBuffer[i] = (UInt32)searchResults[i];
+        }
+        *listPtr = outputBuffer;
+    }
+    free(searchResults);
+
+    return (UInt32)recordCount;
+}
+
+// MARK: Completions
+
+- (NSArray *)completionsInClass:(Class)c
+                      forPrefix:(NSString *)prefix
+                         forKey:(NSString *)key
+                          limit:(NSUInteger)limit
+{
+    [indexLock lock];
+    @try {
+        return [[self loadedPrefixIndexForClass:c key:key] completionsForPrefix:prefix limit:limit];
+    }
+    @finally {
+        [indexLock unlock];
+    }
+    return nil;
+}
+
+// MARK: Ranked search
+
+// Okapi BM25 parameters
+#define kBNRRankK1 (1.2)
+#define kBNRRankB (0.75)
+
+typedef struct {
+    double score;
+    UInt32 rowID;
+} BNRScoredRow;
+
+typedef struct {
+    NSString *term;			// not retained
+    uint64_t *rowIDs;		// ascending, from tcidbsearch()
+    int count;
+    int position;
+    double idf;
+    double maxScore;		// no row can get more than this from the term
+} BNRTermPostings;
+
+// The words of a search expression, lowercased, without operators or repeats
+static NSArray *BNRRankingTermsOfExpression(NSString *expr)
+{
+    NSMutableArray *terms = [NSMutableArray array];
+    NSCharacterSet *quotes = [NSCharacterSet characterSetWithCharactersInString:@"\"[]*"];
+    for (NSString *word in [expr componentsSeparatedByCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]]) {
+        word = [[word stringByTrimmingCharactersInSet:quotes] lowercaseString];
+        if ([word length] == 0 || [word isEqual:@"&&"] || [word isEqual:@"||"] || [terms containsObject:word]) {
+            continue;
+        }
+        [terms addObject:word];
+    }
+    return terms;
+}
+
+static double BNRScoreOfText(NSString *text, const BNRTermPostings *postings, NSUInteger termCount, double averageLength)
+{
+    NSStringCompareOptions options = NSCaseInsensitiveSearch | NSDiacriticInsensitiveSearch;
+    NSUInteger textLength = [text length];
+    double lengthNorm = kBNRRankK1 * (1.0 - kBNRRankB + kBNRRankB * textLength / averageLength);
+    double score = 0.0;
+    for (NSUInteger i = 0; i < termCount; i++) {
+        NSString *term = postings[i].term;
+        NSUInteger frequency = 0;
+        NSRange searchRange = NSMakeRange(0, textLength);
+        NSRange found;
+        while ((found = [text rangeOfString:term options:options range:searchRange]).location != NSNotFound) {
+            frequency++;
+            searchRange.location = NSMaxRange(found);
+            searchRange.length = textLength - searchRange.location;
+        }
+        if (frequency > 0) {
+            score += postings[i].idf * (frequency * (kBNRRankK1 + 1.0)) / (frequency + lengthNorm);
+        }
+    }
+    return score;
+}
+
+// A min-heap of the best |limit| rows so far, so heap[0] is the score to beat
+static void BNRTopRowsAdd(BNRScoredRow *heap, UInt32 *countPtr, UInt32 limit, BNRScoredRow row)
+{
+    UInt32 count = *countPtr;
+    UInt32 i;
+    if (count < limit) {
+        i = count++;
+        while (i > 0 && heap[(i - 1) / 2].score > row.score) {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        heap[i] = row;
+        *countPtr = count;
+        return;
+    }
+    if (row.score <= heap[0].score) {
+        return;
+    }
+    i = 0;
+    while (YES) {
+        UInt32 child = 2 * i + 1;
+        if (child >= count) {
+            break;
+        }
+        if (child + 1 < count && heap[child + 1].score < heap[child].score) {
+            child++;
+        }
+        if (heap[child].score >= row.score) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = row;
+}
+
+static int BNRCompareScoredRowsBestFirst(const void *a, const void *b)
+{
+    const BNRScoredRow *x = (const BNRScoredRow *)a;
+    const BNRScoredRow *y = (const BNRScoredRow *)b;
+    if (x->score != y->score) {
+        return (x->score > y->score) ? -1 : 1;
+    }
+    return (x->rowID < y->rowID) ? -1 : (x->rowID > y->rowID);
+}
+
+static int BNRComparePostingsByMaxScore(const void *a, const void *b)
+{
+    double x = ((const BNRTermPostings *)a)->maxScore;
+    double y = ((const BNRTermPostings *)b)->maxScore;
+    return (x < y) ? -1 : (x > y);
+}
+
+// Moves the list's position to the first row >= |rowID|, galloping from where it is
+static BOOL BNRPostingsAdvanceTo(BNRTermPostings *p, uint64_t rowID)
+{
+    int low = p->position;
+    int step = 1;
+    int high = low;
+    while (high < p->count && p->rowIDs[high] < rowID) {
+        low = high + 1;
+        high += step;
+        step *= 2;
+    }
+    if (high > p->count) {
+        high = p->count;
+    }
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (p->rowIDs[mid] < rowID) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    p->position = low;
+    return (low < p->count && p->rowIDs[low] == rowID);
+}
+
+- (UInt32)rankedRowsInClass:(Class)c
+               matchingText:(NSString *)toMatch
+                     forKey:(NSString *)key
+                      limit:(UInt32)limit
+                       list:(UInt32 **)listPtr
+{
+    NSArray *terms = BNRRankingTermsOfExpression(toMatch);
+    NSUInteger termCount = [terms count];
+    if (termCount == 0 || limit == 0) {
+        return 0;
+    }
+    
+    BNRTermPostings *postings = (BNRTermPostings *)calloc(termCount, sizeof(BNRTermPostings));
+    BNRScoredRow *top = (BNRScoredRow *)malloc(limit * sizeof(BNRScoredRow));
+    UInt32 topCount = 0;
+    BNRTextIndex *textIndex = nil;
+    
+    [indexLock lock];
+    @try {
+        textIndex = [self loadedIndexObjectForClass:c key:key];
+        [textIndex lock];
+        TCIDB *ti = [textIndex TCIDBFile];
+        double rowCount = (double)tcidbrnum(ti);
+        double averageLength = [textIndex averageTextLength];
+        
+        // Changes still in the queue are scored from their text, not from the index
+        NSDictionary *queued = nil;
+        if (indexQueue && [indexQueue count] > 0) {
+            BNRClassKey *ck = [[[BNRClassKey alloc] init] autorelease];
+            [ck setKeyClass:c];
+            [ck setKey:key];
+            NSMutableDictionary *changes = [NSMutableDictionary dictionary];
+            [indexQueue readChanges:changes forClassKey:ck afterSequence:0 limit:0 lastSequence:NULL];
+            queued = [changes objectForKey:ck];
+        }
+        
+        for (NSUInteger i = 0; i < termCount; i++) {
+            BNRTermPostings *p = &postings[i];
+            p->term = [terms objectAtIndex:i];
+            p->rowIDs = tcidbsearch(ti, [p->term UTF8String], IDBSSUBSTR, &p->count);
+            if (!p->rowIDs) {
+                p->count = 0;
+            }
+            double df = p->count;
+            p->idf = log(1.0 + (rowCount - df + 0.5) / (df + 0.5));
+            p->maxScore = p->idf * (kBNRRankK1 + 1.0);
+        }
+        
+        // Score the queued texts first; they only raise the bar for the index
+        for (NSNumber *rowID in queued) {
+            id value = [queued objectForKey:rowID];
+            if (value == [NSNull null]) {
+                continue;
+            }
+            BNRScoredRow row = { BNRScoreOfText(value, postings, termCount, averageLength), [rowID unsignedIntValue] };
+            if (row.score > 0.0) {
+                BNRTopRowsAdd(top, &topCount, limit, row);
+            }
+        }
+        
+        // MaxScore: with the terms in order of their best possible contribution,
+        // a row found only in the lists before |firstEssential| can't make the top
+        // |limit|, so candidates come only from the remaining ("essential") lists,
+        // and a candidate's text is read only if its bound beats the current bar.
+        qsort(postings, termCount, sizeof(BNRTermPostings), BNRComparePostingsByMaxScore);
+        
+        double *boundBefore = (double *)malloc((termCount + 1) * sizeof(double));
+        boundBefore[0] = 0.0;
+        for (NSUInteger i = 0; i < termCount; i++) {
+            boundBefore[i + 1] = boundBefore[i] + postings[i].maxScore;
+        }
+        
+        NSUInteger firstEssential = 0;
+        while (YES) {
+            double bar = (topCount == limit) ? top[0].score : 0.0;
+            while (firstEssential < termCount && boundBefore[firstEssential + 1] <= bar) {
+                firstEssential++;
+            }
+            if (firstEssential == termCount) {
+                break;  // nothing left can beat the rows we have
+            }
+            
+            uint64_t candidate = UINT64_MAX;
+            for (NSUInteger i = firstEssential; i < termCount; i++) {
+                BNRTermPostings *p = &postings[i];
+                if (p->position < p->count && p->rowIDs[p->position] < candidate) {
+                    candidate = p->rowIDs[p->position];
+                }
+            }
+            if (candidate == UINT64_MAX) {
+                break;
+            }
+            
+            double bound = boundBefore[firstEssential];
+            for (NSUInteger i = firstEssential; i < termCount; i++) {
+                BNRTermPostings *p = &postings[i];
+                if (p->position < p->count && p->rowIDs[p->position] == candidate) {
+                    bound += p->maxScore;
+                    p->position++;
+                }
+            }
+            // Tighten with the lists the candidate is really in
+            for (NSUInteger i = 0; i < firstEssential && bound > bar; i++) {
+                if (!BNRPostingsAdvanceTo(&postings[i], candidate)) {
+                    bound -= postings[i].maxScore;
+                }
+            }
+            if (bound <= bar || [queued objectForKey:[NSNumber numberWithUnsignedInt:(UInt32)candidate]]) {
+                continue;
+            }
+            
+            char *cText = tcidbget(ti, candidate);
+            if (!cText) {
+                continue;
+            }
+            NSString *text = [[NSString alloc] initWithUTF8String:cText];
+            free(cText);
+            BNRScoredRow row = { BNRScoreOfText(text, postings, termCount, averageLength), (UInt32)candidate };
+            [text release];
+            BNRTopRowsAdd(top, &topCount, limit, row);
+        }
+        free(boundBefore);
+    }
+    @finally {
+        [textIndex unlock];
+        [indexLock unlock];
+        for (NSUInteger i = 0; i < termCount; i++) {
+            free(postings[i].rowIDs);
+        }
+        free(postings);
+    }
+    
+    qsort(top, topCount, sizeof(BNRScoredRow), BNRCompareScoredRowsBestFirst);
+    if (listPtr && topCount > 0) {
+        UInt32 *outputBuffer = (UInt32 *)malloc(topCount * sizeof(UInt32));
+        for (UInt32 i = 0; i < topCount; i++) {
+            outputBuffer[i] = top[i].rowID;
+        }
+        *listPtr = outputBuffer;
+    }
+    free(top);
+    return topCount;
+}
+
+// MARK: Batched changes
+
+- (void)queueValueOfObject:(BNRStoredObject *)obj forKey:(NSString *)key withRowID:(UInt32)rowID inChanges:(NSMutableDictionary *)changes
+{
+	// Copy the value: it is read when the batch is applied, and the object may be
+	// edited (or gone) by then.  A nil value takes out whatever was indexed before.
+	NSString *value = [[obj valueForKey:key] copy];
+	[BNRChangesForClassKey(changes, [obj class], key) setObject:(value ? (id)value : (id)[NSNull null])
+														 forKey:[NSNumber numberWithUnsignedInt:rowID]];
+	[value release];
+}
+
+// The index objects that |changes| go into, loaded if need be.  The caller
+// must hold indexLock.
+- (NSDictionary *)indexObjectsForChanges:(NSDictionary *)changes
+{
+    NSMutableDictionary *indexObjects = [NSMutableDictionary dictionaryWithCapacity:[changes count]];
+    for (BNRClassKey *ck in changes) {
+        [indexObjects setObject:[self loadedIndexObjectForClass:[ck keyClass] key:[ck key]] forKey:ck];
+        [searchCache invalidateClassKey:ck];
+    }
+    return indexObjects;
+}
+
+// One pass per index, in rowID order.  tcidbput() replaces any text already
+// stored for the row, so an update needs no tcidbout() first.  With |sync|,
+// the q-gram cache is flushed into the index files once per index.  Takes
+// each index's own lock, so the caller need not hold indexLock.
+- (void)applyChanges:(NSDictionary *)changes toIndexes:(NSDictionary *)indexObjects syncing:(BOOL)sync
+{
+    for (BNRClassKey *ck in changes) {
+        NSDictionary *rowChanges = [changes objectForKey:ck];
+        BNRTextIndex *textIndex = [indexObjects objectForKey:ck];
+        TCIDB *ti = [textIndex TCIDBFile];
+        NSArray *rowIDs = [[rowChanges allKeys] sortedArrayUsingSelector:@selector(compare:)];
+        
+        [textIndex lock];
+        for (NSNumber *rowID in rowIDs) {
+            id value = [rowChanges objectForKey:rowID];
+            if (value == [NSNull null]) {
+                // Fails for rows that had no text to index, which is of no consequence
+                (void)tcidbout(ti, [rowID unsignedIntValue]);
+                continue;
+            }
+            const char *cValue = [value cStringUsingEncoding:NSUTF8StringEncoding];
+            if (cValue && !tcidbput(ti, [rowID unsignedIntValue], cValue)) {
+                NSLog(@"Insert of value %@ into text index for (class:%@, key:%@) failed", value, NSStringFromClass([ck keyClass]), [ck key]);
+            }
         }
         
-		[self insertValueOfObject:obj forKey:key withRowID:rowID intoTextIndex:ti];
+        if (sync && !tcidbmemsync(ti, 1)) {
+            NSLog(@"Sync of text index for (class:%@, key:%@) failed: %s", NSStringFromClass([ck keyClass]), [ck key], tcidberrmsg(tcidbecode(ti)));
+        }
+        [textIndex unlock];
     }
+}
+
+// The caller must hold indexLock
+- (void)applyChanges:(NSDictionary *)changes syncing:(BOOL)sync
+{
+    [self applyChanges:changes toIndexes:[self indexObjectsForChanges:changes] syncing:sync];
+}
+
+// The caller must hold indexLock
+- (BNRPrefixIndex *)loadedPrefixIndexForClass:(Class)c key:(NSString *)k
+{
+    BNRClassKey *ck = [[[BNRClassKey alloc] init] autorelease];
+    [ck setKeyClass:c];
+    [ck setKey:k];
     
-      
+    BNRPrefixIndex *pi = [prefixIndexes objectForKey:ck];
+    if (!pi) {
+        NSError *error = nil;
+        NSString *indexPath = [path stringByAppendingPathComponent:[BNRPrefixIndex standardIndexFilenameForClass:c key:k]];
+        pi = [[BNRPrefixIndex alloc] initWithPath:indexPath usesWriteSync:usesIndexFileWriteSync error:&error];
+        if (!pi) {
+            @throw [NSException exceptionWithName:@"DB Error (full text indexing)" 
+                                           reason:[error localizedDescription]
+                                         userInfo:[error userInfo]];
+        }
+        [prefixIndexes setObject:pi forKey:ck];
+        [pi release];
+    }
+    return pi;
+}
+
+// Applies the pending changes, or with background indexing hands them to the
+// queue.  Prefix indexes are cheap to update, so they never wait in the queue.
+- (void)flushPendingChangesSyncing:(BOOL)sync
+{
+    if ([pendingChanges count] == 0 && [pendingPrefixChanges count] == 0) {
+        return;
+    }
+    [indexLock lock];
+    @try {
+        for (BNRClassKey *ck in pendingPrefixChanges) {
+            [[self loadedPrefixIndexForClass:[ck keyClass] key:[ck key]] applyChanges:[pendingPrefixChanges objectForKey:ck]];
+        }
+        if ([pendingChanges count] == 0) {
+            return;
+        }
+        if (rebuild) {
+            [self recordChangesForRebuild:pendingChanges];
+        }
+        if (usesBackgroundIndexing) {
+            // Searches that include pending changes will see these now
+            for (BNRClassKey *ck in pendingChanges) {
+                [searchCache invalidateClassKey:ck];
+            }
+            if (![indexQueue appendChanges:pendingChanges]) {
+                // Don't lose them: apply them here instead
+                [self applyChanges:pendingChanges syncing:sync];
+            }
+            [indexLock broadcast];
+        } else {
+            [self applyChanges:pendingChanges syncing:sync];
+        }
+    }
+    @finally {
+        [indexLock unlock];
+        [pendingChanges removeAllObjects];
+        [pendingPrefixChanges removeAllObjects];
+    }
+}
+
+- (void)beginIndexBatch
+{
+    batchDepth++;
+}
+
+- (void)commitIndexBatch
+{
+    if (batchDepth == 0) {
+        return;
+    }
+    if (--batchDepth == 0) {
+        [self flushPendingChangesSyncing:YES];
+    }
+}
+
+- (void)discardIndexBatch
+{
+    if (batchDepth == 0) {
+        return;
+    }
+    if (--batchDepth == 0) {
+        [pendingChanges removeAllObjects];
+        [pendingPrefixChanges removeAllObjects];
+    }
+}
+
+// MARK: Search cache
+
+- (NSUInteger)searchCacheByteLimit
+{
+    return searchCacheByteLimit;
+}
+
+- (void)setSearchCacheByteLimit:(NSUInteger)limit
+{
+    [indexLock lock];
+    searchCacheByteLimit = limit;
+    [searchCache release];
+    searchCache = (limit > 0) ? [[BNRSearchCache alloc] initWithByteLimit:limit] : nil;
+    [indexLock unlock];
+}
+
+- (NSUInteger)searchCacheHitCount
+{
+    [indexLock lock];
+    NSUInteger count = searchCache ? searchCache->hitCount : 0;
+    [indexLock unlock];
+    return count;
+}
+
+- (NSUInteger)searchCacheMissCount
+{
+    [indexLock lock];
+    NSUInteger count = searchCache ? searchCache->missCount : 0;
+    [indexLock unlock];
+    return count;
+}
+
+- (double)searchCacheHitRate
+{
+    [indexLock lock];
+    NSUInteger lookups = searchCache ? searchCache->hitCount + searchCache->missCount : 0;
+    double rate = (lookups > 0) ? (double)searchCache->hitCount / lookups : 0.0;
+    [indexLock unlock];
+    return rate;
+}
+
+// MARK: Rebuilding
+
+- (void)beginRebuildOfIndexesForClass:(Class)c threadCount:(NSUInteger)n
+{
+    if (rebuild) {
+        @throw [NSException exceptionWithName:@"DB Error (full text indexing)"
+                                       reason:[NSString stringWithFormat:@"Already rebuilding the text indexes of %@", NSStringFromClass([rebuild rebuildClass])]
+                                     userInfo:nil];
+    }
+    BNRIndexRebuild *newRebuild = [[BNRIndexRebuild alloc] initWithClass:c
+                                                               directory:path
+                                                             threadCount:n
+                                                    usesIndexCompression:usesIndexFileCompression];
+    [indexLock lock];
+    rebuild = newRebuild;
+    rebuildChanges = [[NSMutableDictionary alloc] init];
+    [indexLock unlock];
+}
+
+// Keeps the changes to the class being rebuilt, as the scan may already have
+// read the records they were made to.  The caller must hold indexLock.
+- (void)recordChangesForRebuild:(NSDictionary *)changes
+{
+    for (BNRClassKey *ck in changes) {
+        if ([ck keyClass] == [rebuild rebuildClass]) {
+            [BNRChangesForClassKey(rebuildChanges, [ck keyClass], [ck key]) addEntriesFromDictionary:[changes objectForKey:ck]];
+        }
+    }
+}
+
+- (void)addObjectToRebuild:(BNRStoredObject *)obj
+{
+    [rebuild addObject:obj];
+}
+
+- (BOOL)commitRebuild
+{
+    // Saves go on being recorded until the new indexes are in
+    BOOL successful = [rebuild finish];
+    [indexLock lock];
+    BNRIndexRebuild *finished = rebuild;
+    NSDictionary *savedChanges = rebuildChanges;
+    rebuild = nil;
+    rebuildChanges = nil;
+    if (successful) {
+        @try {
+            // The background thread may be writing to an old index
+            while (backgroundThreadApplying) {
+                [indexLock wait];
+            }
+            // Closes the old indexes; the next search opens the new ones
+            for (NSString *k in [finished keys]) {
+                BNRClassKey *ck = [[BNRClassKey alloc] init];
+                [ck setKeyClass:[finished rebuildClass]];
+                [ck setKey:k];
+                [textIndexes removeObjectForKey:ck];
+                [searchCache invalidateClassKey:ck];
+                [ck release];
+            }
+            successful = [finished installIndexes];
+            if (successful) {
+                // Everything saved since the scan began goes into the new
+                // indexes again, in case the scan read the record before the save
+                [self applyChanges:savedChanges syncing:YES];
+            }
+            // Changes the background thread applied to the old indexes, but
+            // hasn't taken out of the queue, go into the new ones too
+            queueAppliedSequence = 0;
+        }
+        @finally {
+            [indexLock unlock];
+        }
+    } else {
+        [indexLock unlock];
+    }
+    if (!successful) {
+        [finished removeFiles];
+    }
+    [finished release];
+    [savedChanges release];
+    return successful;
+}
+
+- (void)discardRebuild
+{
+    [rebuild finish];
+    [rebuild removeFiles];
+    [indexLock lock];
+    [rebuild release];
+    rebuild = nil;
+    [rebuildChanges release];
+    rebuildChanges = nil;
+    [indexLock unlock];
+}
+
+// MARK: Background indexing
+
+- (BOOL)openIndexQueue:(NSError **)err
+{
+    if (!indexQueue) {
+        indexQueue = [[BNRIndexQueue alloc] initWithPath:[BNRIndexQueue queuePathInDirectory:path]
+                                           usesWriteSync:usesIndexFileWriteSync
+                                                   error:err];
+    }
+    return (indexQueue != nil);
+}
+
+// Applies up to |limit| queued changes (0 for all) and takes them out of the
+// queue.  Returns how many there were.  The caller must hold indexLock, or be
+// the only thread.
+- (NSUInteger)applyQueuedChangesLimit:(NSUInteger)limit
+{
+    if (!indexQueue) {
+        return 0;
+    }
+    NSMutableDictionary *changes = [[NSMutableDictionary alloc] init];
+    UInt64 last = 0;
+    NSUInteger count = [indexQueue readChanges:changes forClassKey:nil afterSequence:0 limit:limit lastSequence:&last];
+    if (count > 0) {
+        // Applied before they leave the queue: after a crash in between they
+        // are just applied again
+        [self applyChanges:changes syncing:YES];
+        [indexQueue removeChangesThroughSequence:last];
+    }
+    [changes release];
+    return count;
+}
+
+// Runs the background thread.  Only reading the queue and taking changes out
+// of it happen under indexLock; the changes are applied under each index's
+// own lock, so saves and searches of other indexes go on in the meantime.
+// Applied changes stay in the queue (searches keep seeing them there) until
+// the indexes are synced, which happens once the queue has been worked
+// through, or every kBNRIndexQueueSyncInterval changes while it keeps filling.
+- (void)drainQueueInBackground
+{
+    NSAutoreleasePool *threadPool = [[NSAutoreleasePool alloc] init];
+    NSMutableSet *unsyncedIndexes = [[NSMutableSet alloc] init];
+    NSUInteger unsyncedCount = 0;
+    BOOL finished = NO;
+    [indexLock lock];
+    while (!finished) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        NSMutableDictionary *changes = [NSMutableDictionary dictionary];
+        UInt64 last = queueAppliedSequence;
+        NSUInteger count = 0;
+        @try {
+            if (!backgroundThreadShouldStop && unsyncedCount < kBNRIndexQueueSyncInterval) {
+                count = [indexQueue readChanges:changes forClassKey:nil afterSequence:queueAppliedSequence limit:kBNRIndexQueueBatchSize lastSequence:&last];
+            }
+            if (count > 0) {
+                NSDictionary *indexObjects = [self indexObjectsForChanges:changes];
+                backgroundThreadApplying = YES;
+                [indexLock unlock];
+                @try {
+                    [self applyChanges:changes toIndexes:indexObjects syncing:NO];
+                }
+                @finally {
+                    [indexLock lock];
+                    backgroundThreadApplying = NO;
+                    [indexLock broadcast];
+                }
+                [unsyncedIndexes addObjectsFromArray:[indexObjects allValues]];
+                unsyncedCount += count;
+                queueAppliedSequence = last;
+            } else if ([unsyncedIndexes count] > 0) {
+                backgroundThreadApplying = YES;
+                [indexLock unlock];
+                @try {
+                    for (BNRTextIndex *textIndex in unsyncedIndexes) {
+                        [textIndex lock];
+                        if (!tcidbmemsync([textIndex TCIDBFile], 1)) {
+                            NSLog(@"Sync of text index %@ failed: %s", [textIndex indexDirectoryPath], tcidberrmsg(tcidbecode([textIndex TCIDBFile])));
+                        }
+                        [textIndex unlock];
+                    }
+                }
+                @finally {
+                    [indexLock lock];
+                    backgroundThreadApplying = NO;
+                }
+                [unsyncedIndexes removeAllObjects];
+                unsyncedCount = 0;
+                [indexQueue removeChangesThroughSequence:queueAppliedSequence];
+                // Wake anyone waiting for the indexes to catch up
+                [indexLock broadcast];
+            } else if (backgroundThreadShouldStop) {
+                finished = YES;
+            } else {
+                // Sleep until more is queued
+                [indexLock broadcast];
+                [indexLock wait];
+            }
+        }
+        @catch (NSException *e) {
+            NSLog(@"Background indexing stopped: %@", [e reason]);
+            backgroundThreadShouldStop = YES;
+            [unsyncedIndexes removeAllObjects];
+        }
+        [pool drain];
+    }
+    [unsyncedIndexes release];
+    backgroundThreadRunning = NO;
+    [indexLock broadcast];
+    [indexLock unlock];
+    [threadPool drain];
+}
+
+// The thread's entry point.  It holds the manager only weakly, so a manager
+// that is released without -close still goes away: -dealloc calls -close,
+// which stops the thread and waits for it to finish.
++ (void)drainQueueOfIndexManager:(NSValue *)weakManager
+{
+    [(BNRTCIndexManager *)[weakManager nonretainedObjectValue] drainQueueInBackground];
+}
+
+- (void)stopBackgroundThread
+{
+    [indexLock lock];
+    backgroundThreadShouldStop = YES;
+    [indexLock broadcast];
+    while (backgroundThreadRunning) {
+        [indexLock wait];
+    }
+    [indexLock unlock];
+}
+
+- (BOOL)usesBackgroundIndexing
+{
+    return usesBackgroundIndexing;
+}
+
+- (void)setUsesBackgroundIndexing:(BOOL)yn
+{
+    if (yn == usesBackgroundIndexing) {
+        return;
+    }
+    if (yn) {
+        NSError *error = nil;
+        if (![self openIndexQueue:&error]) {
+            @throw [NSException exceptionWithName:@"DB Error (full text indexing)" 
+                                           reason:[error localizedDescription]
+                                         userInfo:[error userInfo]];
+        }
+        [indexLock lock];
+        usesBackgroundIndexing = YES;
+        backgroundThreadShouldStop = NO;
+        backgroundThreadRunning = YES;
+        queueAppliedSequence = 0;
+        [indexLock unlock];
+        [NSThread detachNewThreadSelector:@selector(drainQueueOfIndexManager:)
+                                 toTarget:[BNRTCIndexManager class]
+                               withObject:[NSValue valueWithNonretainedObject:self]];
+    } else {
+        [self stopBackgroundThread];
+        [indexLock lock];
+        usesBackgroundIndexing = NO;
+        [self applyQueuedChangesLimit:0];
+        [indexLock unlock];
+    }
+}
+
+- (NSUInteger)countOfQueuedChanges
+{
+    [indexLock lock];
+    NSUInteger count = [indexQueue count];
+    [indexLock unlock];
+    return count;
+}
+
+- (void)waitUntilIndexesAreCurrent
+{
+    [indexLock lock];
+    while (backgroundThreadRunning && [indexQueue count] > 0) {
+        [indexLock wait];
+    }
+    // Without the thread, nobody else will apply them
+    if (!backgroundThreadRunning) {
+        [self applyQueuedChangesLimit:0];
+    }
+    [indexLock unlock];
+}
+
+// MARK: Index changes
+
+- (void)addChangesForObject:(BNRStoredObject *)obj
+{
+    UInt32 rowID = [obj rowID];
+    NSSet *indexKeys = [[obj class] textIndexedAttributes];
+    for (NSString *key in indexKeys) {
+        [self queueValueOfObject:obj forKey:key withRowID:rowID inChanges:pendingChanges];
+    }
+    for (NSString *key in [[obj class] prefixIndexedAttributes]) {
+        [self queueValueOfObject:obj forKey:key withRowID:rowID inChanges:pendingPrefixChanges];
+    }
+    if (batchDepth == 0) {
+        [self flushPendingChangesSyncing:NO];
+    }
+}
+
+- (void)insertObjectInIndexes:(BNRStoredObject *)obj
+{
+    [self addChangesForObject:obj];
+}
+
+- (void)deleteObjectFromIndexes:(BNRStoredObject *)obj
+{
+    Class c = [obj class];
+    NSNumber *rowID = [NSNumber numberWithUnsignedInt:[obj rowID]];
+    NSSet *indexKeys = [c textIndexedAttributes];
+    for (NSString *key in indexKeys) {
+        [BNRChangesForClassKey(pendingChanges, c, key) setObject:[NSNull null] forKey:rowID];
+    }
+    for (NSString *key in [c prefixIndexedAttributes]) {
+        [BNRChangesForClassKey(pendingPrefixChanges, c, key) setObject:[NSNull null] forKey:rowID];
+    }
+    if (batchDepth == 0) {
+        [self flushPendingChangesSyncing:NO];
+    }
+}
+
+- (void)updateObjectInIndexes:(BNRStoredObject *)obj
+{
+    [self addChangesForObject:obj];
 }
 @end
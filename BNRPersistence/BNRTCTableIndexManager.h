@@ -0,0 +1,63 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import <Foundation/Foundation.h>
+#import "BNRIndexManager.h"
+#include <tctdb.h>
+
+/*!
+ @class BNRTCTableIndexManager
+ @abstract Mirrors the tableIndexedAttributes of each class into a Tokyo
+ Cabinet table database, so conditions on several of them run inside TC
+ @discussion Each class gets a "<Class>.tct" table in the index directory, one
+ row per stored object, keyed by rowID.  Attributes declared as
+ BNRTableAttributeNumber get a decimal index and the rest a lexical one.
+
+ Queries are NSPredicates over those attributes: comparisons with a constant
+ (==, !=, <, <=, >, >=, BETWEEN and IN for numbers; ==, !=, BEGINSWITH,
+ ENDSWITH, CONTAINS, MATCHES and IN for strings), joined with AND, with NOT
+ around single comparisons, and ORs of those at the top.  Anything else, and
+ case- or diacritic-insensitive comparisons, raise NSInvalidArgumentException.
+ Full-text searches use TC's compound expressions on the attribute's column.
+
+ Changes are applied a save at a time, in one transaction per table.
+ */
+@interface BNRTCTableIndexManager : BNRIndexManager {
+    NSString *path;
+    NSMutableDictionary *tables;		// class name -> NSValue holding the TCTDB *
+    NSMutableDictionary *pendingRows;	// class name -> (rowID -> column name -> value, or NSNull to remove)
+    NSUInteger batchDepth;
+}
+
+- (id)initWithPath:(NSString *)p error:(NSError **)err;
+
+- (NSString *)path;
+
+/*!
+ @method tableForClass:
+ @abstract The table for |c|, opened (and its indexes made) when first needed
+ */
+- (TCTDB *)tableForClass:(Class)c;
+
+- (void)close;
+
+@end
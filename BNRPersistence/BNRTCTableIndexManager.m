@@ -0,0 +1,484 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "BNRTCTableIndexManager.h"
+#import "BNRStoredObject.h"
+#include <limits.h>
+
+@interface BNRTCTableIndexManager (Private)
+- (void)flushPendingRows;
+@end
+
+// MARK: -
+// MARK: Predicates
+// MARK: -
+// =============================//
+
+// How a value is kept in a table column, and written in a condition
+static NSString *BNRTableStringForValue(id value)
+{
+    if ([value isKindOfClass:[NSString class]]) {
+        return value;
+    }
+    if ([value isKindOfClass:[NSDate class]]) {
+        return [NSString stringWithFormat:@"%.17g", [value timeIntervalSinceReferenceDate]];
+    }
+    if ([value isKindOfClass:[NSNumber class]]) {
+        return [value stringValue];
+    }
+    return [value description];
+}
+
+static void BNRRaiseUnsupportedPredicate(NSPredicate *p, NSString *why)
+{
+    [NSException raise:NSInvalidArgumentException
+                format:@"BNRTCTableIndexManager can't evaluate %@: %@", p, why];
+}
+
+static void BNRAddComparisonToQuery(TDBQRY *qry, NSComparisonPredicate *p, NSDictionary *types, BOOL negated)
+{
+    if ([[p leftExpression] expressionType] != NSKeyPathExpressionType
+        || [[p rightExpression] expressionType] != NSConstantValueExpressionType) {
+        BNRRaiseUnsupportedPredicate(p, @"comparisons must be of an attribute with a constant");
+    }
+    if ([p comparisonPredicateModifier] != NSDirectPredicateModifier) {
+        BNRRaiseUnsupportedPredicate(p, @"ANY and ALL are not supported");
+    }
+    if ([p options] & (NSCaseInsensitivePredicateOption | NSDiacriticInsensitivePredicateOption)) {
+        BNRRaiseUnsupportedPredicate(p, @"table conditions are case and diacritic sensitive");
+    }
+    NSString *column = [[p leftExpression] keyPath];
+    NSNumber *type = [types objectForKey:column];
+    if (!type) {
+        BNRRaiseUnsupportedPredicate(p, [NSString stringWithFormat:@"%@ is not a table-indexed attribute", column]);
+    }
+    BOOL numeric = ([type intValue] == BNRTableAttributeNumber);
+    id value = [[p rightExpression] constantValue];
+    
+    int op = -1;
+    switch ([p predicateOperatorType]) {
+        case NSNotEqualToPredicateOperatorType:
+            negated = !negated;
+            // fall through
+        case NSEqualToPredicateOperatorType:
+            op = numeric ? TDBQCNUMEQ : TDBQCSTREQ;
+            break;
+        case NSLessThanPredicateOperatorType:
+            op = numeric ? TDBQCNUMLT : -1;
+            break;
+        case NSLessThanOrEqualToPredicateOperatorType:
+            op = numeric ? TDBQCNUMLE : -1;
+            break;
+        case NSGreaterThanPredicateOperatorType:
+            op = numeric ? TDBQCNUMGT : -1;
+            break;
+        case NSGreaterThanOrEqualToPredicateOperatorType:
+            op = numeric ? TDBQCNUMGE : -1;
+            break;
+        case NSBetweenPredicateOperatorType:
+            op = numeric ? TDBQCNUMBT : -1;
+            break;
+        case NSInPredicateOperatorType:
+            op = numeric ? TDBQCNUMOREQ : TDBQCSTROREQ;
+            break;
+        case NSBeginsWithPredicateOperatorType:
+            op = numeric ? -1 : TDBQCSTRBW;
+            break;
+        case NSEndsWithPredicateOperatorType:
+            op = numeric ? -1 : TDBQCSTREW;
+            break;
+        case NSContainsPredicateOperatorType:
+            op = numeric ? -1 : TDBQCSTRINC;
+            break;
+        case NSMatchesPredicateOperatorType:
+            op = numeric ? -1 : TDBQCSTRRX;
+            break;
+        default:
+            break;
+    }
+    if (op < 0) {
+        BNRRaiseUnsupportedPredicate(p, [NSString stringWithFormat:@"no such condition on %@ %@", (numeric ? @"number" : @"string"), column]);
+    }
+    
+    // BETWEEN and IN take their operands as a list of tokens
+    NSString *expr;
+    if (op == TDBQCNUMBT || op == TDBQCNUMOREQ || op == TDBQCSTROREQ) {
+        if (![value respondsToSelector:@selector(objectEnumerator)]) {
+            BNRRaiseUnsupportedPredicate(p, @"BETWEEN and IN need a collection");
+        }
+        NSMutableArray *tokens = [NSMutableArray array];
+        for (id v in value) {
+            [tokens addObject:BNRTableStringForValue(v)];
+        }
+        expr = [tokens componentsJoinedByString:@","];
+    } else {
+        expr = BNRTableStringForValue(value);
+    }
+    tctdbqryaddcond(qry, [column UTF8String], op | (negated ? TDBQCNEGATE : 0), [expr UTF8String]);
+}
+
+// Adds |p|, which must be a conjunction, to |qry|
+static void BNRAddConjunctionToQuery(TDBQRY *qry, NSPredicate *p, NSDictionary *types)
+{
+    if ([p isKindOfClass:[NSComparisonPredicate class]]) {
+        BNRAddComparisonToQuery(qry, (NSComparisonPredicate *)p, types, NO);
+        return;
+    }
+    if (![p isKindOfClass:[NSCompoundPredicate class]]) {
+        BNRRaiseUnsupportedPredicate(p, @"only comparisons, AND, NOT and OR are supported");
+    }
+    NSCompoundPredicate *compound = (NSCompoundPredicate *)p;
+    NSArray *subpredicates = [compound subpredicates];
+    switch ([compound compoundPredicateType]) {
+        case NSAndPredicateType:
+            for (NSPredicate *sub in subpredicates) {
+                BNRAddConjunctionToQuery(qry, sub, types);
+            }
+            break;
+        case NSNotPredicateType:
+            if ([subpredicates count] != 1 || ![[subpredicates lastObject] isKindOfClass:[NSComparisonPredicate class]]) {
+                BNRRaiseUnsupportedPredicate(p, @"NOT only goes around a single comparison");
+            }
+            BNRAddComparisonToQuery(qry, [subpredicates lastObject], types, YES);
+            break;
+        default:
+            BNRRaiseUnsupportedPredicate(p, @"OR only goes at the top");
+            break;
+    }
+}
+
+// MARK: -
+// MARK: Public Classes
+// MARK: -
+// =============================//
+
+@implementation BNRTCTableIndexManager
+
+- (id)initWithPath:(NSString *)p error:(NSError **)err
+{
+    self = [super init];
+    if (self) {
+        path = [p copy];
+        
+        BOOL isDir;
+        if ([[NSFileManager defaultManager] fileExistsAtPath:path isDirectory:&isDir]) {
+            if (!isDir) {
+                if (err) {
+                    NSMutableDictionary *ui = [NSMutableDictionary dictionary];
+                    [ui setObject:[NSString stringWithFormat:@"%@ is a file", path]
+                           forKey:NSLocalizedDescriptionKey];
+                    *err = [NSError errorWithDomain:@"BNRPersistence (BNRTCTableIndexManager)"
+                                               code:4
+                                           userInfo:ui];
+                }
+                [self release];
+                return nil;
+            }
+        } else if (![[NSFileManager defaultManager] createDirectoryAtPath:path
+                                              withIntermediateDirectories:YES
+                                                               attributes:nil
+                                                                    error:err]) {
+            [self release];
+            return nil;
+        }
+        
+        tables = [[NSMutableDictionary alloc] init];
+        pendingRows = [[NSMutableDictionary alloc] init];
+    }
+    return self;
+}
+
+- (void)close
+{
+    [pendingRows removeAllObjects];
+    for (NSValue *v in [tables allValues]) {
+        tctdbdel((TCTDB *)[v pointerValue]);
+    }
+    [tables removeAllObjects];
+}
+
+- (void)dealloc
+{
+    [self close];
+    [pendingRows release];
+    [tables release];
+    [path release];
+    [super dealloc];
+}
+
+- (NSString *)path
+{
+    return path;
+}
+
+- (TCTDB *)tableForClass:(Class)c
+{
+    NSString *className = NSStringFromClass(c);
+    NSValue *v = [tables objectForKey:className];
+    if (v) {
+        return (TCTDB *)[v pointerValue];
+    }
+    
+    NSString *tablePath = [path stringByAppendingPathComponent:[className stringByAppendingPathExtension:@"tct"]];
+    TCTDB *tdb = tctdbnew();
+    if (!tctdbopen(tdb, [tablePath fileSystemRepresentation], TDBOREADER | TDBOWRITER | TDBONOLCK | TDBOCREAT)) {
+        NSString *msg = [NSString stringWithFormat:@"Unable to open table index at path:%@, error %s", tablePath, tctdberrmsg(tctdbecode(tdb))];
+        NSLog(@"%@", msg);
+        tctdbdel(tdb);
+        @throw [NSException exceptionWithName:@"DB Error (table indexing)" 
+                                       reason:msg
+                                     userInfo:nil];
+    }
+    
+    // TDBITKEEP makes this a no-op for indexes made before
+    NSDictionary *types = [c tableIndexedAttributes];
+    for (NSString *column in types) {
+        int type = ([[types objectForKey:column] intValue] == BNRTableAttributeNumber) ? TDBITDECIMAL : TDBITLEXICAL;
+        (void)tctdbsetindex(tdb, [column UTF8String], type | TDBITKEEP);
+    }
+    
+    [tables setObject:[NSValue valueWithPointer:tdb] forKey:className];
+    return tdb;
+}
+
+// MARK: Searching
+
+- (UInt32)countOfRowsInClass:(Class)c
+           matchingPredicate:(NSPredicate *)predicate
+              sortDescriptor:(NSSortDescriptor *)sortDescriptor
+                       limit:(NSUInteger)limit
+                        list:(UInt32 **)listPtr
+{
+    NSDictionary *types = [c tableIndexedAttributes];
+    TCTDB *tdb = [self tableForClass:c];
+    
+    // An OR at the top becomes a union of one query per alternative
+    NSArray *alternatives = [NSArray arrayWithObject:predicate];
+    if ([predicate isKindOfClass:[NSCompoundPredicate class]]
+        && [(NSCompoundPredicate *)predicate compoundPredicateType] == NSOrPredicateType) {
+        alternatives = [(NSCompoundPredicate *)predicate subpredicates];
+    }
+    int queryCount = (int)[alternatives count];
+    if (queryCount == 0) {
+        return 0;
+    }
+    TDBQRY **queries = (TDBQRY **)calloc(queryCount, sizeof(TDBQRY *));
+    TCLIST *rows = NULL;
+    
+    @try {
+        for (int i = 0; i < queryCount; i++) {
+            queries[i] = tctdbqrynew(tdb);
+            BNRAddConjunctionToQuery(queries[i], [alternatives objectAtIndex:i], types);
+        }
+        
+        // The union is sorted and cut by the first query's settings
+        if (sortDescriptor) {
+            NSNumber *type = [types objectForKey:[sortDescriptor key]];
+            if (!type) {
+                [NSException raise:NSInvalidArgumentException
+                            format:@"Can't sort on %@: not a table-indexed attribute", [sortDescriptor key]];
+            }
+            int order;
+            if ([type intValue] == BNRTableAttributeNumber) {
+                order = [sortDescriptor ascending] ? TDBQONUMASC : TDBQONUMDESC;
+            } else {
+                order = [sortDescriptor ascending] ? TDBQOSTRASC : TDBQOSTRDESC;
+            }
+            tctdbqrysetorder(queries[0], [[sortDescriptor key] UTF8String], order);
+        }
+        if (limit > 0) {
+            tctdbqrysetlimit(queries[0], (int)MIN(limit, INT_MAX), 0);
+        }
+        
+        rows = (queryCount == 1) ? tctdbqrysearch(queries[0]) : tctdbmetasearch(queries, queryCount, TDBMSUNION);
+    }
+    @finally {
+        for (int i = 0; i < queryCount; i++) {
+            if (queries[i]) {
+                tctdbqrydel(queries[i]);
+            }
+        }
+        free(queries);
+    }
+    
+    UInt32 rowCount = (UInt32)tclistnum(rows);
+    if (limit > 0 && rowCount > limit) {
+        rowCount = (UInt32)limit;
+    }
+    if (listPtr && rowCount > 0) {
+        UInt32 *outputBuffer = (UInt32 *)malloc(rowCount * sizeof(UInt32));
+        for (UInt32 i = 0; i < rowCount; i++) {
+            outputBuffer[i] = (UInt32)strtoul(tclistval2(rows, i), NULL, 10);
+        }
+        *listPtr = outputBuffer;
+    }
+    tclistdel(rows);
+    return rowCount;
+}
+
+- (UInt32)countOfRowsInClass:(Class)c 
+                matchingText:(NSString *)toMatch
+                      forKey:(NSString *)key
+                        list:(UInt32 **)listPtr
+{
+    if (![[c tableIndexedAttributes] objectForKey:key]) {
+        return 0;
+    }
+    TDBQRY *query = tctdbqrynew([self tableForClass:c]);
+    tctdbqryaddcond(query, [key UTF8String], TDBQCFTSEX, [toMatch UTF8String]);
+    TCLIST *rows = tctdbqrysearch(query);
+    tctdbqrydel(query);
+    
+    UInt32 rowCount = (UInt32)tclistnum(rows);
+    if (listPtr && rowCount > 0) {
+        UInt32 *outputBuffer = (UInt32 *)malloc(rowCount * sizeof(UInt32));
+        for (UInt32 i = 0; i < rowCount; i++) {
+            outputBuffer[i] = (UInt32)strtoul(tclistval2(rows, i), NULL, 10);
+        }
+        *listPtr = outputBuffer;
+    }
+    tclistdel(rows);
+    return rowCount;
+}
+
+// MARK: Batched changes
+
+- (void)flushPendingRows
+{
+    for (NSString *className in pendingRows) {
+        NSDictionary *rowChanges = [pendingRows objectForKey:className];
+        TCTDB *tdb = [self tableForClass:NSClassFromString(className)];
+        if (!tctdbtranbegin(tdb)) {
+            NSLog(@"tctdbtranbegin() failed for table index of %@: %s", className, tctdberrmsg(tctdbecode(tdb)));
+            continue;
+        }
+        
+        BOOL successful = YES;
+        NSArray *rowIDs = [[rowChanges allKeys] sortedArrayUsingSelector:@selector(compare:)];
+        for (NSNumber *rowID in rowIDs) {
+            char pkbuf[16];
+            int pksiz = snprintf(pkbuf, sizeof(pkbuf), "%u", [rowID unsignedIntValue]);
+            NSDictionary *columns = [rowChanges objectForKey:rowID];
+            if ((id)columns == [NSNull null]) {
+                // Fails for rows that were never put, which is of no consequence
+                (void)tctdbout(tdb, pkbuf, pksiz);
+                continue;
+            }
+            TCMAP *cols = tcmapnew2([columns count] + 1);
+            for (NSString *column in columns) {
+                tcmapput2(cols, [column UTF8String], [[columns objectForKey:column] UTF8String]);
+            }
+            successful = tctdbput(tdb, pkbuf, pksiz, cols);
+            tcmapdel(cols);
+            if (!successful) {
+                break;
+            }
+        }
+        
+        if (!successful || !tctdbtrancommit(tdb)) {
+            NSLog(@"Updating table index of %@ failed: %s", className, tctdberrmsg(tctdbecode(tdb)));
+            tctdbtranabort(tdb);
+        }
+    }
+    [pendingRows removeAllObjects];
+}
+
+- (NSMutableDictionary *)pendingRowsForClass:(Class)c
+{
+    NSString *className = NSStringFromClass(c);
+    NSMutableDictionary *rowChanges = [pendingRows objectForKey:className];
+    if (!rowChanges) {
+        rowChanges = [NSMutableDictionary dictionary];
+        [pendingRows setObject:rowChanges forKey:className];
+    }
+    return rowChanges;
+}
+
+- (void)beginIndexBatch
+{
+    batchDepth++;
+}
+
+- (void)commitIndexBatch
+{
+    if (batchDepth == 0) {
+        return;
+    }
+    if (--batchDepth == 0) {
+        [self flushPendingRows];
+    }
+}
+
+- (void)discardIndexBatch
+{
+    if (batchDepth == 0) {
+        return;
+    }
+    if (--batchDepth == 0) {
+        [pendingRows removeAllObjects];
+    }
+}
+
+// MARK: Index changes
+
+- (void)putObject:(BNRStoredObject *)obj
+{
+    NSDictionary *types = [[obj class] tableIndexedAttributes];
+    if ([types count] == 0) {
+        return;
+    }
+    // Strings now: the object may be edited (or gone) by the time the batch is applied
+    NSMutableDictionary *columns = [NSMutableDictionary dictionaryWithCapacity:[types count]];
+    for (NSString *column in types) {
+        id value = [obj valueForKey:column];
+        if (value) {
+            [columns setObject:[[BNRTableStringForValue(value) copy] autorelease] forKey:column];
+        }
+    }
+    [[self pendingRowsForClass:[obj class]] setObject:columns forKey:[NSNumber numberWithUnsignedInt:[obj rowID]]];
+    if (batchDepth == 0) {
+        [self flushPendingRows];
+    }
+}
+
+- (void)insertObjectInIndexes:(BNRStoredObject *)obj
+{
+    [self putObject:obj];
+}
+
+- (void)updateObjectInIndexes:(BNRStoredObject *)obj
+{
+    [self putObject:obj];
+}
+
+- (void)deleteObjectFromIndexes:(BNRStoredObject *)obj
+{
+    if ([[[obj class] tableIndexedAttributes] count] == 0) {
+        return;
+    }
+    [[self pendingRowsForClass:[obj class]] setObject:[NSNull null] forKey:[NSNumber numberWithUnsignedInt:[obj rowID]]];
+    if (batchDepth == 0) {
+        [self flushPendingRows];
+    }
+}
+
+@end
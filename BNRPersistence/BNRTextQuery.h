@@ -0,0 +1,70 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#import <Foundation/Foundation.h>
+@class BNRIndexManager;
+
+typedef enum {
+    BNRTextQueryMatch = 0,      // one key's index matches some text
+    BNRTextQueryAnd,            // every subquery matches
+    BNRTextQueryOr,             // any subquery matches
+    BNRTextQueryExcluding       // the first subquery matches and the second doesn't
+} BNRTextQueryType;
+
+/*!
+ @class BNRTextQuery
+ @abstract A boolean full-text query across several text-indexed keys of a class
+ @discussion Evaluated on sorted rowID lists before any object is made.  An AND
+ evaluates its subqueries (giving up as soon as one matches nothing), then
+ starts with the one that matched the fewest rows.  Each further list is
+ intersected by galloping through it from the smaller side.
+ */
+@interface BNRTextQuery : NSObject {
+    BNRTextQueryType queryType;
+    NSString *key;
+    NSString *text;
+    NSArray *subqueries;
+}
+
++ (BNRTextQuery *)queryWithKey:(NSString *)k matchingText:(NSString *)t;
++ (BNRTextQuery *)andQueryWithSubqueries:(NSArray *)qs;
++ (BNRTextQuery *)orQueryWithSubqueries:(NSArray *)qs;
++ (BNRTextQuery *)query:(BNRTextQuery *)q excluding:(BNRTextQuery *)ex;
+
+- (BNRTextQueryType)queryType;
+- (NSString *)key;
+- (NSString *)text;
+- (NSArray *)subqueries;
+
+/*!
+ @method countOfRowsInClass:indexManager:list:
+ @abstract Evaluates the query with |im|'s indexes
+ @discussion Like -[BNRIndexManager countOfRowsInClass:matchingText:forKey:list:]:
+ if the count is not 0, |*listPtr| is a malloc'd array of that many rowIDs,
+ in ascending order, for the caller to free.
+ */
+- (UInt32)countOfRowsInClass:(Class)c
+                indexManager:(BNRIndexManager *)im
+                        list:(UInt32 **)listPtr;
+
+@end
@@ -0,0 +1,282 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "BNRTextQuery.h"
+#import "BNRIndexManager.h"
+
+// A sorted list of rowIDs; |rowIDs| is malloc'd, or NULL when |count| is 0
+typedef struct {
+    UInt32 *rowIDs;
+    UInt32 count;
+} BNRRowList;
+
+// Shortest list first
+static int BNRCompareRowListCounts(const void *a, const void *b)
+{
+    UInt32 x = ((const BNRRowList *)a)->count;
+    UInt32 y = ((const BNRRowList *)b)->count;
+    return (x < y) ? -1 : (x > y);
+}
+
+// The first index at or after |from| whose rowID is >= |rowID|
+static UInt32 BNRGallop(const UInt32 *rowIDs, UInt32 count, UInt32 from, UInt32 rowID)
+{
+    UInt32 low = from;
+    UInt32 high = from;
+    UInt32 step = 1;
+    while (high < count && rowIDs[high] < rowID) {
+        low = high + 1;
+        high += step;
+        step *= 2;
+    }
+    if (high > count) {
+        high = count;
+    }
+    while (low < high) {
+        UInt32 mid = low + (high - low) / 2;
+        if (rowIDs[mid] < rowID) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Keeps the rows of |a| that are (or with |excluding|, are not) in |b|, in place.
+// Walks the smaller list and gallops through the other.
+static void BNRFilterRowList(BNRRowList *a, BNRRowList b, BOOL excluding)
+{
+    UInt32 kept = 0;
+    if (!excluding && b.count < a->count) {
+        UInt32 at = 0;
+        for (UInt32 i = 0; i < b.count && at < a->count; i++) {
+            at = BNRGallop(a->rowIDs, a->count, at, b.rowIDs[i]);
+            if (at < a->count && a->rowIDs[at] == b.rowIDs[i]) {
+                a->rowIDs[kept++] = a->rowIDs[at++];
+            }
+        }
+    } else {
+        UInt32 at = 0;
+        for (UInt32 i = 0; i < a->count; i++) {
+            at = BNRGallop(b.rowIDs, b.count, at, a->rowIDs[i]);
+            BOOL found = (at < b.count && b.rowIDs[at] == a->rowIDs[i]);
+            if (found != excluding) {
+                a->rowIDs[kept++] = a->rowIDs[i];
+            }
+        }
+    }
+    a->count = kept;
+    if (kept == 0) {
+        free(a->rowIDs);
+        a->rowIDs = NULL;
+    }
+}
+
+static BNRRowList BNRUniteRowLists(BNRRowList a, BNRRowList b)
+{
+    BNRRowList u = { NULL, 0 };
+    if (a.count + b.count > 0) {
+        u.rowIDs = (UInt32 *)malloc((a.count + b.count) * sizeof(UInt32));
+    }
+    UInt32 i = 0, j = 0;
+    while (i < a.count || j < b.count) {
+        UInt32 next;
+        if (j >= b.count || (i < a.count && a.rowIDs[i] < b.rowIDs[j])) {
+            next = a.rowIDs[i++];
+        } else if (i >= a.count || b.rowIDs[j] < a.rowIDs[i]) {
+            next = b.rowIDs[j++];
+        } else {
+            next = a.rowIDs[i++];
+            j++;
+        }
+        u.rowIDs[u.count++] = next;
+    }
+    free(a.rowIDs);
+    free(b.rowIDs);
+    return u;
+}
+
+@interface BNRTextQuery ()
+- (id)initWithType:(BNRTextQueryType)t key:(NSString *)k text:(NSString *)s subqueries:(NSArray *)qs;
+- (BNRRowList)rowListInClass:(Class)c indexManager:(BNRIndexManager *)im;
+@end
+
+@implementation BNRTextQuery
+
+- (id)initWithType:(BNRTextQueryType)t key:(NSString *)k text:(NSString *)s subqueries:(NSArray *)qs
+{
+    self = [super init];
+    if (self) {
+        queryType = t;
+        key = [k copy];
+        text = [s copy];
+        subqueries = [qs copy];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [key release];
+    [text release];
+    [subqueries release];
+    [super dealloc];
+}
+
++ (BNRTextQuery *)queryWithKey:(NSString *)k matchingText:(NSString *)t
+{
+    return [[[self alloc] initWithType:BNRTextQueryMatch key:k text:t subqueries:nil] autorelease];
+}
+
++ (BNRTextQuery *)andQueryWithSubqueries:(NSArray *)qs
+{
+    return [[[self alloc] initWithType:BNRTextQueryAnd key:nil text:nil subqueries:qs] autorelease];
+}
+
++ (BNRTextQuery *)orQueryWithSubqueries:(NSArray *)qs
+{
+    return [[[self alloc] initWithType:BNRTextQueryOr key:nil text:nil subqueries:qs] autorelease];
+}
+
++ (BNRTextQuery *)query:(BNRTextQuery *)q excluding:(BNRTextQuery *)ex
+{
+    return [[[self alloc] initWithType:BNRTextQueryExcluding
+                                   key:nil
+                                  text:nil
+                            subqueries:[NSArray arrayWithObjects:q, ex, nil]] autorelease];
+}
+
+- (BNRTextQueryType)queryType
+{
+    return queryType;
+}
+
+- (NSString *)key
+{
+    return key;
+}
+
+- (NSString *)text
+{
+    return text;
+}
+
+- (NSArray *)subqueries
+{
+    return subqueries;
+}
+
+- (NSString *)description
+{
+    switch (queryType) {
+        case BNRTextQueryMatch:
+            return [NSString stringWithFormat:@"%@ ~ \"%@\"", key, text];
+        case BNRTextQueryAnd:
+            return [NSString stringWithFormat:@"(%@)", [[subqueries valueForKey:@"description"] componentsJoinedByString:@" AND "]];
+        case BNRTextQueryOr:
+            return [NSString stringWithFormat:@"(%@)", [[subqueries valueForKey:@"description"] componentsJoinedByString:@" OR "]];
+        case BNRTextQueryExcluding:
+            return [NSString stringWithFormat:@"(%@ EXCLUDING %@)", [subqueries objectAtIndex:0], [subqueries objectAtIndex:1]];
+    }
+    return [super description];
+}
+
+- (BNRRowList)rowListInClass:(Class)c indexManager:(BNRIndexManager *)im
+{
+    BNRRowList result = { NULL, 0 };
+    switch (queryType) {
+        case BNRTextQueryMatch: {
+            UInt32 *list = NULL;
+            result.count = [im countOfRowsInClass:c matchingText:text forKey:key list:&list];
+            if (result.count > 0) {
+                result.rowIDs = list;
+                BNRSortRowIDs(result.rowIDs, result.count);
+            }
+            break;
+        }
+        case BNRTextQueryAnd: {
+            // Evaluate every subquery (stopping at the first that matches
+            // nothing), then intersect starting from the shortest list.
+            NSUInteger n = [subqueries count];
+            if (n == 0) {
+                break;
+            }
+            BNRRowList *lists = (BNRRowList *)malloc(n * sizeof(BNRRowList));
+            NSUInteger evaluated = 0;
+            BOOL empty = NO;
+            for (BNRTextQuery *q in subqueries) {
+                lists[evaluated] = [q rowListInClass:c indexManager:im];
+                if (lists[evaluated++].count == 0) {
+                    empty = YES;
+                    break;
+                }
+            }
+            if (empty) {
+                for (NSUInteger i = 0; i < evaluated; i++) {
+                    free(lists[i].rowIDs);
+                }
+            } else {
+                qsort(lists, evaluated, sizeof(BNRRowList), BNRCompareRowListCounts);
+                result = lists[0];
+                for (NSUInteger i = 1; i < evaluated; i++) {
+                    if (result.count > 0) {
+                        BNRFilterRowList(&result, lists[i], NO);
+                    }
+                    free(lists[i].rowIDs);
+                }
+            }
+            free(lists);
+            break;
+        }
+        case BNRTextQueryOr:
+            for (BNRTextQuery *q in subqueries) {
+                result = BNRUniteRowLists(result, [q rowListInClass:c indexManager:im]);
+            }
+            break;
+        case BNRTextQueryExcluding: {
+            result = [[subqueries objectAtIndex:0] rowListInClass:c indexManager:im];
+            if (result.count > 0) {
+                BNRRowList excluded = [[subqueries objectAtIndex:1] rowListInClass:c indexManager:im];
+                BNRFilterRowList(&result, excluded, YES);
+                free(excluded.rowIDs);
+            }
+            break;
+        }
+    }
+    return result;
+}
+
+- (UInt32)countOfRowsInClass:(Class)c
+                indexManager:(BNRIndexManager *)im
+                        list:(UInt32 **)listPtr
+{
+    BNRRowList result = [self rowListInClass:c indexManager:im];
+    if (listPtr && result.count > 0) {
+        *listPtr = result.rowIDs;
+    } else {
+        free(result.rowIDs);
+    }
+    return result.count;
+}
+
+@end
@@ -0,0 +1,76 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#import <Foundation/Foundation.h>
+@class BNRArena;
+@class BNRDataBuffer;
+
+/*!
+ @class BNRUndoJournal
+ @abstract Holds the undo snapshots a BNRStore registers with its undo manager
+ @discussion Snapshots are encoded into one reusable scratch buffer and then copied
+ into the current segment, a BNRArena shared by every snapshot taken in the same
+ undo group.  Each snapshot retains its segment, so when the undo manager drops a
+ group (or clears its stack) the whole segment is freed at once.
+
+ The journal starts a new segment whenever its undo manager opens a group, undoes
+ or redoes, and before a registration that will open a group by event.
+ */
+@interface BNRUndoJournal : NSObject {
+    NSUndoManager *undoManager;     // not retained; the store owns both
+    BNRArena *currentSegment;
+    CFMutableSetRef snapshottedObjects; // objects with an update snapshot in currentSegment
+    BNRDataBuffer *scratchBuffer;
+    BOOL expectingGroup;            // the segment was started for a group about to be opened
+}
+
+- (id)initWithUndoManager:(NSUndoManager *)um;
+
+/*!
+ @method scratchBuffer
+ @abstract An empty buffer to encode a snapshot into before calling snapshotOfBuffer:
+ */
+- (BNRDataBuffer *)scratchBuffer;
+
+/*!
+ @method snapshotOfBuffer:
+ @abstract Copies the contents of |b| into the current segment
+ @discussion The returned buffer is autoreleased and its cursor is at the start.
+ */
+- (BNRDataBuffer *)snapshotOfBuffer:(BNRDataBuffer *)b;
+
+/*!
+ @method needsUpdateSnapshotOfObject:
+ @abstract Returns NO if |obj| already has an update snapshot in the current undo group
+ @discussion Undoing a group restores the oldest snapshot of each object last, so
+ later snapshots of the same object within the group are never seen.
+ */
+- (BOOL)needsUpdateSnapshotOfObject:(id)obj;
+
+/*!
+ @method startNewSegment
+ @abstract Snapshots taken after this go into a fresh segment
+ */
+- (void)startNewSegment;
+
+@end
@@ -0,0 +1,124 @@
+// The MIT License
+//
+// Copyright (c) 2008 Big Nerd Ranch, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#import "BNRUndoJournal.h"
+#import "BNRArena.h"
+#import "BNRDataBuffer.h"
+
+#define kBNRUndoJournalChunkSize (256 * 1024)
+
+@implementation BNRUndoJournal
+
+- (id)initWithUndoManager:(NSUndoManager *)um
+{
+    self = [super init];
+    if (self) {
+        undoManager = um;
+        scratchBuffer = [[BNRDataBuffer alloc] initWithCapacity:4096];
+        snapshottedObjects = CFSetCreateMutable(kCFAllocatorDefault, 0, NULL); // pointer identity, no retain
+        [self startNewSegment];
+        
+        NSNotificationCenter *nc = [NSNotificationCenter defaultCenter];
+        [nc addObserver:self
+               selector:@selector(undoManagerChangedGroup:)
+                   name:NSUndoManagerDidOpenUndoGroupNotification
+                 object:um];
+        [nc addObserver:self
+               selector:@selector(undoManagerChangedGroup:)
+                   name:NSUndoManagerWillUndoChangeNotification
+                 object:um];
+        [nc addObserver:self
+               selector:@selector(undoManagerChangedGroup:)
+                   name:NSUndoManagerWillRedoChangeNotification
+                 object:um];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    CFRelease(snapshottedObjects);
+    [currentSegment release];
+    [scratchBuffer release];
+    [super dealloc];
+}
+
+- (void)undoManagerChangedGroup:(NSNotification *)note
+{
+    if (expectingGroup && [[note name] isEqual:NSUndoManagerDidOpenUndoGroupNotification]) {
+        expectingGroup = NO;
+        return;
+    }
+    expectingGroup = NO;
+    [self startNewSegment];
+}
+
+// With groupsByEvent, the first registration in an event opens the group
+// *after* the snapshot is taken, so that snapshot has to start the segment.
+- (void)checkForImplicitGroup
+{
+    if (!expectingGroup && [undoManager groupingLevel] == 0) {
+        [self startNewSegment];
+        expectingGroup = YES;
+    }
+}
+
+- (void)startNewSegment
+{
+    // Snapshots already taken keep the old segment alive
+    [currentSegment release];
+    currentSegment = [[BNRArena alloc] initWithChunkSize:kBNRUndoJournalChunkSize];
+    CFSetRemoveAllValues(snapshottedObjects);
+}
+
+- (BNRDataBuffer *)scratchBuffer
+{
+    [scratchBuffer clearBuffer];
+    return scratchBuffer;
+}
+
+- (BNRDataBuffer *)snapshotOfBuffer:(BNRDataBuffer *)b
+{
+    [self checkForImplicitGroup];
+    
+    unsigned length = [b length];
+    void *bytes = [currentSegment copyBytes:[b buffer] length:length];
+    BNRDataBuffer *snapshot = [[BNRDataBuffer alloc] initWithBytesNoCopy:bytes
+                                                                  length:length
+                                                                   owner:currentSegment];
+    return [snapshot autorelease];
+}
+
+- (BOOL)needsUpdateSnapshotOfObject:(id)obj
+{
+    [self checkForImplicitGroup];
+    
+    if (CFSetContainsValue(snapshottedObjects, obj)) {
+        return NO;
+    }
+    CFSetAddValue(snapshottedObjects, obj);
+    return YES;
+}
+
+@end
@@ -10,6 +10,8 @@
 #import "BNRDataBuffer.h"
 #import "BNRDataBuffer+Encryption.h"
 #import "BNRCrypto.h"
+#import "BNRRecordCipher.h"
+#import "BNRCryptoPipeline.h"
 
 @interface BufferEncryptionTests : SenTestCase {
     BNRDataBuffer *buffer;
@@ -96,5 +98,94 @@
     STAssertFalse([self bufferMatchesOriginalData], @"Decrypted data with different password should not match");
 }
 
+- (void)testCipherCycle
+{
+    BNRRecordCipher *cipher = [[BNRRecordCipher alloc] initWithKey:@"howdy" salt:&salt];
+    [cipher encryptBuffer:buffer word0:0 word1:17];
+    STAssertEquals([buffer length], (unsigned)[randomData length] + kBNRRecordCipherOverhead, @"wrong encrypted length");
+    STAssertFalse([cipher decryptBuffer:buffer word0:0 word1:18], @"Decrypted with another row's key stream");
+    STAssertTrue([cipher decryptBuffer:buffer word0:0 word1:17], @"Could not decrypt");
+    STAssertTrue([self bufferMatchesOriginalData], @"Decrypted data should match");
+    [cipher release];
+}
+- (void)testCipherBadPassword
+{
+    BNRRecordCipher *cipher = [[BNRRecordCipher alloc] initWithKey:@"howdy" salt:&salt];
+    BNRRecordCipher *other = [[BNRRecordCipher alloc] initWithKey:@"howdy1" salt:&salt];
+    [cipher encryptBuffer:buffer word0:0 word1:17];
+    STAssertFalse([other decryptBuffer:buffer word0:0 word1:17], @"Decrypted with a different password");
+    STAssertTrue([cipher decryptBuffer:buffer word0:0 word1:17], @"Failed attempt changed the buffer");
+    [other release];
+    [cipher release];
+}
+- (void)testCipherReservedHeader
+{
+    BNRRecordCipher *cipher = [[BNRRecordCipher alloc] initWithKey:@"howdy" salt:&salt];
+    BNRDataBuffer *record = [[BNRDataBuffer alloc] initWithCapacity:2048];
+    [cipher reserveHeaderInBuffer:record];
+    [record copyFrom:[randomData bytes] length:[randomData length]];
+    unsigned char *bytes = [record buffer];
+    [cipher encryptReservedBuffer:record word0:0 word1:17];
+    STAssertTrue([record buffer] == bytes, @"Encrypting moved the record");
+    STAssertTrue([cipher decryptBuffer:record word0:0 word1:17], @"Could not decrypt");
+    STAssertTrue([record buffer] == bytes, @"Decrypting moved the record");
+    STAssertTrue(memcmp(bytes, [randomData bytes], [randomData length]) == 0, @"Decrypted data should match");
+    [record release];
+    [cipher release];
+}
+- (void)testCipherLeavesV1Records
+{
+    BNRRecordCipher *cipher = [[BNRRecordCipher alloc] initWithKey:@"howdy" salt:&salt];
+    [buffer encryptWithKey:@"howdy" salt:&salt];
+    STAssertFalse([cipher decryptBuffer:buffer word0:0 word1:0], @"v1 record taken for v2");
+    STAssertTrue([buffer decryptWithKey:@"howdy" salt:&salt], @"v1 record was changed");
+    STAssertTrue([self bufferMatchesOriginalData], @"Decrypted data should match");
+    [cipher release];
+}
+
+- (void)testPipelineThroughput
+{
+    const NSUInteger recordCount = 8192;
+    BNRRecordCipher *cipher = [[BNRRecordCipher alloc] initWithKey:@"howdy" salt:&salt];
+    BNRCryptoJob *jobs = (BNRCryptoJob *)calloc(recordCount, sizeof(BNRCryptoJob));
+    for (NSUInteger i = 0; i < recordCount; i++) {
+        BNRDataBuffer *record = [[BNRDataBuffer alloc] initWithCapacity:[randomData length] + kBNRRecordCipherOverhead];
+        [cipher reserveHeaderInBuffer:record];
+        [record copyFrom:[randomData bytes] length:[randomData length]];
+        jobs[i].buffer = record;
+        jobs[i].cipher = cipher;
+        jobs[i].word1 = (UInt32)i + 2;
+    }
+    
+    NSUInteger threadCounts[] = { 1, 4, 8 };
+    double megabytes = (double)recordCount * [randomData length] / (1024 * 1024);
+    for (int t = 0; t < 3; t++) {
+        BNRCryptoPipeline *pipeline = [[BNRCryptoPipeline alloc] initWithThreadCount:threadCounts[t]];
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        [pipeline encryptJobs:jobs count:recordCount key:@"howdy"];
+        CFAbsoluteTime encrypted = CFAbsoluteTimeGetCurrent();
+        [pipeline decryptJobs:jobs count:recordCount key:@"howdy"];
+        CFAbsoluteTime decrypted = CFAbsoluteTimeGetCurrent();
+        NSLog(@"%lu threads: encrypt %.1f MB/s, decrypt %.1f MB/s", (unsigned long)threadCounts[t],
+              megabytes / (encrypted - start), megabytes / (decrypted - encrypted));
+        [pipeline release];
+        
+        for (NSUInteger i = 0; i < recordCount; i++) {
+            STAssertTrue(jobs[i].succeeded, @"Could not decrypt");
+            STAssertTrue(memcmp([jobs[i].buffer buffer], [randomData bytes], [randomData length]) == 0, @"Decrypted data should match");
+            // Decrypting took the header off; put the room back for the next round
+            [jobs[i].buffer clearBuffer];
+            [cipher reserveHeaderInBuffer:jobs[i].buffer];
+            [jobs[i].buffer copyFrom:[randomData bytes] length:[randomData length]];
+        }
+    }
+    
+    for (NSUInteger i = 0; i < recordCount; i++) {
+        [jobs[i].buffer release];
+    }
+    free(jobs);
+    [cipher release];
+}
+
 
 @end
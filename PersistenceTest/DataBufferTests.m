@@ -1,5 +1,40 @@
 #import "DataBufferTests.h"
 #import "BNRDataBuffer.h"
+#import "BNRDataBuffer+Objects.h"
+#import "BNRArena.h"
+#import "BNRStringDictionary.h"
+#import "BNRStore.h"
+#import "BNRStoredObject.h"
+#import "BNRTCBackend.h"
+
+// A stored object that is just a string, for reading back raw records
+@interface DataBufferTestNote : BNRStoredObject {
+    NSString *text;
+}
+- (void)setText:(NSString *)s;
+@end
+
+@implementation DataBufferTestNote
+- (void)dealloc
+{
+    [text release];
+    [super dealloc];
+}
+- (void)setText:(NSString *)s
+{
+    [s retain];
+    [text release];
+    text = s;
+}
+- (void)readContentFromBuffer:(BNRDataBuffer *)d
+{
+    [self setText:[d readString]];
+}
+- (void)writeContentToBuffer:(BNRDataBuffer *)d
+{
+    [d writeString:text];
+}
+@end
 
 @implementation DataBufferTests
 
@@ -22,4 +57,243 @@
     UInt32 readInt = [db readUInt32];
     STAssertEquals(orig, readInt, @"read != written");
 }
+
+- (void)testVarInts
+{
+    BNRDataBuffer *db = [[BNRDataBuffer alloc] initWithCapacity:16];
+    UInt64 unsignedValues[] = { 0, 1, 127, 128, 16383, 16384, UINT32_MAX, UINT64_MAX };
+    SInt64 signedValues[] = { 0, -1, 1, -64, 64, INT64_MIN, INT64_MAX };
+    for (int i = 0; i < 8; i++) {
+        [db writeVarUInt:unsignedValues[i]];
+    }
+    for (int i = 0; i < 7; i++) {
+        [db writeVarInt:signedValues[i]];
+    }
+    [db resetCursor];
+    for (int i = 0; i < 8; i++) {
+        STAssertEquals([db readVarUInt], unsignedValues[i], @"read != written");
+    }
+    for (int i = 0; i < 7; i++) {
+        STAssertEquals([db readVarInt], signedValues[i], @"read != written");
+    }
+    [db release];
+}
+
+- (void)testCompactLengths
+{
+    BNRDataBuffer *db = [[BNRDataBuffer alloc] initWithCapacity:16];
+    [db setUsesCompactLengths:YES];
+    [db writeString:@"short"];
+    STAssertEquals([db length], 6U, @"length prefix not compact");
+    [db resetCursor];
+    STAssertEqualObjects([db readString], @"short", @"read != written");
+    [db release];
+}
+
+- (void)testCompactObjectReferences
+{
+    BNRStore *store = [[BNRStore alloc] init];
+    Class c = [BNRStoredObject class];
+    BNRStoredObject *first = [store objectForClass:c rowID:2 fetchContent:NO];
+    BNRStoredObject *second = [store objectForClass:c rowID:300 fetchContent:NO];
+    BNRStoredObject *third = [store objectForClass:c rowID:70000 fetchContent:NO];
+    NSArray *orig = [NSArray arrayWithObjects:first, second, third, nil];
+    
+    BNRDataBuffer *db = [[BNRDataBuffer alloc] initWithCapacity:16];
+    [db setUsesCompactLengths:YES];
+    [db writeObjectReference:second];
+    [db writeArray:orig ofClass:c];
+    // Reference, then count and rowIDs of 1, 2 and 3 bytes
+    STAssertEquals([db length], 2U + 1U + 6U, @"references not compact");
+    
+    [db resetCursor];
+    STAssertEquals([db readObjectReferenceOfClass:c usingStore:store], second, @"read != written");
+    STAssertEqualObjects([db readArrayOfClass:c usingStore:store], orig, @"read != written");
+    [db release];
+    [store release];
+}
+
+- (void)testDictionaryStrings
+{
+    BNRStringDictionary *sd = [[BNRStringDictionary alloc] init];
+    BNRDataBuffer *db = [[BNRDataBuffer alloc] initWithCapacity:16];
+    [db setStringDictionary:sd];
+    [db writeDictionaryString:@"Bach"];
+    [db writeDictionaryString:@"Handel"];
+    [db writeDictionaryString:[NSMutableString stringWithString:@"Bach"]];
+    [db writeDictionaryString:nil];
+    STAssertEquals([db length], 4U, @"codes should take a byte each");
+    STAssertEquals([sd count], (NSUInteger)2, @"repeated string got a new code");
+    
+    [db resetCursor];
+    NSString *first = [db readDictionaryString];
+    STAssertEqualObjects(first, @"Bach", @"read != written");
+    STAssertEqualObjects([db readDictionaryString], @"Handel", @"read != written");
+    STAssertTrue([db readDictionaryString] == first, @"repeated string not shared");
+    STAssertNil([db readDictionaryString], @"nil didn't come back");
+    
+    // What the store saves comes back with the same codes
+    BNRDataBuffer *chunk = [[BNRDataBuffer alloc] initWithCapacity:16];
+    NSRange unsaved = [sd unsavedChunks];
+    STAssertEquals(unsaved.length, (NSUInteger)1, @"wrong number of unsaved chunks");
+    [sd writeChunk:unsaved.location toBuffer:chunk];
+    [chunk resetCursor];
+    BNRStringDictionary *loaded = [[BNRStringDictionary alloc] init];
+    [loaded readChunkFromBuffer:chunk];
+    STAssertEqualObjects([loaded stringForCode:2], @"Handel", @"codes changed when saved");
+    STAssertEquals([loaded unsavedChunks].length, (NSUInteger)0, @"loaded strings are unsaved");
+    
+    [loaded release];
+    [chunk release];
+    [db release];
+    [sd release];
+}
+
+- (void)testNativeObjects
+{
+    NSDictionary *orig = [NSDictionary dictionaryWithObjectsAndKeys:
+                          @"Fugue in G minor", @"title",
+                          [NSNumber numberWithInt:-578], @"bwv",
+                          [NSNumber numberWithDouble:3.75], @"minutes",
+                          [NSNumber numberWithBool:YES], @"organ",
+                          [NSDate dateWithTimeIntervalSinceReferenceDate:1000.5], @"added",
+                          [NSArray arrayWithObjects:@"Bach", [NSNull null], nil], @"credits",
+                          [NSData dataWithBytes:"\0\1\2" length:3], @"cover",
+                          [NSURL URLWithString:@"http://bignerdranch.com"], @"link",
+                          nil];
+    BNRDataBuffer *db = [[BNRDataBuffer alloc] initWithCapacity:16];
+    [db writeObject:orig];
+    [db writeObject:nil];
+    [db resetCursor];
+    STAssertEqualObjects([db readObject], orig, @"read != written");
+    STAssertNil([db readObject], @"nil didn't come back");
+    [db release];
+}
+
+- (void)testFloat32Array
+{
+    BNRDataBuffer *db = [[BNRDataBuffer alloc] initWithCapacity:16];
+    Float32 orig[1000];
+    for (int i = 0; i < 1000; i++) {
+        orig[i] = random() / 3.0f;
+    }
+    [db writeUInt16:1000];
+    [db writeFloat32Array:orig count:1000];
+    [db resetCursor];
+    
+    Float32 readBack[1000];
+    UInt16 count = [db readUInt16];
+    STAssertEquals(count, (UInt16)1000, @"read != written");
+    [db readFloat32Array:readBack count:count];
+    STAssertTrue(memcmp(orig, readBack, sizeof(orig)) == 0, @"read != written");
+    STAssertEquals([db length], (unsigned)(sizeof(UInt16) + sizeof(orig)), @"wrong length");
+    [db release];
+}
+
+- (void)testNoCopyBufferInArena
+{
+    BNRArena *arena = [[BNRArena alloc] initWithChunkSize:64];
+    UInt32 orig = random();
+    UInt32 *bytes = (UInt32 *)[arena copyBytes:&orig length:sizeof(UInt32)];
+    STAssertTrue(((uintptr_t)bytes % 8) == 0, @"arena memory not aligned");
+    
+    BNRDataBuffer *db = [[BNRDataBuffer alloc] initWithBytesNoCopy:bytes
+                                                            length:sizeof(UInt32)
+                                                             owner:arena];
+    [arena release]; // the buffer keeps it alive
+    STAssertEquals(orig, [db readUInt32], @"read != written");
+    
+    // Writing past the end must not touch the arena's memory
+    [db writeUInt32:orig + 1];
+    STAssertTrue([db buffer] != (unsigned char *)bytes, @"grew in place");
+    [db resetCursor];
+    STAssertEquals(orig, [db readUInt32], @"lost bytes when growing");
+    STAssertEquals(orig + 1, [db readUInt32], @"read != written");
+    [db release];
+}
+
+- (void)testNoCopyStringReads
+{
+    BNRDataBuffer *db = [[BNRDataBuffer alloc] initWithCapacity:1024];
+    [db writeString:@"plain ascii"];
+    [db writeString:@"caf\u00e9 cr\u00e8me"];
+    
+    BNRArena *arena = [[BNRArena alloc] init];
+    void *bytes = [arena copyBytes:[db buffer] length:[db length]];
+    BNRDataBuffer *view = [[BNRDataBuffer alloc] initWithCapacity:0];
+    [view setBytesNoCopy:bytes length:[db length] owner:arena];
+    [view setReadsWithoutCopying:YES];
+    [arena release];
+    
+    STAssertEqualObjects([view readString], @"plain ascii", @"ascii read != written");
+    STAssertEqualObjects([view readString], @"caf\u00e9 cr\u00e8me", @"utf-8 read != written");
+    
+    // Writing must copy instead of scribbling on the shared bytes
+    [view resetCursor];
+    [view writeUInt32:0];
+    STAssertTrue([view buffer] != (unsigned char *)bytes, @"wrote into shared bytes");
+    [view release];
+    [db release];
+}
+
+- (void)testBorrowedBufferIsReused
+{
+    BNRDataBuffer *db = [BNRDataBuffer borrowBufferWithCapacity:100];
+    STAssertTrue([db capacity] >= 100, @"borrowed buffer too small");
+    for (int i = 0; i < 4096; i++) {
+        [db writeUInt8:i];
+    }
+    [BNRDataBuffer returnBuffer:db];
+    
+    BNRDataBuffer *again = [BNRDataBuffer borrowBufferWithCapacity:100];
+    STAssertEquals(db, again, @"buffer not reused");
+    STAssertEquals([again length], 0U, @"returned buffer not cleared");
+    [BNRDataBuffer returnBuffer:again];
+}
+
+#if NS_BLOCKS_AVAILABLE
+- (void)testEncryptedRawRecordScan
+{
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:
+                      [NSString stringWithFormat:@"RawScanTest-%d", getpid()]];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+    NSError *error = nil;
+    BNRTCBackend *backend = [[BNRTCBackend alloc] initWithPath:path error:&error];
+    STAssertNotNil(backend, @"no backend: %@", error);
+    
+    BNRStore *store = [[BNRStore alloc] init];
+    [store setBackend:backend];
+    [backend release];
+    [store setEncryptionKey:@"raw scan passphrase"];
+    Class c = [DataBufferTestNote class];
+    [store addClass:c];
+    NSMutableSet *unseen = [NSMutableSet set];
+    for (int i = 0; i < 100; i++) {
+        NSString *text = [NSString stringWithFormat:@"note number %d", i];
+        [unseen addObject:text];
+        DataBufferTestNote *note = [[DataBufferTestNote alloc] init];
+        [note setText:text];
+        [store insertObject:note];
+        [note release];
+    }
+    STAssertTrue([store saveChanges:&error], @"save failed: %@", error);
+    
+    // Each record's plaintext lives in an arena that is emptied when the
+    // block returns, so everything is checked inside the call
+    __block BOOL allMatched = YES;
+    [store enumerateRawRecordsForClass:c usingBlock:^(UInt32 rowID, BNRDataBuffer *record, BOOL *stop) {
+        NSString *text = [record readString];
+        if ([unseen containsObject:text]) {
+            [unseen removeObject:text];
+        } else {
+            allMatched = NO;
+        }
+    }];
+    STAssertTrue(allMatched, @"decrypted record != written");
+    STAssertEquals([unseen count], (NSUInteger)0, @"records missing from the scan");
+    
+    [store release];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+}
+#endif
 @end
@@ -1,6 +1,8 @@
 #import "SpeedTest.h"
 #import "Song.h"
 #import "BNRTCIndexManager.h"
+#import "BNRSearchCursor.h"
+#import "BNRTextQuery.h"
 
 // Uses http://www.irs.gov/pub/irs-utl/eopub78.zip
 
@@ -37,6 +39,7 @@ int main (int argc, const char * argv[]) {
     [indexManager release];
     
     [store addClass:[Song class]];
+    [indexManager setSearchCacheByteLimit:4 * 1024 * 1024];
     
     uint64_t start = mach_absolute_time();
     
@@ -58,6 +61,52 @@ int main (int argc, const char * argv[]) {
                                      forKey:@"title"];
     NSLog(@"%lu song titles contain 'pets'", (unsigned long)[songsThatMatch count]);
     
+    songsThatMatch = [store objectsForClass:[Song class]
+                               matchingText:@"community foundation"
+                                     forKey:@"title"
+                                      limit:20];
+    NSLog(@"%lu best song titles for 'community foundation'", (unsigned long)[songsThatMatch count]);
+    
+    // Pages of 50, as a UI would fetch them
+    BNRSearchCursor *cursor = [store searchCursorForClass:[Song class]
+                                             matchingText:@"[[*foundation*]]"
+                                                   forKey:@"title"];
+    NSUInteger pageCount = 0;
+    while (![cursor isAtEnd]) {
+        NSAutoreleasePool *pagePool = [[NSAutoreleasePool alloc] init];
+        [cursor take:50];
+        pageCount++;
+        [pagePool drain];
+    }
+    NSLog(@"%lu song titles contain 'foundation' (%lu pages)", (unsigned long)[cursor count], (unsigned long)pageCount);
+    
+    BNRTextQuery *query = [BNRTextQuery andQueryWithSubqueries:
+                           [NSArray arrayWithObjects:
+                            [BNRTextQuery queryWithKey:@"title" matchingText:@"[[*foundation*]]"],
+                            [BNRTextQuery queryWithKey:@"title" matchingText:@"[[*community*]]"],
+                            nil]];
+    query = [BNRTextQuery query:query excluding:[BNRTextQuery queryWithKey:@"title" matchingText:@"[[*trust*]]"]];
+    songsThatMatch = [store objectsForClass:[Song class] matchingQuery:query];
+    NSLog(@"%lu song titles match %@", (unsigned long)[songsThatMatch count], query);
+    
+    // As a UI rerunning its searches would; all but the first come from the cache
+    for (int i = 0; i < 10; i++) {
+        songsThatMatch = [store objectsForClass:[Song class]
+                                   matchingText:@"[[*choice*]]"
+                                         forKey:@"title"];
+    }
+    NSLog(@"search cache hit rate %.2f", [indexManager searchCacheHitRate]);
+    
+    // Type-ahead, a keystroke at a time
+    NSArray *prefixes = [NSArray arrayWithObjects:@"f", @"fo", @"fou", @"foun", nil];
+    for (NSString *prefix in prefixes) {
+        NSArray *completions = [store completionsForClass:[Song class]
+                                                   prefix:prefix
+                                                   forKey:@"title"
+                                                    limit:5];
+        NSLog(@"'%@' -> %@", prefix, [completions componentsJoinedByString:@", "]);
+    }
+    
     uint64_t end = mach_absolute_time();
     
     
@@ -38,6 +38,24 @@ int main (int argc, const char * argv[]) {
     
     [store addClass:[Song class]];
     
+    // Pass -bulk to load through the store's bulk import mode, -background
+    // to leave the indexing to the index manager's background thread
+    BOOL bulkImport = NO;
+    BOOL backgroundIndexing = NO;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-bulk") == 0) {
+            bulkImport = YES;
+        } else if (strcmp(argv[i], "-background") == 0) {
+            backgroundIndexing = YES;
+        }
+    }
+    if (bulkImport) {
+        [store beginBulkImport];
+    }
+    if (backgroundIndexing) {
+        [indexManager setUsesBackgroundIndexing:YES];
+    }
+    
     FILE *fileHandle = fopen("eopub1m.txt", "r");
     if (!fileHandle) {
         char *cwd = getcwd(NULL, 0);
@@ -72,6 +90,15 @@ int main (int argc, const char * argv[]) {
         NSLog(@"error = %@", [error localizedDescription]);
         return EXIT_FAILURE;
     }
+    if (bulkImport && ![store endBulkImport]) {
+        NSLog(@"error: bulk import did not finish");
+        return EXIT_FAILURE;
+    }
+    if (backgroundIndexing) {
+        NSLog(@"save returned after:");
+        LogElapsedTime(start, mach_absolute_time());
+        [indexManager waitUntilIndexesAreCurrent];
+    }
     [store release];
     
     [pool drain];
@@ -0,0 +1,56 @@
+#import "SpeedTest.h"
+#import "Song.h"
+#import "BNRTCIndexManager.h"
+
+// Rebuilds the title index made by FullTextInsertTest from the stored songs.
+// Pass -threads N to tokenize on N threads (default 4).
+
+int main (int argc, const char * argv[]) {
+    NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+    
+    NSUInteger threadCount = 4;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            threadCount = strtoul(argv[++i], NULL, 10);
+        }
+    }
+    
+    BNRStore *store = CreateStoreAtPath(@TEXTTEST_PATH);
+    if (!store) exit(EXIT_FAILURE);
+    
+    NSError *err;
+    BNRTCIndexManager *indexManager = [[BNRTCIndexManager alloc] initWithPath:@TEXTTEST_PATH
+                                                                        error:&err];
+    if (!indexManager) {
+        NSLog(@"error = %@", [err localizedDescription]);
+        exit(EXIT_FAILURE);
+    }
+    
+    [store setIndexManager:indexManager];
+    [indexManager release];
+    
+    [store addClass:[Song class]];
+    
+    uint64_t start = mach_absolute_time();
+    
+    if (![store rebuildTextIndexesForClass:[Song class] threadCount:threadCount]) {
+        NSLog(@"error: rebuilding the text index failed");
+        return EXIT_FAILURE;
+    }
+    
+    uint64_t end = mach_absolute_time();
+    NSLog(@"rebuilt on %lu threads in:", (unsigned long)threadCount);
+    LogElapsedTime(start, end);
+    
+    UInt32 *rows = NULL;
+    UInt32 count = [indexManager countOfRowsInClass:[Song class]
+                                       matchingText:@"Foundation"
+                                             forKey:@"title"
+                                               list:&rows];
+    free(rows);
+    NSLog(@"%u titles match 'Foundation'", (unsigned)count);
+    
+    [store release];
+    [pool drain];
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+// Compares writeArchiveableObject: with and without native object encoding
+// on the kind of dictionary apps tend to store: a few strings and dates and
+// a series of numbers.
+
+#import "SpeedTest.h"
+
+#define OBJECT_COUNT (20000)
+#define SERIES_LENGTH (64)
+
+static NSDictionary *SampleObject(int i)
+{
+    NSMutableArray *series = [NSMutableArray arrayWithCapacity:SERIES_LENGTH];
+    for (int j = 0; j < SERIES_LENGTH; j++) {
+        [series addObject:[NSNumber numberWithFloat:(i + j) / 7.0f]];
+    }
+    return [NSDictionary dictionaryWithObjectsAndKeys:
+            [NSString stringWithFormat:@"sensor-%d", i % 100], @"name",
+            [NSDate dateWithTimeIntervalSinceReferenceDate:i * 60.0], @"start",
+            [NSNumber numberWithInt:i], @"sequence",
+            [NSNumber numberWithBool:(i % 2)], @"calibrated",
+            series, @"samples",
+            nil];
+}
+
+static void TimeCodec(NSArray *objects, BOOL native)
+{
+    const char *name = native ? "native" : "keyed archiver";
+    BNRDataBuffer *buffer = [[BNRDataBuffer alloc] initWithCapacity:65536];
+    [buffer setUsesNativeObjectEncoding:native];
+    
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    uint64_t start = mach_absolute_time();
+    for (id obj in objects) {
+        [buffer writeArchiveableObject:obj];
+    }
+    uint64_t end = mach_absolute_time();
+    fprintf(stderr, "%s: %s wrote %u bytes\n", getprogname(), name, [buffer length]);
+    LogElapsedTime(start, end);
+    [pool drain];
+    
+    pool = [[NSAutoreleasePool alloc] init];
+    [buffer resetCursor];
+    start = mach_absolute_time();
+    NSUInteger matches = 0;
+    for (id obj in objects) {
+        if ([[buffer readArchiveableObject] isEqual:obj]) {
+            matches++;
+        }
+    }
+    end = mach_absolute_time();
+    fprintf(stderr, "%s: %s read back %lu of %lu objects\n", getprogname(), name,
+            (unsigned long)matches, (unsigned long)[objects count]);
+    LogElapsedTime(start, end);
+    [pool drain];
+    
+    [buffer release];
+}
+
+int main (int argc, const char * argv[]) {
+    NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+    
+    NSMutableArray *objects = [NSMutableArray arrayWithCapacity:OBJECT_COUNT];
+    for (int i = 0; i < OBJECT_COUNT; i++) {
+        [objects addObject:SampleObject(i)];
+    }
+    
+    TimeCodec(objects, NO);
+    TimeCodec(objects, YES);
+    
+    [pool drain];
+    return EXIT_SUCCESS;
+}
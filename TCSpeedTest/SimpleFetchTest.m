@@ -12,9 +12,31 @@ int main (int argc, const char * argv[]) {
     [store addClass:[Song class]];
 
     // Get all the songs
+    StartCountingMallocs();
     NSArray *allSongs = [store allObjectsForClass:[Song class]];
+    uint64_t mallocs = StopCountingMallocs();
     NSLog(@"%s: allSongs has %lu songs",
           getprogname(), (unsigned long)[allSongs count]);
+    if ([allSongs count]) {
+        NSLog(@"%s: %.2f allocations per song",
+              getprogname(), (double)mallocs / [allSongs count]);
+    }
+
+#if NS_BLOCKS_AVAILABLE
+    // Same records again, reading the fields straight out of the file
+    __block UInt32 totalSeconds = 0;
+    StartCountingMallocs();
+    [store enumerateRawRecordsForClass:[Song class]
+                            usingBlock:^(UInt32 rowID, BNRDataBuffer *record, BOOL *stop) {
+        [record readString]; // title
+        totalSeconds += [record readUInt32];
+    }];
+    mallocs = StopCountingMallocs();
+    if ([allSongs count]) {
+        NSLog(@"%s: %.2f allocations per song in a raw scan (%u seconds of music)",
+              getprogname(), (double)mallocs / [allSongs count], (unsigned)totalSeconds);
+    }
+#endif
 
     [store release];
     [pool drain];
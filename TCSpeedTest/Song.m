@@ -35,6 +35,25 @@
     return textKeys;
 }
 
+// For type-ahead on titles
++ (NSSet *)prefixIndexedAttributes
+{
+    return [self textIndexedAttributes];
+}
+
+// For BNRTCTableIndexManager
++ (NSDictionary *)tableIndexedAttributes
+{
+    static NSDictionary *tableKeys = nil;
+    if (!tableKeys) {
+        tableKeys = [[NSDictionary alloc] initWithObjectsAndKeys:
+                     [NSNumber numberWithInt:BNRTableAttributeString], @"title",
+                     [NSNumber numberWithInt:BNRTableAttributeNumber], @"seconds",
+                     nil];
+    }
+    return tableKeys;
+}
+
 @synthesize title, seconds;
 
 - (NSString *)title
@@ -26,6 +26,11 @@
 #define COMPLEXTEST_PATH "/tmp/complextest/"
 #define TEXTTEST_PATH "/tmp/texttest/"
 #define NAMEDBUFFER_PATH "/tmp/namedbuffertest/"
+#define TABLETEST_PATH "/tmp/tabletest/"
 
 BNRStore *CreateStoreAtPath(NSString *path);
-void LogElapsedTime(uint64_t start, uint64_t stop);
\ No newline at end of file
+void LogElapsedTime(uint64_t start, uint64_t stop);
+
+// Counts calls to malloc/calloc/realloc (on any thread) between the two calls.
+void StartCountingMallocs(void);
+uint64_t StopCountingMallocs(void);
\ No newline at end of file
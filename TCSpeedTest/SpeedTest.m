@@ -9,6 +9,15 @@
 #import <inttypes.h>
 #import <stdbool.h>
 #import "BNRTCBackend.h"
+#import <libkern/OSAtomic.h>
+
+// libmalloc calls this hook (if set) on every allocation; it is what MallocStackLogging uses.
+typedef void (BNRMallocLogger)(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3,
+                               uintptr_t result, uint32_t num_hot_frames_to_skip);
+extern BNRMallocLogger *malloc_logger;
+#define kBNRMallocLogTypeAllocate (2)
+
+static volatile int64_t mallocCount;
 
 static bool GetElapsedMs(uint64_t start, uint64_t stop, uint64_t *out_elapsed);
 
@@ -98,3 +107,23 @@ LogElapsedTime(uint64_t start, uint64_t stop) {
                 getprogname(), ms);
     }
 }
+
+static void
+CountMalloc(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3,
+            uintptr_t result, uint32_t num_hot_frames_to_skip) {
+    if (type & kBNRMallocLogTypeAllocate) {
+        OSAtomicIncrement64(&mallocCount);
+    }
+}
+
+void
+StartCountingMallocs(void) {
+    mallocCount = 0;
+    malloc_logger = CountMalloc;
+}
+
+uint64_t
+StopCountingMallocs(void) {
+    malloc_logger = NULL;
+    return (uint64_t)mallocCount;
+}
@@ -0,0 +1,65 @@
+#import "SpeedTest.h"
+#import "Song.h"
+#import "BNRTCTableIndexManager.h"
+
+// Mirrors songs into a table index, then runs a mixed query inside Tokyo Cabinet
+
+int main (int argc, const char * argv[]) {
+    NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+    
+    NSLog(@"%s: %d songs", getprogname(), SONG_COUNT);
+    
+    BNRStore *store = CreateStoreAtPath(@TABLETEST_PATH);
+    if (!store) exit(EXIT_FAILURE);
+    
+    NSError *err;
+    BNRTCTableIndexManager *indexManager = [[BNRTCTableIndexManager alloc] initWithPath:@TABLETEST_PATH
+                                                                                  error:&err];
+    if (!indexManager) {
+        NSLog(@"error = %@", [err localizedDescription]);
+        exit(EXIT_FAILURE);
+    }
+    [store setIndexManager:indexManager];
+    [indexManager release];
+    
+    [store addClass:[Song class]];
+    
+    NSArray *words = [NSArray arrayWithObjects:@"love", @"night", @"blue", @"road", @"heart", @"rain", @"river", nil];
+    for (int i = 0; i < SONG_COUNT; i++) {
+        Song *song = [[Song alloc] init];
+        [song setTitle:[NSString stringWithFormat:@"%@ %@ %d",
+                        [words objectAtIndex:i % [words count]],
+                        [words objectAtIndex:(i / 7) % [words count]],
+                        i]];
+        [song setSeconds:i % 400];
+        [store insertObject:song];
+        [song release];
+    }
+    
+    uint64_t start = mach_absolute_time();
+    
+    NSError *error = nil;
+    if (![store saveChanges:&error]) {
+        NSLog(@"%s: Error saving changes: %@", getprogname(), [error localizedDescription]);
+        return EXIT_FAILURE;
+    }
+    
+    uint64_t saved = mach_absolute_time();
+    NSLog(@"saved in:");
+    LogElapsedTime(start, saved);
+    
+    NSPredicate *predicate = [NSPredicate predicateWithFormat:@"seconds > 200 AND title CONTAINS 'love'"];
+    NSSortDescriptor *byTitle = [[[NSSortDescriptor alloc] initWithKey:@"title" ascending:YES] autorelease];
+    NSMutableArray *songs = [store objectsForClass:[Song class]
+                                 matchingPredicate:predicate
+                                    sortDescriptor:byTitle
+                                             limit:50];
+    
+    uint64_t end = mach_absolute_time();
+    NSLog(@"%lu songs for '%@', first '%@', in:", (unsigned long)[songs count], predicate, [[songs objectAtIndex:0] title]);
+    LogElapsedTime(saved, end);
+    
+    [store release];
+    [pool drain];
+    return EXIT_SUCCESS;
+}
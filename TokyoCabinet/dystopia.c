@@ -38,6 +38,7 @@ static bool tcidbsynccb(int total, int current, const char *msg, TCIDB *idb);
 static bool tcidbopenimpl(TCIDB *idb, const char *path, int omode);
 static bool tcidbcloseimpl(TCIDB *idb);
 static bool tcidbputimpl(TCIDB *idb, int64_t id, const char *text);
+static bool tcidbputshardimpl(TCIDB *idb, int shard, int64_t id, const char *text);
 static bool tcidboutimpl(TCIDB *idb, int64_t id);
 static char *tcidbgetimpl(TCIDB *idb, int64_t id);
 static uint64_t *tcidbsearchimpl(TCIDB *idb, const char *word, int smode, int *np);
@@ -626,6 +627,47 @@ bool tcidbmemsync(TCIDB *idb, int level){
 }
 
 
+/* Set the number of internal databases of an indexed database object for parallel loading. */
+bool tcidbsetshards(TCIDB *idb, int snum){
+  assert(idb && snum > 0);
+  if(!tcidblockmethod(idb, true)) return false;
+  if(!idb->path || !idb->wmode || snum > IDBQDBMAX){
+    tchdbsetecode(idb->txdb, TCEINVALID, __FILE__, __LINE__, __func__);
+    tcidbunlockmethod(idb);
+    return false;
+  }
+  TCQDB **idxs = idb->idxs;
+  char pbuf[strlen(idb->path)+TDNUMBUFSIZ];
+  while(idb->inum < snum){
+    sprintf(pbuf, "%s%c%04d", idb->path, MYPATHCHR, idb->inum + 1);
+    if(!tcqdbopen(idxs[idb->inum], pbuf, idb->qomode | IDBOCREAT)){
+      tchdbsetecode(idb->txdb, tcqdbecode(idxs[idb->inum]), __FILE__, __LINE__, __func__);
+      tcidbunlockmethod(idb);
+      return false;
+    }
+    idb->inum++;
+  }
+  idb->exopts |= IDBXNOCYCLE;
+  tcidbunlockmethod(idb);
+  return true;
+}
+
+
+/* Store a new record into a specified internal database of an indexed database object. */
+bool tcidbputshard(TCIDB *idb, int shard, int64_t id, const char *text){
+  assert(idb && shard >= 0 && id > 0 && text);
+  if(!tcidblockmethod(idb, false)) return false;
+  if(!idb->path || !idb->wmode || shard >= idb->inum){
+    tchdbsetecode(idb->txdb, TCEINVALID, __FILE__, __LINE__, __func__);
+    tcidbunlockmethod(idb);
+    return false;
+  }
+  bool rv = tcidbputshardimpl(idb, shard, id, text);
+  tcidbunlockmethod(idb);
+  return rv;
+}
+
+
 /* Get the inode number of the database file of an indexed database object. */
 uint64_t tcidbinode(TCIDB *idb){
   assert(idb);
@@ -703,7 +745,7 @@ static bool tcidbunlockmethod(TCIDB *idb){
    The return value is true usually, or false if the sync operation should be terminated. */
 static bool tcidbsynccb(int total, int current, const char *msg, TCIDB *idb){
   bool rv = idb->synccb ? idb->synccb(total, current, msg, idb->syncopq) : true;
-  if((total|current) == 0 && !strcmp(msg, QDBSYNCMSGL) &&
+  if((total|current) == 0 && !strcmp(msg, QDBSYNCMSGL) && !(idb->exopts & IDBXNOCYCLE) &&
      tcqdbfsiz(idb->idxs[idb->cnum]) >= idb->iusiz && idb->inum > 0){
     TCQDB **idxs = idb->idxs;
     if(idb->synccb && !idb->synccb(total, current, "to be cycled", idb->syncopq)) rv = false;
@@ -1002,6 +1044,43 @@ static bool tcidbputimpl(TCIDB *idb, int64_t id, const char *text){
 }
 
 
+/* Store a new record into a specified internal database of an indexed database object.
+   `idb' specifies the indexed database object.
+   `shard' specifies the index of the internal database.
+   `id' specifies the ID number of the record.
+   `text' specifies the string of the record.
+   If successful, the return value is true, else, it is false.
+   Only the method lock for reading is held, so this touches nothing shared but the text database,
+   which has its own mutex, and the internal database of `shard'. */
+static bool tcidbputshardimpl(TCIDB *idb, int shard, int64_t id, const char *text){
+  assert(idb && shard >= 0 && id > 0 && text);
+  TCHDB *txdb = idb->txdb;
+  char kbuf[TDNUMBUFSIZ];
+  int ksiz;
+  TDSETVNUMBUF64(ksiz, kbuf, id);
+  char stack[IDBIOBUFSIZ];
+  uint8_t cnum = shard;
+  int tlen = strlen(text);
+  char *vbuf = (tlen < IDBIOBUFSIZ - sizeof(cnum)) ? stack : tcmalloc(tlen + sizeof(cnum));
+  memcpy(vbuf, text, tlen);
+  ((uint8_t *)vbuf)[tlen] = cnum;
+  if(!(idb->exopts & IDBXNOTXT) && !tchdbputkeep(txdb, kbuf, ksiz, vbuf, tlen + sizeof(cnum))){
+    if(vbuf != stack) tcfree(vbuf);
+    return false;
+  }
+  vbuf[tlen] = '\0';
+  tctextnormalize(vbuf, TCTNLOWER | TCTNNOACC | TCTNSPACE);
+  TCQDB *cidx = idb->idxs[shard];
+  if(!tcqdbput(cidx, id, vbuf)){
+    tchdbsetecode(txdb, tcqdbecode(cidx), __FILE__, __LINE__, __func__);
+    if(vbuf != stack) tcfree(vbuf);
+    return false;
+  }
+  if(vbuf != stack) tcfree(vbuf);
+  return true;
+}
+
+
 /* Remove a record of an indexed database object.
    `idb' specifies the indexed database object.
    `id' specifies the ID number of the record.
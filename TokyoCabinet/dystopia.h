@@ -312,7 +312,8 @@ uint64_t tcidbfsiz(TCIDB *idb);
 
 
 enum {                                   /* enumeration for expert options */
-  IDBXNOTXT = 1 << 0                     /* no text mode */
+  IDBXNOTXT = 1 << 0,                    /* no text mode */
+  IDBXNOCYCLE = 1 << 1                   /* no cycling of the current internal database */
 };
 
 
@@ -336,6 +337,26 @@ int tcidbdbgfd(TCIDB *idb);
 bool tcidbmemsync(TCIDB *idb, int level);
 
 
+/* Set the number of internal databases of an indexed database object for parallel loading.
+   `idb' specifies the indexed database object connected as a writer.
+   `snum' specifies the number of internal databases.  The ones not existing yet are created.
+   If successful, the return value is true, else, it is false.
+   The expert option `IDBXNOCYCLE' is set so that the loaders decide where each record goes. */
+bool tcidbsetshards(TCIDB *idb, int snum);
+
+
+/* Store a new record into a specified internal database of an indexed database object.
+   `idb' specifies the indexed database object connected as a writer.
+   `shard' specifies the index of the internal database, less than the number set with
+   `tcidbsetshards'.
+   `id' specifies the ID number of the record.  It should not be stored yet.
+   `text' specifies the string of the record.
+   If successful, the return value is true, else, it is false.
+   Records for different internal databases can be stored by different threads at the same time,
+   which is the way to build a large index in parallel. */
+bool tcidbputshard(TCIDB *idb, int shard, int64_t id, const char *text);
+
+
 /* Get the inode number of the database directory of an indexed database object.
    `idb' specifies the indexed database object.
    The return value is the inode number of the database directory or 0 the object does not
@@ -21,6 +21,7 @@
 
 #define HDBFILEMODE    00644             // permission of created files
 #define HDBIOBUFSIZ    8192              // size of an I/O buffer
+#define HDBSCANBUFSIZ  (1 << 20)         // size of the readahead buffer of a scan
 
 #define HDBMAGICDATA   "ToKyO CaBiNeT"   // magic data for identification
 #define HDBHEADSIZ     256               // size of the reagion of the header
@@ -34,6 +35,7 @@
 #define HDBFSIZOFF     56                // offset of the region for the file size
 #define HDBFRECOFF     64                // offset of the region for the first record offset
 #define HDBOPAQUEOFF   128               // offset of the region for the opaque field
+#define HDBKNOWNOPTS   (HDBTLARGE | HDBTDEFLATE | HDBTBZIP | HDBTTCBS | HDBTEXCODEC | HDBTFHASH)
 
 #define HDBDEFBNUM     131071            // default bucket number
 #define HDBDEFAPOW     4                 // default alignment power
@@ -90,6 +92,13 @@ enum {                                   // enumeration for duplication behavior
   HDBPDPROC                              // process by a callback function
 };
 
+typedef struct {                         // type of structure for a request of a batch operation
+  uint64_t bidx;                         // index of the bucket
+  off_t off;                             // offset of the first record of the bucket
+  int idx;                               // index of the request in the caller's arrays
+  uint8_t hash;                          // second hash value
+} HDBMREQ;
+
 typedef struct {                         // type of structure for a duplication callback
   TCPDPROC proc;                         // function pointer
   void *op;                              // opaque pointer
@@ -131,6 +140,8 @@ static void tchdbloadmeta(TCHDB *hdb, const char *hbuf);
 static void tchdbclear(TCHDB *hdb);
 static int32_t tchdbpadsize(TCHDB *hdb, uint64_t off);
 static void tchdbsetflag(TCHDB *hdb, int flag, bool sign);
+static uint64_t tchdbfmix(uint64_t hash);
+static uint64_t tchdbfhash(const char *kbuf, int ksiz);
 static uint64_t tchdbbidx(TCHDB *hdb, const char *kbuf, int ksiz, uint8_t *hp);
 static off_t tchdbgetbucket(TCHDB *hdb, uint64_t bidx);
 static void tchdbsetbucket(TCHDB *hdb, uint64_t bidx, uint64_t off);
@@ -146,6 +157,7 @@ static void tchdbfbptrim(TCHDB *hdb, uint64_t base, uint64_t next, uint64_t off,
 static bool tchdbwritefb(TCHDB *hdb, uint64_t off, uint32_t rsiz);
 static bool tchdbwriterec(TCHDB *hdb, TCHREC *rec, uint64_t bidx, off_t entoff);
 static bool tchdbreadrec(TCHDB *hdb, TCHREC *rec, char *rbuf);
+static bool tchdbparserec(TCHDB *hdb, TCHREC *rec, const char *rbuf, int rsiz);
 static bool tchdbreadrecbody(TCHDB *hdb, TCHREC *rec);
 static bool tchdbremoverec(TCHDB *hdb, TCHREC *rec, char *rbuf, uint64_t bidx, off_t entoff);
 static bool tchdbshiftrec(TCHDB *hdb, TCHREC *rec, char *rbuf, off_t destoff);
@@ -169,12 +181,24 @@ static char *tchdbgetimpl(TCHDB *hdb, const char *kbuf, int ksiz, uint64_t bidx,
                           int *sp);
 static int tchdbgetintobuf(TCHDB *hdb, const char *kbuf, int ksiz, uint64_t bidx, uint8_t hash,
                            char *vbuf, int max);
+static int tchdbgetintoxstr(TCHDB *hdb, const char *kbuf, int ksiz, uint64_t bidx, uint8_t hash,
+                            TCXSTR *xstr);
+static HDBMREQ *tchdbmreqnew(TCHDB *hdb, const void * const *kbufs, const int *ksizs, int num);
+static int tchdbmreqcmpoff(const void *a, const void *b);
+static int tchdbmreqcmpbidx(const void *a, const void *b);
+static void tchdbprefetch(TCHDB *hdb, const HDBMREQ *reqs, int num);
 static char *tchdbgetnextimpl(TCHDB *hdb, const char *kbuf, int ksiz, int *sp,
                               const char **vbp, int *vsp);
 static int tchdbvsizimpl(TCHDB *hdb, const char *kbuf, int ksiz, uint64_t bidx, uint8_t hash);
 static bool tchdbiterinitimpl(TCHDB *hdb);
 static char *tchdbiternextimpl(TCHDB *hdb, int *sp);
 static bool tchdbiternextintoxstr(TCHDB *hdb, TCXSTR *kxstr, TCXSTR *vxstr);
+static bool tchdbiternextmappedimpl(TCHDB *hdb, TCXSTR *kxstr, TCXSTR *vxstr,
+                                    const void **vbp, int *vsp);
+static HDBSCAN *tchdbscannewimpl(TCHDB *hdb, uint64_t off, uint64_t end);
+static const char *tchdbscanwindow(HDBSCAN *scan, uint64_t off, int need, int *sp);
+static bool tchdbisrecoff(TCHDB *hdb, TCHREC *rec);
+static uint64_t tchdbfindrecafter(TCHDB *hdb, uint64_t off, uint64_t end);
 static bool tchdboptimizeimpl(TCHDB *hdb, int64_t bnum, int8_t apow, int8_t fpow, uint8_t opts);
 static bool tchdbvanishimpl(TCHDB *hdb);
 static bool tchdbcopyimpl(TCHDB *hdb, const char *path);
@@ -303,7 +327,7 @@ bool tchdbtune(TCHDB *hdb, int64_t bnum, int8_t apow, int8_t fpow, uint8_t opts)
   hdb->bnum = (bnum > 0) ? tcgetprime(bnum) : HDBDEFBNUM;
   hdb->apow = (apow >= 0) ? tclmin(apow, HDBMAXAPOW) : HDBDEFAPOW;
   hdb->fpow = (fpow >= 0) ? tclmin(fpow, HDBMAXFPOW) : HDBDEFFPOW;
-  hdb->opts = opts;
+  hdb->opts = opts & HDBKNOWNOPTS;
   if(!_tc_deflate) hdb->opts &= ~HDBTDEFLATE;
   if(!_tc_bzcompress) hdb->opts &= ~HDBTBZIP;
   return true;
@@ -645,6 +669,64 @@ bool tchdbputasync2(TCHDB *hdb, const char *kstr, const char *vstr){
 }
 
 
+/* Store records into a hash database object at once. */
+bool tchdbputmany(TCHDB *hdb, const void * const *kbufs, const int *ksizs,
+                  const void * const *vbufs, const int *vsizs, int num){
+  assert(hdb && kbufs && ksizs && vbufs && vsizs && num >= 0);
+  if(!HDBLOCKMETHOD(hdb, false)) return false;
+  if(hdb->fd < 0 || !(hdb->omode & HDBOWRITER)){
+    tchdbsetecode(hdb, TCEINVALID, __FILE__, __LINE__, __func__);
+    HDBUNLOCKMETHOD(hdb);
+    return false;
+  }
+  if(hdb->async && !tchdbflushdrp(hdb)){
+    HDBUNLOCKMETHOD(hdb);
+    return false;
+  }
+  HDBMREQ *reqs = tchdbmreqnew(hdb, kbufs, ksizs, num);
+  qsort(reqs, num, sizeof(*reqs), tchdbmreqcmpbidx);
+  bool err = false;
+  for(int i = 0; i < num && !err; i++){
+    const HDBMREQ *req = reqs + i;
+    int idx = req->idx;
+    const char *vbuf = vbufs[idx];
+    int vsiz = vsizs[idx];
+    if(!HDBLOCKRECORD(hdb, req->bidx, true)){
+      err = true;
+      break;
+    }
+    char *zbuf = NULL;
+    if(hdb->zmode){
+      if(hdb->opts & HDBTDEFLATE){
+        zbuf = _tc_deflate(vbuf, vsiz, &vsiz, _TCZMRAW);
+      } else if(hdb->opts & HDBTBZIP){
+        zbuf = _tc_bzcompress(vbuf, vsiz, &vsiz);
+      } else if(hdb->opts & HDBTTCBS){
+        zbuf = tcbsencode(vbuf, vsiz, &vsiz);
+      } else {
+        zbuf = hdb->enc(vbuf, vsiz, &vsiz, hdb->encop);
+      }
+      if(!zbuf){
+        tchdbsetecode(hdb, TCEMISC, __FILE__, __LINE__, __func__);
+        HDBUNLOCKRECORD(hdb, req->bidx);
+        err = true;
+        break;
+      }
+      vbuf = zbuf;
+    }
+    if(!tchdbputimpl(hdb, kbufs[idx], ksizs[idx], req->bidx, req->hash, vbuf, vsiz, HDBPDOVER))
+      err = true;
+    if(zbuf) TCFREE(zbuf);
+    HDBUNLOCKRECORD(hdb, req->bidx);
+  }
+  HDBUNLOCKMETHOD(hdb);
+  TCFREE(reqs);
+  if(hdb->dfunit > 0 && hdb->dfcnt > hdb->dfunit &&
+     !tchdbdefrag(hdb, hdb->dfunit * HDBDFRSRAT + 1)) err = true;
+  return !err;
+}
+
+
 /* Remove a record of a hash database object. */
 bool tchdbout(TCHDB *hdb, const void *kbuf, int ksiz){
   assert(hdb && kbuf && ksiz >= 0);
@@ -740,6 +822,62 @@ int tchdbget3(TCHDB *hdb, const void *kbuf, int ksiz, void *vbuf, int max){
 }
 
 
+/* Retrieve records in a hash database object at once. */
+void *tchdbgetmany(TCHDB *hdb, const void * const *kbufs, const int *ksizs, int num,
+                   const void **vbufs, int *vsizs){
+  assert(hdb && kbufs && ksizs && num >= 0 && vbufs && vsizs);
+  if(!HDBLOCKMETHOD(hdb, false)) return NULL;
+  if(hdb->fd < 0){
+    tchdbsetecode(hdb, TCEINVALID, __FILE__, __LINE__, __func__);
+    HDBUNLOCKMETHOD(hdb);
+    return NULL;
+  }
+  if(hdb->async && !tchdbflushdrp(hdb)){
+    HDBUNLOCKMETHOD(hdb);
+    return NULL;
+  }
+  HDBMREQ *reqs = tchdbmreqnew(hdb, kbufs, ksizs, num);
+  qsort(reqs, num, sizeof(*reqs), tchdbmreqcmpoff);
+  tchdbprefetch(hdb, reqs, num);
+  TCXSTR *xstr = tcxstrnew3(HDBIOBUFSIZ);
+  int64_t *voffs;
+  TCMALLOC(voffs, sizeof(*voffs) * num + 1);
+  bool err = false;
+  for(int i = 0; i < num && !err; i++){
+    const HDBMREQ *req = reqs + i;
+    int idx = req->idx;
+    if(!HDBLOCKRECORD(hdb, req->bidx, false)){
+      err = true;
+      break;
+    }
+    int voff = TCXSTRSIZE(xstr);
+    int vsiz = tchdbgetintoxstr(hdb, kbufs[idx], ksizs[idx], req->bidx, req->hash, xstr);
+    HDBUNLOCKRECORD(hdb, req->bidx);
+    if(vsiz < 0){
+      if(tchdbecode(hdb) != TCENOREC) err = true;
+      voffs[idx] = -1;
+      vsizs[idx] = -1;
+    } else {
+      voffs[idx] = voff;
+      vsizs[idx] = vsiz;
+    }
+  }
+  HDBUNLOCKMETHOD(hdb);
+  TCFREE(reqs);
+  if(err){
+    TCFREE(voffs);
+    tcxstrdel(xstr);
+    return NULL;
+  }
+  char *rv = tcxstrtomalloc(xstr);
+  for(int i = 0; i < num; i++){
+    vbufs[i] = (voffs[i] >= 0) ? rv + voffs[i] : NULL;
+  }
+  TCFREE(voffs);
+  return rv;
+}
+
+
 /* Get the size of the value of a record in a hash database object. */
 int tchdbvsiz(TCHDB *hdb, const void *kbuf, int ksiz){
   assert(hdb && kbuf && ksiz >= 0);
@@ -838,6 +976,200 @@ bool tchdbiternext3(TCHDB *hdb, TCXSTR *kxstr, TCXSTR *vxstr){
 }
 
 
+/* Get the next record of the iterator of a hash database object without copying the value. */
+bool tchdbiternextmapped(TCHDB *hdb, TCXSTR *kxstr, TCXSTR *vxstr, const void **vbp, int *vsp){
+  assert(hdb && kxstr && vxstr && vbp && vsp);
+  if(!HDBLOCKMETHOD(hdb, true)) return false;
+  if(hdb->fd < 0 || hdb->iter < 1){
+    tchdbsetecode(hdb, TCEINVALID, __FILE__, __LINE__, __func__);
+    HDBUNLOCKMETHOD(hdb);
+    return false;
+  }
+  if(hdb->async && !tchdbflushdrp(hdb)){
+    HDBUNLOCKMETHOD(hdb);
+    return false;
+  }
+  bool rv = tchdbiternextmappedimpl(hdb, kxstr, vxstr, vbp, vsp);
+  HDBUNLOCKMETHOD(hdb);
+  return rv;
+}
+
+
+/* Create a scan object walking the records of a hash database object in the order of the file. */
+HDBSCAN *tchdbscannew(TCHDB *hdb){
+  assert(hdb);
+  if(!HDBLOCKMETHOD(hdb, true)) return NULL;
+  if(hdb->fd < 0){
+    tchdbsetecode(hdb, TCEINVALID, __FILE__, __LINE__, __func__);
+    HDBUNLOCKMETHOD(hdb);
+    return NULL;
+  }
+  if(hdb->async && !tchdbflushdrp(hdb)){
+    HDBUNLOCKMETHOD(hdb);
+    return NULL;
+  }
+  HDBSCAN *scan = tchdbscannewimpl(hdb, hdb->frec, hdb->fsiz);
+  HDBUNLOCKMETHOD(hdb);
+  return scan;
+}
+
+
+/* Create scan objects over disjoint parts of the file of a hash database object. */
+HDBSCAN **tchdbsplitscan(TCHDB *hdb, int num, int *np){
+  assert(hdb && num > 0 && np);
+  if(!HDBLOCKMETHOD(hdb, true)) return NULL;
+  if(hdb->fd < 0){
+    tchdbsetecode(hdb, TCEINVALID, __FILE__, __LINE__, __func__);
+    HDBUNLOCKMETHOD(hdb);
+    return NULL;
+  }
+  if(hdb->async && !tchdbflushdrp(hdb)){
+    HDBUNLOCKMETHOD(hdb);
+    return NULL;
+  }
+  uint64_t beg = hdb->frec;
+  uint64_t end = hdb->fsiz;
+  if(num > (end - beg) / HDBSCANBUFSIZ + 1) num = (end - beg) / HDBSCANBUFSIZ + 1;
+  /* bounds[i] starts out as the first part boundary wanted, and ends up as the offset of the
+     first record at or after it that heads a bucket */
+  uint64_t *targets;
+  TCMALLOC(targets, sizeof(*targets) * (num + 1));
+  uint64_t *bounds;
+  TCMALLOC(bounds, sizeof(*bounds) * (num + 1));
+  for(int i = 0; i <= num; i++){
+    targets[i] = beg + (end - beg) / num * i;
+    bounds[i] = end;
+  }
+  targets[num] = end;
+  for(uint64_t i = 0; i < hdb->bnum; i++){
+    uint64_t off = tchdbgetbucket(hdb, i);
+    if(off < beg + 1 || off >= end) continue;
+    int left = 0;
+    int right = num;
+    while(left < right){
+      int mid = (left + right + 1) / 2;
+      if(targets[mid] <= off){
+        left = mid;
+      } else {
+        right = mid - 1;
+      }
+    }
+    if(off < bounds[left]) bounds[left] = off;
+  }
+  /* bucket heads are the first records put in their buckets, so with many more records than
+     buckets they all sit near the start of the file; a boundary with no head close after it is
+     found by looking for a record start in the block that follows it */
+  for(int i = 1; i < num; i++){
+    if(bounds[i] - targets[i] <= HDBSCANBUFSIZ) continue;
+    uint64_t off = tchdbfindrecafter(hdb, targets[i], tclmin(bounds[i], targets[i] + HDBSCANBUFSIZ));
+    if(off > 0) bounds[i] = off;
+  }
+  for(int i = num - 1; i >= 0; i--){
+    if(bounds[i + 1] < bounds[i]) bounds[i] = bounds[i + 1];
+  }
+  bounds[0] = beg;
+  bounds[num] = end;
+  HDBSCAN **scans;
+  TCMALLOC(scans, sizeof(*scans) * num + 1);
+  int snum = 0;
+  for(int i = 0; i < num; i++){
+    if(bounds[i] >= bounds[i + 1] && !(i == 0 && beg == end)) continue;
+    scans[snum++] = tchdbscannewimpl(hdb, bounds[i], bounds[i + 1]);
+  }
+  TCFREE(bounds);
+  TCFREE(targets);
+  HDBUNLOCKMETHOD(hdb);
+  *np = snum;
+  return scans;
+}
+
+
+/* Delete a scan object. */
+void tchdbscandel(HDBSCAN *scan){
+  assert(scan);
+  TCFREE(scan->rbuf);
+  if(scan->zxstr) tcxstrdel(scan->zxstr);
+  TCFREE(scan);
+}
+
+
+/* Get the next record of a scan object. */
+bool tchdbscannext(HDBSCAN *scan, const void **kbp, int *ksp, const void **vbp, int *vsp,
+                   bool *mp){
+  assert(scan && kbp && ksp && vbp && vsp);
+  TCHDB *hdb = scan->hdb;
+  if(!HDBLOCKMETHOD(hdb, false)) return false;
+  if(hdb->fd < 0){
+    tchdbsetecode(hdb, TCEINVALID, __FILE__, __LINE__, __func__);
+    HDBUNLOCKMETHOD(hdb);
+    return false;
+  }
+  while(scan->off < scan->end){
+    TCHREC rec;
+    rec.off = scan->off;
+    int need = tclmin(hdb->runit, scan->end - scan->off);
+    int rsiz;
+    const char *rbuf = tchdbscanwindow(scan, rec.off, need, &rsiz);
+    if(!rbuf || !tchdbparserec(hdb, &rec, rbuf, rsiz)){
+      HDBUNLOCKMETHOD(hdb);
+      return false;
+    }
+    if(rec.rsiz < 1){
+      tchdbsetecode(hdb, TCERHEAD, __FILE__, __LINE__, __func__);
+      HDBUNLOCKMETHOD(hdb);
+      return false;
+    }
+    scan->off += rec.rsiz;
+    if(rec.magic != HDBMAGICREC) continue;
+    if(!rec.vbuf){
+      rbuf = tchdbscanwindow(scan, rec.boff, rec.ksiz + rec.vsiz, &rsiz);
+      if(!rbuf){
+        HDBUNLOCKMETHOD(hdb);
+        return false;
+      }
+      rec.kbuf = rbuf;
+      rec.vbuf = rbuf + rec.ksiz;
+    }
+    *kbp = rec.kbuf;
+    *ksp = rec.ksiz;
+    if(hdb->zmode){
+      int zsiz;
+      char *zbuf;
+      if(hdb->opts & HDBTDEFLATE){
+        zbuf = _tc_inflate(rec.vbuf, rec.vsiz, &zsiz, _TCZMRAW);
+      } else if(hdb->opts & HDBTBZIP){
+        zbuf = _tc_bzdecompress(rec.vbuf, rec.vsiz, &zsiz);
+      } else if(hdb->opts & HDBTTCBS){
+        zbuf = tcbsdecode(rec.vbuf, rec.vsiz, &zsiz);
+      } else {
+        zbuf = hdb->dec(rec.vbuf, rec.vsiz, &zsiz, hdb->decop);
+      }
+      if(!zbuf){
+        tchdbsetecode(hdb, TCEMISC, __FILE__, __LINE__, __func__);
+        HDBUNLOCKMETHOD(hdb);
+        return false;
+      }
+      if(!scan->zxstr) scan->zxstr = tcxstrnew();
+      tcxstrclear(scan->zxstr);
+      TCXSTRCAT(scan->zxstr, zbuf, zsiz);
+      TCFREE(zbuf);
+      *vbp = TCXSTRPTR(scan->zxstr);
+      *vsp = zsiz;
+      if(mp) *mp = false;
+    } else {
+      *vbp = rec.vbuf;
+      *vsp = rec.vsiz;
+      if(mp) *mp = hdb->map && rec.vbuf >= hdb->map && rec.vbuf < hdb->map + hdb->xmsiz;
+    }
+    HDBUNLOCKMETHOD(hdb);
+    return true;
+  }
+  tchdbsetecode(hdb, TCENOREC, __FILE__, __LINE__, __func__);
+  HDBUNLOCKMETHOD(hdb);
+  return false;
+}
+
+
 /* Get forward matching keys in a hash database object. */
 TCLIST *tchdbfwmkeys(TCHDB *hdb, const void *pbuf, int psiz, int max){
   assert(hdb && pbuf && psiz >= 0);
@@ -2152,6 +2484,57 @@ static void tchdbsetflag(TCHDB *hdb, int flag, bool sign){
 }
 
 
+/* Finish a 64-bit hash value so that every input bit affects every output bit.
+   `hash' specifies the value.
+   The return value is the mixed value. */
+static uint64_t tchdbfmix(uint64_t hash){
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+
+/* Calculate the hash value of a key a 64-bit word at a time.
+   `kbuf' specifies the pointer to the region of the key.
+   `ksiz' specifies the size of the region of the key.
+   The return value is the hash value.  Words are read little-endian, so the value does not
+   depend on the byte order of the host. */
+static uint64_t tchdbfhash(const char *kbuf, int ksiz){
+  assert(kbuf && ksiz >= 0);
+  const uint64_t seed = 0x9e3779b97f4a7c15ULL;
+  if(ksiz == sizeof(uint32_t)){
+    uint32_t lnum;
+    memcpy(&lnum, kbuf, sizeof(lnum));
+    return tchdbfmix(seed ^ (uint64_t)TCITOHL(lnum));
+  }
+  if(ksiz == sizeof(uint64_t)){
+    uint64_t llnum;
+    memcpy(&llnum, kbuf, sizeof(llnum));
+    return tchdbfmix((seed ^ sizeof(uint64_t)) + TCITOHLL(llnum));
+  }
+  uint64_t hash = seed ^ ((uint64_t)ksiz * 0x87c37b91114253d5ULL);
+  while(ksiz >= (int)sizeof(uint64_t)){
+    uint64_t llnum;
+    memcpy(&llnum, kbuf, sizeof(llnum));
+    llnum = TCITOHLL(llnum) * 0x87c37b91114253d5ULL;
+    llnum = (llnum << 31) | (llnum >> 33);
+    hash ^= llnum * 0x4cf5ad432745937fULL;
+    hash = ((hash << 27) | (hash >> 37)) * 5 + 0x52dce729;
+    kbuf += sizeof(uint64_t);
+    ksiz -= sizeof(uint64_t);
+  }
+  uint64_t tail = 0;
+  for(int i = 0; i < ksiz; i++){
+    tail |= (uint64_t)((uint8_t *)kbuf)[i] << (i * 8);
+  }
+  hash ^= tail * 0x4cf5ad432745937fULL;
+  return tchdbfmix(hash);
+}
+
+
 /* Get the bucket index of a record.
    `hdb' specifies the hash database object.
    `kbuf' specifies the pointer to the region of the key.
@@ -2160,6 +2543,11 @@ static void tchdbsetflag(TCHDB *hdb, int flag, bool sign){
    The return value is the bucket index. */
 static uint64_t tchdbbidx(TCHDB *hdb, const char *kbuf, int ksiz, uint8_t *hp){
   assert(hdb && kbuf && ksiz >= 0 && hp);
+  if(hdb->opts & HDBTFHASH){
+    uint64_t hash = tchdbfhash(kbuf, ksiz);
+    *hp = (hash * 0x9e3779b97f4a7c15ULL) >> 56;
+    return hash % hdb->bnum;
+  }
   uint64_t idx = 19780211;
   uint32_t hash = 751;
   const char *rp = kbuf + ksiz;
@@ -2804,6 +3192,19 @@ static bool tchdbreadrec(TCHDB *hdb, TCHREC *rec, char *rbuf){
     }
     HDBUNLOCKDB(hdb);
   }
+  return tchdbparserec(hdb, rec, rbuf, rsiz);
+}
+
+
+/* Parse the header of a record.
+   `hdb' specifies the hash database object.
+   `rec' specifies the record object whose offset is set.
+   `rbuf' specifies the pointer to the region holding the record.
+   `rsiz' specifies the size of the region.
+   The return value is true if successful, else, it is false.  The key and the value are pointed
+   at in `rbuf' if the region holds them. */
+static bool tchdbparserec(TCHDB *hdb, TCHREC *rec, const char *rbuf, int rsiz){
+  assert(hdb && rec && rbuf && rsiz >= 0);
   const char *rp = rbuf;
   rec->magic = *(uint8_t *)(rp++);
   if(rec->magic == HDBMAGICFB){
@@ -3444,6 +3845,12 @@ static bool tchdbopenimpl(TCHDB *hdb, const char *path, int omode){
     close(fd);
     return false;
   }
+  /* an option this version does not know may change where records are, as `HDBTFHASH' does */
+  if(hdb->opts & ~HDBKNOWNOPTS){
+    tchdbsetecode(hdb, TCEMETA, __FILE__, __LINE__, __func__);
+    close(fd);
+    return false;
+  }
   size_t xmsiz = (hdb->xmsiz > msiz) ? hdb->xmsiz : msiz;
   if(!(omode & HDBOWRITER) && xmsiz > hdb->fsiz) xmsiz = hdb->fsiz;
   void *map = mmap(0, xmsiz, PROT_READ | ((omode & HDBOWRITER) ? PROT_WRITE : 0),
@@ -4150,6 +4557,164 @@ static int tchdbgetintobuf(TCHDB *hdb, const char *kbuf, int ksiz, uint64_t bidx
 }
 
 
+/* Retrieve a record in a hash database object and append the value to an extensible string.
+   `hdb' specifies the hash database object.
+   `kbuf' specifies the pointer to the region of the key.
+   `ksiz' specifies the size of the region of the key.
+   `bidx' specifies the index of the bucket array.
+   `hash' specifies the hash value for the collision tree.
+   `xstr' specifies the extensible string object.  The value is followed by a zero code and
+   padded so that whatever is appended next starts on an 8-byte boundary.
+   If successful, the return value is the size of the value, else, it is -1. */
+static int tchdbgetintoxstr(TCHDB *hdb, const char *kbuf, int ksiz, uint64_t bidx, uint8_t hash,
+                            TCXSTR *xstr){
+  assert(hdb && kbuf && ksiz >= 0 && xstr);
+  int vsiz;
+  if(hdb->recc || hdb->zmode){
+    char *vbuf = tchdbgetimpl(hdb, kbuf, ksiz, bidx, hash, &vsiz);
+    if(!vbuf) return -1;
+    TCXSTRCAT(xstr, vbuf, vsiz);
+    TCFREE(vbuf);
+  } else {
+    off_t off = tchdbgetbucket(hdb, bidx);
+    TCHREC rec;
+    char rbuf[HDBIOBUFSIZ];
+    vsiz = -1;
+    while(off > 0){
+      rec.off = off;
+      if(!tchdbreadrec(hdb, &rec, rbuf)) return -1;
+      if(hash > rec.hash){
+        off = rec.left;
+      } else if(hash < rec.hash){
+        off = rec.right;
+      } else {
+        if(!rec.kbuf && !tchdbreadrecbody(hdb, &rec)) return -1;
+        int kcmp = tcreckeycmp(kbuf, ksiz, rec.kbuf, rec.ksiz);
+        if(kcmp > 0){
+          off = rec.left;
+          TCFREE(rec.bbuf);
+          rec.kbuf = NULL;
+          rec.bbuf = NULL;
+        } else if(kcmp < 0){
+          off = rec.right;
+          TCFREE(rec.bbuf);
+          rec.kbuf = NULL;
+          rec.bbuf = NULL;
+        } else {
+          if(!rec.vbuf && !tchdbreadrecbody(hdb, &rec)) return -1;
+          vsiz = rec.vsiz;
+          TCXSTRCAT(xstr, rec.vbuf, vsiz);
+          TCFREE(rec.bbuf);
+          break;
+        }
+      }
+    }
+    if(vsiz < 0){
+      tchdbsetecode(hdb, TCENOREC, __FILE__, __LINE__, __func__);
+      return -1;
+    }
+  }
+  static const char zeros[sizeof(uint64_t)];
+  TCXSTRCAT(xstr, zeros, sizeof(uint64_t) - TCXSTRSIZE(xstr) % sizeof(uint64_t));
+  return vsiz;
+}
+
+
+/* Make the requests of a batch operation.
+   `hdb' specifies the hash database object.
+   `kbufs' specifies the array of the pointers to the regions of the keys.
+   `ksizs' specifies the array of the sizes of the keys.
+   `num' specifies the number of the keys.
+   The return value is the array of the requests, in the order of the keys.  Because the region
+   of the return value is allocated with the `malloc' call, it should be released with the `free'
+   call when it is no longer in use.  The offsets are read without the record locks: they only
+   order the requests and guide the prefetching. */
+static HDBMREQ *tchdbmreqnew(TCHDB *hdb, const void * const *kbufs, const int *ksizs, int num){
+  assert(hdb && kbufs && ksizs && num >= 0);
+  HDBMREQ *reqs;
+  TCMALLOC(reqs, sizeof(*reqs) * num + 1);
+  for(int i = 0; i < num; i++){
+    HDBMREQ *req = reqs + i;
+    req->bidx = tchdbbidx(hdb, kbufs[i], ksizs[i], &req->hash);
+    req->off = tchdbgetbucket(hdb, req->bidx);
+    req->idx = i;
+  }
+  return reqs;
+}
+
+
+/* Compare two requests of a batch operation by the offset of the first record.
+   `a' specifies the pointer to one request.
+   `b' specifies the pointer to the other request.
+   The return value is positive if the former is big, negative if the latter is big, 0 if both
+   are equivalent. */
+static int tchdbmreqcmpoff(const void *a, const void *b){
+  assert(a && b);
+  const HDBMREQ *ra = a;
+  const HDBMREQ *rb = b;
+  if(ra->off != rb->off) return (ra->off > rb->off) ? 1 : -1;
+  return ra->idx - rb->idx;
+}
+
+
+/* Compare two requests of a batch operation by the bucket index.
+   `a' specifies the pointer to one request.
+   `b' specifies the pointer to the other request.
+   The return value is positive if the former is big, negative if the latter is big, 0 if both
+   are equivalent.  Requests for the same bucket keep the caller's order, so the last of
+   several values for one key wins. */
+static int tchdbmreqcmpbidx(const void *a, const void *b){
+  assert(a && b);
+  const HDBMREQ *ra = a;
+  const HDBMREQ *rb = b;
+  if(ra->bidx != rb->bidx) return (ra->bidx > rb->bidx) ? 1 : -1;
+  return ra->idx - rb->idx;
+}
+
+
+/* Tell the kernel which regions the requests of a batch operation are going to read.
+   `hdb' specifies the hash database object.
+   `reqs' specifies the array of the requests, sorted by the offset.
+   `num' specifies the number of the requests.
+   Neighbouring regions are merged so that each run of records costs one hint. */
+static void tchdbprefetch(TCHDB *hdb, const HDBMREQ *reqs, int num){
+  assert(hdb && reqs && num >= 0);
+  if(num < 2) return;
+  uint64_t psiz = sysconf(_SC_PAGESIZE);
+  uint64_t beg = 0;
+  uint64_t end = 0;
+  for(int i = 0; i <= num; i++){
+    if(i < num){
+      if(reqs[i].off < 1) continue;
+      uint64_t off = reqs[i].off;
+      if(end > 0 && off <= end + HDBIOBUFSIZ){
+        if(off + hdb->runit > end) end = off + hdb->runit;
+        continue;
+      }
+    }
+    if(end > 0){
+      if(end <= hdb->xmsiz){
+        uint64_t abeg = beg - beg % psiz;
+        madvise(hdb->map + abeg, end - abeg, MADV_WILLNEED);
+      } else {
+#if defined(POSIX_FADV_WILLNEED)
+        posix_fadvise(hdb->fd, beg, end - beg, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+        struct radvisory ra;
+        ra.ra_offset = beg;
+        ra.ra_count = end - beg;
+        fcntl(hdb->fd, F_RDADVISE, &ra);
+#endif
+      }
+    }
+    if(i < num){
+      beg = reqs[i].off;
+      end = beg + hdb->runit;
+    }
+  }
+}
+
+
 /* Retrieve the next record of a record in a hash database object.
    `hdb' specifies the hash database object.
    `kbuf' specifies the pointer to the region of the key.
@@ -4513,6 +5078,180 @@ static bool tchdbiternextintoxstr(TCHDB *hdb, TCXSTR *kxstr, TCXSTR *vxstr){
 }
 
 
+/* Get the next record of the iterator of a hash database object without copying the value.
+   `hdb' specifies the hash database object.
+   `kxstr' specifies the object into which the next key is wrote down.
+   `vxstr' specifies the object into which the next value is wrote down if it is not mapped.
+   `vbp' specifies the pointer to the variable into which the pointer to the value is assigned.
+   `vsp' specifies the pointer to the variable into which the size of the value is assigned.
+   If successful, the return value is true, else, it is false. */
+static bool tchdbiternextmappedimpl(TCHDB *hdb, TCXSTR *kxstr, TCXSTR *vxstr,
+                                    const void **vbp, int *vsp){
+  assert(hdb && kxstr && vxstr && vbp && vsp);
+  TCHREC rec;
+  char rbuf[HDBIOBUFSIZ];
+  while(hdb->iter < hdb->fsiz){
+    rec.off = hdb->iter;
+    if(!tchdbreadrec(hdb, &rec, rbuf)) return false;
+    hdb->iter += rec.rsiz;
+    if(rec.magic == HDBMAGICREC){
+      uint64_t voff = rec.boff + rec.ksiz;
+      uint64_t end = voff + rec.vsiz;
+      if(!hdb->zmode && hdb->map && end <= hdb->xmsiz && end <= hdb->fsiz){
+        if(!rec.kbuf && !tchdbreadrecbody(hdb, &rec)) return false;
+        tcxstrclear(kxstr);
+        TCXSTRCAT(kxstr, rec.kbuf, rec.ksiz);
+        TCFREE(rec.bbuf);
+        *vbp = hdb->map + voff;
+        *vsp = rec.vsiz;
+        return true;
+      }
+      hdb->iter = rec.off;
+      if(!tchdbiternextintoxstr(hdb, kxstr, vxstr)) return false;
+      *vbp = tcxstrptr(vxstr);
+      *vsp = tcxstrsize(vxstr);
+      return true;
+    }
+  }
+  tchdbsetecode(hdb, TCENOREC, __FILE__, __LINE__, __func__);
+  return false;
+}
+
+
+/* Create a scan object over a region of the file of a hash database object.
+   `hdb' specifies the hash database object.
+   `off' specifies the offset of the first record of the region.
+   `end' specifies the offset where the region ends.
+   The return value is the new scan object. */
+static HDBSCAN *tchdbscannewimpl(TCHDB *hdb, uint64_t off, uint64_t end){
+  assert(hdb && off <= end);
+  HDBSCAN *scan;
+  TCMALLOC(scan, sizeof(*scan));
+  scan->hdb = hdb;
+  scan->off = off;
+  scan->end = end;
+  scan->rbsiz = HDBSCANBUFSIZ;
+  TCMALLOC(scan->rbuf, scan->rbsiz);
+  scan->rboff = 0;
+  scan->rblen = 0;
+  scan->zxstr = NULL;
+  if(end > hdb->xmsiz){
+    uint64_t beg = tclmax(off, hdb->xmsiz);
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(hdb->fd, beg, end - beg, POSIX_FADV_SEQUENTIAL);
+#elif defined(F_RDAHEAD)
+    fcntl(hdb->fd, F_RDAHEAD, 1);
+#endif
+  }
+  return scan;
+}
+
+
+/* Get a region of the file for a scan object.
+   `scan' specifies the scan object.
+   `off' specifies the offset of the region.
+   `need' specifies the size the region must have at least.
+   `sp' specifies the pointer to the variable into which the size of the region is assigned.  It
+   can be more than `need', up to the end of the scan.
+   The return value is the pointer to the region in the mapped memory or in the readahead buffer,
+   or `NULL' on failure.  The readahead buffer is refilled, a block at a time, only when it does
+   not hold the region. */
+static const char *tchdbscanwindow(HDBSCAN *scan, uint64_t off, int need, int *sp){
+  assert(scan && need >= 0 && sp);
+  TCHDB *hdb = scan->hdb;
+  uint64_t end = scan->end;
+  if(off + need > end){
+    tchdbsetecode(hdb, TCERHEAD, __FILE__, __LINE__, __func__);
+    return NULL;
+  }
+  if(hdb->map && off + need <= hdb->xmsiz){
+    *sp = tclmin(tclmin(end, hdb->xmsiz) - off, INT_MAX);
+    return hdb->map + off;
+  }
+  if(off < scan->rboff || off + need > scan->rboff + scan->rblen){
+    if(need > scan->rbsiz){
+      scan->rbsiz = need;
+      TCREALLOC(scan->rbuf, scan->rbuf, scan->rbsiz);
+    }
+    int len = tclmin(scan->rbsiz, end - off);
+    if(!tchdbseekread(hdb, off, scan->rbuf, len)) return NULL;
+    scan->rboff = off;
+    scan->rblen = len;
+  }
+  *sp = scan->rboff + scan->rblen - off;
+  return scan->rbuf + (off - scan->rboff);
+}
+
+
+/* Check whether a record read from an arbitrary offset is one the database holds there.
+   `hdb' specifies the hash database object.
+   `rec' specifies the record object whose header and key are read.
+   The return value is true if the tree of the bucket of its key leads to the offset.  Bytes
+   that only look like a record header fail this, as no tree entry points to them. */
+static bool tchdbisrecoff(TCHDB *hdb, TCHREC *rec){
+  assert(hdb && rec && rec->kbuf);
+  uint8_t hash;
+  uint64_t bidx = tchdbbidx(hdb, rec->kbuf, rec->ksiz, &hash);
+  if(hash != rec->hash) return false;
+  uint64_t off = tchdbgetbucket(hdb, bidx);
+  char rbuf[HDBIOBUFSIZ];
+  while(off > 0){
+    if(off == rec->off) return true;
+    TCHREC nrec;
+    nrec.off = off;
+    if(!tchdbreadrec(hdb, &nrec, rbuf)) return false;
+    if(hash > nrec.hash){
+      off = nrec.left;
+    } else if(hash < nrec.hash){
+      off = nrec.right;
+    } else {
+      if(!nrec.kbuf && !tchdbreadrecbody(hdb, &nrec)) return false;
+      int kcmp = tcreckeycmp(rec->kbuf, rec->ksiz, nrec.kbuf, nrec.ksiz);
+      TCFREE(nrec.bbuf);
+      if(kcmp > 0){
+        off = nrec.left;
+      } else if(kcmp < 0){
+        off = nrec.right;
+      } else {
+        return false;
+      }
+    }
+  }
+  return false;
+}
+
+
+/* Find the first record at or after an offset without walking from the start of the file.
+   `hdb' specifies the hash database object.
+   `off' specifies the offset to look from.
+   `end' specifies the offset to give up at.
+   The return value is the offset of the record, or 0 if none was found.  Records start on
+   alignment boundaries; each that begins with the record magic number and whose key hashes
+   back to it is checked against the tree of its bucket. */
+static uint64_t tchdbfindrecafter(TCHDB *hdb, uint64_t off, uint64_t end){
+  assert(hdb);
+  uint64_t align = hdb->align;
+  off = (off + align - 1) / align * align;
+  if(off >= end) return 0;
+  int wsiz = end - off;
+  char *wbuf;
+  TCMALLOC(wbuf, wsiz);
+  uint64_t found = 0;
+  if(tchdbseekread(hdb, off, wbuf, wsiz)){
+    for(int wp = 0; wp + HDBMAXHSIZ <= wsiz && found < 1; wp += align){
+      if(*(uint8_t *)(wbuf + wp) != HDBMAGICREC) continue;
+      TCHREC rec;
+      rec.off = off + wp;
+      if(!tchdbparserec(hdb, &rec, wbuf + wp, wsiz - wp) || !rec.kbuf) continue;
+      if(rec.off + rec.rsiz > hdb->fsiz) continue;
+      if(tchdbisrecoff(hdb, &rec)) found = rec.off;
+    }
+  }
+  TCFREE(wbuf);
+  return found;
+}
+
+
 /* Optimize the file of a hash database object.
    `hdb' specifies the hash database object.
    `bnum' specifies the number of elements of the bucket array.
@@ -109,6 +109,17 @@ typedef struct {                         /* type of structure for a hash databas
   int64_t cnt_trunc;                     /* tesing counter for truncation times */
 } TCHDB;
 
+typedef struct {                         /* type of structure for a sequential scan */
+  TCHDB *hdb;                            /* hash database object */
+  uint64_t off;                          /* offset of the next record */
+  uint64_t end;                          /* offset where the scan stops */
+  char *rbuf;                            /* readahead buffer */
+  int rbsiz;                             /* allocated size of the readahead buffer */
+  uint64_t rboff;                        /* offset of the data in the readahead buffer */
+  int rblen;                             /* size of the data in the readahead buffer */
+  TCXSTR *zxstr;                         /* decompressed value of the last record */
+} HDBSCAN;
+
 enum {                                   /* enumeration for additional flags */
   HDBFOPEN = 1 << 0,                     /* whether opened */
   HDBFFATAL = 1 << 1                     /* whether with fatal error */
@@ -119,7 +130,8 @@ enum {                                   /* enumeration for tuning options */
   HDBTDEFLATE = 1 << 1,                  /* compress each record with Deflate */
   HDBTBZIP = 1 << 2,                     /* compress each record with BZIP2 */
   HDBTTCBS = 1 << 3,                     /* compress each record with TCBS */
-  HDBTEXCODEC = 1 << 4                   /* compress each record with custom functions */
+  HDBTEXCODEC = 1 << 4,                  /* compress each record with custom functions */
+  HDBTFHASH = 1 << 5                     /* use the 64-bit word-at-a-time hash function */
 };
 
 enum {                                   /* enumeration for open modes */
@@ -186,7 +198,12 @@ bool tchdbsetmutex(TCHDB *hdb);
    `opts' specifies options by bitwise-or: `HDBTLARGE' specifies that the size of the database
    can be larger than 2GB by using 64-bit bucket array, `HDBTDEFLATE' specifies that each record
    is compressed with Deflate encoding, `HDBTBZIP' specifies that each record is compressed with
-   BZIP2 encoding, `HDBTTCBS' specifies that each record is compressed with TCBS encoding.
+   BZIP2 encoding, `HDBTTCBS' specifies that each record is compressed with TCBS encoding,
+   `HDBTFHASH' specifies that keys are hashed a 64-bit word at a time instead of byte by byte.
+   The hash function is recorded in the header, so files made without `HDBTFHASH' keep the
+   original one.  Versions of the library from before `HDBTFHASH' open files made with it
+   without an error but do not find their records, so it is only for files that no older
+   version will open.  This version refuses to open a file with options it does not know.
    If successful, the return value is true, else, it is false.
    Note that the tuning parameters should be set before the database is opened. */
 bool tchdbtune(TCHDB *hdb, int64_t bnum, int8_t apow, int8_t fpow, uint8_t opts);
@@ -323,6 +340,22 @@ bool tchdbputasync(TCHDB *hdb, const void *kbuf, int ksiz, const void *vbuf, int
 bool tchdbputasync2(TCHDB *hdb, const char *kstr, const char *vstr);
 
 
+/* Store records into a hash database object at once.
+   `hdb' specifies the hash database object connected as a writer.
+   `kbufs' specifies the array of the pointers to the regions of the keys.
+   `ksizs' specifies the array of the sizes of the keys.
+   `vbufs' specifies the array of the pointers to the regions of the values.
+   `vsizs' specifies the array of the sizes of the values.
+   `num' specifies the number of the records.
+   If successful, the return value is true, else, it is false.  Records stored before a failure
+   stay stored.
+   Existing records are overwritten.  If a key appears more than once, the last value wins.  The
+   method lock is taken once for the whole batch and the records are stored in the order of their
+   buckets. */
+bool tchdbputmany(TCHDB *hdb, const void * const *kbufs, const int *ksizs,
+                  const void * const *vbufs, const int *vsizs, int num);
+
+
 /* Remove a record of a hash database object.
    `hdb' specifies the hash database object connected as a writer.
    `kbuf' specifies the pointer to the region of the key.
@@ -377,6 +410,26 @@ char *tchdbget2(TCHDB *hdb, const char *kstr);
 int tchdbget3(TCHDB *hdb, const void *kbuf, int ksiz, void *vbuf, int max);
 
 
+/* Retrieve records in a hash database object at once.
+   `hdb' specifies the hash database object.
+   `kbufs' specifies the array of the pointers to the regions of the keys.
+   `ksizs' specifies the array of the sizes of the keys.
+   `num' specifies the number of the keys.
+   `vbufs' specifies the array into which the pointers to the values are assigned.  The pointer
+   for a key without a record is `NULL'.
+   `vsizs' specifies the array into which the sizes of the values are assigned.  The size for a
+   key without a record is -1.
+   If successful, the return value is the pointer to one region holding all the values found,
+   else, it is `NULL'.  A key without a record is not an error.
+   Each value is followed by a zero code and starts on an 8-byte boundary.  Because the region of
+   the return value is allocated with the `malloc' call, it should be released with the `free'
+   call when it is no longer in use.
+   The method lock is taken once for the whole batch, and the records are read in the order of
+   their offsets in the file after the regions to be read are hinted to the kernel. */
+void *tchdbgetmany(TCHDB *hdb, const void * const *kbufs, const int *ksizs, int num,
+                   const void **vbufs, int *vsizs);
+
+
 /* Get the size of the value of a record in a hash database object.
    `hdb' specifies the hash database object.
    `kbuf' specifies the pointer to the region of the key.
@@ -440,6 +493,79 @@ char *tchdbiternext2(TCHDB *hdb);
 bool tchdbiternext3(TCHDB *hdb, TCXSTR *kxstr, TCXSTR *vxstr);
 
 
+/* Get the next record of the iterator of a hash database object without copying the value.
+   `hdb' specifies the hash database object.
+   `kxstr' specifies the object into which the next key is wrote down.
+   `vxstr' specifies the object into which the next value is wrote down if it cannot be served
+   from the mapped memory.
+   `vbp' specifies the pointer to the variable into which the pointer to the region of the value
+   is assigned.
+   `vsp' specifies the pointer to the variable into which the size of the value is assigned.
+   If successful, the return value is true, else, it is false.  False is returned when no record
+   is to be get out of the iterator.
+   If the value lies inside the mapped memory and the database is not compressed, the region
+   points into the mapped memory and `vxstr' is left untouched; otherwise the value is wrote down
+   into `vxstr' and the region points into it.  The region must not be modified.  A mapped
+   region is valid only until the next update or optimization of the database or until it is
+   closed; a region in `vxstr' is valid until `vxstr' is next changed. */
+bool tchdbiternextmapped(TCHDB *hdb, TCXSTR *kxstr, TCXSTR *vxstr, const void **vbp, int *vsp);
+
+
+/* Create a scan object walking the records of a hash database object in the order of the file.
+   `hdb' specifies the hash database object.
+   The return value is the new scan object or `NULL' if the database is not open.
+   A scan reads the file a large block at a time instead of a record at a time, skips free blocks
+   by their headers, and does not use or disturb the iterator.  Several scans can run at once,
+   even on different threads, but the database should not be updated while they do.  Because
+   the object of the return value is created with the function `tchdbscannew', it should be
+   deleted with the function `tchdbscandel' when it is no longer in use. */
+HDBSCAN *tchdbscannew(TCHDB *hdb);
+
+
+/* Create scan objects over disjoint parts of the file of a hash database object.
+   `hdb' specifies the hash database object.
+   `num' specifies the number of parts wanted.
+   `np' specifies the pointer to the variable into which the number of scan objects is assigned.
+   The return value is the array of the scan objects or `NULL' if the database is not open.
+   Together the scans walk every record once.  The parts are of about the same size.  Where it
+   can, a part starts at a record that heads a bucket, found in the bucket array without reading
+   any record.  With many more records than buckets, those records all lie near the start of
+   the file.  A part is then started at the first record in the block after its ideal start,
+   and merged with the part before it if no record is found there.  There are fewer than `num'
+   when the file is too small to split that far.
+   Each scan is independent of the others and of the iterator, so each can be run on a thread of
+   its own.  Because the array and the scan objects of the return value are allocated with the
+   `malloc' call and the function `tchdbscannew', each scan object should be deleted with the
+   function `tchdbscandel' and the array released with the `free' call when they are no longer
+   in use. */
+HDBSCAN **tchdbsplitscan(TCHDB *hdb, int num, int *np);
+
+
+/* Delete a scan object.
+   `scan' specifies the scan object. */
+void tchdbscandel(HDBSCAN *scan);
+
+
+/* Get the next record of a scan object.
+   `scan' specifies the scan object.
+   `kbp' specifies the pointer to the variable into which the pointer to the region of the key
+   is assigned.
+   `ksp' specifies the pointer to the variable into which the size of the key is assigned.
+   `vbp' specifies the pointer to the variable into which the pointer to the region of the value
+   is assigned.
+   `vsp' specifies the pointer to the variable into which the size of the value is assigned.
+   `mp' specifies the pointer to the variable into which whether the value lies in the mapped
+   memory is assigned.  If it is `NULL', it is not used.
+   If successful, the return value is true, else, it is false.  False is returned when the scan
+   has no more records.
+   Nothing is copied: the regions point into the mapped memory or into the readahead buffer (or,
+   if the database is compressed, a buffer for the decompressed value) of the scan object.  They
+   must not be modified.  A region in the mapped memory is valid until the database is next
+   updated, optimized or closed; any other region is valid until the next call on the scan. */
+bool tchdbscannext(HDBSCAN *scan, const void **kbp, int *ksp, const void **vbp, int *vsp,
+                   bool *mp);
+
+
 /* Get forward matching keys in a hash database object.
    `hdb' specifies the hash database object.
    `pbuf' specifies the pointer to the region of the prefix.
@@ -507,8 +633,9 @@ bool tchdbsync(TCHDB *hdb);
    `opts' specifies options by bitwise-or: `HDBTLARGE' specifies that the size of the database
    can be larger than 2GB by using 64-bit bucket array, `HDBTDEFLATE' specifies that each record
    is compressed with Deflate encoding, `HDBTBZIP' specifies that each record is compressed with
-   BZIP2 encoding, `HDBTTCBS' specifies that each record is compressed with TCBS encoding.  If it
-   is `UINT8_MAX', the current setting is not changed.
+   BZIP2 encoding, `HDBTTCBS' specifies that each record is compressed with TCBS encoding,
+   `HDBTFHASH' specifies that keys are hashed a 64-bit word at a time.  If it is `UINT8_MAX', the
+   current setting is not changed.
    If successful, the return value is true, else, it is false.
    This function is useful to reduce the size of the database file with data fragmentation by
    successive updating. */
@@ -36,6 +36,14 @@ typedef struct {                         // type of structure for read thread
   int id;
 } TARGREAD;
 
+typedef struct {                         // type of structure for scan thread
+  TCHDB *hdb;
+  HDBSCAN *scan;
+  int64_t rnum;
+  int64_t vsum;
+  int id;
+} TARGSCAN;
+
 typedef struct {                         // type of structure for remove thread
   TCHDB *hdb;
   int rnum;
@@ -86,6 +94,7 @@ static bool iterfunc(const void *kbuf, int ksiz, const void *vbuf, int vsiz, voi
 static int runwrite(int argc, char **argv);
 static int runread(int argc, char **argv);
 static int runremove(int argc, char **argv);
+static int runscan(int argc, char **argv);
 static int runwicked(int argc, char **argv);
 static int runtypical(int argc, char **argv);
 static int runrace(int argc, char **argv);
@@ -95,6 +104,7 @@ static int procread(const char *path, int tnum, int rcnum, int xmsiz, int dfunit
                     bool wb, bool rnd);
 static int procremove(const char *path, int tnum, int rcnum, int xmsiz, int dfunit, int omode,
                       bool rnd);
+static int procscan(const char *path, int tnum, int xmsiz, int omode);
 static int procwicked(const char *path, int tnum, int rnum, int opts, int omode, bool nc);
 static int proctypical(const char *path, int tnum, int rnum, int bnum, int apow, int fpow,
                        int opts, int rcnum, int xmsiz, int dfunit, int omode,
@@ -104,6 +114,7 @@ static int procrace(const char *path, int tnum, int rnum, int bnum, int apow, in
 static void *threadwrite(void *targ);
 static void *threadread(void *targ);
 static void *threadremove(void *targ);
+static void *threadscan(void *targ);
 static void *threadwicked(void *targ);
 static void *threadtypical(void *targ);
 static void *threadrace(void *targ);
@@ -125,6 +136,8 @@ int main(int argc, char **argv){
     rv = runread(argc, argv);
   } else if(!strcmp(argv[1], "remove")){
     rv = runremove(argc, argv);
+  } else if(!strcmp(argv[1], "scan")){
+    rv = runscan(argc, argv);
   } else if(!strcmp(argv[1], "wicked")){
     rv = runwicked(argc, argv);
   } else if(!strcmp(argv[1], "typical")){
@@ -150,17 +163,18 @@ static void usage(void){
   fprintf(stderr, "%s: test cases of the hash database API of Tokyo Cabinet\n", g_progname);
   fprintf(stderr, "\n");
   fprintf(stderr, "usage:\n");
-  fprintf(stderr, "  %s write [-tl] [-td|-tb|-tt|-tx] [-rc num] [-xm num] [-df num]"
+  fprintf(stderr, "  %s write [-tl] [-tf] [-td|-tb|-tt|-tx] [-rc num] [-xm num] [-df num]"
           " [-nl|-nb] [-as] [-rnd] path tnum rnum [bnum [apow [fpow]]]\n", g_progname);
   fprintf(stderr, "  %s read [-rc num] [-xm num] [-df num] [-nl|-nb] [-wb] [-rnd] path tnum\n",
           g_progname);
   fprintf(stderr, "  %s remove [-rc num] [-xm num] [-df num] [-nl|-nb] [-rnd] path tnum\n",
           g_progname);
-  fprintf(stderr, "  %s wicked [-tl] [-td|-tb|-tt|-tx] [-nl|-nb] [-nc]"
+  fprintf(stderr, "  %s scan [-xm num] [-nl|-nb] path tnum\n", g_progname);
+  fprintf(stderr, "  %s wicked [-tl] [-tf] [-td|-tb|-tt|-tx] [-nl|-nb] [-nc]"
           " path tnum rnum\n", g_progname);
-  fprintf(stderr, "  %s typical [-tl] [-td|-tb|-tt|-tx] [-rc num] [-xm num] [-df num]"
+  fprintf(stderr, "  %s typical [-tl] [-tf] [-td|-tb|-tt|-tx] [-rc num] [-xm num] [-df num]"
           " [-nl|-nb] [-nc] [-rr num] path tnum rnum [bnum [apow [fpow]]]\n", g_progname);
-  fprintf(stderr, "  %s race [-tl] [-td|-tb|-tt|-tx] [-xm num] [-df num] [-nl|-nb]"
+  fprintf(stderr, "  %s race [-tl] [-tf] [-td|-tb|-tt|-tx] [-xm num] [-df num] [-nl|-nb]"
           " path tnum rnum [bnum [apow [fpow]]]\n", g_progname);
   fprintf(stderr, "\n");
   exit(1);
@@ -281,6 +295,8 @@ static int runwrite(int argc, char **argv){
     if(!path && argv[i][0] == '-'){
       if(!strcmp(argv[i], "-tl")){
         opts |= HDBTLARGE;
+      } else if(!strcmp(argv[i], "-tf")){
+        opts |= HDBTFHASH;
       } else if(!strcmp(argv[i], "-td")){
         opts |= HDBTDEFLATE;
       } else if(!strcmp(argv[i], "-tb")){
@@ -431,6 +447,40 @@ static int runremove(int argc, char **argv){
 }
 
 
+/* parse arguments of scan command */
+static int runscan(int argc, char **argv){
+  char *path = NULL;
+  char *tstr = NULL;
+  int xmsiz = -1;
+  int omode = 0;
+  for(int i = 2; i < argc; i++){
+    if(!path && argv[i][0] == '-'){
+      if(!strcmp(argv[i], "-xm")){
+        if(++i >= argc) usage();
+        xmsiz = tcatoix(argv[i]);
+      } else if(!strcmp(argv[i], "-nl")){
+        omode |= HDBONOLCK;
+      } else if(!strcmp(argv[i], "-nb")){
+        omode |= HDBOLCKNB;
+      } else {
+        usage();
+      }
+    } else if(!path){
+      path = argv[i];
+    } else if(!tstr){
+      tstr = argv[i];
+    } else {
+      usage();
+    }
+  }
+  if(!path || !tstr) usage();
+  int tnum = tcatoix(tstr);
+  if(tnum < 1) usage();
+  int rv = procscan(path, tnum, xmsiz, omode);
+  return rv;
+}
+
+
 /* parse arguments of wicked command */
 static int runwicked(int argc, char **argv){
   char *path = NULL;
@@ -443,6 +493,8 @@ static int runwicked(int argc, char **argv){
     if(!path && argv[i][0] == '-'){
       if(!strcmp(argv[i], "-tl")){
         opts |= HDBTLARGE;
+      } else if(!strcmp(argv[i], "-tf")){
+        opts |= HDBTFHASH;
       } else if(!strcmp(argv[i], "-td")){
         opts |= HDBTDEFLATE;
       } else if(!strcmp(argv[i], "-tb")){
@@ -498,6 +550,8 @@ static int runtypical(int argc, char **argv){
     if(!path && argv[i][0] == '-'){
       if(!strcmp(argv[i], "-tl")){
         opts |= HDBTLARGE;
+      } else if(!strcmp(argv[i], "-tf")){
+        opts |= HDBTFHASH;
       } else if(!strcmp(argv[i], "-td")){
         opts |= HDBTDEFLATE;
       } else if(!strcmp(argv[i], "-tb")){
@@ -572,6 +626,8 @@ static int runrace(int argc, char **argv){
     if(!path && argv[i][0] == '-'){
       if(!strcmp(argv[i], "-tl")){
         opts |= HDBTLARGE;
+      } else if(!strcmp(argv[i], "-tf")){
+        opts |= HDBTFHASH;
       } else if(!strcmp(argv[i], "-td")){
         opts |= HDBTDEFLATE;
       } else if(!strcmp(argv[i], "-tb")){
@@ -870,6 +926,98 @@ static int procremove(const char *path, int tnum, int rcnum, int xmsiz, int dfun
 }
 
 
+/* perform scan command */
+static int procscan(const char *path, int tnum, int xmsiz, int omode){
+  iprintf("<Scanning Test>\n  seed=%u  path=%s  tnum=%d  xmsiz=%d  omode=%d\n\n",
+          g_randseed, path, tnum, xmsiz, omode);
+  bool err = false;
+  double stime = tctime();
+  TCHDB *hdb = tchdbnew();
+  if(g_dbgfd >= 0) tchdbsetdbgfd(hdb, g_dbgfd);
+  if(!tchdbsetmutex(hdb)){
+    eprint(hdb, __LINE__, "tchdbsetmutex");
+    err = true;
+  }
+  if(!tchdbsetcodecfunc(hdb, _tc_recencode, NULL, _tc_recdecode, NULL)){
+    eprint(hdb, __LINE__, "tchdbsetcodecfunc");
+    err = true;
+  }
+  if(xmsiz >= 0 && !tchdbsetxmsiz(hdb, xmsiz)){
+    eprint(hdb, __LINE__, "tchdbsetxmsiz");
+    err = true;
+  }
+  if(!tchdbopen(hdb, path, HDBOREADER | omode)){
+    eprint(hdb, __LINE__, "tchdbopen");
+    err = true;
+  }
+  int snum = 0;
+  HDBSCAN **scans = tchdbsplitscan(hdb, tnum, &snum);
+  if(!scans){
+    eprint(hdb, __LINE__, "tchdbsplitscan");
+    err = true;
+  }
+  iprintf("parts: %d\n", snum);
+  double otime = tctime();
+  TARGSCAN targs[snum];
+  pthread_t threads[snum];
+  for(int i = 0; i < snum; i++){
+    targs[i].hdb = hdb;
+    targs[i].scan = scans[i];
+    targs[i].rnum = 0;
+    targs[i].vsum = 0;
+    targs[i].id = i;
+  }
+  if(snum == 1){
+    if(threadscan(targs) != NULL) err = true;
+  } else {
+    for(int i = 0; i < snum; i++){
+      if(pthread_create(threads + i, NULL, threadscan, targs + i) != 0){
+        eprint(hdb, __LINE__, "pthread_create");
+        targs[i].id = -1;
+        err = true;
+      }
+    }
+    for(int i = 0; i < snum; i++){
+      if(targs[i].id == -1) continue;
+      void *rv;
+      if(pthread_join(threads[i], &rv) != 0){
+        eprint(hdb, __LINE__, "pthread_join");
+        err = true;
+      } else if(rv){
+        err = true;
+      }
+    }
+  }
+  double etime = tctime() - otime;
+  int64_t rnum = 0;
+  int64_t vsum = 0;
+  for(int i = 0; i < snum; i++){
+    rnum += targs[i].rnum;
+    vsum += targs[i].vsum;
+    tchdbscandel(scans[i]);
+  }
+  tcfree(scans);
+  if(rnum != tchdbrnum(hdb)){
+    eprint(hdb, __LINE__, "(validation)");
+    err = true;
+  }
+  iprintf("scanned: %lld records, %lld bytes in %.3f sec (%.1f MB/s)\n", (long long)rnum,
+          (long long)vsum, etime, etime > 0 ? tchdbfsiz(hdb) / etime / 1024 / 1024 : 0.0);
+  iprintf("record number: %llu\n", (unsigned long long)tchdbrnum(hdb));
+  iprintf("size: %llu\n", (unsigned long long)tchdbfsiz(hdb));
+  mprint(hdb);
+  sysprint();
+  if(!tchdbclose(hdb)){
+    eprint(hdb, __LINE__, "tchdbclose");
+    err = true;
+  }
+  tchdbdel(hdb);
+  iprintf("time: %.3f\n", tctime() - stime);
+  iprintf("%s\n\n", err ? "error" : "ok");
+  return err ? 1 : 0;
+}
+
+
 /* perform wicked command */
 static int procwicked(const char *path, int tnum, int rnum, int opts, int omode, bool nc){
   iprintf("<Writing Test>\n  seed=%u  path=%s  tnum=%d  rnum=%d  opts=%d  omode=%d  nc=%d\n\n",
@@ -1260,6 +1408,29 @@ static void *threadremove(void *targ){
 }
 
 
+/* thread the scan function */
+static void *threadscan(void *targ){
+  TCHDB *hdb = ((TARGSCAN *)targ)->hdb;
+  HDBSCAN *scan = ((TARGSCAN *)targ)->scan;
+  bool err = false;
+  int64_t rnum = 0;
+  int64_t vsum = 0;
+  const void *kbuf, *vbuf;
+  int ksiz, vsiz;
+  while(tchdbscannext(scan, &kbuf, &ksiz, &vbuf, &vsiz, NULL)){
+    rnum++;
+    vsum += vsiz;
+  }
+  if(tchdbecode(hdb) != TCENOREC){
+    eprint(hdb, __LINE__, "tchdbscannext");
+    err = true;
+  }
+  ((TARGSCAN *)targ)->rnum = rnum;
+  ((TARGSCAN *)targ)->vsum = vsum;
+  return err ? "error" : NULL;
+}
+
+
 /* thread the wicked function */
 static void *threadwicked(void *targ){
   TCHDB *hdb = ((TARGWICKED *)targ)->hdb;
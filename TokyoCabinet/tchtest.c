@@ -99,17 +99,17 @@ static void usage(void){
   fprintf(stderr, "%s: test cases of the hash database API of Tokyo Cabinet\n", g_progname);
   fprintf(stderr, "\n");
   fprintf(stderr, "usage:\n");
-  fprintf(stderr, "  %s write [-mt] [-tl] [-td|-tb|-tt|-tx] [-rc num] [-xm num] [-df num]"
+  fprintf(stderr, "  %s write [-mt] [-tl] [-tf] [-td|-tb|-tt|-tx] [-rc num] [-xm num] [-df num]"
           " [-nl|-nb] [-as] [-rnd] path rnum [bnum [apow [fpow]]]\n", g_progname);
   fprintf(stderr, "  %s read [-mt] [-rc num] [-xm num] [-df num] [-nl|-nb] [-wb] [-rnd] path\n",
           g_progname);
   fprintf(stderr, "  %s remove [-mt] [-rc num] [-xm num] [-df num] [-nl|-nb] [-rnd] path\n",
           g_progname);
-  fprintf(stderr, "  %s rcat [-mt] [-tl] [-td|-tb|-tt|-tx] [-rc num] [-xm num] [-df num]"
+  fprintf(stderr, "  %s rcat [-mt] [-tl] [-tf] [-td|-tb|-tt|-tx] [-rc num] [-xm num] [-df num]"
           " [-nl|-nb] [-pn num] [-dai|-dad|-rl|-ru] path rnum [bnum [apow [fpow]]]\n",
           g_progname);
-  fprintf(stderr, "  %s misc [-mt] [-tl] [-td|-tb|-tt|-tx] [-nl|-nb] path rnum\n", g_progname);
-  fprintf(stderr, "  %s wicked [-mt] [-tl] [-td|-tb|-tt|-tx] [-nl|-nb] path rnum\n", g_progname);
+  fprintf(stderr, "  %s misc [-mt] [-tl] [-tf] [-td|-tb|-tt|-tx] [-nl|-nb] path rnum\n", g_progname);
+  fprintf(stderr, "  %s wicked [-mt] [-tl] [-tf] [-td|-tb|-tt|-tx] [-nl|-nb] path rnum\n", g_progname);
   fprintf(stderr, "\n");
   exit(1);
 }
@@ -252,6 +252,8 @@ static int runwrite(int argc, char **argv){
         mt = true;
       } else if(!strcmp(argv[i], "-tl")){
         opts |= HDBTLARGE;
+      } else if(!strcmp(argv[i], "-tf")){
+        opts |= HDBTFHASH;
       } else if(!strcmp(argv[i], "-td")){
         opts |= HDBTDEFLATE;
       } else if(!strcmp(argv[i], "-tb")){
@@ -419,6 +421,8 @@ static int runrcat(int argc, char **argv){
         mt = true;
       } else if(!strcmp(argv[i], "-tl")){
         opts |= HDBTLARGE;
+      } else if(!strcmp(argv[i], "-tf")){
+        opts |= HDBTFHASH;
       } else if(!strcmp(argv[i], "-td")){
         opts |= HDBTDEFLATE;
       } else if(!strcmp(argv[i], "-tb")){
@@ -493,6 +497,8 @@ static int runmisc(int argc, char **argv){
         mt = true;
       } else if(!strcmp(argv[i], "-tl")){
         opts |= HDBTLARGE;
+      } else if(!strcmp(argv[i], "-tf")){
+        opts |= HDBTFHASH;
       } else if(!strcmp(argv[i], "-td")){
         opts |= HDBTDEFLATE;
       } else if(!strcmp(argv[i], "-tb")){
@@ -537,6 +543,8 @@ static int runwicked(int argc, char **argv){
         mt = true;
       } else if(!strcmp(argv[i], "-tl")){
         opts |= HDBTLARGE;
+      } else if(!strcmp(argv[i], "-tf")){
+        opts |= HDBTFHASH;
       } else if(!strcmp(argv[i], "-td")){
         opts |= HDBTDEFLATE;
       } else if(!strcmp(argv[i], "-tb")){